@@ -23,6 +23,8 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <errno.h>
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <limits.h>
+#include <linux/futex.h>
 
 #include "shm_wrappers.h"
 #include "shmutil.h"
@@ -36,47 +38,84 @@ static pid_t gettid()
 extern char *spindle_strdup(const char *s);
 extern void *spindle_malloc(size_t s);
 extern void spindle_free(void *p);
+/**
+ * Locks live in shared memory and are used across processes.  The lock word
+ * holds LOCK_FREE, LOCK_HELD, or LOCK_CONTENDED, and threads that lose the
+ * race sleep on it with a futex.  A release only pays for the FUTEX_WAKE
+ * syscall if someone marked the lock as contended.  Futexes are 32-bits, so
+ * we sleep on the half of the unsigned long that holds the value.
+ **/
+#define LOCK_FREE 0
+#define LOCK_HELD 1
+#define LOCK_CONTENDED 2
+
+static volatile int *futex_word(volatile unsigned long *l)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+   return ((volatile int *) l) + (sizeof(unsigned long) / sizeof(int) - 1);
+#else
+   return (volatile int *) l;
+#endif
+}
+
+static void futex_wait(volatile unsigned long *l, unsigned long val)
+{
+   syscall(SYS_futex, futex_word(l), FUTEX_WAIT, (int) val, NULL, NULL, 0);
+}
+
+static void futex_wake(volatile unsigned long *l, int count)
+{
+   syscall(SYS_futex, futex_word(l), FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+static unsigned long atomic_xchg(volatile unsigned long *l, unsigned long val)
+{
+   unsigned long old;
+   do {
+      old = *l;
+   } while (!__sync_bool_compare_and_swap(l, old, val));
+   return old;
+}
+
 int take_lock(lock_t *lock)
 {
-   unsigned long one = 1, result = 0;
-   unsigned long count = 0;
+   unsigned long result;
 
-   if (*lock->lock == 1 && *lock->held_by == gettid()) {
+   if (*lock->lock != LOCK_FREE && *lock->held_by == gettid()) {
       lock->ref_count++;
       return 0;
    }
 
-   do {
-      while (*lock->lock == 1) {
-         count++;
-         if (count > 100000) {
-            usleep(10000); //.01 sec
-         }
+   result = __sync_val_compare_and_swap(lock->lock, LOCK_FREE, LOCK_HELD);
+   if (result != LOCK_FREE) {
+      if (result != LOCK_CONTENDED)
+         result = atomic_xchg(lock->lock, LOCK_CONTENDED);
+      while (result != LOCK_FREE) {
+         futex_wait(lock->lock, LOCK_CONTENDED);
+         result = atomic_xchg(lock->lock, LOCK_CONTENDED);
       }
-      result = __sync_lock_test_and_set(lock->lock, one);
-   } while (result == 1);
+   }
 
    *lock->held_by = gettid();
    lock->ref_count = 1;
 
-
    return 0;
 }
 
 int test_lock(lock_t *lock) 
 {
-   unsigned long one = 1, result = 0;
+   unsigned long result;
 
-   if (*lock->lock == 1 && *lock->held_by == gettid()) {
+   if (*lock->lock != LOCK_FREE && *lock->held_by == gettid()) {
       lock->ref_count++;
       return 1;
    }
 
-   if (*lock->lock == 1)
+   if (*lock->lock != LOCK_FREE)
       return 0;
 
-   result = __sync_lock_test_and_set(lock->lock, one);
-   if (result == 1)
+   result = __sync_val_compare_and_swap(lock->lock, LOCK_FREE, LOCK_HELD);
+   if (result != LOCK_FREE)
       return 0;
 
    *lock->held_by = gettid();
@@ -98,9 +137,115 @@ int release_lock(lock_t *lock)
    lock->ref_count = 0;
    *lock->held_by = -1;
 
-   MEMORY_BARRIER;
+   if (__sync_fetch_and_sub(lock->lock, 1) != LOCK_HELD) {
+      *lock->lock = LOCK_FREE;
+      MEMORY_BARRIER;
+      futex_wake(lock->lock, 1);
+   }
+   return 0;
+}
+
+/**
+ * Reader/writer locks use the same lock_t.  The lock word holds a count of
+ * readers, plus a bit for an active writer and a bit saying someone is asleep
+ * waiting for the lock.  held_by records the writing thread so that a
+ * writer may recursively take the lock.  Waiters are all woken when the lock
+ * drains and race for it again.
+ **/
+#define RW_WRITER  0x40000000UL
+#define RW_WAITING 0x80000000UL
+#define RW_READERS 0x3fffffffUL
+
+static void rw_sleep(volatile unsigned long *l, unsigned long cur)
+{
+   if (!(cur & RW_WAITING)) {
+      if (!__sync_bool_compare_and_swap(l, cur, cur | RW_WAITING))
+         return;
+      cur |= RW_WAITING;
+   }
+   futex_wait(l, cur);
+}
+
+int take_rwlock_read(lock_t *lock)
+{
+   unsigned long cur;
+
+   if ((*lock->lock & RW_WRITER) && *lock->held_by == gettid()) {
+      lock->ref_count++;
+      return 0;
+   }
+
+   for (;;) {
+      cur = *lock->lock;
+      if (!(cur & RW_WRITER)) {
+         if (__sync_bool_compare_and_swap(lock->lock, cur, cur + 1))
+            return 0;
+         continue;
+      }
+      rw_sleep(lock->lock, cur);
+   }
+}
+
+int release_rwlock_read(lock_t *lock)
+{
+   unsigned long cur;
+
+   if ((*lock->lock & RW_WRITER) && *lock->held_by == gettid())
+      return release_rwlock_write(lock);
+
+   cur = __sync_sub_and_fetch(lock->lock, 1);
+   while (cur == RW_WAITING) {
+      if (__sync_bool_compare_and_swap(lock->lock, cur, 0)) {
+         futex_wake(lock->lock, INT_MAX);
+         break;
+      }
+      cur = *lock->lock;
+   }
+   return 0;
+}
+
+int take_rwlock_write(lock_t *lock)
+{
+   unsigned long cur;
+
+   if ((*lock->lock & RW_WRITER) && *lock->held_by == gettid()) {
+      lock->ref_count++;
+      return 0;
+   }
+
+   for (;;) {
+      cur = *lock->lock;
+      if (!(cur & (RW_WRITER | RW_READERS))) {
+         if (__sync_bool_compare_and_swap(lock->lock, cur, cur | RW_WRITER))
+            break;
+         continue;
+      }
+      rw_sleep(lock->lock, cur);
+   }
+
+   *lock->held_by = gettid();
+   lock->ref_count = 1;
+   return 0;
+}
+
+int release_rwlock_write(lock_t *lock)
+{
+   unsigned long old;
+
+   if (*lock->held_by != gettid()) {
+      return -1;
+   }
+
+   if (lock->ref_count > 1) {
+      lock->ref_count--;
+      return 0;
+   }
+   lock->ref_count = 0;
+   *lock->held_by = -1;
 
-   *lock->lock = 0;
+   old = __sync_fetch_and_and(lock->lock, ~(RW_WRITER | RW_WAITING));
+   if (old & RW_WAITING)
+      futex_wake(lock->lock, INT_MAX);
    return 0;
 }
 
@@ -76,6 +76,11 @@ int take_lock(lock_t *lock);
 int test_lock(lock_t *lock);
 int release_lock(lock_t *lock);
 
+int take_rwlock_read(lock_t *lock);
+int release_rwlock_read(lock_t *lock);
+int take_rwlock_write(lock_t *lock);
+int release_rwlock_write(lock_t *lock);
+
 int init_shm(const char *tmpdir, size_t shm_size, int unique_number, shminfo_t **shminfo);
 int init_heap_lock(shminfo_t *shminfo);
 int init_heap(shminfo_t *shminfo);
@@ -66,6 +66,7 @@ char *la_objsearch(const char *name, uintptr_t *cookie, unsigned int flag)
       return (char *) name;
    }
    
+   client_library_prefetch(name, flag);
    return client_library_load(name);
 }
 
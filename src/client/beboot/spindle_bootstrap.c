@@ -66,10 +66,12 @@ opt_t opts;
 char libstr_socket_subaudit[] = PROGLIBDIR "/libspindle_subaudit_socket.so";
 char libstr_pipe_subaudit[] = PROGLIBDIR "/libspindle_subaudit_pipe.so";
 char libstr_biter_subaudit[] = PROGLIBDIR "/libspindle_subaudit_biter.so";
+char libstr_shmem_subaudit[] = PROGLIBDIR "/libspindle_subaudit_shmem.so";
 
 char libstr_socket_audit[] = PROGLIBDIR "/libspindle_audit_socket.so";
 char libstr_pipe_audit[] = PROGLIBDIR "/libspindle_audit_pipe.so";
 char libstr_biter_audit[] = PROGLIBDIR "/libspindle_audit_biter.so";
+char libstr_shmem_audit[] = PROGLIBDIR "/libspindle_audit_shmem.so";
 
 #if defined(COMM_SOCKET)
 static char *default_audit_libstr = libstr_socket_audit;
@@ -80,6 +82,9 @@ static char *default_subaudit_libstr = libstr_pipe_subaudit;
 #elif defined(COMM_BITER)
 static char *default_audit_libstr = libstr_biter_audit;
 static char *default_subaudit_libstr = libstr_biter_subaudit;
+#elif defined(COMM_SHMEM)
+static char *default_audit_libstr = libstr_shmem_audit;
+static char *default_subaudit_libstr = libstr_shmem_subaudit;
 #else
 #error Unknown connection type
 #endif
@@ -96,6 +101,7 @@ static int establish_connection()
       return -1;
 
    send_pid(ldcsid);
+   send_cwd(ldcsid);
    send_rankinfo_query(ldcsid, &rankinfo[0], &rankinfo[1], &rankinfo[2], &rankinfo[3]);      
    if (opts & OPT_NUMA)
       send_cpu(ldcsid, get_cur_cpu());
@@ -288,6 +294,11 @@ void test_log(const char *name)
 {
 }
 
+/* The bootstrap sends its cwd when it connects and never changes it */
+void sync_cwd()
+{
+}
+
 int main(int argc, char *argv[])
 {
    int error, result;
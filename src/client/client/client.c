@@ -37,6 +37,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "client_api.h"
 #include "spindle_launch.h"
 #include "shmcache.h"
+#include "lookup_cache.h"
 
 errno_location_t app_errno_location;
 
@@ -53,6 +54,7 @@ int intercept_fork;
 static char debugging_name[32];
 
 static char old_cwd[MAX_PATH_LEN+1];
+static int cwd_changed = 1;
 static int rankinfo[4]={-1,-1,-1,-1};
 
 extern char *parse_location(char *loc);
@@ -262,6 +264,7 @@ static void reset_server_connection()
 
    ldcsid = -1;
    old_cwd[0] = '\0';
+   cwd_changed = 1;
 
    init_server_connection();
 }
@@ -300,8 +303,30 @@ void test_log(const char *name)
    test_printf("open(\"%s\", O_RDONLY) = %d\n", name, result);
 }
 
+/* The server resolves our relative paths against the last cwd we sent it.
+   Send it lazily, before the next request, after a chdir or reconnect. */
 void sync_cwd()
 {
+   char cwd[MAX_PATH_LEN+1];
+
+   if (!cwd_changed || ldcsid == -1)
+      return;
+   cwd_changed = 0;
+
+   if (!getcwd(cwd, sizeof(cwd))) {
+      debug_printf("Could not get cwd to send to server: %s\n", strerror(errno));
+      return;
+   }
+   if (strcmp(cwd, old_cwd) == 0)
+      return;
+   strncpy(old_cwd, cwd, sizeof(old_cwd));
+   debug_printf2("Sending new cwd %s to server\n", cwd);
+   send_dir_cwd(ldcsid, cwd);
+}
+
+void mark_cwd_changed()
+{
+   cwd_changed = 1;
 }
 
 void set_errno(int newerrno)
@@ -354,11 +379,103 @@ int client_done()
       return 0;
 
    debug_printf2("Done. Closing connection %d\n", ldcsid);
+   if (opts & OPT_SHMCACHE)
+      shmcache_print_stats();
+   lookup_cache_print_stats();
    send_end(ldcsid);
    client_close_connection(ldcsid);
    return 0;
 }
 
+/**
+ * ld.so walks a search path by handing la_objsearch one candidate at a
+ * time, and every walk through LD_LIBRARY_PATH or the default directories
+ * visits the same directories in the same order.  We learn that order from
+ * the walks we see.  At the start of a walk we then ask the server for the
+ * library in every directory of it at once, and the rest of the walk is 
+ * answered from the lookup cache.
+ **/
+#define MAX_SEARCH_DIRS 64
+typedef struct {
+   char *dirs[MAX_SEARCH_DIRS];
+   int num_dirs;
+   int pos;
+   char last_base[MAX_NAME_LEN+1];
+} search_walk_t;
+static search_walk_t libpath_walk, default_walk;
+
+void client_library_prefetch(const char *name, unsigned int flag)
+{
+   search_walk_t *walk;
+   const char *base, *candidates[MAX_SEARCH_DIRS];
+   char dir[MAX_PATH_LEN+1], buffer[MAX_PATH_LEN];
+   size_t dir_len, pos;
+   int i, j, len, num_candidates;
+
+   check_for_fork();
+   if (!use_ldcs || ldcsid == -1 || !(opts & OPT_RELOCSO))
+      return;
+   if (flag == LA_SER_LIBPATH)
+      walk = &libpath_walk;
+   else if (flag == LA_SER_DEFAULT)
+      walk = &default_walk;
+   else
+      return;
+
+   base = strrchr(name, '/');
+   if (!base || base == name)
+      return;
+   dir_len = base - name;
+   base++;
+   if (dir_len > MAX_PATH_LEN || strlen(base) > MAX_NAME_LEN)
+      return;
+   memcpy(dir, name, dir_len);
+   dir[dir_len] = '\0';
+
+   if (strcmp(base, walk->last_base) != 0 || (walk->num_dirs && strcmp(dir, walk->dirs[0]) == 0)) {
+      strcpy(walk->last_base, base);
+      walk->pos = 0;
+   }
+   else {
+      walk->pos++;
+   }
+
+   if (walk->pos < walk->num_dirs && strcmp(walk->dirs[walk->pos], dir) != 0) {
+      /* ld.so stops searching directories it found don't exist, so drop
+         any that were skipped.  Otherwise relearn the order from here. */
+      for (j = walk->pos + 1; j < walk->num_dirs; j++) {
+         if (strcmp(walk->dirs[j], dir) == 0)
+            break;
+      }
+      debug_printf3("Search for %s went to %s rather than %s.  %s\n", base, dir, walk->dirs[walk->pos],
+                    j < walk->num_dirs ? "Dropping skipped directories" : "Relearning search path from there");
+      for (i = walk->pos; i < j; i++)
+         spindle_free(walk->dirs[i]);
+      for (i = j; i < walk->num_dirs; i++)
+         walk->dirs[walk->pos + i - j] = walk->dirs[i];
+      walk->num_dirs -= j - walk->pos;
+   }
+   if (walk->pos == walk->num_dirs) {
+      if (walk->num_dirs < MAX_SEARCH_DIRS)
+         walk->dirs[walk->num_dirs++] = spindle_strdup(dir);
+      return;
+   }
+   if (walk->pos != 0 || walk->num_dirs < 2)
+      return;
+
+   for (i = 0, pos = 0, num_candidates = 0; i < walk->num_dirs; i++) {
+      len = snprintf(buffer + pos, sizeof(buffer) - pos, "%s/%s", walk->dirs[i], base);
+      if (len < 0 || pos + len + 1 > sizeof(buffer))
+         break;
+      candidates[num_candidates++] = buffer + pos;
+      pos += len + 1;
+   }
+
+   sync_cwd();
+   debug_printf2("Prefetching %s from %d directories of its search path\n", base, num_candidates);
+   prefetch_relocated_files(ldcsid, candidates, num_candidates);
+}
+
 char *client_library_load(const char *name)
 {
    char *newname;
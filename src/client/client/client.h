@@ -39,6 +39,7 @@ typedef unsigned long ElfX_Addr;
  **/
 ElfX_Addr client_call_binding(const char *symname, ElfX_Addr symvalue);
 char *client_library_load(const char *libname);
+void client_library_prefetch(const char *libname, unsigned int flag);
 int client_init();
 int client_done();
 
@@ -48,6 +49,7 @@ int client_done();
 void set_errno(int newerrno);
 void patch_on_load_success(const char *rewritten_name, const char *orig_name);
 void sync_cwd();
+void mark_cwd_changed();
 void check_for_fork();
 
 /**
@@ -71,9 +73,13 @@ int get_ldso_metadata(signed int *binding_offset);
 
 
 int get_relocated_file(int fd, const char *name, char** newname, int *errcode);
+int is_held_fd(int fd);
+void forget_held_fd(int fd);
 int get_stat_result(int fd, const char *path, int is_lstat, int *exists, struct stat *buf);
 int get_existance_test(int fd, const char *path, int *exists);
 int fetch_from_cache(const char *name, char **newname);
+int prefetch_relocated_files(int fd, const char **names, int num_names);
+int prefetch_stat_results(int fd, const char **paths, int num_paths, int is_lstat);
 
 /**
  * Tracking python prefixes
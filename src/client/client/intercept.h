@@ -43,6 +43,8 @@ extern int (*orig_open64)(const char *pathname, int flags, ...);
 extern FILE* (*orig_fopen)(const char *pathname, const char *mode);
 extern FILE* (*orig_fopen64)(const char *pathname, const char *mode);
 extern int (*orig_close)(int fd);
+extern int (*orig_chdir)(const char *path);
+extern int (*orig_fchdir)(int fd);
 
 int rtcache_stat(const char *path, struct stat *buf);
 int rtcache_lstat(const char *path, struct stat *buf);
@@ -71,6 +73,9 @@ pid_t vfork_wrapper();
 ssize_t readlink_wrapper(const char *path, char *buf, size_t bufsiz);
 int readlinkat_wrapper(int dirfd, const char *pathname, char *buf, size_t bufsiz);
 
+int chdir_wrapper(const char *path);
+int fchdir_wrapper(int fd);
+
 int int_spindle_open(const char *pathname, int flags, ...);
 FILE *int_spindle_fopen(const char *path, const char *opts);
 int int_spindle_stat(const char *path, struct stat *buf);
@@ -0,0 +1,52 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include "intercept.h"
+#include "client.h"
+#include "ldcs_api.h"
+
+int (*orig_chdir)(const char *path);
+int (*orig_fchdir)(int fd);
+
+int chdir_wrapper(const char *path)
+{
+   int result;
+
+   check_for_fork();
+   result = orig_chdir(path);
+   if (result == 0) {
+      debug_printf3("Intercepted chdir to %s\n", path);
+      mark_cwd_changed();
+   }
+   return result;
+}
+
+int fchdir_wrapper(int fd)
+{
+   int result;
+
+   check_for_fork();
+   result = orig_fchdir(fd);
+   if (result == 0) {
+      debug_printf3("Intercepted fchdir to fd %d\n", fd);
+      mark_cwd_changed();
+   }
+   return result;
+}
@@ -139,6 +139,7 @@ int open_worker(const char *path, int oflag, mode_t mode, int is_64)
       /* The file is being exclusively created.  Short-circuit error return
          if it exists */
       debug_printf("Testing for existance before exclusive open of %s\n", path);
+      sync_cwd();
       result = send_existance_test(ldcsid, (char *) path, &exists);
       if (result == -1 || !exists) {
          debug_printf3("File %s does not exist, allowing exclusive open\n", path);
@@ -274,6 +275,7 @@ int rtcache_close(int fd)
       set_errno(EBADF);
       return -1;
    }
+   forget_held_fd(fd);
    return orig_close(fd);
 }
 
@@ -43,9 +43,14 @@ int (*orig_fstat)(int fd, struct stat *buf);
 int (*orig_fxstat)(int vers, int fd, struct stat *buf);
 int (*orig_fxstat64)(int vers, int fd, struct stat *buf);
 
+/* Most names of a python module to look up together */
+#define MAX_MODULE_CANDIDATES 12
+
 int handle_stat(const char *path, struct stat *buf, int flags)
 {
-   int result, exists;
+   int result, exists, num_candidates;
+   const char *candidates[MAX_MODULE_CANDIDATES];
+   char buffer[MAX_PATH_LEN];
 
    check_for_fork();
    if (ldcsid < 0 || !use_ldcs || !path || !buf) {
@@ -68,6 +73,10 @@ int handle_stat(const char *path, struct stat *buf, int flags)
       return ORIG_STAT;
    }
 
+   num_candidates = python_module_candidates(path, buffer, sizeof(buffer), candidates, MAX_MODULE_CANDIDATES);
+   if (num_candidates > 1)
+      prefetch_stat_results(ldcsid, candidates, num_candidates, flags & IS_LSTAT);
+
    debug_printf3("Asking spindle for stat on %s\n", path);
    result = get_stat_result(ldcsid, path, flags & IS_LSTAT, &exists, buf);
    if (result == -1) {
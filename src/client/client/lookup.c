@@ -1,4 +1,7 @@
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "spindle_debug.h"
 #include "shmcache.h"
 #include "config.h"
@@ -6,6 +9,13 @@
 #include "client_heap.h"
 #include "client_api.h"
 #include "ccwarns.h"
+#include "lookup_cache.h"
+
+/* Most paths sent in one prefetch */
+#define MAX_PREFETCH_PATHS 32
+
+/* Times we ask the server again for a file that was evicted under us */
+#define MAX_EVICT_RETRIES 4
 
 #define SPINDLE_ENODIR -68
 #define SPINDLE_ENODIR_STR "NODR"
@@ -123,12 +133,52 @@ static int update_cache(char *cache_name, char *dir_name, char *result_name, int
    return 0;
 }
 
+static int check_local_cache(char *cache_name, char *dir_name, int nodir_errcode, int *errcode,
+                             char *result, size_t result_size)
+{
+   char dirresult[8];
+   int direrrcode;
+
+   if (lookup_cache_get(dir_name, dirresult, sizeof(dirresult), &direrrcode) && direrrcode == SPINDLE_ENODIR) {
+      debug_printf2("Lookup cache reports directory not present for %s.  Short-circuiting to errcode %d\n",
+                    cache_name, nodir_errcode);
+      lookup_cache_count(1);
+      *errcode = nodir_errcode;
+      result[0] = '\0';
+      return 1;
+   }
+
+   if (!lookup_cache_get(cache_name, result, result_size, errcode)) {
+      lookup_cache_count(0);
+      return 0;
+   }
+   debug_printf3("Lookup cache has %s as %s, errcode %d\n", cache_name, result, *errcode);
+   lookup_cache_count(1);
+   if (*errcode == SPINDLE_ENODIR)
+      *errcode = nodir_errcode;
+   return 1;
+}
+
+static void update_local_cache(char *cache_name, char *dir_name, const char *result, int errcode)
+{
+   if (errcode == SPINDLE_ENODIR)
+      lookup_cache_set(dir_name, NULL, SPINDLE_ENODIR);
+   lookup_cache_set(cache_name, result, errcode);
+}
+
 int get_existance_test(int fd, const char *path, int *exists)
 {
    int use_cache = (opts & OPT_SHMCACHE);
    int found_file, errcode, result = 0;
    char cache_name[MAX_PATH_LEN+2], dir_name[MAX_PATH_LEN+2];
    char *exist_str = NULL;
+   char local_result[8];
+
+   get_cache_name(path, "&", cache_name, dir_name);
+   if (check_local_cache(cache_name, dir_name, ENOENT, &errcode, local_result, sizeof(local_result))) {
+      *exists = (local_result[0] == 'y');
+      return 0;
+   }
 
    if (use_cache) {
       debug_printf2("Looking up file existance for %s in shared cache\n", path);
@@ -141,9 +191,12 @@ int get_existance_test(int fd, const char *path, int *exists)
    }
 
    debug_printf3("Sending existance test for %s to server\n", path);
+   sync_cwd();
    result = send_existance_test(fd, (char *) path, exists);
    debug_printf3("Existance test for %s returned exists: %d, result: %d\n",
                  path, *exists, result);
+   if (result != -1)
+      update_local_cache(cache_name, dir_name, *exists ? "y" : "n", 0);
 
    if (use_cache) {
       exist_str = *exists ? "y" : "n";
@@ -164,7 +217,10 @@ int get_stat_result(int fd, const char *path, int is_lstat, int *exists, struct
    int found_file = 0;
    buffer[0] = '\0';
 
-   if (use_cache) {
+   get_cache_name(path, is_lstat ? "**" : "*", cache_name, dir_name);
+   found_file = check_local_cache(cache_name, dir_name, ENOENT, &errcode, buffer, sizeof(buffer));
+
+   if (use_cache && !found_file) {
       debug_printf2("Looking up %s stat for %s in shared cache\n", is_lstat ? "l" : "", path);
       found_file = check_cache(path, is_lstat ? "**" : "*", cache_name, dir_name, 
                                ENOENT, &errcode, &newpath);
@@ -179,11 +235,14 @@ int get_stat_result(int fd, const char *path, int is_lstat, int *exists, struct
 
    if (!found_file) {
       debug_printf2("Sending request for %sstat of %s to server\n", is_lstat ? "l" : "", path);
+      sync_cwd();
       network_result = send_stat_request(fd, (char *) path, is_lstat, buffer);
       debug_printf2("Server returned stat result for %s: %s\n", path, buffer);
       
       if (network_result == -1)
          buffer[0] = '\0';
+      else
+         update_local_cache(cache_name, dir_name, buffer, 0);
 
       if (use_cache)
          update_cache(cache_name, dir_name, buffer, &errcode, ENOENT);
@@ -205,29 +264,280 @@ int get_stat_result(int fd, const char *path, int is_lstat, int *exists, struct
    return network_result;
 }
 
+/**
+ * With OPT_EVICT the server removes cached files that no process has open
+ * when its cache is over budget.  A local name remembered from an earlier
+ * answer is then only good if the file is still there.
+ **/
+static int local_file_evicted(const char *localname)
+{
+   if (!(opts & OPT_EVICT) || !localname || !localname[0])
+      return 0;
+   if (access(localname, F_OK) == 0)
+      return 0;
+   debug_printf2("Cached local file %s was evicted.  Asking the server again\n", localname);
+   return 1;
+}
+
+static int query_relocated_file(int fd, const char *name, char *cache_name, char *dir_name,
+                                char **newname, int *errorcode)
+{
+   int result;
+
+   debug_printf2("Send file request to server: %s\n", name);
+   sync_cwd();
+   result = send_file_query(fd, (char *) name, newname, errorcode);
+   debug_printf2("Recv file from server: %s\n", *newname ? *newname : "NONE");
+   if (result != -1)
+      update_local_cache(cache_name, dir_name, *newname, *errorcode);
+
+   if (opts & OPT_SHMCACHE) {
+      update_cache(cache_name, dir_name, *newname, errorcode, ENOENT);
+   }
+   return result;
+}
+
+/**
+ * The server only evicts files that no process has open, but it may have
+ * answered us with a file that our caller hasn't opened yet.  We keep the
+ * last few files we handed out open, which covers ld.so and exec opening
+ * them after we return, even with other threads looking up files meanwhile.
+ * A file that is already gone by the time we open it is asked for again.
+ *
+ * The held fds are ours, and fd_filter hides them from the application.  An
+ * application can still close one behind our back, e.g. with close_range or
+ * dup2, and reuse its number, so we only trust a held fd while it still
+ * refers to the file we opened.
+ **/
+#define MAX_HELD_FILES 4
+#define MIN_HELD_FD 315
+
+typedef struct {
+   int fd;
+   dev_t dev;
+   ino_t ino;
+} held_file_t;
+
+/* fd is 0 in empty slots, since held fds are moved above MIN_HELD_FD */
+static held_file_t held_files[MAX_HELD_FILES];
+static int held_next;
+static struct lock_t held_lock;
+
+static int held_file_valid(held_file_t *held)
+{
+   struct stat buf;
+   if (fstat(held->fd, &buf) == -1)
+      return 0;
+   return buf.st_dev == held->dev && buf.st_ino == held->ino;
+}
+
+int is_held_fd(int fd)
+{
+   int i, result = 0;
+
+   if (fd < MIN_HELD_FD || lock(&held_lock) == -1)
+      return 0;
+   for (i = 0; i < MAX_HELD_FILES; i++) {
+      if (held_files[i].fd != fd)
+         continue;
+      if (held_file_valid(held_files + i))
+         result = 1;
+      else
+         held_files[i].fd = 0;
+   }
+   unlock(&held_lock);
+   return result;
+}
+
+/* The application closed one of our held files, which it may reuse */
+void forget_held_fd(int fd)
+{
+   int i;
+
+   if (fd < MIN_HELD_FD || lock(&held_lock) == -1)
+      return;
+   for (i = 0; i < MAX_HELD_FILES; i++) {
+      if (held_files[i].fd == fd)
+         held_files[i].fd = 0;
+   }
+   unlock(&held_lock);
+}
+
+static int hold_file(const char *path)
+{
+   held_file_t *slot;
+   struct stat buf;
+   int fd, highfd;
+
+   fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return -1;
+   highfd = fcntl(fd, F_DUPFD_CLOEXEC, MIN_HELD_FD);
+   if (highfd == -1 || fstat(highfd, &buf) == -1) {
+      if (highfd != -1)
+         close(highfd);
+      close(fd);
+      return 0;
+   }
+   close(fd);
+
+   if (lock(&held_lock) == -1) {
+      close(highfd);
+      return 0;
+   }
+   slot = held_files + held_next;
+   held_next = (held_next + 1) % MAX_HELD_FILES;
+   if (slot->fd && held_file_valid(slot))
+      close(slot->fd);
+   slot->fd = highfd;
+   slot->dev = buf.st_dev;
+   slot->ino = buf.st_ino;
+   unlock(&held_lock);
+   return 0;
+}
+
+static int hold_relocated_file(int fd, const char *name, char *cache_name, char *dir_name,
+                               char **newname, int *errorcode, int result)
+{
+   int i;
+
+   if (!(opts & OPT_EVICT))
+      return result;
+   for (i = 0; *newname && i < MAX_EVICT_RETRIES; i++) {
+      if (hold_file(*newname) == 0)
+         return result;
+      if (errno != ENOENT)
+         return result;
+      debug_printf2("Local file %s for %s was evicted before it was opened.  Asking the server again\n",
+                    *newname, name);
+      spindle_free(*newname);
+      *newname = NULL;
+      result = query_relocated_file(fd, name, cache_name, dir_name, newname, errorcode);
+   }
+   return result;
+}
+
 int get_relocated_file(int fd, const char *name, char** newname, int *errorcode)
 {
    int use_cache = (opts & OPT_SHMCACHE);
    int found_file = 0, result;
    char cache_name[MAX_PATH_LEN+2], dir_name[MAX_PATH_LEN+2];
+   char local_result[MAX_PATH_LEN+1];
+
+   get_cache_name(name, "", cache_name, dir_name);
+   if (check_local_cache(cache_name, dir_name, ENOENT, errorcode, local_result, sizeof(local_result)) &&
+       !local_file_evicted(local_result)) {
+      *newname = local_result[0] ? spindle_strdup(local_result) : NULL;
+      return hold_relocated_file(fd, name, cache_name, dir_name, newname, errorcode, 0);
+   }
 
    if (use_cache) {
       debug_printf2("Looking up %s in shared cache\n", name);
       found_file = check_cache(name, "", cache_name, dir_name, ENOENT, errorcode, newname);
-      if (found_file)
-         return 0;
+      if (found_file && !local_file_evicted(*newname))
+         return hold_relocated_file(fd, name, cache_name, dir_name, newname, errorcode, 0);
+      if (found_file) {
+         spindle_free(*newname);
+         *newname = NULL;
+      }
    }
 
-   debug_printf2("Send file request to server: %s\n", name);
-   result = send_file_query(fd, (char *) name, newname, errorcode);
-   debug_printf2("Recv file from server: %s\n", *newname ? *newname : "NONE");
-
-   if (use_cache) {
-      update_cache(cache_name, dir_name, *newname, errorcode, ENOENT);
-   }
+   result = query_relocated_file(fd, name, cache_name, dir_name, newname, errorcode);
+   result = hold_relocated_file(fd, name, cache_name, dir_name, newname, errorcode, result);
    if (*errorcode == SPINDLE_ENODIR)
       *errorcode = ENOENT;
 
    return result;
 }
 
+/**
+ * Looks up several paths with one round trip to the server and puts the
+ * answers in the lookup cache, where the get_* calls that follow will find
+ * them.  Paths already in the lookup cache aren't sent.  With first_hit the
+ * server stops at the first path that exists, and so do we if that path
+ * is already cached.
+ **/
+static int prefetch_lookups(int fd, ldcs_message_ids_t query_type, const char *prefix, int first_hit,
+                            const char **paths, int num_paths)
+{
+   const char *query_paths[MAX_PREFETCH_PATHS];
+   ldcs_message_t answers[MAX_PREFETCH_PATHS];
+   char cache_name[MAX_PATH_LEN+3], dir_name[MAX_PATH_LEN+2];
+   char local_result[MAX_PATH_LEN+1];
+   const char *value;
+   void *answer_buffer;
+   int i, num_query = 0, num_answers, errcode, result, is_hit;
+
+   for (i = 0; i < num_paths && num_query < MAX_PREFETCH_PATHS; i++) {
+      get_cache_name(paths[i], prefix, cache_name, dir_name);
+      if (lookup_cache_get(dir_name, local_result, sizeof(local_result), &errcode) && errcode == SPINDLE_ENODIR)
+         continue;
+      if (!lookup_cache_get(cache_name, local_result, sizeof(local_result), &errcode)) {
+         query_paths[num_query++] = paths[i];
+         continue;
+      }
+      is_hit = (errcode == 0 && local_result[0] != '\0' &&
+                (query_type != LDCS_MSG_EXISTS_QUERY || local_result[0] == 'y'));
+      if (first_hit && is_hit)
+         break;
+   }
+   if (num_query < 2)
+      return 0;
+
+   debug_printf2("Prefetching %d lookups starting at %s%s\n", num_query, prefix, query_paths[0]);
+   sync_cwd();
+   result = send_multi_query(fd, query_type, first_hit, query_paths, num_query,
+                             answers, &num_answers, &answer_buffer);
+   if (result == -1)
+      return -1;
+
+   for (i = 0; i < num_answers; i++) {
+      errcode = 0;
+      switch (answers[i].header.type) {
+         case LDCS_MSG_FILE_QUERY_ANSWER:
+            if (answers[i].header.len > sizeof(int)) {
+               value = answers[i].data + sizeof(int);
+            }
+            else {
+               value = NULL;
+               memcpy(&errcode, answers[i].data, sizeof(int));
+            }
+            break;
+         case LDCS_MSG_STAT_ANSWER:
+            value = answers[i].header.len ? answers[i].data : NULL;
+            break;
+         case LDCS_MSG_EXISTS_ANSWER:
+            value = *((uint32_t *) answers[i].data) ? "y" : "n";
+            break;
+         case LDCS_MSG_MULTI_QUERY_ERROR:
+            memcpy(&errcode, answers[i].data, sizeof(int));
+            debug_printf2("Server failed prefetch of %s (%d), leaving it to a single query\n",
+                          query_paths[i], errcode);
+            continue;
+         default:
+            err_printf("Unexpected answer type %d to prefetch of %s\n", (int) answers[i].header.type, query_paths[i]);
+            continue;
+      }
+      get_cache_name(query_paths[i], prefix, cache_name, dir_name);
+      debug_printf3("Prefetched %s as %s, errcode %d\n", cache_name, value ? value : "NONE", errcode);
+      update_local_cache(cache_name, dir_name, value, errcode);
+   }
+
+   spindle_free(answer_buffer);
+   return 0;
+}
+
+/**
+ * Prefetch the candidates of a search path walk, in the order they will be
+ * tried.  Only files up to the first one that exists are fetched.
+ **/
+int prefetch_relocated_files(int fd, const char **names, int num_names)
+{
+   return prefetch_lookups(fd, LDCS_MSG_FILE_QUERY_EXACT_PATH, "", 1, names, num_names);
+}
+
+int prefetch_stat_results(int fd, const char **paths, int num_paths, int is_lstat)
+{
+   return prefetch_lookups(fd, is_lstat ? LDCS_MSG_LSTAT_QUERY : LDCS_MSG_STAT_QUERY,
+                           is_lstat ? "**" : "*", 0, paths, num_paths);
+}
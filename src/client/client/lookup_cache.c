@@ -0,0 +1,135 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lookup_cache.h"
+#include "spindle_debug.h"
+
+/* The cache is a direct-mapped table.  A new entry replaces whatever was in its
+   slot, which bounds the memory footprint at LOOKUP_CACHE_SLOTS slots.  Each slot
+   is guarded by a sequence number that is odd while a writer owns the slot.
+   Readers copy the slot and treat it as a miss if the sequence number changed
+   while they copied.  Writers that find the slot busy drop their update. */
+
+#define LOOKUP_CACHE_SLOTS 2048
+#define LOOKUP_CACHE_DATA_LEN 384
+
+typedef struct {
+   volatile uint32_t seq;
+   uint32_t hash;
+   int32_t errcode;
+   uint16_t key_len;
+   uint16_t value_len;
+   char data[LOOKUP_CACHE_DATA_LEN];  /* key\0value\0 */
+} lookup_cache_slot_t;
+
+static lookup_cache_slot_t slots[LOOKUP_CACHE_SLOTS];
+static unsigned long hits, misses;
+
+static uint32_t lookup_cache_hash(const char *str, size_t *len)
+{
+   uint32_t hash = 5381;
+   const char *s;
+   for (s = str; *s; s++)
+      hash = ((hash << 5) + hash) + (unsigned char) *s;
+   *len = s - str;
+   return hash;
+}
+
+/* Fills in value and errcode and returns 1 if key is in the cache, otherwise 
+   returns 0. */
+int lookup_cache_get(const char *key, char *value, size_t value_size, int *errcode)
+{
+   lookup_cache_slot_t *slot, copy;
+   uint32_t hash, seq;
+   size_t key_len;
+
+   hash = lookup_cache_hash(key, &key_len);
+   slot = slots + (hash % LOOKUP_CACHE_SLOTS);
+
+   seq = slot->seq;
+   if (seq == 0 || (seq & 1) || slot->hash != hash)
+      return 0;
+   __sync_synchronize();
+   memcpy(&copy, slot, sizeof(copy));
+   __sync_synchronize();
+   if (slot->seq != seq)
+      return 0;
+
+   if (copy.key_len != key_len || memcmp(copy.data, key, key_len) != 0)
+      return 0;
+   if (copy.value_len + 1 > value_size)
+      return 0;
+
+   memcpy(value, copy.data + copy.key_len + 1, copy.value_len + 1);
+   *errcode = copy.errcode;
+   return 1;
+}
+
+/* Adds key to the cache.  A NULL value is stored as an empty string. */
+void lookup_cache_set(const char *key, const char *value, int errcode)
+{
+   lookup_cache_slot_t *slot;
+   uint32_t hash, seq;
+   size_t key_len, value_len;
+
+   if (!value)
+      value = "";
+   hash = lookup_cache_hash(key, &key_len);
+   value_len = strlen(value);
+   if (key_len + value_len + 2 > LOOKUP_CACHE_DATA_LEN) {
+      debug_printf3("Not adding %s to lookup cache, its entry is too long\n", key);
+      return;
+   }
+
+   slot = slots + (hash % LOOKUP_CACHE_SLOTS);
+   seq = slot->seq;
+   if ((seq & 1) || !__sync_bool_compare_and_swap(&slot->seq, seq, seq + 1))
+      return;
+
+   slot->hash = hash;
+   slot->errcode = errcode;
+   slot->key_len = (uint16_t) key_len;
+   slot->value_len = (uint16_t) value_len;
+   memcpy(slot->data, key, key_len + 1);
+   memcpy(slot->data + key_len + 1, value, value_len + 1);
+   __sync_synchronize();
+   slot->seq = seq + 2;
+}
+
+/* Counts a query as answered, or not, from the cache.  A query may take 
+   more than one lookup. */
+void lookup_cache_count(int hit)
+{
+   if (hit)
+      __sync_fetch_and_add(&hits, 1);
+   else
+      __sync_fetch_and_add(&misses, 1);
+}
+
+void lookup_cache_get_stats(unsigned long *hits_out, unsigned long *misses_out)
+{
+   *hits_out = hits;
+   *misses_out = misses;
+}
+
+void lookup_cache_print_stats()
+{
+   debug_printf("lookup cache stats: %lu hits, %lu misses\n", hits, misses);
+}
@@ -0,0 +1,32 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LOOKUP_CACHE_H_)
+#define LOOKUP_CACHE_H_
+
+#include <stdlib.h>
+
+/* An in-process cache of the server's answers to file, stat and existance
+   queries, including file-not-found and directory-not-found answers.  It has
+   a fixed number of slots and is safe to use from any thread without locks. */
+
+int lookup_cache_get(const char *key, char *value, size_t value_size, int *errcode);
+void lookup_cache_set(const char *key, const char *value, int errcode);
+void lookup_cache_count(int hit);
+void lookup_cache_get_stats(unsigned long *hits, unsigned long *misses);
+void lookup_cache_print_stats();
+
+#endif
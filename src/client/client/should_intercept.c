@@ -147,7 +147,7 @@ static int is_lib_prefix(const char *pathname, char *last_slash)
    if (!last_slash && strncmp(pathname, "lib", 3) != 0)
       return 0;
    int len = strlen(pathname);
-   if (!strstr(last_slash, ".so.") && len > 3 && strncmp(pathname + len - 3, ".so", 3) != 0)
+   if (!strstr(last_slash ? last_slash : pathname, ".so.") && len > 3 && strncmp(pathname + len - 3, ".so", 3) != 0)
       return 0;
    return 1;
 }
@@ -273,6 +273,73 @@ int stat_filter(const char *fname)
       return ORIG_CALL;
 }
 
+/**
+ * Python looks for a module by trying several names for it in each directory
+ * of its path.  If fname is under a python prefix, fill in candidates with
+ * fname and the other names that will be tried for the same module, so they
+ * can be looked up together.  Returns the number of candidates.
+ **/
+static const char *python_module_suffixes[] = { ".abi3.so", "module.so", ".pyc", ".py", ".so", NULL };
+static const char *python_package_suffixes[] = { "", "/__init__.py", "/__init__.pyc", NULL };
+
+int python_module_candidates(const char *fname, char *buffer, size_t buffer_size,
+                             const char **candidates, int max_candidates)
+{
+   const char *last_slash, *base, *ext_suffix, *suffixes[16];
+   size_t stem_len, pos = 0;
+   int i, len, num_suffixes = 0, num_candidates = 0;
+
+   if (!(opts & OPT_RELOCPY) || !is_python_path(fname))
+      return 0;
+   last_slash = strrchr(fname, '/');
+   if (!last_slash)
+      return 0;
+   base = last_slash + 1;
+
+   /* Strip the suffix to get the module's path.  Extension modules may be
+      tagged with the interpreter (foo.cpython-311-x86_64-linux-gnu.so) */
+   stem_len = strlen(fname);
+   ext_suffix = strstr(base, ".cpython-");
+   if (ext_suffix && stem_len > 3 && strcmp(fname + stem_len - 3, ".so") == 0) {
+      stem_len = ext_suffix - fname;
+   }
+   else if (strcmp(base, "__init__.py") == 0 || strcmp(base, "__init__.pyc") == 0) {
+      ext_suffix = NULL;
+      stem_len = last_slash - fname;
+   }
+   else {
+      ext_suffix = NULL;
+      for (i = 0; python_module_suffixes[i]; i++) {
+         len = strlen(python_module_suffixes[i]);
+         if (stem_len > (size_t) len && strcmp(fname + stem_len - len, python_module_suffixes[i]) == 0) {
+            stem_len -= len;
+            break;
+         }
+      }
+   }
+   if (stem_len <= (size_t) (base - fname) && fname + stem_len != last_slash)
+      return 0;
+
+   if (ext_suffix)
+      suffixes[num_suffixes++] = ext_suffix;
+   for (i = 0; python_package_suffixes[i]; i++)
+      suffixes[num_suffixes++] = python_package_suffixes[i];
+   for (i = 0; python_module_suffixes[i]; i++)
+      suffixes[num_suffixes++] = python_module_suffixes[i];
+
+   candidates[num_candidates++] = fname;
+   for (i = 0; i < num_suffixes && num_candidates < max_candidates; i++) {
+      len = snprintf(buffer + pos, buffer_size - pos, "%.*s%s", (int) stem_len, fname, suffixes[i]);
+      if (len < 0 || pos + len + 1 > buffer_size)
+         break;
+      if (strcmp(buffer + pos, fname) == 0)
+         continue;
+      candidates[num_candidates++] = buffer + pos;
+      pos += len + 1;
+   }
+   return num_candidates;
+}
+
 int fd_filter(int fd)
 {
    if (opts & OPT_NOHIDE)
@@ -284,6 +351,8 @@ int fd_filter(int fd)
       return ERR_CALL;
    if (is_debug_fd(fd))
       return ERR_CALL;
+   if (is_held_fd(fd))
+      return ERR_CALL;
 
    return ORIG_CALL;
 }
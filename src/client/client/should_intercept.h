@@ -32,5 +32,7 @@ int fopen_filter(const char *fname, const char *flags);
 int exec_filter(const char *fname);
 int stat_filter(const char *fname);
 int fd_filter(int fd);
+int python_module_candidates(const char *fname, char *buffer, size_t buffer_size,
+                             const char **candidates, int max_candidates);
 
 #endif
@@ -127,6 +127,88 @@ int send_stat_request(int fd, char *path, int is_lstat, char *newpath)
    return 0;
 }
 
+/**
+ * Sends queries of type query_type for several paths in one round trip.
+ * Paths are sent in order until the message is full, and *num_answers is
+ * set to how many the server answered.  That's fewer than num_paths if they
+ * didn't all fit, or if first_hit stopped the server at an existing file.
+ * answers[i] holds the single-query answer for paths[i], pointing into
+ * *answer_buffer, which the caller frees with spindle_free.
+ **/
+int send_multi_query(int fd, ldcs_message_ids_t query_type, int first_hit, const char **paths, int num_paths,
+                     ldcs_message_t *answers, int *num_answers, void **answer_buffer)
+{
+   ldcs_message_t message;
+   char buffer[MAX_PATH_LEN];
+   multi_query_header_t header;
+   multi_answer_header_t answer_header;
+   size_t pos = sizeof(header), path_len;
+   char *answer_pos, *answer_end;
+   int32_t count;
+   int i, n;
+
+   for (n = 0; n < num_paths; n++) {
+      path_len = strlen(paths[n]) + 1;
+      if (pos + path_len > sizeof(buffer))
+         break;
+      memcpy(buffer + pos, paths[n], path_len);
+      pos += path_len;
+   }
+   if (n == 0) {
+      err_printf("Path to long for message");
+      return -1;
+   }
+
+   header.query_type = query_type;
+   header.flags = first_hit ? MULTI_QUERY_FIRST_HIT : 0;
+   header.num_paths = n;
+   memcpy(buffer, &header, sizeof(header));
+
+   message.header.type = LDCS_MSG_MULTI_QUERY;
+   message.header.len = pos;
+   message.data = buffer;
+
+   COMM_LOCK;
+
+   debug_printf3("sending message of type: multi_query len=%d with %d of %d paths, first is %s\n",
+                 message.header.len, n, num_paths, paths[0]);
+   client_send_msg(fd, &message);
+
+   client_recv_msg_dynamic(fd, &message, LDCS_READ_BLOCK);
+
+   COMM_UNLOCK;
+
+   if (message.header.type != LDCS_MSG_MULTI_QUERY_ANSWER || message.header.len < sizeof(count)) {
+      err_printf("Got unexpected message of type %d\n", (int) message.header.type);
+      if (message.data)
+         spindle_free(message.data);
+      return -1;
+   }
+
+   memcpy(&count, message.data, sizeof(count));
+   answer_pos = message.data + sizeof(count);
+   answer_end = message.data + message.header.len;
+   for (i = 0; i < count && i < n; i++) {
+      if (answer_pos + sizeof(answer_header) > answer_end)
+         break;
+      memcpy(&answer_header, answer_pos, sizeof(answer_header));
+      answer_pos += sizeof(answer_header);
+      if (answer_header.len < 0 || answer_pos + answer_header.len > answer_end)
+         break;
+      answers[i].header.type = (ldcs_message_ids_t) answer_header.type;
+      answers[i].header.len = answer_header.len;
+      answers[i].data = answer_header.len ? answer_pos : NULL;
+      answer_pos += answer_header.len;
+   }
+   if (i != count)
+      err_printf("Multi-query answer was cut short at %d of %d answers\n", i, (int) count);
+
+   debug_printf3("Server answered %d of %d paths in multi-query\n", i, n);
+   *num_answers = i;
+   *answer_buffer = message.data;
+   return 0;
+}
+
 int send_existance_test(int fd, char *path, int *exists)
 {
    ldcs_message_t message;
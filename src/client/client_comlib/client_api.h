@@ -37,6 +37,8 @@ int send_existance_test(int fd, char *path, int *exists);
 int send_stat_request(int fd, char *path, int islstat, char *result);
 int send_ldso_info_request(int fd, const char *ldso_path, char *result_path);
 int send_orig_path_request(int fd, const char *path, char *newpath);
+int send_multi_query(int fd, ldcs_message_ids_t query_type, int first_hit, const char **paths, int num_paths,
+                     ldcs_message_t *answers, int *num_answers, void **answer_buffer);
 
 int get_python_prefix(int fd, char **prefix);
 
@@ -0,0 +1,363 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <stdlib.h>
+
+#include "client_heap.h"
+#include "ldcs_api_shmem.h"
+#include "ldcs_api.h"
+#include "spindle_launch.h"
+
+#define MAX_FD 1
+static struct shmem_fdlist_entry_t fdlist_shmem[MAX_FD];
+
+static int get_new_fd_shmem()
+{
+   /* Each client should establish one connection, just return 0 as our fd */
+   return 0;
+}
+
+/* Map the connection file.  With create, the file is created and initialized
+   if we are the first process with this pid to connect; without it, a missing
+   file is an error.  Sets *existed if the file was already there, which means
+   we exec'd and still hold the doorbell fd. */
+static shmem_conn_t *map_conn_file(char *fname, int create, int *existed)
+{
+   int fd, result;
+   shmem_conn_t *conn;
+
+   *existed = 0;
+   if (!create) {
+      *existed = 1;
+      fd = open(fname, O_RDWR);
+   }
+   else {
+      fd = open(fname, O_RDWR | O_CREAT | O_EXCL, 0600);
+      if (fd == -1 && errno == EEXIST) {
+         debug_printf2("Likely inheriting an existing shared memory connection after exec\n");
+         *existed = 1;
+         fd = open(fname, O_RDWR);
+      }
+   }
+   if (fd == -1) {
+      err_printf("Error opening shared memory file %s: %s\n", fname, strerror(errno));
+      return NULL;
+   }
+
+   if (!*existed) {
+      result = ftruncate(fd, sizeof(shmem_conn_t));
+      if (result == -1) {
+         err_printf("Error sizing shared memory file %s: %s\n", fname, strerror(errno));
+         close(fd);
+         return NULL;
+      }
+   }
+
+   conn = (shmem_conn_t *) mmap(NULL, sizeof(shmem_conn_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (conn == MAP_FAILED) {
+      err_printf("Error mapping shared memory file %s: %s\n", fname, strerror(errno));
+      return NULL;
+   }
+
+   if (!*existed) {
+      shmem_ring_init(&conn->request);
+      shmem_ring_init(&conn->response);
+      conn->server_pid = 0;
+      conn->client_pid = getpid();
+      __sync_synchronize();
+      conn->magic = SHMEM_MAGIC;
+   }
+   else if (conn->magic != SHMEM_MAGIC) {
+      err_printf("Shared memory file %s is not an initialized connection\n", fname);
+      munmap(conn, sizeof(shmem_conn_t));
+      return NULL;
+   }
+   return conn;
+}
+
+/* After an exec the doorbell fd is still open, but we no longer know its
+   number.  Find it through /proc/self/fd, as the pipe transport does. */
+static int find_existing_fd(char *path)
+{
+   struct dirent *dent;
+   DIR *dir;
+   char fdpath[MAX_PATH_LEN+1];
+   char dirpath[MAX_PATH_LEN+1];
+   int found = -1;
+
+   dir = opendir("/proc/self/fd");
+   if (!dir) {
+      err_printf("Failed to open dir /proc/self/fd.  Perhaps /proc not mounted: %s\n", 
+                 strerror(errno));
+      return -1;
+   }
+
+   for (dent = readdir(dir); dent != NULL; dent = readdir(dir)) {
+      int fd = atoi(dent->d_name);
+      snprintf(dirpath, MAX_PATH_LEN, "/proc/self/fd/%d", fd);
+      memset(fdpath, 0, sizeof(fdpath));
+      (void)! readlink(dirpath, fdpath, MAX_PATH_LEN);
+      if (strcmp(fdpath, path) == 0) {
+         found = fd;
+         break;
+      }
+   }
+   closedir(dir);
+
+   if (found == -1)
+      err_printf("Didn't find expected doorbell fd for %s\n", path);
+   return found;
+}
+
+#define MIN_REMAP_FD 315
+#define MAX_REMAP_FD 315+1024
+extern unsigned long opts;
+static int remap_to_high_fd(int fd)
+{  
+   int i;
+   if (opts & OPT_NOHIDE)
+      return fd;
+
+   for (i = MIN_REMAP_FD; i < MAX_REMAP_FD; i++) {
+      errno = 0;
+      fcntl(i, F_GETFD);
+      if (errno != EBADF)
+         continue;
+      dup2(fd, i);
+      close(fd);
+      debug_printf("Remapped fd %d to high fd %d\n", fd, i);
+      return i;
+   }
+   err_printf("Failed to map fd %d to higher limit\n", fd);
+   return fd;
+}
+
+int client_open_connection_shmem(char* location, int number)
+{
+   int fd, result, existed;
+   struct stat st;
+   int stat_cnt;
+   char fname[MAX_PATH_LEN];
+   char ready[MAX_PATH_LEN];
+
+   debug_printf("Client creating shared memory connection to server\n");
+   fd = get_new_fd_shmem();
+   if (fd < 0) 
+      return -1;
+  
+   fdlist_shmem[fd].type = LDCS_SHMEM_FD_TYPE_CONN;
+
+   /* wait for directory (at most one minute) */
+   stat_cnt = 0;
+   snprintf(ready, MAX_PATH_LEN, "%s/spindle_comm/ready", location);
+   memset(&st, 0, sizeof(st));
+   while (((stat(ready, &st) == -1) || ((st.st_mode & (S_IRUSR | S_IWUSR)) == 0)) && 
+          (stat_cnt<600)) {
+      if (stat_cnt % 10 == 0)
+         debug_printf3("waiting: location %s does not exists (after %d seconds)\n", ready, stat_cnt/10);
+      usleep(100000); /* .1 seconds */
+      stat_cnt++;
+   }
+
+   /* The rings must be in place before the doorbell appears, since the
+      server attaches as soon as it sees the doorbell. */
+   snprintf(fname, MAX_PATH_LEN, "%s/spindle_comm/shm-%d", location, getpid());
+   fdlist_shmem[fd].conn = map_conn_file(fname, 1, &existed);
+   if (!fdlist_shmem[fd].conn)
+      return -1;
+   fdlist_shmem[fd].shm_fn = spindle_strdup(fname);
+
+   snprintf(fname, MAX_PATH_LEN, "%s/spindle_comm/bell-%d", location, getpid());
+   fdlist_shmem[fd].bell_fn = spindle_strdup(fname);
+   fdlist_shmem[fd].bell_fd = -1;
+
+   if (existed) {
+      fdlist_shmem[fd].bell_fd = find_existing_fd(fname);
+      if (fdlist_shmem[fd].bell_fd != -1)
+         return fd;
+      debug_printf2("Doorbell fd for %s not inherited.  Reopening\n", fname);
+   }
+
+   debug_printf3("mkfifo %s\n", fname);
+   result = mkfifo(fname, 0600);
+   if (result == -1 && errno != EEXIST) {
+      err_printf("Error during mkfifo of %s: %s\n", fname, strerror(errno));
+      return -1;
+   }
+
+   debug_printf3("Opening doorbell fifo %s\n", fname);
+   fdlist_shmem[fd].bell_fd = open(fname, O_WRONLY);
+   if (fdlist_shmem[fd].bell_fd == -1) {
+      err_printf("Error opening doorbell fifo %s: %s\n", fname, strerror(errno));
+      return -1;
+   }
+   fdlist_shmem[fd].bell_fd = remap_to_high_fd(fdlist_shmem[fd].bell_fd);
+   debug_printf3("Opened doorbell fifo %s = %d\n", fname, fdlist_shmem[fd].bell_fd);
+
+   return fd;
+}
+
+int client_register_connection_shmem(char *connection_str)
+{
+   char *shm_name = NULL, *bell_name = NULL;
+   int bell_fd, result, existed;
+   shmem_conn_t *conn;
+
+   result = sscanf(connection_str, "%ms %ms %d", &shm_name, &bell_name, &bell_fd);
+   if (result != 3) {
+      err_printf("Reading connection string.  Returned %d on '%s'\n", result, connection_str);
+      return -1;
+   }
+
+   int fd = get_new_fd_shmem();
+   if (fd < 0) {
+      err_printf("Could not create new shared memory connection\n");
+      return -1;
+   }
+
+   conn = map_conn_file(shm_name, 0, &existed);
+   if (!conn)
+      return -1;
+
+   fdlist_shmem[fd].type = LDCS_SHMEM_FD_TYPE_CONN;
+   fdlist_shmem[fd].conn = conn;
+   fdlist_shmem[fd].shm_fn = shm_name;
+   fdlist_shmem[fd].bell_fn = bell_name;
+   fdlist_shmem[fd].bell_fd = bell_fd;
+
+   return fd;
+}
+
+char *client_get_connection_string_shmem(int fd)
+{
+   char *shm_name = fdlist_shmem[fd].shm_fn;
+   char *bell_name = fdlist_shmem[fd].bell_fn;
+   
+   int slen = strlen(shm_name) + strlen(bell_name) + 64;
+   char *str = (char *) spindle_malloc(slen);
+   if (!str)
+      return NULL;
+   snprintf(str, slen, "%s %s %d", shm_name, bell_name, fdlist_shmem[fd].bell_fd);
+   return str;
+}
+
+int client_send_msg_shmem(int fd, ldcs_message_t *msg)
+{
+   shmem_conn_t *conn;
+   int result;
+   char bell = 0;
+
+   assert(fd >= 0 && fd < MAX_FD);
+   conn = fdlist_shmem[fd].conn;
+   
+   debug_printf3("sending message of size len=%d\n", msg->header.len);
+
+   result = shmem_ring_write(&conn->request, &msg->header, sizeof(msg->header), &conn->server_pid);
+   if (result == -1)
+      return -1;
+   if (msg->header.len) {
+      result = shmem_ring_write(&conn->request, msg->data, msg->header.len, &conn->server_pid);
+      if (result == -1)
+         return -1;
+   }
+
+   /* One doorbell byte per message, written after the message is complete */
+   do {
+      result = write(fdlist_shmem[fd].bell_fd, &bell, 1);
+   } while (result == -1 && errno == EINTR);
+   if (result != 1) {
+      err_printf("Failed to ring server doorbell: %s\n", strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+static int client_recv_msg_shmem(int fd, ldcs_message_t *msg, ldcs_read_block_t block, int is_dynamic)
+{
+   shmem_conn_t *conn;
+   int result;
+   msg->header.type=LDCS_MSG_UNKNOWN;
+   msg->header.len=0;
+
+   assert(fd >= 0 && fd < MAX_FD);
+   assert(block == LDCS_READ_BLOCK); /* Non-blocking isn't implemented yet */
+   conn = fdlist_shmem[fd].conn;
+
+   result = shmem_ring_read(&conn->response, &msg->header, sizeof(msg->header), &conn->server_pid);
+   if (result == -1)
+      return -1;
+   
+   if (msg->header.len == 0) {
+      msg->data = NULL;
+      return 0;
+   }
+
+   if (is_dynamic) {
+      msg->data = (char *) spindle_malloc(msg->header.len);
+   }
+
+   debug_printf3("Reading %d bytes for payload from shared memory\n", msg->header.len);
+   result = shmem_ring_read(&conn->response, msg->data, msg->header.len, &conn->server_pid);
+   return (result == -1) ? -1 : 0;
+}
+
+int client_recv_msg_dynamic_shmem(int fd, ldcs_message_t *msg, ldcs_read_block_t block)
+{
+   return client_recv_msg_shmem(fd, msg, block, 1);
+}
+
+int client_recv_msg_static_shmem(int fd, ldcs_message_t *msg, ldcs_read_block_t block)
+{
+   return client_recv_msg_shmem(fd, msg, block, 0);
+}
+
+int is_client_fd(int connfd, int fd)
+{
+   return (fdlist_shmem[connfd].bell_fd == fd);
+}
+
+int client_close_connection_shmem(int fd)
+{
+   int result;
+
+   assert(fd >= 0 && fd < MAX_FD);
+
+   debug_printf2("Closing client connection.  Closing doorbell %s (%d) and unmapping %s\n",
+                 fdlist_shmem[fd].bell_fn, fdlist_shmem[fd].bell_fd, fdlist_shmem[fd].shm_fn);
+
+   result = close(fdlist_shmem[fd].bell_fd);
+   if (result != 0) {
+      err_printf("Error while closing fifo %s errno=%d (%s)\n", fdlist_shmem[fd].bell_fn, errno, strerror(errno));
+   }
+   munmap(fdlist_shmem[fd].conn, sizeof(shmem_conn_t));
+   fdlist_shmem[fd].conn = NULL;
+
+   return 0;
+}
@@ -22,6 +22,10 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "spindle_debug.h"
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 struct entry_t {
    sheep_ptr_t libname;
@@ -50,6 +54,11 @@ static sheep_ptr_t *table;
 
 static shminfo_t *shminfo = NULL;
 
+/* Debug statistics for blocking on in-progress entries */
+static unsigned long waitfor_count = 0;
+static unsigned long waitfor_sleeps = 0;
+static unsigned long waitfor_wakes = 0;
+
 
 void print_shmcache()
 {
@@ -69,32 +78,64 @@ void print_shmcache()
    }
 }
 
-static void upgrade_to_writelock()
+/**
+ * Entries being filled in by another process have their result set to
+ * in_progress.  Waiters sleep in the kernel on the result word, and whoever
+ * updates the entry wakes them.  The futexes are not private, since the
+ * waiters are in other processes.
+ **/
+static void futex_wait_result(volatile sheep_ptr_t *result, uint32_t in_progress_val)
+{
+   syscall(SYS_futex, &result->val, FUTEX_WAIT, in_progress_val, NULL, NULL, 0);
+}
+
+static void wake_result_waiters(struct entry_t *entry)
 {
+   if (!entry->pending_count)
+      return;
+   MEMORY_BARRIER;
+   syscall(SYS_futex, &entry->result.val, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+   waitfor_wakes++;
 }
 
-static void downgrade_to_readlock()
+/**
+ * cache_lock is a reader/writer lock.  Lookups run concurrently under the
+ * reader lock, and anything that adds or frees entries takes the writer lock.
+ * The one thing readers modify is the LRU list, which they serialize among
+ * themselves with the heap lock.  A writer already excludes every reader, so
+ * under the writer lock (as in clean_oldest_entry) the list is edited without
+ * the heap lock, and take_lru_lock(1) does nothing.
+ **/
+static void take_lru_lock(int have_write_lock)
 {
+   if (!have_write_lock)
+      take_heap_lock(shminfo);
+}
+
+static void release_lru_lock(int have_write_lock)
+{
+   if (!have_write_lock)
+      release_heap_lock(shminfo);
 }
 
 static void take_writer_lock()
 {
-   take_lock(&cache_lock);
+   take_rwlock_write(&cache_lock);
 }
 
 static void release_writer_lock()
 {
-   release_lock(&cache_lock);
+   release_rwlock_write(&cache_lock);
 }
 
 static void take_reader_lock()
 {
-   take_lock(&cache_lock);
+   take_rwlock_read(&cache_lock);
 }
 
 static void release_reader_lock()
 {
-   release_lock(&cache_lock);
+   release_rwlock_read(&cache_lock);
 }
 
 static void take_sheep_lock()
@@ -172,8 +213,11 @@ static void mark_recently_used(struct entry_t *entry, int have_write_lock)
    if (sheep_ptr_equals(ptr_sheep(entry), *lru_head))
       return;
 
-   if (!have_write_lock)
-      upgrade_to_writelock();
+   take_lru_lock(have_write_lock);
+   if (sheep_ptr_equals(ptr_sheep(entry), *lru_head)) {
+      release_lru_lock(have_write_lock);
+      return;
+   }
 
    nentry = (struct entry_t *) sheep_ptr(&entry->lru_next);
    pentry = (struct entry_t *) sheep_ptr(&entry->lru_prev);
@@ -198,8 +242,7 @@ static void mark_recently_used(struct entry_t *entry, int have_write_lock)
    if (IS_SHEEP_NULL(lru_end)) {
       set_sheep_ptr(lru_end, entry);
    }
-   if (!have_write_lock)
-      downgrade_to_readlock();
+   release_lru_lock(have_write_lock);
 }
 
 static int clean_oldest_entry()
@@ -346,6 +389,7 @@ static int shmcache_add_worker(const char *libname, const char *mapped_name, int
             entry->libname = ptr_sheep(SHEEP_NULL);
             entry->result = ptr_sheep(SHEEP_NULL);
             entry->hash_key = 0;
+            wake_result_waiters(entry);
             err_printf("Could not free space in cache for updated entry for %s\n", libname);
             return -1;
          }
@@ -356,6 +400,7 @@ static int shmcache_add_worker(const char *libname, const char *mapped_name, int
       }
 
       entry->result = ptr_sheep(mappedname_str);
+      wake_result_waiters(entry);
       debug_printf3("Successfully updated shmcache entry %s\n", libname);
       return 0;
    }
@@ -470,16 +515,21 @@ int shmcache_lookup(const char *libname, char **result)
 
 int shmcache_lookup_or_add(const char *libname, char **result)
 {
-   int iresult;
+   int iresult, have_write_lock = 0;
    char *strresult = NULL;
    if (!table)
       return -1;
    take_reader_lock();
    iresult = shmcache_lookup_worker(libname, &strresult, 0, NULL);
    if (iresult == -1) {
-      upgrade_to_writelock();
-      shmcache_add_worker(libname, in_progress, 0);
-      downgrade_to_readlock();
+      /* Adding may evict entries, so it needs the writer lock.  Someone may
+         add the entry between our locks, so look again once we have it. */
+      release_reader_lock();
+      take_writer_lock();
+      have_write_lock = 1;
+      iresult = shmcache_lookup_worker(libname, &strresult, 1, NULL);
+      if (iresult == -1)
+         shmcache_add_worker(libname, in_progress, 0);
    }
 
    if (strresult == in_progress)
@@ -492,7 +542,10 @@ int shmcache_lookup_or_add(const char *libname, char **result)
       *result = NULL;
    }
                         
-   release_reader_lock();
+   if (have_write_lock)
+      release_writer_lock();
+   else
+      release_reader_lock();
    return iresult;
 }
 
@@ -575,16 +628,19 @@ int shmcache_waitfor_update(const char *libname, char **result)
       return -1;
    }
    if (sheep_ptr(&entry->result) == in_progress) {
-      upgrade_to_writelock();
-      entry->pending_count++;
-      downgrade_to_readlock();
+      __sync_fetch_and_add(&entry->pending_count, 1);
       set_pending_count = 1;
    }
    release_reader_lock();
 
    debug_printf3("Blocking until %s is updated in shmcache\n", libname);
    entry_result = &entry->result;
-   while (volatile_sheep_ptr(entry_result) == in_progress);
+   if (set_pending_count)
+      waitfor_count++;
+   while (volatile_sheep_ptr(entry_result) == in_progress) {
+      waitfor_sleeps++;
+      futex_wait_result(entry_result, hash_error.val);
+   }
 
    sresult = sheep_ptr(&entry->result);
    
@@ -596,10 +652,18 @@ int shmcache_waitfor_update(const char *libname, char **result)
    }
    
    if (set_pending_count) {
-      take_writer_lock();
-      entry->pending_count--;
-      release_writer_lock();
+      take_reader_lock();
+      __sync_fetch_and_sub(&entry->pending_count, 1);
+      release_reader_lock();
    }
 
    return 0;
 }
+
+void shmcache_print_stats()
+{
+   if (!table)
+      return;
+   debug_printf("shmcache stats: %lu waits on in-progress entries, %lu futex sleeps, %lu futex wakes sent\n",
+                waitfor_count, waitfor_sleeps, waitfor_wakes);
+}
@@ -27,6 +27,7 @@ int shmcache_waitfor_update(const char *libname, char **result);
 int shmcache_lookup(const char *libname, char **result);
 void shmcache_take_lock();
 void shmcache_release_lock();
+void shmcache_print_stats();
 
 extern char *in_progress;
 
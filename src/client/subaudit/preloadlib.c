@@ -56,6 +56,8 @@ SPINDLE_EXPORT int execvp(const char *path, char *const argv[]);
 SPINDLE_EXPORT pid_t vfork();
 SPINDLE_EXPORT ssize_t readlink(const char *path, char *buf, size_t bufsiz);
 SPINDLE_EXPORT ssize_t readlinkat(int dirfd, const char *pathname, char *buf, size_t bufsz);
+SPINDLE_EXPORT int chdir(const char *path);
+SPINDLE_EXPORT int fchdir(int fd);
 SPINDLE_EXPORT int spindle_open(const char *pathname, int flags, ...);
 SPINDLE_EXPORT int spindle_stat(const char *path, struct stat *buf);
 SPINDLE_EXPORT int spindle_lstat(const char *path, struct stat *buf);
@@ -245,6 +247,16 @@ ssize_t readlinkat(int dirfd, const char *pathname, char *buf, size_t bufsz)
    return readlinkat_wrapper(dirfd, pathname, buf, bufsz);
 }
 
+int chdir(const char *path)
+{
+   return chdir_wrapper(path);
+}
+
+int fchdir(int fd)
+{
+   return fchdir_wrapper(fd);
+}
+
 FILE *spindle_fopen(const char *path, const char *mode)
 {
    return int_spindle_fopen(path, mode);
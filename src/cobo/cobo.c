@@ -111,6 +111,12 @@ static int  cobo_num_child_incl = 0; /* total number of children this node is re
 
 static int cobo_root_fd = -1;
 
+/* tree shape, set by the server and forwarded down the tree with the hostlist */
+static int  cobo_tree_shape  = COBO_TREE_BINOMIAL;
+static int  cobo_tree_degree = 2;     /* fan-out for k-ary trees and within groups */
+static int* cobo_tree_groups = NULL;  /* group id of each rank for grouped trees */
+static int  cobo_tree_num_groups = 0; /* number of entries in cobo_tree_groups */
+
 static handshake_protocol_t cobo_handshake;
 
 double __cobo_ts = 0.0f;
@@ -339,310 +345,497 @@ static int cobo_read_fd(int fd, void* buf, int size)
     return cobo_read_fd_w_timeout(fd, buf, size, -1);
 }
 
-/* Open a connection on socket FD to peer at ADDR (which LEN bytes long).
- * This function uses a non-blocking filedescriptor for the connect(),
- * and then does a bounded poll() for the connection to complete.  This
- * allows us to timeout the connect() earlier than TCP might do it on
- * its own.  We have seen timeouts that failed after several minutes,
- * where we would really prefer to time out earlier and retry the connect.
- *
- * Return 0 on success, -1 for errors.
- */
-static int cobo_connect_w_timeout(int fd, struct sockaddr const * addr, socklen_t len, int millisec)
+/* send rank id and hostlist data to specified hostname */
+static int cobo_send_hostlist(int s, char* hostname, int rank, int ranks, void* hostlist, int bytes)
 {
-    int rc, flags, err;
-    socklen_t err_len;
-    struct pollfd ufds;
-
-    flags = fcntl(fd, F_GETFL);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    debug_printf3("Sending hostlist to rank %d on %s\n", rank, hostname);
 
-    err = 0;
-    rc = connect(fd , addr , len);
-    if (rc < 0 && errno != EINPROGRESS) {
-/*
-        err_printf("Nonblocking connect failed immediately (connect() %m errno=%d)\n",
-                   errno);
-*/
-        return -1;
-    }
-    if (rc == 0) {
-        goto done;  /* connect completed immediately */
+    /* check that we have an open socket */
+    if (s == -1) {
+        err_printf("No connection to rank %d on %s to send hostlist\n",
+                   rank, hostname);
+        return (!COBO_SUCCESS);
     }
 
-    ufds.fd = fd;
-    ufds.events = POLLIN | POLLOUT;
-    ufds.revents = 0;
-
-again:	rc = poll(&ufds, 1, millisec);
-    if (rc == -1) {
-        /* poll failed */
-        if (errno == EINTR) {
-            /* NOTE: connect() is non-interruptible in Linux */
-            goto again;
-        } else {
-/*
-            err_printf("Polling connection (poll() %m errno=%d)\n",
-                       errno);
-*/
-        }
-        return -1;
-    } else if (rc == 0) {
-        /* poll timed out before any socket events */
-        /* perror("cobo_connect_w_timeout poll timeout"); */
-        return -1;
-    } else {
-        /* poll saw some event on the socket
-         * We need to check if the connection succeeded by
-         * using getsockopt.  The revent is not necessarily
-         * POLLERR when the connection fails! */
-        err_len = (socklen_t) sizeof(err);
-        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0) {
-/*
-            err_printf("Failed to read event on socket (getsockopt() %m errno=%d)\n",
-                       errno);
-*/
-            return -1; /* solaris pending error */
-        }
+    /* forward the rank of hostname to hostname */
+    if (cobo_write_fd(s, &rank, sizeof(rank)) < 0) {
+        err_printf("Writing hostname table to rank %d on %s failed\n",
+                   rank, hostname);
+        return (!COBO_SUCCESS);
     }
 
-done:
-    fcntl(fd, F_SETFL, flags);
-
-    /* NOTE: Connection refused is typically reported for
-     * non-responsive nodes plus attempts to communicate
-     * with terminated launcher. */
-    if (err) {
-/*
-        err_printf("Error on socket in cobo_connect_w_timeout() (getsockopt() set err=%d)\n",
-                   err);
-*/
-        return -1;
+    /* forward the number of ranks in the job to hostname */
+    if (cobo_write_fd(s, &ranks, sizeof(ranks)) < 0) {
+        err_printf("Writing hostname table to rank %d on %s failed\n",
+                   rank, hostname);
+        return (!COBO_SUCCESS);
     }
- 
-    return 0;
-}
-
-/* Connect to given IP:port.  Upon successful connection, cobo_connect
- * shall return the connected socket file descriptor.  Otherwise, -1 shall be
- * returned.
- */
-static int cobo_connect(struct in_addr ip, int port, int timeout)
-{
-    struct sockaddr_in sockaddr;
 
-    /* set up address to connect to */
-    sockaddr.sin_family = AF_INET;
-    sockaddr.sin_addr = ip;
-    sockaddr.sin_port = port;
+    /* forward the shape of the tree */
+    if (cobo_write_fd(s, &cobo_tree_shape, sizeof(int)) < 0 ||
+        cobo_write_fd(s, &cobo_tree_degree, sizeof(int)) < 0) {
+        err_printf("Writing tree shape to rank %d on %s failed\n",
+                   rank, hostname);
+        return (!COBO_SUCCESS);
+    }
 
-    /* create a socket */
-    int s = socket(AF_INET, SOCK_STREAM, 0); /* IPPROTO_TCP */
-    if (s < 0) {
-        err_printf("Creating socket (socket() %m errno=%d)\n",
-                   errno);
-        return -1;
+    /* forward the size of the hostlist in bytes */
+    if (cobo_write_fd(s, &bytes, sizeof(bytes)) < 0) {
+        err_printf("Writing hostname table to rank %d on %s failed\n",
+                   rank, hostname);
+        return (!COBO_SUCCESS);
     }
 
-    /* connect socket to address */
-    if (cobo_connect_w_timeout(s, (struct sockaddr *) &sockaddr, sizeof(sockaddr), timeout) < 0) {
-        close(s);
-        return -1;
+    /* forward the hostlist table */
+    if (cobo_write_fd(s, hostlist, bytes) < 0) {
+        err_printf("Writing hostname table to child (rank %d) at %s failed\n",
+                   rank, hostname);
+        return (!COBO_SUCCESS);
     }
 
-    _cobo_opt_socket(s);
+    /* and finally, the group of every rank if the tree follows the network topology */
+    if (cobo_tree_shape == COBO_TREE_GROUPED &&
+        cobo_write_fd(s, cobo_tree_groups, ranks * sizeof(int)) < 0) {
+        err_printf("Writing group table to child (rank %d) at %s failed\n",
+                   rank, hostname);
+        return (!COBO_SUCCESS);
+    }
 
-    return s;
+    return COBO_SUCCESS;
 }
 
-/* Attempts to connect to a given hostname using a port list and timeouts */
-static int cobo_connect_hostname(char* hostname, int rank)
+/*
+ * =============================
+ * Connection engine.  Connections to all children are opened at once
+ * with non-blocking sockets driven by a single poll loop.
+ * =============================
+ */
+
+/* Resolved host addresses, so retries and later connects skip the lookup */
+typedef struct cobo_addr_cache_t {
+    char* hostname;
+    struct in_addr addr;
+    struct cobo_addr_cache_t* next;
+} cobo_addr_cache_t;
+
+static cobo_addr_cache_t* cobo_addr_cache = NULL;
+
+/* States of a connection to one child */
+typedef enum {
+    COBO_CONN_WAIT,       /* waiting to start the next connect attempt */
+    COBO_CONN_CONNECTING, /* non-blocking connect() in progress */
+    COBO_CONN_ACCEPTING,  /* connected, waiting for the peer to start the handshake */
+    COBO_CONN_REPLY,      /* sent our ids, waiting for service and accept ids */
+    COBO_CONN_DONE,       /* acknowledged, needs the hostlist */
+    COBO_CONN_FORWARDED,  /* finished */
+    COBO_CONN_FAILED
+} cobo_conn_state_t;
+
+typedef struct {
+    char* hostname;
+    int rank;
+    struct in_addr addr;
+    cobo_conn_state_t state;
+    int fd;
+    int flags;
+    int port_index;
+    int connect_timeout;
+    int reply_timeout;
+    struct timeval deadline;
+    unsigned int reply[2];
+    int reply_bytes;
+} cobo_conn_t;
+
+/* Bring-up timings of the last cobo_connect_children call, in seconds from its start */
+static struct {
+    double resolve;   /* all hostnames resolved */
+    double connect;   /* last TCP connect completed */
+    double handshake; /* total time spent in security handshakes */
+    double reply;     /* last child acknowledged */
+    double hostlist;  /* last hostlist forwarded */
+    int attempts;     /* connect attempts started */
+} cobo_open_times;
+
+/* Look up the address of hostname, consulting and filling the address cache */
+static int cobo_resolve_hostname(char* hostname, struct in_addr* addr)
 {
-    int s = -1;
-    struct in_addr saddr;
+    cobo_addr_cache_t* entry;
+    for (entry = cobo_addr_cache; entry; entry = entry->next) {
+        if (strcmp(entry->hostname, hostname) == 0) {
+            *addr = entry->addr;
+            return 0;
+        }
+    }
 
     /* lookup host address by name */
     struct hostent* he = gethostbyname(hostname);
     if (!he) {
        /* gethostbyname doesn't know how to resolve hostname, trying inet_addr */ 
-       saddr.s_addr = inet_addr(hostname);
-       if (saddr.s_addr == -1) {
+       addr->s_addr = inet_addr(hostname);
+       if (addr->s_addr == -1) {
            err_printf("Hostname lookup failed (gethostbyname(%s) %s h_errno=%d)\n",
                 hostname, hstrerror(h_errno), h_errno);
-           return s;
+           return -1;
        }
     }
     else {
-      saddr = *((struct in_addr *) (*he->h_addr_list));
+      *addr = *((struct in_addr *) (*he->h_addr_list));
     }
 
-    /* Loop until we make a connection or until our timeout expires. */
-    struct timeval start, end;
-    cobo_gettimeofday(&start);
-    double secs = 0;
-    int connected = 0;
-    int connect_timeout = cobo_connect_timeout;
-    int reply_timeout = cobo_connect_timeout * 10;
-    int result;
-    while (!connected && secs < cobo_connect_timelimit) {
-        /* iterate over our ports trying to find a connection */
-        int i;
-        for (i=0; i < cobo_num_ports; i++) {
-            /* get our port */
-            int port = cobo_ports[i];
-
-            /* attempt to connect to hostname on this port */
-            debug_printf3("Trying rank %d port %d on %s\n", rank, port, hostname);
-            /* s = cobo_connect(*(struct in_addr *) (*he->h_addr_list), htons(port)); */
-            s = cobo_connect(saddr, htons(port), connect_timeout);
-            if (s != -1) {
-                /* got a connection, let's test it out */
-                debug_printf3("Connected to rank %d port %d on %s\n", rank, port, hostname);
-                int test_failed = 0;
-
-                result = spindle_handshake_client(s, &cobo_handshake, cobo_sessionid);
-                switch (result) {
-                   case HSHAKE_SUCCESS:
-                      break;
-                   case HSHAKE_INTERNAL_ERROR:
-                      err_printf("Internal error doing handshake: %s", spindle_handshake_last_error_str());
-                      exit(-1);
-                      break;
-                   case HSHAKE_DROP_CONNECTION:
-                      debug_printf3("Handshake said to drop connection\n");
-                      close(s);
-                      continue;
-                   case HSHAKE_ABORT:
-                      handle_security_error(spindle_handshake_last_error_str());
-                      abort();
-                   default:
-                      assert(0 && "Unknown return value from handshake_server\n");
-                }
-                
-                /* write cobo service id */
-                if (!test_failed && cobo_write_fd_w_suppress(s, &cobo_serviceid, sizeof(cobo_serviceid), 1) < 0) {
-                    debug_printf3("Writing service id to %s on port %d\n",
-                                  hostname, port);
-                    test_failed = 1;
-                }
+    entry = (cobo_addr_cache_t*) cobo_malloc(sizeof(cobo_addr_cache_t), "Address cache entry");
+    entry->hostname = strdup(hostname);
+    entry->addr = *addr;
+    entry->next = cobo_addr_cache;
+    cobo_addr_cache = entry;
+    return 0;
+}
 
-                /* write our session id */
-                if (!test_failed && cobo_write_fd_w_suppress(s, &cobo_sessionid, sizeof(cobo_sessionid), 1) < 0) {
-                    debug_printf3("Writing session id to %s on port %d\n",
-                                  hostname, port);
-                    test_failed = 1;
-                }
+static void cobo_set_deadline(struct timeval* deadline, int millisec)
+{
+    struct timeval now, add;
+    cobo_gettimeofday(&now);
+    add.tv_sec = millisec / 1000;
+    add.tv_usec = (millisec % 1000) * 1000;
+    timeradd(&now, &add, deadline);
+}
 
-                /* read the service id */
-                unsigned int received_serviceid = 0;
-                if (!test_failed && cobo_read_fd_w_timeout(s, &received_serviceid, sizeof(received_serviceid), reply_timeout) < 0) {
-                    debug_printf3("Receiving service id from %s on port %d failed\n",
-                              hostname, port);
-                    test_failed = 1;
-                }
+/* Drop the current attempt and move on to the next port.  After a full scan
+ * of the ports, wait before rescanning and extend the timeouts, in case we
+ * were too impatient waiting for a reply. */
+static void cobo_conn_retry(cobo_conn_t* conn)
+{
+    if (conn->fd != -1) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    conn->reply_bytes = 0;
+    conn->state = COBO_CONN_WAIT;
+    conn->port_index++;
+    if (conn->port_index < cobo_num_ports) {
+        cobo_gettimeofday(&conn->deadline);
+        return;
+    }
 
-                /* read the accept id */
-                unsigned int received_acceptid = 0;
-                if (!test_failed && cobo_read_fd_w_timeout(s, &received_acceptid, sizeof(received_acceptid), reply_timeout) < 0) {
-                    debug_printf3("Receiving accept id from %s on port %d failed\n",
-                              hostname, port);
-                    test_failed = 1;
-                }
+    conn->port_index = 0;
+    cobo_set_deadline(&conn->deadline, cobo_connect_sleep);
+    if (conn->connect_timeout < 30000) {
+        conn->connect_timeout *= cobo_connect_backoff;
+        conn->reply_timeout   *= cobo_connect_backoff;
+    }
+}
 
-                /* check that we got the expected service and accept ids */
-                if (!test_failed && (received_serviceid != cobo_serviceid || received_acceptid != cobo_acceptid)) {
-                    test_failed = 1;
-                }
+/* Start a non-blocking connect to the current port of conn */
+static void cobo_conn_start(cobo_conn_t* conn)
+{
+    struct sockaddr_in sockaddr;
+    int port = cobo_ports[conn->port_index];
 
-                /* write ack to finalize connection (no need to suppress write errors any longer) */
-                unsigned int ack = 1;
-                if (!test_failed && cobo_write_fd(s, &ack, sizeof(ack)) < 0) {
-                    debug_printf3("Writing ack to finalize connection to rank %d on %s port %d\n",
-                               rank, hostname, port);
-                    test_failed = 1;
-                }
+    cobo_open_times.attempts++;
+    debug_printf3("Trying rank %d port %d on %s\n", conn->rank, port, conn->hostname);
 
-                /* if the connection test failed, close the socket, otherwise we've got a good connection */
-                if (test_failed) {
-                    close(s);
-                } else {
-                    connected = 1;
-                    break;
-                }
-            }
-        }
+    conn->fd = socket(AF_INET, SOCK_STREAM, 0); /* IPPROTO_TCP */
+    if (conn->fd < 0) {
+        err_printf("Creating socket (socket() %m errno=%d)\n", errno);
+        conn->fd = -1;
+        cobo_conn_retry(conn);
+        return;
+    }
 
-        /* sleep for some time before we try another port scan */
-        if (!connected) {
-            usleep(cobo_connect_sleep * 1000);
+    memset(&sockaddr, 0, sizeof(sockaddr));
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_addr = conn->addr;
+    sockaddr.sin_port = htons(port);
 
-            /* maybe we connected ok, but we were too impatient waiting for a reply, extend the reply timeout for the next attempt */
-            if (connect_timeout < 30000) {
-              connect_timeout *= cobo_connect_backoff;
-              reply_timeout   *= cobo_connect_backoff;
-            }
-        }
+    conn->flags = fcntl(conn->fd, F_GETFL);
+    fcntl(conn->fd, F_SETFL, conn->flags | O_NONBLOCK);
 
-        /* compute how many seconds we've spent trying to connect */
-        cobo_gettimeofday(&end);
-        secs = cobo_getsecs(&end, &start);
-        if (secs >= cobo_connect_timelimit) {
-            err_printf("Time limit to connect to rank %d on %s expired\n",
-                       rank, hostname);
-        }
+    int rc = connect(conn->fd, (struct sockaddr *) &sockaddr, sizeof(sockaddr));
+    if (rc == 0) {
+        fcntl(conn->fd, F_SETFL, conn->flags);
+        conn->state = COBO_CONN_ACCEPTING;
+        cobo_set_deadline(&conn->deadline, conn->reply_timeout);
     }
-
-    /* check that we successfully opened a socket */
-    if (s == -1) {
-        err_printf("Connecting socket to %s at %s failed\n",
-                   hostname, inet_ntoa(saddr));
-        return s;
+    else if (errno == EINPROGRESS) {
+        conn->state = COBO_CONN_CONNECTING;
+        cobo_set_deadline(&conn->deadline, conn->connect_timeout);
+    }
+    else {
+        cobo_conn_retry(conn);
     }
+}
 
-    return s;
+/* poll saw an event on a connecting socket.  We need to check if the
+ * connection succeeded by using getsockopt.  The revent is not necessarily
+ * POLLERR when the connection fails! */
+static void cobo_conn_connected(cobo_conn_t* conn)
+{
+    int err = 0;
+    socklen_t err_len = (socklen_t) sizeof(err);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err) {
+        /* NOTE: Connection refused is typically reported for
+         * non-responsive nodes plus attempts to communicate
+         * with terminated launcher. */
+        cobo_conn_retry(conn);
+        return;
+    }
+    fcntl(conn->fd, F_SETFL, conn->flags);
+    conn->state = COBO_CONN_ACCEPTING;
+    cobo_set_deadline(&conn->deadline, conn->reply_timeout);
 }
 
-/* send rank id and hostlist data to specified hostname */
-static int cobo_send_hostlist(int s, char* hostname, int rank, int ranks, void* hostlist, int bytes)
+/* Authenticate a new connection and send our service and session ids.
+ * The handshake is blocking and keeps global state, so handshakes run
+ * one at a time.  They are only started once the peer has sent its first
+ * handshake bytes, so we never block on a peer that is still serving some
+ * other connection.  The replies are collected in the poll loop. */
+static void cobo_conn_handshake(cobo_conn_t* conn)
 {
-    debug_printf3("Sending hostlist to rank %d on %s\n", rank, hostname);
+    int port = cobo_ports[conn->port_index];
+    debug_printf3("Connected to rank %d port %d on %s\n", conn->rank, port, conn->hostname);
+    _cobo_opt_socket(conn->fd);
+
+    int result = spindle_handshake_client(conn->fd, &cobo_handshake, cobo_sessionid);
+    switch (result) {
+       case HSHAKE_SUCCESS:
+          break;
+       case HSHAKE_INTERNAL_ERROR:
+          err_printf("Internal error doing handshake: %s", spindle_handshake_last_error_str());
+          exit(-1);
+          break;
+       case HSHAKE_DROP_CONNECTION:
+          debug_printf3("Handshake said to drop connection\n");
+          cobo_conn_retry(conn);
+          return;
+       case HSHAKE_ABORT:
+          handle_security_error(spindle_handshake_last_error_str());
+          abort();
+       default:
+          assert(0 && "Unknown return value from handshake_server\n");
+    }
+
+    /* write cobo service id */
+    if (cobo_write_fd_w_suppress(conn->fd, &cobo_serviceid, sizeof(cobo_serviceid), 1) < 0) {
+        debug_printf3("Writing service id to %s on port %d\n", conn->hostname, port);
+        cobo_conn_retry(conn);
+        return;
+    }
+
+    /* write our session id */
+    if (cobo_write_fd_w_suppress(conn->fd, &cobo_sessionid, sizeof(cobo_sessionid), 1) < 0) {
+        debug_printf3("Writing session id to %s on port %d\n", conn->hostname, port);
+        cobo_conn_retry(conn);
+        return;
+    }
+
+    conn->reply_bytes = 0;
+    conn->state = COBO_CONN_REPLY;
+    cobo_set_deadline(&conn->deadline, conn->reply_timeout);
+}
 
-    /* check that we have an open socket */
-    if (s == -1) {
-        err_printf("No connection to rank %d on %s to send hostlist\n",
-                   rank, hostname);
-        return (!COBO_SUCCESS);
-    }
+/* Read the service and accept ids as they arrive, then finalize the connection */
+static void cobo_conn_read_reply(cobo_conn_t* conn)
+{
+    int port = cobo_ports[conn->port_index];
+    int rc = read(conn->fd, ((char *) conn->reply) + conn->reply_bytes, sizeof(conn->reply) - conn->reply_bytes);
+    if (rc < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if (rc <= 0) {
+        debug_printf3("Receiving service and accept ids from %s on port %d failed\n", conn->hostname, port);
+        cobo_conn_retry(conn);
+        return;
+    }
+    conn->reply_bytes += rc;
+    if (conn->reply_bytes < sizeof(conn->reply))
+        return;
+
+    /* check that we got the expected service and accept ids */
+    if (conn->reply[0] != cobo_serviceid || conn->reply[1] != cobo_acceptid) {
+        cobo_conn_retry(conn);
+        return;
+    }
+
+    /* write ack to finalize connection (no need to suppress write errors any longer) */
+    unsigned int ack = 1;
+    if (cobo_write_fd(conn->fd, &ack, sizeof(ack)) < 0) {
+        debug_printf3("Writing ack to finalize connection to rank %d on %s port %d\n",
+                      conn->rank, conn->hostname, port);
+        cobo_conn_retry(conn);
+        return;
+    }
+
+    conn->state = COBO_CONN_DONE;
+}
 
-    /* forward the rank of hostname to hostname */
-    if (cobo_write_fd(s, &rank, sizeof(rank)) < 0) {
-        err_printf("Writing hostname table to rank %d on %s failed\n",
-                   rank, hostname);
-        return (!COBO_SUCCESS);
-    }
+/* Milliseconds from now until tv, clamped at zero */
+static int cobo_msecs_until(struct timeval* tv)
+{
+    struct timeval now;
+    cobo_gettimeofday(&now);
+    if (!timercmp(&now, tv, <))
+        return 0;
+    double secs = cobo_getsecs(tv, &now);
+    return (int) (secs * 1000.0) + 1;
+}
 
-    /* forward the number of ranks in the job to hostname */
-    if (cobo_write_fd(s, &ranks, sizeof(ranks)) < 0) {
-        err_printf("Writing hostname table to rank %d on %s failed\n",
-                   rank, hostname);
-        return (!COBO_SUCCESS);
+/* Connect to each host in hostnames and forward the rank and hostlist
+ * to it as soon as its connection is up.  All connects and replies are
+ * in flight at once.  Fills in fds, and returns the number of hosts that
+ * could not be connected. */
+static int cobo_connect_children(char** hostnames, int* ranks, int num, int nprocs, int* fds)
+{
+    struct timeval start, now;
+    int i, num_pending = num, num_failed = 0;
+
+    if (num == 0)
+        return 0;
+
+    cobo_gettimeofday(&start);
+    memset(&cobo_open_times, 0, sizeof(cobo_open_times));
+
+    cobo_conn_t* conns = (cobo_conn_t*) cobo_malloc(num * sizeof(cobo_conn_t), "Connection state array");
+    struct pollfd* pfds = (struct pollfd*) cobo_malloc(num * sizeof(struct pollfd), "Connection poll array");
+    int* pfd_conn = (int*) cobo_malloc(num * sizeof(int), "Connection poll index array");
+
+    for (i = 0; i < num; i++) {
+        cobo_conn_t* conn = conns + i;
+        memset(conn, 0, sizeof(*conn));
+        conn->hostname = hostnames[i];
+        conn->rank = ranks[i];
+        conn->fd = -1;
+        conn->connect_timeout = cobo_connect_timeout;
+        conn->reply_timeout = cobo_connect_timeout * 10;
+        conn->state = COBO_CONN_WAIT;
+        cobo_gettimeofday(&conn->deadline);
+        fds[i] = -1;
+        if (cobo_resolve_hostname(conn->hostname, &conn->addr) == -1) {
+            conn->state = COBO_CONN_FAILED;
+            num_pending--;
+        }
     }
+    cobo_gettimeofday(&now);
+    cobo_open_times.resolve = cobo_getsecs(&now, &start);
+
+    while (num_pending) {
+        int num_pfds = 0;
+        int timeout = -1;
+
+        /* Start due connects, expire timeouts, forward hostlists, and collect
+           the sockets that are waiting on the network */
+        for (i = 0; i < num; i++) {
+            cobo_conn_t* conn = conns + i;
+            if (conn->state == COBO_CONN_FORWARDED || conn->state == COBO_CONN_FAILED)
+                continue;
+            if (conn->state == COBO_CONN_WAIT && cobo_msecs_until(&conn->deadline) == 0)
+                cobo_conn_start(conn);
+            else if (conn->state != COBO_CONN_WAIT && conn->state != COBO_CONN_DONE &&
+                     cobo_msecs_until(&conn->deadline) == 0)
+                cobo_conn_retry(conn);
+
+            if (conn->state == COBO_CONN_DONE) {
+                /* tell child what rank he is and forward the hostname table to him */
+                cobo_gettimeofday(&now);
+                cobo_open_times.reply = cobo_getsecs(&now, &start);
+                if (cobo_send_hostlist(conn->fd, conn->hostname, conn->rank, nprocs,
+                                       cobo_hostlist, cobo_hostlist_size) == COBO_SUCCESS) {
+                    fds[i] = conn->fd;
+                    conn->state = COBO_CONN_FORWARDED;
+                }
+                else {
+                    err_printf("Failed to forward hostname table to child (rank %d) on %s failed\n",
+                               conn->rank, conn->hostname);
+                    conn->state = COBO_CONN_FAILED;
+                }
+                cobo_gettimeofday(&now);
+                cobo_open_times.hostlist = cobo_getsecs(&now, &start);
+                num_pending--;
+                continue;
+            }
 
-    /* forward the size of the hostlist in bytes */
-    if (cobo_write_fd(s, &bytes, sizeof(bytes)) < 0) {
-        err_printf("Writing hostname table to rank %d on %s failed\n",
-                   rank, hostname);
-        return (!COBO_SUCCESS);
+            if (conn->state != COBO_CONN_WAIT) {
+                pfds[num_pfds].fd = conn->fd;
+                pfds[num_pfds].events = (conn->state == COBO_CONN_CONNECTING) ? (POLLIN | POLLOUT) : POLLIN;
+                pfds[num_pfds].revents = 0;
+                pfd_conn[num_pfds] = i;
+                num_pfds++;
+            }
+            int until = cobo_msecs_until(&conn->deadline);
+            if (timeout == -1 || until < timeout)
+                timeout = until;
+        }
+
+        /* compute how many seconds we've spent trying to connect */
+        cobo_gettimeofday(&now);
+        if (num_pending && cobo_getsecs(&now, &start) >= cobo_connect_timelimit) {
+            for (i = 0; i < num; i++) {
+                cobo_conn_t* conn = conns + i;
+                if (conn->state != COBO_CONN_FORWARDED && conn->state != COBO_CONN_FAILED)
+                    err_printf("Time limit to connect to rank %d on %s expired\n",
+                               conn->rank, conn->hostname);
+            }
+            break;
+        }
+        if (!num_pending)
+            break;
+
+        int rc = poll(pfds, num_pfds, timeout);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            err_printf("Polling connections (poll() %m errno=%d)\n", errno);
+            break;
+        }
+        for (i = 0; i < num_pfds; i++) {
+            cobo_conn_t* conn = conns + pfd_conn[i];
+            if (!pfds[i].revents)
+                continue;
+            if (conn->state == COBO_CONN_CONNECTING) {
+                cobo_conn_connected(conn);
+                if (conn->state == COBO_CONN_ACCEPTING) {
+                    cobo_gettimeofday(&now);
+                    cobo_open_times.connect = cobo_getsecs(&now, &start);
+                }
+            }
+            else if (conn->state == COBO_CONN_ACCEPTING) {
+                /* A reset (e.g. we sat in the backlog of a peer that has since
+                   closed its listening socket) also shows up as readable */
+                char peek;
+                if (recv(conn->fd, &peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT) <= 0) {
+                    cobo_conn_retry(conn);
+                    continue;
+                }
+                struct timeval hs_start, hs_end;
+                cobo_gettimeofday(&hs_start);
+                cobo_conn_handshake(conn);
+                cobo_gettimeofday(&hs_end);
+                cobo_open_times.handshake += cobo_getsecs(&hs_end, &hs_start);
+            }
+            else if (conn->state == COBO_CONN_REPLY)
+                cobo_conn_read_reply(conn);
+        }
     }
 
-    /* and finally, forward the hostlist table */
-    if (cobo_write_fd(s, hostlist, bytes) < 0) {
-        err_printf("Writing hostname table to child (rank %d) at %s failed\n",
-                   rank, hostname);
-        return (!COBO_SUCCESS);
+    /* check that we successfully opened a socket to each child */
+    for (i = 0; i < num; i++) {
+        cobo_conn_t* conn = conns + i;
+        if (conn->state == COBO_CONN_FORWARDED)
+            continue;
+        if (conn->fd != -1)
+            close(conn->fd);
+        err_printf("Connecting socket to %s at %s failed\n",
+                   conn->hostname, inet_ntoa(conn->addr));
+        num_failed++;
     }
 
-    return COBO_SUCCESS;
+    debug_printf("Connected to %d of %d children: resolve %.6fs, last connect %.6fs, "
+                 "handshakes %.6fs, last reply %.6fs, last hostlist %.6fs, %d connect attempts\n",
+                 num - num_failed, num, cobo_open_times.resolve, cobo_open_times.connect,
+                 cobo_open_times.handshake, cobo_open_times.reply, cobo_open_times.hostlist,
+                 cobo_open_times.attempts);
+
+    free(pfd_conn);
+    free(pfds);
+    free(conns);
+    return num_failed;
 }
 
 /* 
@@ -665,44 +858,234 @@ static char* cobo_expand_hostname(int rank)
     return strdup(hostname);
 }
 
-/* given cobo_me and cobo_nprocs, fills in parent and children ranks -- currently implements a binomial tree */
-static int cobo_compute_children()
+/* Splits count ranks starting at first into at most parts contiguous chunks
+ * whose sizes differ by at most one.  Appends the chunks to starts/ends in
+ * descending rank order and returns the new number of chunks. */
+static int cobo_split_even(int first, int count, int parts, int* starts, int* ends, int n)
 {
-    /* compute the maximum number of children this task may have */
+    int i;
+    if (count <= 0) {
+        return n;
+    }
+    if (parts > count) {
+        parts = count;
+    }
+    int end = first + count - 1;
+    for (i = parts - 1; i >= 0; i--) {
+        int size = count / parts + (i < count % parts ? 1 : 0);
+        starts[n] = end - size + 1;
+        ends[n] = end;
+        end -= size;
+        n++;
+    }
+    return n;
+}
+
+/* Fills in the child subtrees of the task that heads the rank range [low, high].
+ * Every subtree covers a contiguous range of ranks, which cobo_get_child_for_rank
+ * and the gather/scatter code depend on.  Children are listed in descending rank
+ * order.  Returns the number of children. */
+static int cobo_split_range(int low, int high, int* starts, int* ends)
+{
+    int n = 0;
+
+    if (cobo_tree_shape == COBO_TREE_KARY) {
+        /* k-ary: the ranks below us are split evenly across k subtrees */
+        return cobo_split_even(low + 1, high - low, cobo_tree_degree, starts, ends, 0);
+    }
+
+    if (cobo_tree_shape == COBO_TREE_GROUPED) {
+        /* ranks are sorted by group, so each group is a contiguous range.  The head of a
+         * range forwards to one leader per chunk of other groups, so each group is only
+         * sent one copy across its uplink, and builds a k-ary tree within its own group */
+        int group_end = low;
+        while (group_end < high && cobo_tree_groups[group_end + 1] == cobo_tree_groups[low]) {
+            group_end++;
+        }
+
+        if (group_end < high) {
+            int num_groups = 0, r;
+            for (r = group_end + 1; r <= high; r++) {
+                if (r == group_end + 1 || cobo_tree_groups[r] != cobo_tree_groups[r - 1]) {
+                    num_groups++;
+                }
+            }
+
+            /* split the other groups into at most k chunks of whole groups */
+            int parts = (num_groups < cobo_tree_degree) ? num_groups : cobo_tree_degree;
+            int chunk, chunk_groups = 0, start = group_end + 1;
+            int first_n = n;
+            chunk = 0;
+            for (r = group_end + 1; r <= high; r++) {
+                if (r > group_end + 1 && cobo_tree_groups[r] != cobo_tree_groups[r - 1]) {
+                    chunk_groups++;
+                    int want = num_groups / parts + (chunk < num_groups % parts ? 1 : 0);
+                    if (chunk_groups == want) {
+                        starts[n] = start;
+                        ends[n] = r - 1;
+                        n++;
+                        chunk++;
+                        chunk_groups = 0;
+                        start = r;
+                    }
+                }
+            }
+            starts[n] = start;
+            ends[n] = high;
+            n++;
+
+            /* those chunks were found in ascending order, reverse them */
+            int a = first_n, b = n - 1;
+            while (a < b) {
+                int tmp = starts[a]; starts[a] = starts[b]; starts[b] = tmp;
+                tmp = ends[a]; ends[a] = ends[b]; ends[b] = tmp;
+                a++;
+                b--;
+            }
+        }
+
+        return cobo_split_even(low + 1, group_end - low, cobo_tree_degree, starts, ends, n);
+    }
+
+    /* binomial: split the range in half, then split the lower half again, ... */
+    int h = high;
+    while (h > low) {
+        int mid = (h - low) / 2 + (h - low) % 2 + low;
+        starts[n] = mid;
+        ends[n] = h;
+        n++;
+        h = mid - 1;
+    }
+    return n;
+}
+
+/* upper bound on the number of children any task may have in the current tree shape */
+static int cobo_max_children()
+{
+    if (cobo_tree_shape == COBO_TREE_KARY) {
+        return cobo_tree_degree;
+    }
+    if (cobo_tree_shape == COBO_TREE_GROUPED) {
+        return 2 * cobo_tree_degree;
+    }
+
     int n = 1;
     int max_children = 0;
     while (n < cobo_nprocs) {
         n <<= 1;
         max_children++;
     }
+    return max_children;
+}
+
+/* given cobo_me and cobo_nprocs, fills in parent and children ranks according to the tree shape */
+static int cobo_compute_children()
+{
+    /* compute the maximum number of children this task may have */
+    int max_children = cobo_max_children();
 
     /* prepare data structures to store our parent and children */
     cobo_parent = 0;
     cobo_num_child = 0;
     cobo_num_child_incl = 0;
-    cobo_child      = (int*) cobo_malloc(max_children * sizeof(int), "Child rank array");
-    cobo_child_fd    = (int*) cobo_malloc(max_children * sizeof(int), "Child socket fd array");
-    cobo_child_incl = (int*) cobo_malloc(max_children * sizeof(int), "Child children count array");
+    cobo_child      = (int*) cobo_malloc(max_children * sizeof(int) + 1, "Child rank array");
+    cobo_child_fd    = (int*) cobo_malloc(max_children * sizeof(int) + 1, "Child socket fd array");
+    cobo_child_incl = (int*) cobo_malloc(max_children * sizeof(int) + 1, "Child children count array");
+    int* starts = (int*) cobo_malloc(max_children * sizeof(int) + 1, "Subtree start array");
+    int* ends   = (int*) cobo_malloc(max_children * sizeof(int) + 1, "Subtree end array");
 
-    /* find our parent rank and the ranks of our children */
+    /* walk down from the root to the subtree we head, finding our parent on the way */
     int low  = 0;
     int high = cobo_nprocs - 1;
-    while (high - low > 0) {
-        int mid = (high - low) / 2 + (high - low) % 2 + low;
-        if (low == cobo_me) {
-            cobo_child[cobo_num_child] = mid;
-            cobo_child_incl[cobo_num_child] = high - mid + 1;
-            cobo_num_child++;
-            cobo_num_child_incl += (high - mid + 1);
+    int i, n;
+    while (low != cobo_me) {
+        n = cobo_split_range(low, high, starts, ends);
+        for (i = 0; i < n; i++) {
+            if (starts[i] <= cobo_me && cobo_me <= ends[i]) {
+                break;
+            }
+        }
+        assert(i < n);
+        if (starts[i] == cobo_me) { cobo_parent = low; }
+        low  = starts[i];
+        high = ends[i];
+    }
+
+    /* the subtrees below us are our children */
+    n = cobo_split_range(low, high, starts, ends);
+    for (i = 0; i < n; i++) {
+        cobo_child[cobo_num_child] = starts[i];
+        cobo_child_incl[cobo_num_child] = ends[i] - starts[i] + 1;
+        cobo_num_child++;
+        cobo_num_child_incl += ends[i] - starts[i] + 1;
+    }
+
+    cobo_free(starts);
+    cobo_free(ends);
+    return COBO_SUCCESS;
+}
+
+/* Fills in the depth and the largest fan-out of the whole tree */
+int cobo_get_tree_stats(int* depth, int* max_fanout)
+{
+    if (cobo_nprocs <= 0) {
+        return -1;
+    }
+
+    int max_children = cobo_max_children();
+    int* starts = (int*) cobo_malloc(max_children * sizeof(int) + 1, "Subtree start array");
+    int* ends   = (int*) cobo_malloc(max_children * sizeof(int) + 1, "Subtree end array");
+    int* stack  = (int*) cobo_malloc(3 * cobo_nprocs * sizeof(int), "Subtree stack");
+    int top = 0, i, n;
+
+    *depth = 0;
+    *max_fanout = 0;
+    stack[top++] = 0;
+    stack[top++] = cobo_nprocs - 1;
+    stack[top++] = 0;
+    while (top) {
+        int d    = stack[--top];
+        int high = stack[--top];
+        int low  = stack[--top];
+        if (d > *depth) {
+            *depth = d;
+        }
+        n = cobo_split_range(low, high, starts, ends);
+        if (n > *max_fanout) {
+            *max_fanout = n;
+        }
+        for (i = 0; i < n; i++) {
+            stack[top++] = starts[i];
+            stack[top++] = ends[i];
+            stack[top++] = d + 1;
         }
-        if (mid == cobo_me) { cobo_parent = low; }
-        if (mid <= cobo_me) { low  = mid; }
-        else                { high = mid-1; }
     }
 
+    cobo_free(stack);
+    cobo_free(starts);
+    cobo_free(ends);
     return COBO_SUCCESS;
 }
 
+static const char* cobo_tree_shape_name()
+{
+    switch (cobo_tree_shape) {
+        case COBO_TREE_KARY:    return "k-ary";
+        case COBO_TREE_GROUPED: return "grouped";
+        default:                return "binomial";
+    }
+}
+
+static void cobo_print_tree_stats()
+{
+    int depth, max_fanout;
+    if (cobo_get_tree_stats(&depth, &max_fanout) != COBO_SUCCESS) {
+        return;
+    }
+    debug_printf("COBO %s tree (degree %d) over %d tasks: depth %d, max fan-out %d\n",
+                 cobo_tree_shape_name(), cobo_tree_degree, cobo_nprocs, depth, max_fanout);
+}
+
 #ifdef __COBO_CURRENTLY_NOT_USED
 /* given cobo_me and cobo_nprocs, fills in parent and children ranks -- currently implements a binomial tree */
 static int cobo_compute_children_root_C1()
@@ -892,6 +1275,10 @@ static int cobo_open_tree()
         have_parent = 1;
     }
 
+    /* we've got the connection to our parent, so close the listening socket.  Any
+     * other connection attempts sitting in its backlog fail and move on to the next port */
+    close(sockfd);
+
     cobo_gettimeofday(&tree_start);
 
     /* TODO: exchange protocol version number */
@@ -908,6 +1295,13 @@ static int cobo_open_tree()
         exit(1);
     }
 
+    /* read the shape of the tree */
+    if (cobo_read_fd(cobo_parent_fd, &cobo_tree_shape, sizeof(int)) < 0 ||
+        cobo_read_fd(cobo_parent_fd, &cobo_tree_degree, sizeof(int)) < 0) {
+        err_printf("Receiving tree shape from parent failed\n");
+        exit(1);
+    }
+
     /* read the size of the hostlist (in bytes) */
     if (cobo_read_fd(cobo_parent_fd, &cobo_hostlist_size, sizeof(int)) < 0) {
         err_printf("Receiving size of hostname table from parent failed\n");
@@ -921,6 +1315,15 @@ static int cobo_open_tree()
         exit(1);
     }
 
+    /* read the group of every rank */
+    if (cobo_tree_shape == COBO_TREE_GROUPED) {
+        cobo_tree_groups = (int*) cobo_malloc(cobo_nprocs * sizeof(int), "Tree group table");
+        if (cobo_read_fd(cobo_parent_fd, cobo_tree_groups, cobo_nprocs * sizeof(int)) < 0) {
+            err_printf("Receiving group table from parent failed\n");
+            exit(1);
+        }
+    }
+
 /*
     if (cobo_me == 0) {
       for (i=0; i < cobo_nprocs; i++) {
@@ -934,6 +1337,9 @@ static int cobo_open_tree()
     /* given our rank and the number of ranks, compute the ranks of our children */
     cobo_compute_children();  
     /* cobo_compute_children_root_C1(); */
+    if (cobo_me == 0) {
+        cobo_print_tree_stats();
+    }
 
     char **child_names = (char **) malloc(sizeof(char *) * cobo_num_child);
     for (i = 0; i < cobo_num_child; i++) {
@@ -948,40 +1354,23 @@ static int cobo_open_tree()
           preconnect_cb(child_names[i]);
     }
 
-    /* for each child, open socket connection and forward hostname table */
-    for(i=0; i < cobo_num_child; i++) {
-        /* get rank and hostname for this child */
-        int c = cobo_child[i];
-        char* child_hostname = child_names[i];
-
-        debug_printf3("%d: on COBO%02d: connect to child #%02d (%s)\n",i,cobo_me,c,child_hostname);
-
-        /* connect to child */
-        cobo_child_fd[i] = cobo_connect_hostname(child_hostname, c);
-        if (cobo_child_fd[i] == -1) {
-            err_printf("Failed to connect to child (rank %d) on %s failed\n",
-                       c, child_hostname);
-            exit(1);
-        }
-
-        /* tell child what rank he is and forward the hostname table to him */
-        int forward = cobo_send_hostlist(cobo_child_fd[i], child_hostname, c,
-                          cobo_nprocs, cobo_hostlist, cobo_hostlist_size);
-        if (forward != COBO_SUCCESS) {
-            err_printf("Failed to forward hostname table to child (rank %d) on %s failed\n",
-                       c, child_hostname);
-            exit(1);
+    /* open socket connections to all children at once, forwarding the hostname
+       table to each as soon as its connection is up */
+    debug_printf3("COBO%02d: connecting to %d children\n", cobo_me, cobo_num_child);
+    if (cobo_connect_children(child_names, cobo_child, cobo_num_child, cobo_nprocs, cobo_child_fd) != 0) {
+        for (i = 0; i < cobo_num_child; i++) {
+            if (cobo_child_fd[i] == -1)
+                err_printf("Failed to connect to child (rank %d) on %s failed\n",
+                           cobo_child[i], child_names[i]);
         }
-
-        /* free the child hostname string */
-        free(child_hostname);
+        exit(1);
     }
 
+    /* free the child hostname strings */
+    for (i = 0; i < cobo_num_child; i++)
+        free(child_names[i]);
     free(child_names);
 
-    /* we've got the connection to our parent, so close the listening socket */
-    close(sockfd);
-    
     return COBO_SUCCESS;
 }
 
@@ -1005,6 +1394,7 @@ static int cobo_close_tree()
     cobo_free(cobo_child_fd);
     cobo_free(cobo_child_incl);
     cobo_free(cobo_hostlist);
+    cobo_free(cobo_tree_groups);
 
     return COBO_SUCCESS;
 }
@@ -1184,6 +1574,19 @@ int cobo_get_child_socket(int num, int *fd)
    return COBO_SUCCESS;
 }
 
+int cobo_get_child_for_rank(int rank, int *num)
+{
+   int i;
+   /* Each child's subtree covers the contiguous ranks [child, child+child_incl) */
+   for (i = 0; i < cobo_num_child; i++) {
+      if (rank >= cobo_child[i] && rank < cobo_child[i] + cobo_child_incl[i]) {
+         *num = i;
+         return COBO_SUCCESS;
+      }
+   }
+   return -1;
+}
+
 /*
  * ==========================================================================
  * ==========================================================================
@@ -1553,8 +1956,31 @@ int cobo_server_open(uint64_t sessionid, char** hostlist, int num_hosts, int* po
         return (!COBO_SUCCESS);
     }
 
+    /* a grouped tree needs the hosts of each group to hold contiguous ranks, so
+     * stable-sort the hostlist by group before assigning ranks */
+    int i, j;
+    if (cobo_tree_shape == COBO_TREE_GROUPED && cobo_tree_num_groups != num_hosts) {
+        err_printf("COBO group table has %d entries for %d hosts\n", cobo_tree_num_groups, num_hosts);
+        return (!COBO_SUCCESS);
+    }
+    if (cobo_tree_shape == COBO_TREE_GROUPED) {
+        char** sorted = (char**) cobo_malloc(num_hosts * sizeof(char*), "Sorted hostlist");
+        int* sorted_groups = (int*) cobo_malloc(num_hosts * sizeof(int), "Sorted group table");
+        for (i = 0; i < num_hosts; i++) {
+            for (j = i; j > 0 && sorted_groups[j-1] > cobo_tree_groups[i]; j--) {
+                sorted[j] = sorted[j-1];
+                sorted_groups[j] = sorted_groups[j-1];
+            }
+            sorted[j] = hostlist[i];
+            sorted_groups[j] = cobo_tree_groups[i];
+        }
+        cobo_free(cobo_tree_groups);
+        cobo_tree_groups = sorted_groups;
+        hostlist = sorted;
+    }
+    cobo_print_tree_stats();
+
     /* determine the total number of bytes to hold the strings including terminating NUL character */
-    int i;
     int size = 0;
     for (i=0; i < num_hosts; i++) {
         size += strlen(hostlist[i]) + 1;
@@ -1590,22 +2016,47 @@ int cobo_server_open(uint64_t sessionid, char** hostlist, int num_hosts, int* po
         return (!COBO_SUCCESS);
     }
 
-    /* connect to first host */
-    cobo_root_fd = cobo_connect_hostname(hostlist[0], 0);
-    if (cobo_root_fd == -1) {
+    /* connect to first host and forward the hostlist table to it */
+    int root_rank = 0;
+    int result = COBO_SUCCESS;
+    if (cobo_connect_children(hostlist, &root_rank, 1, num_hosts, &cobo_root_fd) != 0) {
         err_printf("Failed to connect to child (rank %d) on %s failed\n",
                    0, hostlist[0]);
-        return (!COBO_SUCCESS);
+        result = !COBO_SUCCESS;
     }
 
-    /* forward the hostlist table to the first host */
-    int forward = cobo_send_hostlist(cobo_root_fd, hostlist[0], 0, num_hosts, cobo_hostlist, cobo_hostlist_size);
-    if (forward != COBO_SUCCESS) {
-        err_printf("Failed to forward hostname table to child (rank %d) on %s failed\n",
-                   0, hostlist[0]);
+    if (cobo_tree_shape == COBO_TREE_GROUPED) {
+        cobo_free(hostlist);
+    }
+    return result;
+}
+
+/* select the shape of the tree the server will build, must be called before cobo_server_open */
+int cobo_set_tree_shape(int shape, int degree, int* groups, int num_groups)
+{
+    if (shape != COBO_TREE_BINOMIAL && shape != COBO_TREE_KARY && shape != COBO_TREE_GROUPED) {
+        err_printf("Unknown COBO tree shape %d\n", shape);
+        return (!COBO_SUCCESS);
+    }
+    if (shape != COBO_TREE_BINOMIAL && degree < 1) {
+        err_printf("COBO tree degree must be at least 1, got %d\n", degree);
+        return (!COBO_SUCCESS);
+    }
+    if (shape == COBO_TREE_GROUPED && (groups == NULL || num_groups <= 0)) {
+        err_printf("Grouped COBO tree requested without a group table\n");
         return (!COBO_SUCCESS);
     }
 
+    cobo_tree_shape = shape;
+    cobo_tree_degree = (shape == COBO_TREE_BINOMIAL) ? 2 : degree;
+    cobo_free(cobo_tree_groups);
+    if (shape == COBO_TREE_GROUPED) {
+        cobo_tree_groups = cobo_int_dup(groups, num_groups);
+        if (cobo_tree_groups == NULL) {
+            return (!COBO_SUCCESS);
+        }
+        cobo_tree_num_groups = num_groups;
+    }
     return COBO_SUCCESS;
 }
 
@@ -1620,6 +2071,7 @@ int cobo_server_close()
     /* free data structures */
     cobo_free(cobo_ports);
     cobo_free(cobo_hostlist);
+    cobo_free(cobo_tree_groups);
 
     return COBO_SUCCESS;
 }
@@ -28,6 +28,8 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <poll.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <arpa/inet.h>
 #include <poll.h>
 #include <assert.h>
@@ -225,6 +227,69 @@ int ll_write(int fd, void *buf, size_t count)
    return 0;
 }
 
+/* write every iovec to fd, retry on partial writes.  Modifies iov */
+int ll_writev(int fd, struct iovec *iov, int iovcnt)
+{
+   ssize_t result;
+
+   while (iovcnt) {
+      result = writev(fd, iov, iovcnt);
+      if (result == -1) {
+         if (errno == EINTR || errno == EAGAIN)
+            continue;
+         err_printf("Error writing to cobo FD %d: %s\n", fd, strerror(errno));
+         return -1;
+      }
+      else if (result == 0) {
+         err_printf("Unexpected exit from peer\n");
+         return -1;
+      }
+      debug_printf3("Wrote %ld bytes from %d iovecs to network\n", (long) result, iovcnt);
+      while (iovcnt && (size_t) result >= iov->iov_len) {
+         result -= iov->iov_len;
+         iov++;
+         iovcnt--;
+      }
+      if (iovcnt) {
+         iov->iov_base = ((unsigned char *) iov->iov_base) + result;
+         iov->iov_len -= result;
+      }
+   }
+   return 0;
+}
+
+/* send count bytes from the start of file_fd to fd in the kernel.  *sent is set
+   to the bytes transferred, so a caller can finish the send some other way if
+   the file or socket doesn't support sendfile (errno is EINVAL or ENOSYS). */
+int ll_sendfile(int fd, int file_fd, size_t count, size_t *sent)
+{
+   ssize_t result;
+   off_t offset = 0;
+
+   *sent = 0;
+   while ((size_t) offset < count) {
+      result = sendfile(fd, file_fd, &offset, count - offset);
+      if (result == -1) {
+         if (errno == EINTR || errno == EAGAIN)
+            continue;
+         *sent = offset;
+         if (errno != EINVAL && errno != ENOSYS)
+            err_printf("Error sending file to cobo FD %d: %s\n", fd, strerror(errno));
+         return -1;
+      }
+      else if (result == 0) {
+         *sent = offset;
+         err_printf("File ended after %lu of %lu bytes while sending to cobo FD %d\n",
+                    (unsigned long) offset, (unsigned long) count, fd);
+         errno = EIO;
+         return -1;
+      }
+   }
+   debug_printf3("Sent %lu bytes of file %d to network\n", (unsigned long) count, file_fd);
+   *sent = count;
+   return 0;
+}
+
 int write_msg(int fd, ldcs_message_t *msg)
 {
    int result = ll_write(fd, msg, sizeof(*msg));
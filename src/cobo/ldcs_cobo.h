@@ -40,6 +40,11 @@ extern "C" {
 
 #define COBO_SUCCESS (0)
 
+/* tree shapes */
+#define COBO_TREE_BINOMIAL (0)  /* split the ranks in half at each level */
+#define COBO_TREE_KARY     (1)  /* split the ranks into k even subtrees at each level */
+#define COBO_TREE_GROUPED  (2)  /* one leader per group (rack, switch), k-ary within a group */
+
 #define COBO_NAMESPACE ldcs
 
 #if defined(COBO_NAMESPACE)
@@ -62,9 +67,12 @@ extern "C" {
 #define cobo_get_num_childs COMBINE(COBO_NAMESPACE, cobo_get_num_childs)
 #define cobo_bcast_down COMBINE(COBO_NAMESPACE, cobo_bcast_down)
 #define cobo_get_child_socket COMBINE(COBO_NAMESPACE, cobo_get_child_socket)
+#define cobo_get_child_for_rank COMBINE(COBO_NAMESPACE, cobo_get_child_for_rank)
 #define cobo_set_handshake COMBINE(COBO_NAMESPACE, cobo_set_handshake)
 #define cobo_preconnect_cb_t COMBINE(COBO_NAMESPACE, cobo_preconnect_cb_t)
 #define cobo_register_preconnect_cb COMBINE(COBO_NAMESPACE, cobo_register_preconnect_cb)
+#define cobo_set_tree_shape COMBINE(COBO_NAMESPACE, cobo_set_tree_shape)
+#define cobo_get_tree_stats COMBINE(COBO_NAMESPACE, cobo_get_tree_stats)
 #endif
 
 /*
@@ -142,6 +150,14 @@ int cobo_server_open(uint64_t sessionid, char** hostlist, int num_hosts, int* po
 /* shut down the tree connections (leaves processes running) */
 int cobo_server_close();
 
+/* select the shape of the tree before calling cobo_server_open.  degree is the
+ * fan-out for k-ary trees and within groups; for grouped trees, groups holds the
+ * group id of each of the num_groups hosts in the hostlist */
+int cobo_set_tree_shape(int shape, int degree, int* groups, int num_groups);
+
+/* fills in the depth and largest fan-out of the tree, once its size is known */
+int cobo_get_tree_stats(int* depth, int* max_fanout);
+
 /* fills in fd with socket file desriptor to the root client process (rank 0) */
 /* TODO: the upside here is that the upper layer can directly use our
  * communication tree, but the downside is that it exposes the implementation
@@ -155,6 +171,10 @@ int cobo_get_num_childs(int* num_childs);
 /* Methods to access child fds */
 int cobo_get_child_socket(int num, int *fd);
 
+/* Fills in num with the index of the child whose subtree contains rank.
+   Returns -1 if rank is not below us in the tree */
+int cobo_get_child_for_rank(int rank, int *num);
+
 void cobo_set_handshake(handshake_protocol_t *hs);
 
 void handle_security_error(const char *msg);
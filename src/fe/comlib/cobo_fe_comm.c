@@ -22,6 +22,88 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "config.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+static pthread_t listener_thread;
+static int listener_running = 0;
+static int listener_result = 0;
+static fe_msg_cb_t listener_cb;
+
+/* Looks up host in a map file of "hostname group" lines.  Hosts match on their full
+   name or on the name up to the first '.'.  Returns the group, or -1 if not listed. */
+static int lookup_tree_group(FILE *f, const char *host)
+{
+   char line[4096], name[1024];
+   int group;
+   size_t shortlen = strcspn(host, ".");
+
+   rewind(f);
+   while (fgets(line, sizeof(line), f)) {
+      char *hash = strchr(line, '#');
+      if (hash)
+         *hash = '\0';
+      if (sscanf(line, "%1023s %d", name, &group) != 2)
+         continue;
+      if (strcmp(name, host) == 0)
+         return group;
+      if (strcspn(name, ".") == shortlen && strncmp(name, host, shortlen) == 0)
+         return group;
+   }
+   return -1;
+}
+
+int ldcs_audit_server_fe_md_set_tree(char **hostlist, int numhosts, unsigned int shape, unsigned int degree,
+                                     const char *mapfile)
+{
+   int *groups = NULL;
+   int i, unmapped = 0, max_group = -1, result, cobo_shape;
+
+   switch (shape) {
+      case tree_binomial: cobo_shape = COBO_TREE_BINOMIAL; break;
+      case tree_kary: cobo_shape = COBO_TREE_KARY; break;
+      case tree_topology: cobo_shape = COBO_TREE_GROUPED; break;
+      default:
+         err_printf("Unknown tree shape %u\n", shape);
+         return -1;
+   }
+
+   if (cobo_shape == COBO_TREE_GROUPED) {
+      if (!mapfile) {
+         err_printf("Topology tree requested without a tree map file\n");
+         return -1;
+      }
+      FILE *f = fopen(mapfile, "r");
+      if (!f) {
+         err_printf("Could not open tree map file %s\n", mapfile);
+         return -1;
+      }
+      groups = malloc(sizeof(int) * numhosts);
+      for (i = 0; i < numhosts; i++) {
+         groups[i] = lookup_tree_group(f, hostlist[i]);
+         if (groups[i] > max_group)
+            max_group = groups[i];
+      }
+      fclose(f);
+
+      /* hosts that are missing from the map share one group of their own */
+      for (i = 0; i < numhosts; i++) {
+         if (groups[i] != -1)
+            continue;
+         debug_printf2("Host %s is not listed in tree map %s\n", hostlist[i], mapfile);
+         groups[i] = max_group + 1;
+         unmapped++;
+      }
+      if (unmapped)
+         debug_printf("%d of %d hosts are not listed in tree map %s\n", unmapped, numhosts, mapfile);
+   }
+
+   debug_printf2("Setting tree shape %u with degree %u\n", shape, degree);
+   result = cobo_set_tree_shape(cobo_shape, (int) degree, groups, numhosts);
+   free(groups);
+   return result == COBO_SUCCESS ? 0 : -1;
+}
 
 int ldcs_audit_server_fe_md_open ( char **hostlist, int numhosts, unsigned int port, unsigned int num_ports,
                                    unique_id_t unique_id, 
@@ -49,6 +131,54 @@ int ldcs_audit_server_fe_md_open ( char **hostlist, int numhosts, unsigned int p
    return(rc);
 }
 
+/* Reads messages from the root server until it is ready to exit or closes
+   its connection, and hands everything else to the listener callback */
+static void *listener_main(void *arg)
+{
+   int root_fd, result;
+   ldcs_message_t msg;
+
+   cobo_server_get_root_socket(&root_fd);
+   for (;;) {
+      memset(&msg, 0, sizeof(msg));
+      result = read_msg(root_fd, &msg);
+      if (result == -1) {
+         debug_printf2("Root server closed its connection to the FE\n");
+         listener_result = -1;
+         break;
+      }
+      if (msg.header.type == LDCS_MSG_EXIT_READY) {
+         debug_printf2("Listener got exit ready from root server\n");
+         break;
+      }
+      listener_cb(&msg);
+      if (msg.data)
+         free(msg.data);
+   }
+   return NULL;
+}
+
+int ldcs_audit_server_fe_md_start_listener(fe_msg_cb_t cb)
+{
+   int result;
+
+   listener_cb = cb;
+   result = pthread_create(&listener_thread, NULL, listener_main, NULL);
+   if (result != 0) {
+      err_printf("Could not start FE listener thread: %s\n", strerror(result));
+      return -1;
+   }
+   listener_running = 1;
+   return 0;
+}
+
+static int join_listener()
+{
+   pthread_join(listener_thread, NULL);
+   listener_running = 0;
+   return listener_result;
+}
+
 int ldcs_audit_server_fe_md_waitfor_close()
 {
    int root_fd, result;
@@ -56,6 +186,9 @@ int ldcs_audit_server_fe_md_waitfor_close()
 
    debug_printf2("Blocking while waiting for spindle exit\n");
 
+   if (listener_running)
+      return join_listener();
+
    cobo_server_get_root_socket(&root_fd);
    for (;;) {
       memset(&out_msg, 0, sizeof(out_msg));
@@ -82,6 +215,11 @@ int ldcs_audit_server_fe_md_close ( void *data  ) {
 
    cobo_server_get_root_socket(&root_fd);
    write_msg(root_fd, &out_msg);
+
+   /* The root may send the listener the last of its messages before it exits */
+   if (listener_running)
+      join_listener();
+
    return cobo_server_close();
 }
 
@@ -26,8 +26,15 @@ extern "C" {
 
 int ldcs_audit_server_fe_md_open(char **hostlist, int numhosts, unsigned int port, unsigned int num_ports,
                                  unique_id_t unique_id, void **data);
+int ldcs_audit_server_fe_md_set_tree(char **hostlist, int numhosts, unsigned int shape, unsigned int degree,
+                                     const char *mapfile);
 int ldcs_audit_server_fe_md_close(void *data);
 int ldcs_audit_server_fe_md_waitfor_close();
+
+/* Starts a thread that passes messages from the servers to cb until they are ready to exit.
+   waitfor_close and close wait for the thread. */
+typedef void (*fe_msg_cb_t)(ldcs_message_t *msg);
+int ldcs_audit_server_fe_md_start_listener(fe_msg_cb_t cb);
 int ldcs_audit_server_fe_broadcast(ldcs_message_t *msg, void *data);
 
 int read_msg(int fd, ldcs_message_t *msg);
@@ -45,10 +45,12 @@ extern bool setOpenMPIInterceptEnv(string launcher_rel);
 char libstr_socket_subaudit[] = PROGLIBDIR "/libspindle_subaudit_socket.so";
 char libstr_pipe_subaudit[] = PROGLIBDIR "/libspindle_subaudit_pipe.so";
 char libstr_biter_subaudit[] = PROGLIBDIR "/libspindle_subaudit_biter.so";
+char libstr_shmem_subaudit[] = PROGLIBDIR "/libspindle_subaudit_shmem.so";
 
 char libstr_socket_audit[] = PROGLIBDIR "/libspindle_audit_socket.so";
 char libstr_pipe_audit[] = PROGLIBDIR "/libspindle_audit_pipe.so";
 char libstr_biter_audit[] = PROGLIBDIR "/libspindle_audit_biter.so";
+char libstr_shmem_audit[] = PROGLIBDIR "/libspindle_audit_shmem.so";
 
 char libstr_intercept_lib[] = PROGLIBDIR "/libspindleint.so";
 #if defined(COMM_SOCKET)
@@ -60,6 +62,9 @@ static char *default_subaudit_libstr = libstr_pipe_subaudit;
 #elif defined(COMM_BITER)
 static char *default_audit_libstr = libstr_biter_audit;
 static char *default_subaudit_libstr = libstr_biter_subaudit;
+#elif defined(COMM_SHMEM)
+static char *default_audit_libstr = libstr_shmem_audit;
+static char *default_subaudit_libstr = libstr_shmem_subaudit;
 #else
 #error Unknown connection type
 #endif
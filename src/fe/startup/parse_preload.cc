@@ -18,11 +18,13 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <cstring>
 #include <set>
 #include <string>
+#include <vector>
 #include <cerrno>
 #include <cstdlib>
 #include <cassert>
 
 #include "parse_preload.h"
+#include "preload_manifest.h"
 #include "pathfn.h"
 
 extern "C" {
@@ -34,44 +36,22 @@ using namespace std;
 #define STR2(X) #X
 #define STR(X) STR2(X)
 
-ldcs_message_t *parsePreloadFile(string filename)
+/* Packs the directories, then the files, then any metadata queries, in order */
+static ldcs_message_t *buildPreloadMsg(const vector<string> &all_dirs, const vector<string> &all_files,
+                                       const vector<pair<int, string> > &all_metadata)
 {
-   char pathname[MAX_PATH_LEN+1], cwd[MAX_PATH_LEN+1], dir[MAX_PATH_LEN+1], file[MAX_PATH_LEN+1];
-   set<string> all_dirs, all_files;
-
-   debug_printf("Parsing preload file: %s\n", filename.c_str());
-   FILE *f = fopen(filename.c_str(), "r");
-   if (!f) {
-      err_printf("Error opening preload file %s: %s\n", filename.c_str(), strerror(errno));
-      return NULL;
-   }
-
-   (void)! getcwd(cwd, MAX_PATH_LEN+1);
-   cwd[MAX_PATH_LEN] = '\0';
-
-   for (;;) {
-      int result = fscanf(f, "%" STR(MAX_PATH_LEN) "s", pathname);
-      if (result == EOF)
-         break;
-      pathname[MAX_PATH_LEN] = '\0';
-      
-      parseFilenameNoAlloc(pathname, file, dir, MAX_PATH_LEN);
-      file[MAX_PATH_LEN] = '\0';
-      dir[MAX_PATH_LEN] = '\0';
-      addCWDToDir(getpid(), dir, MAX_PATH_LEN);
-      reducePath(dir);
-   
-      all_dirs.insert(string(dir));
-      all_files.insert(string(dir) + string("/") + string(file));      
-   }
-
    size_t size = 0;
    size += sizeof(int); //Num dirs as int
    size += sizeof(int); //Num files as int
-   for (set<string>::iterator i = all_dirs.begin(); i != all_dirs.end(); i++)
+   for (vector<string>::const_iterator i = all_dirs.begin(); i != all_dirs.end(); i++)
       size += i->length() + 1; //String + 0-terminated character
-   for (set<string>::iterator i = all_files.begin(); i != all_files.end(); i++)
+   for (vector<string>::const_iterator i = all_files.begin(); i != all_files.end(); i++)
       size += i->length() + 1; //String + 0-terminated character
+   if (!all_metadata.empty()) {
+      size += sizeof(int); //Num metadata as int
+      for (vector<pair<int, string> >::const_iterator i = all_metadata.begin(); i != all_metadata.end(); i++)
+         size += sizeof(int) + i->second.length() + 1; //Kind + string + 0-terminated character
+   }
 
    char *buffer = (char *) malloc(size);
    assert(buffer);
@@ -82,18 +62,30 @@ ldcs_message_t *parsePreloadFile(string filename)
    *((int *) (buffer+cur)) = (int) all_files.size();
    cur += sizeof(int);
 
-   for (set<string>::iterator i = all_dirs.begin(); i != all_dirs.end(); i++) {
+   for (vector<string>::const_iterator i = all_dirs.begin(); i != all_dirs.end(); i++) {
       debug_printf3("Adding directory %s to preload list\n", i->c_str());
       int length = i->length() + 1;
       memcpy(buffer + cur, i->c_str(), length);
       cur += length;
    }
-   for (set<string>::iterator i = all_files.begin(); i != all_files.end(); i++) {
+   for (vector<string>::const_iterator i = all_files.begin(); i != all_files.end(); i++) {
       debug_printf3("Adding file %s to preload list\n", i->c_str());
       int length = i->length() + 1;
       memcpy(buffer + cur, i->c_str(), length);
       cur += length;
    }
+   if (!all_metadata.empty()) {
+      *((int *) (buffer+cur)) = (int) all_metadata.size();
+      cur += sizeof(int);
+      for (vector<pair<int, string> >::const_iterator i = all_metadata.begin(); i != all_metadata.end(); i++) {
+         debug_printf3("Adding metadata of %s to preload list\n", i->second.c_str());
+         memcpy(buffer + cur, &i->first, sizeof(int));
+         cur += sizeof(int);
+         int length = i->second.length() + 1;
+         memcpy(buffer + cur, i->second.c_str(), length);
+         cur += length;
+      }
+   }
    assert(cur == size);
 
    ldcs_message_t *msg = (ldcs_message_t *) malloc(sizeof(ldcs_message_t));
@@ -104,6 +96,50 @@ ldcs_message_t *parsePreloadFile(string filename)
    return msg;
 }
 
+ldcs_message_t *parsePreloadFile(string filename)
+{
+   char pathname[MAX_PATH_LEN+1], cwd[MAX_PATH_LEN+1], dir[MAX_PATH_LEN+1], file[MAX_PATH_LEN+1];
+   set<string> all_dirs, all_files;
+
+   if (isManifestFile(filename)) {
+      vector<string> manifest_dirs, manifest_files;
+      vector<pair<int, string> > manifest_metadata;
+      if (readManifest(filename, manifest_dirs, manifest_files, manifest_metadata) == -1)
+         return NULL;
+      return buildPreloadMsg(manifest_dirs, manifest_files, manifest_metadata);
+   }
+
+   debug_printf("Parsing preload file: %s\n", filename.c_str());
+   FILE *f = fopen(filename.c_str(), "r");
+   if (!f) {
+      err_printf("Error opening preload file %s: %s\n", filename.c_str(), strerror(errno));
+      return NULL;
+   }
+
+   (void)! getcwd(cwd, MAX_PATH_LEN+1);
+   cwd[MAX_PATH_LEN] = '\0';
+
+   for (;;) {
+      int result = fscanf(f, "%" STR(MAX_PATH_LEN) "s", pathname);
+      if (result == EOF)
+         break;
+      pathname[MAX_PATH_LEN] = '\0';
+      
+      parseFilenameNoAlloc(pathname, file, dir, MAX_PATH_LEN);
+      file[MAX_PATH_LEN] = '\0';
+      dir[MAX_PATH_LEN] = '\0';
+      addCWDToDir(getpid(), dir, MAX_PATH_LEN);
+      reducePath(dir);
+   
+      all_dirs.insert(string(dir));
+      all_files.insert(string(dir) + string("/") + string(file));      
+   }
+
+   return buildPreloadMsg(vector<string>(all_dirs.begin(), all_dirs.end()),
+                          vector<string>(all_files.begin(), all_files.end()),
+                          vector<pair<int, string> >());
+}
+
 void cleanPreloadMsg(ldcs_message_t *msg)
 {
    free(msg->data);
@@ -76,6 +76,17 @@ using namespace std;
 #define CLEANUPPROC 282
 #define RSHMODE 283
 #define NUMA_EXCLUDES_OPTION 284
+#define READERS 285
+#define READ_THREADS 286
+#define TREE_SHAPE 287
+#define TREE_DEGREE 288
+#define TREE_MAP 289
+#define RECORD_MANIFEST 290
+#define NUMA_REPLICATE 291
+#define PREFETCH 292
+#define CACHE_BUDGET 293
+#define DEDUP 294
+#define PCACHE_DIR 295
 
 #define GROUP_RELOC 1
 #define GROUP_PUSHPULL 2
@@ -124,7 +135,8 @@ static const opt_t all_reloc_opts = OPT_RELOCAOUT | OPT_RELOCSO | OPT_RELOCEXEC
                                             OPT_RELOCPY | OPT_FOLLOWFORK | OPT_STOPRELOC;
 static const opt_t all_network_opts = OPT_COBO;
 static const opt_t all_pushpull_opts = OPT_PUSH | OPT_PULL;
-static const opt_t all_misc_opts = OPT_STRIP | OPT_DEBUG | OPT_PRELOAD | OPT_NOCLEAN | OPT_PERSIST | OPT_PROCCLEAN;
+static const opt_t all_misc_opts = OPT_STRIP | OPT_DEBUG | OPT_PRELOAD | OPT_NOCLEAN | OPT_PERSIST | OPT_PROCCLEAN |
+                                    OPT_RECORD | OPT_DEDUP;
 
 static const opt_t default_reloc_opts = OPT_RELOCAOUT | OPT_RELOCSO | OPT_RELOCEXEC |
                                                 OPT_RELOCPY | OPT_FOLLOWFORK;
@@ -151,11 +163,15 @@ static char *hostbin_path = NULL;
 #define DEFAULT_MSGCACHE_BUFFER_KB 1024
 #define DEFAULT_MSGCACHE_TIMEOUT_MS 100
 #define DEFAULT_MSGCACHE_ON 0
+#define DEFAULT_NUM_READERS 1
+#define DEFAULT_READ_THREADS 4
+#define DEFAULT_TREE_DEGREE 8
 
 static opt_t enabled_opts = 0;
 static opt_t disabled_opts = 0;
 
 static char *preload_file;
+static char *record_manifest_file;
 static char **mpi_argv;
 static int mpi_argc;
 static bool done = false;
@@ -168,6 +184,14 @@ static opt_t use_subaudit = DEFAULT_USE_SUBAUDIT;
 static int msgcache_buffer_kb = DEFAULT_MSGCACHE_BUFFER_KB;
 static int msgcache_timeout_ms = DEFAULT_MSGCACHE_TIMEOUT_MS;
 static int msgcache_set = DEFAULT_MSGCACHE_ON;
+static int num_readers = DEFAULT_NUM_READERS;
+static int read_threads = DEFAULT_READ_THREADS;
+static unsigned int prefetch = 0;
+static unsigned int cache_budget_mb = 0;
+static char *pcache_dir = NULL;
+static unsigned int tree_shape = tree_binomial;
+static int tree_degree = DEFAULT_TREE_DEGREE;
+static char *tree_map = NULL;
 
 static session_status_t session_status = sstatus_unused;
 static string session_id;
@@ -177,6 +201,7 @@ static const char *default_python_prefixes = PYTHON_INST_PREFIX;
 static char *user_python_prefixes = NULL;
 
 static char *numa_substrings = NULL;
+static unsigned int numa_replicate = numa_replicate_lazy;
 static const char *numa_excludes = "";
 #if defined NUMA_EXCLUDES
 static const char *default_numa_excludes = NUMA_EXCLUDES;
@@ -254,6 +279,24 @@ struct argp_option options[] = {
      "Use a tree-based cobo network for distributing objects", GROUP_NETWORK },
    { "port", PORT, "port1-port2", 0,
      "TCP/IP port range for Spindle servers.  Default: " STR(SPINDLE_PORT) "-" STR(SPINDLE_MAX_PORT), GROUP_NETWORK },
+   { "readers", READERS, "num", 0,
+     "Number of servers that read files from the shared file system.  Responsibility for each directory is "
+     "spread across the readers by hash.  Default: " STR(DEFAULT_NUM_READERS), GROUP_NETWORK },
+   { "read-threads", READ_THREADS, "num", 0,
+     "Number of threads each reading server uses to read files from the shared file system concurrently.  "
+     "0 reads files synchronously in the server's event loop.  Default: " STR(DEFAULT_READ_THREADS), GROUP_NETWORK },
+   { "prefetch", PREFETCH, YESNO, 0,
+     "When a server reads an executable or library, also read and distribute the libraries it depends on "
+     "before they are requested.  Default: no", GROUP_NETWORK },
+   { "tree-shape", TREE_SHAPE, "binomial|kary|topology", 0,
+     "Shape of the tree connecting Spindle servers.  kary gives every server up to tree-degree children.  "
+     "topology forwards one copy into each group of hosts listed in tree-map, then builds a k-ary tree inside "
+     "each group.  Default: binomial", GROUP_NETWORK },
+   { "tree-degree", TREE_DEGREE, "num", 0,
+     "Maximum number of children of a server in kary and topology trees.  Default: " STR(DEFAULT_TREE_DEGREE), GROUP_NETWORK },
+   { "tree-map", TREE_MAP, "file", 0,
+     "File of 'hostname group' lines that puts hosts sharing a rack or switch in the same group.  "
+     "Implies --tree-shape=topology", GROUP_NETWORK },
    { NULL, 0, NULL, 0,
      "These options specify the security model Spindle should use for validating TCP connections. "
      "Spindle will choose a default value if no option is specified.", GROUP_SEC },
@@ -309,6 +352,9 @@ struct argp_option options[] = {
      " Specify the option, but leave it blank to replicate all spindle-relocated files into each NUMA domain", GROUP_NUMA },
    { "numa-excludes", NUMA_EXCLUDES_OPTION, "list", OPTION_ARG_OPTIONAL,
      "Colon-seprated list of prefixes that will excludes executables/libraries from NUMA optimization. Takes precedence over other numa lists", GROUP_NUMA },
+   { "numa-replicate", NUMA_REPLICATE, "lazy|eager", 0,
+     "When to copy NUMA-replicated files into each NUMA domain.  lazy copies a file into a domain the first time a process there loads it, "
+     "eager copies it into every domain when it is first read.  Default: lazy", GROUP_NUMA },
 #endif
    { "audit-type", AUDITTYPE, "subaudit|audit", 0,
      "Use the new-style subaudit interface for intercepting ld.so, or the old-style audit interface.  The subaudit option reduces memory overhead, but is more complex.  Default is " DEFAULT_USE_SUBAUDIT_STR ".", GROUP_MISC },
@@ -324,11 +370,24 @@ struct argp_option options[] = {
      "Path to a script that returns the hostlist for a job on a cluster", GROUP_MISC },
    { "preload", PRELOAD, "FILE", 0,
      "Provides a text file containing a white-space separated list of files that should be "
-     "relocated to each node before execution begins", GROUP_MISC },
+     "relocated to each node before execution begins, or a manifest written by --record-manifest", GROUP_MISC },
+   { "record-manifest", RECORD_MANIFEST, "FILE", 0,
+     "Record the files, directories and metadata the application uses, and write them to a "
+     "manifest that a later run can pass to --preload", GROUP_MISC },
    { "strip", STRIP, YESNO, 0,
      "Strip debug and symbol information from binaries before distributing them. Default: yes", GROUP_MISC },
    { "location", LOCATION, "directory", 0,
      "Back-end directory for storing relocated files.  Should be a non-shared location such as a ramdisk.  Default: " SPINDLE_LOC, GROUP_MISC },
+   { "cache-budget", CACHE_BUDGET, "megabytes", 0,
+     "Largest size the back-end file cache may grow to.  Beyond it, the least recently used files that no process "
+     "has open are removed and fetched again if needed.  Default: 0 (no limit)", GROUP_MISC },
+   { "dedup", DEDUP, YESNO, 0,
+     "Store and distribute files with identical contents under different paths, such as libraries "
+     "shipped by several install trees, only once.  Default: no", GROUP_MISC },
+   { "persistent-cache", PCACHE_DIR, "directory", 0,
+     "Back-end directory, such as a node-local SSD, where cached files are kept after the job ends.  Later jobs "
+     "serve files that haven't changed on the shared file system from it.  Should not be under --location.  "
+     "Default: none", GROUP_MISC },
    { "noclean", NOCLEAN, YESNO, 0,
      "Don't remove local file cache after execution.  Default: no (removes the cache)", GROUP_MISC },
    { "disable-logging", DISABLE_LOGGING, NULL, DISABLE_LOGGING_FLAGS,
@@ -355,6 +414,8 @@ static opt_t opt_key_to_code(int key)
       case COBO: return OPT_COBO;
       case DEBUG: return OPT_DEBUG;
       case PRELOAD: return OPT_PRELOAD;
+      case RECORD_MANIFEST: return OPT_RECORD;
+      case DEDUP: return OPT_DEDUP;
       case FOLLOWFORK: return OPT_FOLLOWFORK;
       case RELOCSO: return OPT_RELOCSO;
       case PUSH: return OPT_PUSH;
@@ -416,6 +477,11 @@ static int parse(int key, char *arg, struct argp_state *vstate)
       preload_file = arg;
       return 0;
    }
+   else if (entry->key == RECORD_MANIFEST) {
+      enabled_opts |= opt;
+      record_manifest_file = arg;
+      return 0;
+   }
    else if (entry->key == PORT) {
       spindle_port = atoi(arg);
       if (!spindle_port) {
@@ -532,6 +598,82 @@ static int parse(int key, char *arg, struct argp_state *vstate)
       numa_excludes = arg;
       return 0;
    }
+   else if (key == NUMA_REPLICATE) {
+      if (strcmp(arg, "lazy") == 0)
+         numa_replicate = numa_replicate_lazy;
+      else if (strcmp(arg, "eager") == 0)
+         numa_replicate = numa_replicate_eager;
+      else {
+         argp_error(state, "numa-replicate must be lazy or eager");
+         return ARGP_ERR_UNKNOWN;
+      }
+      return 0;
+   }
+   else if (key == READERS) {
+      num_readers = atoi(arg);
+      if (num_readers < 1) {
+         argp_error(state, "readers argument must be a positive integer");
+         return ARGP_ERR_UNKNOWN;
+      }
+      return 0;
+   }
+   else if (key == READ_THREADS) {
+      read_threads = atoi(arg);
+      if (read_threads < 0) {
+         argp_error(state, "read-threads argument must be a non-negative integer");
+         return ARGP_ERR_UNKNOWN;
+      }
+      return 0;
+   }
+   else if (key == CACHE_BUDGET) {
+      if (atoi(arg) < 0) {
+         argp_error(state, "cache-budget argument must be a non-negative integer");
+         return ARGP_ERR_UNKNOWN;
+      }
+      cache_budget_mb = atoi(arg);
+      return 0;
+   }
+   else if (key == PCACHE_DIR) {
+      pcache_dir = arg;
+      return 0;
+   }
+   else if (key == PREFETCH) {
+      if (strcmp(arg, "yes") == 0 || strcmp(arg, "y") == 0)
+         prefetch = 1;
+      else if (strcmp(arg, "no") == 0 || strcmp(arg, "n") == 0)
+         prefetch = 0;
+      else {
+         argp_error(state, "prefetch must be 'yes' or 'no'");
+         return ARGP_ERR_UNKNOWN;
+      }
+      return 0;
+   }
+   else if (key == TREE_SHAPE) {
+      if (strcmp(arg, "binomial") == 0)
+         tree_shape = tree_binomial;
+      else if (strcmp(arg, "kary") == 0)
+         tree_shape = tree_kary;
+      else if (strcmp(arg, "topology") == 0)
+         tree_shape = tree_topology;
+      else {
+         argp_error(state, "tree-shape must be binomial, kary or topology");
+         return ARGP_ERR_UNKNOWN;
+      }
+      return 0;
+   }
+   else if (key == TREE_DEGREE) {
+      tree_degree = atoi(arg);
+      if (tree_degree < 1) {
+         argp_error(state, "tree-degree argument must be a positive integer");
+         return ARGP_ERR_UNKNOWN;
+      }
+      return 0;
+   }
+   else if (key == TREE_MAP) {
+      tree_map = arg;
+      tree_shape = tree_topology;
+      return 0;
+   }
    else if (key == PYTHONPREFIX) {
       user_python_prefixes = arg;
       return 0;
@@ -631,6 +773,7 @@ static int parse(int key, char *arg, struct argp_state *vstate)
       opts |= use_subaudit ? OPT_SUBAUDIT : 0;
       opts |= logging_enabled ? OPT_LOGUSAGE : 0;
       opts |= shm_cache_size > 0 ? OPT_SHMCACHE : 0;
+      opts |= cache_budget_mb > 0 ? OPT_EVICT : 0;
 
       /* Set message buffer options */
       if (msgcache_set) {
@@ -863,9 +1006,19 @@ int parseCommandLine(int argc, char *argv[], spindle_args_t *args, unsigned int
    args->location = strdup(getLocation(args->number).c_str());
    args->pythonprefix = strdup(getPythonPrefixes().c_str());
    args->preloadfile = getPreloadFile();
+   args->record_manifest = record_manifest_file ? strdup(record_manifest_file) : NULL;
    args->bundle_timeout_ms = msgcache_timeout_ms;
    args->bundle_cachesize_kb = msgcache_buffer_kb;
    args->numa_files = numa_substrings ? strdup(numa_substrings) : NULL;
+   args->numa_replicate = numa_replicate;
+   args->num_readers = num_readers;
+   args->read_threads = read_threads;
+   args->prefetch = prefetch;
+   args->cache_budget_mb = cache_budget_mb;
+   args->pcache_dir = pcache_dir ? strdup(pcache_dir) : NULL;
+   args->tree_shape = tree_shape;
+   args->tree_degree = tree_degree;
+   args->tree_map = tree_map ? strdup(tree_map) : NULL;
 
    numa_excludes_size = strlen(numa_excludes) + strlen(default_numa_excludes) + 2;
    args->numa_excludes = (char *) malloc(numa_excludes_size);
@@ -0,0 +1,236 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "preload_manifest.h"
+
+extern "C" {
+#include "ldcs_api.h"
+}
+
+using namespace std;
+
+typedef pair<int, string> manifest_key_t;
+typedef map<manifest_key_t, manifest_record_t> manifest_records_t;
+static manifest_records_t records;
+
+typedef struct {
+   char magic[8];
+   int32_t version;
+   int32_t num_records;
+} manifest_header_t;
+
+void recordManifestMsg(ldcs_message_t *msg)
+{
+   manifest_record_t rec;
+   char *data = (char *) msg->data;
+   int pos = 0, count = 0;
+
+   if (msg->header.type != LDCS_MSG_MANIFEST) {
+      err_printf("Unexpected message of type %d from servers\n", (int) msg->header.type);
+      return;
+   }
+
+   while (pos + (int) sizeof(rec) <= msg->header.len) {
+      memcpy(&rec, data + pos, sizeof(rec));
+      pos += sizeof(rec);
+      if (rec.path_len <= 0 || pos + rec.path_len > msg->header.len) {
+         err_printf("Malformed manifest message from servers\n");
+         return;
+      }
+      manifest_key_t key(rec.kind, string(data + pos));
+      pos += rec.path_len;
+      count++;
+
+      manifest_records_t::iterator i = records.find(key);
+      if (i == records.end()) {
+         records[key] = rec;
+         continue;
+      }
+      manifest_record_t &cur = i->second;
+      if (rec.first_use < cur.first_use)
+         cur.first_use = rec.first_use;
+      if ((rec.flags & MANIFEST_HAS_METADATA) && !(cur.flags & MANIFEST_HAS_METADATA)) {
+         double first_use = cur.first_use;
+         cur = rec;
+         cur.first_use = first_use;
+      }
+   }
+   debug_printf("Got %d manifest records from servers, have %lu\n", count, (unsigned long) records.size());
+}
+
+static bool earlierUse(const manifest_records_t::value_type *a, const manifest_records_t::value_type *b)
+{
+   return a->second.first_use < b->second.first_use;
+}
+
+int writeManifest(string filename)
+{
+   vector<const manifest_records_t::value_type *> sorted;
+   for (manifest_records_t::iterator i = records.begin(); i != records.end(); i++)
+      sorted.push_back(&*i);
+   stable_sort(sorted.begin(), sorted.end(), earlierUse);
+
+   FILE *f = fopen(filename.c_str(), "w");
+   if (!f) {
+      err_printf("Could not open manifest %s for writing: %s\n", filename.c_str(), strerror(errno));
+      return -1;
+   }
+
+   manifest_header_t header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+   header.version = MANIFEST_VERSION;
+   header.num_records = sorted.size();
+   bool ok = (fwrite(&header, sizeof(header), 1, f) == 1);
+
+   /* Store times relative to the first use, so manifests from different runs compare */
+   double base = sorted.empty() ? 0.0 : sorted[0]->second.first_use;
+   for (vector<const manifest_records_t::value_type *>::iterator i = sorted.begin(); ok && i != sorted.end(); i++) {
+      const string &path = (*i)->first.second;
+      manifest_record_t rec = (*i)->second;
+      rec.first_use -= base;
+      rec.path_len = path.length() + 1;
+      ok = (fwrite(&rec, sizeof(rec), 1, f) == 1) && (fwrite(path.c_str(), rec.path_len, 1, f) == 1);
+   }
+
+   if (fclose(f) != 0)
+      ok = false;
+   if (!ok) {
+      err_printf("Error writing manifest %s\n", filename.c_str());
+      return -1;
+   }
+   debug_printf("Wrote %lu records to manifest %s\n", (unsigned long) sorted.size(), filename.c_str());
+   return 0;
+}
+
+bool isManifestFile(string filename)
+{
+   char magic[8];
+   FILE *f = fopen(filename.c_str(), "r");
+   if (!f)
+      return false;
+   size_t result = fread(magic, 1, sizeof(magic), f);
+   fclose(f);
+   return result == sizeof(magic) && memcmp(magic, MANIFEST_MAGIC, sizeof(magic)) == 0;
+}
+
+/* A record is stale if the path's metadata no longer matches what the recording
+   run saw.  Only metadata is checked; file contents are never re-read. */
+static bool isStale(const manifest_record_t &rec, const string &path)
+{
+   struct stat buf;
+   int result;
+
+   if (!(rec.flags & MANIFEST_HAS_METADATA))
+      return false;
+
+   const char *stat_path = path.c_str();
+   if (stat_path[0] == '$')
+      stat_path++;
+   result = (rec.kind == manifest_lstat) ? lstat(stat_path, &buf) : stat(stat_path, &buf);
+
+   if (rec.flags & MANIFEST_MISSING)
+      return result != -1;
+   if (result == -1)
+      return true;
+   return (uint64_t) buf.st_size != rec.size || (int64_t) buf.st_mtim.tv_sec != rec.mtime_sec ||
+      (int64_t) buf.st_mtim.tv_nsec != rec.mtime_nsec || (uint64_t) buf.st_ino != rec.ino;
+}
+
+int readManifest(string filename, vector<string> &dirs, vector<string> &files,
+                 vector<pair<int, string> > &metadata)
+{
+   manifest_header_t header;
+   manifest_record_t rec;
+   char path[MAX_PATH_LEN+1];
+   set<string> seen_dirs;
+   int num_stale = 0;
+
+   debug_printf("Parsing preload manifest: %s\n", filename.c_str());
+   FILE *f = fopen(filename.c_str(), "r");
+   if (!f) {
+      err_printf("Error opening preload manifest %s: %s\n", filename.c_str(), strerror(errno));
+      return -1;
+   }
+   if (fread(&header, sizeof(header), 1, f) != 1 || header.version != MANIFEST_VERSION) {
+      err_printf("Preload manifest %s has an unsupported format\n", filename.c_str());
+      fclose(f);
+      return -1;
+   }
+
+   for (int i = 0; i < header.num_records; i++) {
+      if (fread(&rec, sizeof(rec), 1, f) != 1 || rec.path_len <= 0 || rec.path_len > MAX_PATH_LEN+1 ||
+          fread(path, rec.path_len, 1, f) != 1) {
+         err_printf("Preload manifest %s is truncated at record %d\n", filename.c_str(), i);
+         fclose(f);
+         return -1;
+      }
+      path[rec.path_len-1] = '\0';
+
+      if (isStale(rec, path)) {
+         debug_printf3("Skipping stale manifest entry %s\n", path);
+         num_stale++;
+         continue;
+      }
+
+      string dir;
+      switch (rec.kind) {
+         case manifest_dir:
+            dir = path;
+            break;
+         case manifest_file: {
+            string file(path);
+            size_t slash = file.rfind('/');
+            if (slash != string::npos && slash != 0)
+               dir = file.substr(0, slash);
+            /* Files no server read were missing from their directory, which the
+               directory preload already covers */
+            if ((rec.flags & MANIFEST_HAS_METADATA) && !(rec.flags & MANIFEST_MISSING))
+               files.push_back(file);
+            break;
+         }
+         case manifest_stat:
+         case manifest_lstat:
+         case manifest_ldso:
+            metadata.push_back(make_pair((int) rec.kind, string(path)));
+            break;
+         default:
+            debug_printf("Skipping manifest entry %s of unknown kind %d\n", path, (int) rec.kind);
+            break;
+      }
+      if (!dir.empty() && seen_dirs.insert(dir).second)
+         dirs.push_back(dir);
+   }
+   fclose(f);
+
+   debug_printf("Preload manifest %s has %lu directories, %lu files and %lu metadata entries.  "
+                "Skipped %d stale entries\n", filename.c_str(), (unsigned long) dirs.size(),
+                (unsigned long) files.size(), (unsigned long) metadata.size(), num_stale);
+   return 0;
+}
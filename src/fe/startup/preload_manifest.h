@@ -0,0 +1,36 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(PRELOAD_MANIFEST_H_)
+#define PRELOAD_MANIFEST_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include "ldcs_api.h"
+
+/* Recording: collect the records the servers send and write them out as a manifest */
+void recordManifestMsg(ldcs_message_t *msg);
+int writeManifest(std::string filename);
+
+/* Preloading: read the entries of a manifest that still match the file system, in
+   the order the recorded run first used them */
+bool isManifestFile(std::string filename);
+int readManifest(std::string filename, std::vector<std::string> &dirs, std::vector<std::string> &files,
+                 std::vector<std::pair<int, std::string> > &metadata);
+
+#endif
@@ -15,6 +15,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
 #include "parse_preload.h"
+#include "preload_manifest.h"
 #include "ldcs_api.h"
 #include "spindle_launch.h"
 #include "fe_comm.h"
@@ -62,7 +63,7 @@ void pack_param<char*>(char *value, char *buffer, unsigned int &pos)
 
 static int pack_data(spindle_args_t *args, void* &buffer, unsigned &buffer_size)
 {  
-   buffer_size = sizeof(unsigned int) * 8;
+   buffer_size = sizeof(unsigned int) * 13;
    buffer_size += sizeof(opt_t);
    buffer_size += sizeof(unique_id_t);
    buffer_size += args->location ? strlen(args->location) + 1 : 1;
@@ -70,6 +71,7 @@ static int pack_data(spindle_args_t *args, void* &buffer, unsigned &buffer_size)
    buffer_size += args->preloadfile ? strlen(args->preloadfile) + 1 : 1;
    buffer_size += args->numa_files ? strlen(args->numa_files) + 1 : 1;
    buffer_size += args->numa_excludes ? strlen(args->numa_excludes) + 1 : 1;
+   buffer_size += args->pcache_dir ? strlen(args->pcache_dir) + 1 : 1;
 
    unsigned int pos = 0;
    char *buf = (char *) malloc(buffer_size);
@@ -88,6 +90,12 @@ static int pack_data(spindle_args_t *args, void* &buffer, unsigned &buffer_size)
    pack_param(args->bundle_cachesize_kb, buf, pos);
    pack_param(args->numa_files, buf, pos);
    pack_param(args->numa_excludes, buf, pos);
+   pack_param(args->num_readers, buf, pos);
+   pack_param(args->read_threads, buf, pos);
+   pack_param(args->numa_replicate, buf, pos);
+   pack_param(args->prefetch, buf, pos);
+   pack_param(args->cache_budget_mb, buf, pos);
+   pack_param(args->pcache_dir, buf, pos);
    assert(pos == buffer_size);
 
    buffer = (void *) buf;
@@ -307,16 +315,33 @@ int spindleInitFE(const char **hosts, spindle_args_t *params)
    /* Start FE server */
    debug_printf("spindle_args_t { number = %u; port = %u; num_ports = %u; opts = %lu; unique_id = %lu; "
                 "use_launcher = %u; startup_type = %u; shm_cache_size = %u; location = %s; "
-                "pythonprefix = %s; preloadfile = %s; bundle_timeout_ms = %u; bundle_cachesize_kb = %u }\n",
+                "pythonprefix = %s; preloadfile = %s; bundle_timeout_ms = %u; bundle_cachesize_kb = %u; "
+                "num_readers = %u; read_threads = %u; numa_replicate = %u; prefetch = %u; cache_budget_mb = %u; "
+                "pcache_dir = %s; tree_shape = %u; tree_degree = %u; tree_map = %s }\n",
                 params->number, params->port, params->num_ports, params->opts, params->unique_id,
                 params->use_launcher, params->startup_type, params->shm_cache_size, params->location,
                 params->pythonprefix, params->preloadfile, params->bundle_timeout_ms,
-                params->bundle_cachesize_kb);
+                params->bundle_cachesize_kb, params->num_readers, params->read_threads, params->numa_replicate,
+                params->prefetch, params->cache_budget_mb, params->pcache_dir ? params->pcache_dir : "NULL",
+                params->tree_shape, params->tree_degree, params->tree_map ? params->tree_map : "NULL");
+   if (ldcs_audit_server_fe_md_set_tree(const_cast<char **>(hosts), hosts_size, params->tree_shape,
+                                        params->tree_degree, params->tree_map) == -1) {
+      fprintf(stderr, "Failed to set up the Spindle server tree\n");
+      return -1;
+   }
    debug_printf("Starting FE servers with hostlist of size %u on port %u\n", hosts_size, params->port);
    ldcs_audit_server_fe_md_open(const_cast<char **>(hosts), hosts_size, 
                                 params->port, params->num_ports, params->unique_id,
                                 &md_data_ptr);
 
+   if (params->opts & OPT_RECORD) {
+      debug_printf("Listening for manifest records from servers\n");
+      if (ldcs_audit_server_fe_md_start_listener(recordManifestMsg) == -1) {
+         fprintf(stderr, "Failed to start recording a manifest\n");
+         return -1;
+      }
+   }
+
    /* Broadcast parameters */
    debug_printf("Sending parameters to servers\n");
    void *param_buffer;
@@ -357,6 +382,11 @@ int spindleCloseFE(spindle_args_t *params)
    
    ldcs_audit_server_fe_md_close(md_data_ptr);
 
+   if ((params->opts & OPT_RECORD) && params->record_manifest) {
+      if (writeManifest(params->record_manifest) == -1)
+         fprintf(stderr, "Failed to write manifest %s\n", params->record_manifest);
+   }
+
    if (OPT_GET_SEC(params->opts) == OPT_SEC_KEYFILE) {
       clean_keyfile(params->unique_id);
    }
@@ -73,6 +73,15 @@ typedef enum {
    LDCS_MSG_EXIT,
    LDCS_MSG_BUNDLE,
    LDCS_MSG_ALIAS,
+   LDCS_MSG_MANIFEST,
+   LDCS_MSG_MULTI_QUERY,
+   LDCS_MSG_MULTI_QUERY_ANSWER,
+   LDCS_MSG_MULTI_QUERY_ERROR,
+   LDCS_MSG_PREFETCH_FILE,
+   LDCS_MSG_PREFETCH_ALIAS,
+   LDCS_MSG_CONTENT_ALIAS,
+   LDCS_MSG_PREFETCH_CONTENT_ALIAS,
+   LDCS_MSG_PCACHE_VALID,
    LDCS_MSG_UNKNOWN
 } ldcs_message_ids_t;
 
@@ -148,6 +157,58 @@ typedef struct {
    int64_t binding_offset;
 } ldso_info_t;
 
+/* Preload manifests record which files, directories and metadata clients
+   asked for in a run, so a later run can preload them.  Records are sent up
+   the server tree in LDCS_MSG_MANIFEST messages and are stored the same way
+   in manifest files, each followed by path_len bytes of 0-terminated path. */
+typedef enum {
+   manifest_file,
+   manifest_dir,
+   manifest_stat,
+   manifest_lstat,
+   manifest_ldso
+} manifest_kind_t;
+
+#define MANIFEST_HAS_METADATA 1   /* size, mtime and ino were taken when the server read the path */
+#define MANIFEST_MISSING      2   /* the path did not exist when the server read it */
+
+typedef struct {
+   int32_t kind;
+   int32_t flags;
+   double first_use;
+   uint64_t size;
+   int64_t mtime_sec;
+   int64_t mtime_nsec;
+   uint64_t ino;
+   int32_t path_len;
+   int32_t unused;
+} manifest_record_t;
+
+#define MANIFEST_MAGIC "SPNDLMF"
+#define MANIFEST_VERSION 1
+
+/* A LDCS_MSG_MULTI_QUERY asks for several paths in one round trip.  Its body
+   is a multi_query_header_t followed by num_paths 0-terminated paths, and must
+   fit in MAX_PATH_LEN bytes.  Each path is queried as a message of type
+   query_type would be.  The LDCS_MSG_MULTI_QUERY_ANSWER body is an int32
+   count of answered paths, then a multi_answer_header_t and the body of the
+   single-path answer message for each of them, in order.  A path the server
+   failed to look up is answered with a LDCS_MSG_MULTI_QUERY_ERROR holding an
+   int32 errno instead.  With MULTI_QUERY_FIRST_HIT the server stops after the
+   first path that exists. */
+#define MULTI_QUERY_FIRST_HIT 1
+
+typedef struct {
+   int32_t query_type;
+   int32_t flags;
+   int32_t num_paths;
+} multi_query_header_t;
+
+typedef struct {
+   int32_t type;
+   int32_t len;
+} multi_answer_header_t;
+
 #define MAX_PATH_LEN 4096
 #define MAX_NAME_LEN 255
 #endif
@@ -0,0 +1,99 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef LDCS_API_SHMEM_H
+#define LDCS_API_SHMEM_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "ldcs_api.h"
+
+/* Each client owns a file <location>/spindle_comm/shm-<pid> that both it and
+   the server map.  The file holds a request ring (client -> server) and a
+   response ring (server -> client).  Each ring has exactly one producer and
+   one consumer.  The client rings the server through a one-byte-per-message
+   doorbell fifo, <location>/spindle_comm/bell-<pid>, so the server's epoll
+   loop and disconnect detection work as they do with pipes.  An eventfd would
+   need a unix socket to reach the unrelated server process.  Clients wait for
+   the answer to each query, so there is rarely more than one message in
+   flight to batch, and a doorbell costs the one write per message that a pipe
+   does.  The server wakes a waiting client with a futex on the response
+   ring's head. */
+
+#define SHMEM_RING_SIZE (64*1024)
+#define SHMEM_CACHE_LINE 64
+#define SHMEM_MAGIC 0x5350494e
+
+typedef struct {
+   /* Written by the producer */
+   volatile uint32_t head;
+   volatile uint32_t reader_waiting;
+   char pad1[SHMEM_CACHE_LINE - 2*sizeof(uint32_t)];
+   /* Written by the consumer */
+   volatile uint32_t tail;
+   volatile uint32_t writer_waiting;
+   char pad2[SHMEM_CACHE_LINE - 2*sizeof(uint32_t)];
+   unsigned char data[SHMEM_RING_SIZE];
+} shmem_ring_t;
+
+typedef struct {
+   uint32_t magic;
+   volatile int32_t client_pid;
+   volatile int32_t server_pid;
+   char pad[SHMEM_CACHE_LINE - 3*sizeof(uint32_t)];
+   shmem_ring_t request;
+   shmem_ring_t response;
+} shmem_conn_t;
+
+void shmem_ring_init(shmem_ring_t *ring);
+int shmem_ring_write(shmem_ring_t *ring, const void *data, int bytes, volatile int32_t *peer);
+int shmem_ring_read(shmem_ring_t *ring, void *data, int bytes, volatile int32_t *peer);
+
+int ldcs_create_server_shmem(char* location, int number);
+int ldcs_open_server_connection_shmem(int fd);
+int ldcs_open_server_connections_shmem(int fd, int nc, int *more_avail);
+int ldcs_close_server_connection_shmem(int fd);
+int ldcs_get_fd_shmem(int id);
+int ldcs_destroy_server_shmem(int fd);
+int ldcs_send_msg_shmem(int fd, ldcs_message_t * msg);
+int ldcs_recv_msg_static_shmem(int fd, ldcs_message_t *msg, ldcs_read_block_t block);
+
+typedef enum {
+   LDCS_SHMEM_FD_TYPE_SERVER,
+   LDCS_SHMEM_FD_TYPE_CONN
+} shmem_fd_type_t;
+
+struct shmem_fdlist_entry_t
+{
+  int   inuse;
+  shmem_fd_type_t type;
+
+  /* server part */
+  int   notify_fd;
+  int   conn_list_size;
+  int   conn_list_used;
+  int  *conn_list;
+  char *path;
+
+  /* connection part */
+  shmem_conn_t *conn;
+  char *shm_fn;
+  int   bell_fd;
+  char *bell_fn;
+  int   serverfd;
+};
+
+#endif
@@ -31,6 +31,7 @@ extern "C" {
 #endif
 
 /* Bitfield values for opts parameter */   /* Bit is set if ... */
+#define OPT_EVICT      (1 << 0)             /* Servers may remove cached files to stay within cache_budget_mb */
 #define OPT_COBO       (1 << 1)             /* COBO is the communication implementation */
 #define OPT_DEBUG      (1 << 2)             /* Hide Spindle from debuggers (currently unnecessary) */
 #define OPT_FOLLOWFORK (1 << 3)             /* Spindle should follow and manage child processes */
@@ -58,6 +59,8 @@ extern "C" {
 #define OPT_RSHLAUNCH  (1 << 27)            /* Launch BEs via an rsh/ssh tree */
 #define OPT_STOPRELOC  (1 << 28)            /* Stops spindle from relocating file contents, but still allow it to intercept file-not-found attempts */
 #define OPT_NUMA       (1 << 29)            /* Enables file replication across NUMA domains */
+#define OPT_RECORD     (1 << 30)            /* Servers record the files clients use into a preload manifest */
+#define OPT_DEDUP      ((opt_t) 1 << 31)    /* Identical files under different paths are stored and sent once */
    
 #define OPT_SET_SEC(OPT, X) OPT |= (X << 19)
 #define OPT_GET_SEC(OPT) ((OPT >> 19) & 7)
@@ -87,6 +90,15 @@ extern "C" {
 #define startup_unknown 5                   /* Unknown launch mechanism */
 #define startup_lsf 6                       /* LSF launcher from IBM*/
 
+/* Possible values for tree_shape, describe how Spindle servers are connected */
+#define tree_binomial 0                     /* Binomial tree */
+#define tree_kary 1                         /* Each server has up to tree_degree children */
+#define tree_topology 2                     /* One server per group in tree_map forwards into its group */
+
+/* Possible values for numa_replicate, describe when OPT_NUMA copies files into each numa domain */
+#define numa_replicate_eager 0              /* Copy into every domain when the file is read */
+#define numa_replicate_lazy 1               /* Copy into a domain when a client there first asks for the file */
+
 typedef uint64_t unique_id_t;
 typedef uint64_t opt_t;
 
@@ -137,6 +149,43 @@ typedef struct {
 
    /* Colon-seperated list of prefixes to exclude from numa optimization, with precedence over numa_files */
    char *numa_excludes;
+
+   /* The number of servers that read files from the shared file system.  Responsibility for
+      each directory is hashed across these servers.  1 means only the root server reads. */
+   unsigned int num_readers;
+
+   /* The number of threads a reading server uses to read files concurrently.  0 means
+      files are read synchronously in the server's event loop. */
+   unsigned int read_threads;
+
+   /* With OPT_NUMA, one of the above numa_replicate_* values */
+   unsigned int numa_replicate;
+
+   /* Non-zero if servers read the libraries an ELF object depends on as soon as
+      they read the object, before clients ask for them */
+   unsigned int prefetch;
+
+   /* The size in megabytes the local file cache is held to.  0 means no limit. */
+   unsigned int cache_budget_mb;
+
+   /* Node-local directory where servers keep the files they cached after the job ends,
+      and serve them from in later jobs if they are unchanged.  NULL or empty for none. */
+   char *pcache_dir;
+
+   /* The shape of the server tree, one of the above tree_* values.  The tree is built
+      by the FE before the other parameters are sent, so the tree_* fields are not
+      sent to the servers. */
+   unsigned int tree_shape;
+
+   /* The maximum number of children of a server in k-ary and topology trees */
+   unsigned int tree_degree;
+
+   /* File of "hostname group" lines that groups hosts by rack or switch for topology trees */
+   char *tree_map;
+
+   /* With OPT_RECORD, the file the FE writes the run's preload manifest to.  Only used
+      on the FE and not sent to the servers. */
+   char *record_manifest;
    
 } spindle_args_t;
 
@@ -0,0 +1,198 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ldcs_audit_server_dedup.h"
+
+/**
+ * The hash is XXH64.  Its four independent accumulators keep a 32-byte
+ * stripe of input in flight per iteration, which lets the compiler and
+ * the CPU overlap the multiplies, and it runs at memory bandwidth on the
+ * reader threads right after each read.
+ **/
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+   return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+   uint64_t v;
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+   uint32_t v;
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+   acc += input * PRIME64_2;
+   acc = rotl64(acc, 31);
+   return acc * PRIME64_1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t val)
+{
+   acc ^= hash_round(0, val);
+   return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t dedup_hash(const void *buffer, size_t size)
+{
+   const unsigned char *p = (const unsigned char *) buffer;
+   const unsigned char *end = p + size;
+   uint64_t h;
+
+   if (size >= 32) {
+      const unsigned char *limit = end - 32;
+      uint64_t v1 = PRIME64_1 + PRIME64_2;
+      uint64_t v2 = PRIME64_2;
+      uint64_t v3 = 0;
+      uint64_t v4 = 0 - PRIME64_1;
+      do {
+         v1 = hash_round(v1, read64(p));
+         v2 = hash_round(v2, read64(p + 8));
+         v3 = hash_round(v3, read64(p + 16));
+         v4 = hash_round(v4, read64(p + 24));
+         p += 32;
+      } while (p <= limit);
+      h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+      h = hash_merge(h, v1);
+      h = hash_merge(h, v2);
+      h = hash_merge(h, v3);
+      h = hash_merge(h, v4);
+   }
+   else {
+      h = PRIME64_5;
+   }
+   h += (uint64_t) size;
+
+   for (; p + 8 <= end; p += 8) {
+      h ^= hash_round(0, read64(p));
+      h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+   }
+   if (p + 4 <= end) {
+      h ^= (uint64_t) read32(p) * PRIME64_1;
+      h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+      p += 4;
+   }
+   for (; p < end; p++) {
+      h ^= (*p) * PRIME64_5;
+      h = rotl64(h, 11) * PRIME64_1;
+   }
+
+   h ^= h >> 33;
+   h *= PRIME64_2;
+   h ^= h >> 29;
+   h *= PRIME64_3;
+   h ^= h >> 32;
+   return h;
+}
+
+/* Path first seen with each content hash and size.  Only touched from the
+   event loop. */
+typedef struct dedup_entry_t {
+   uint64_t hash;
+   size_t size;
+   char *pathname;
+   struct dedup_entry_t *next;
+} dedup_entry_t;
+
+/* Starts small and doubles whenever it holds more entries than buckets */
+#define DEDUP_INITIAL_SIZE 1024
+static dedup_entry_t **dedup_table;
+static size_t dedup_table_size;
+static size_t dedup_count;
+
+static void dedup_grow(void)
+{
+   dedup_entry_t **newtable, *e, *next;
+   size_t newsize, i;
+
+   newsize = dedup_table_size ? dedup_table_size * 2 : DEDUP_INITIAL_SIZE;
+   newtable = (dedup_entry_t **) calloc(newsize, sizeof(dedup_entry_t *));
+   if (!newtable)
+      return;
+   for (i = 0; i < dedup_table_size; i++) {
+      for (e = dedup_table[i]; e; e = next) {
+         next = e->next;
+         e->next = newtable[e->hash % newsize];
+         newtable[e->hash % newsize] = e;
+      }
+   }
+   free(dedup_table);
+   dedup_table = newtable;
+   dedup_table_size = newsize;
+}
+
+static dedup_entry_t *dedup_find(uint64_t hash, size_t size)
+{
+   dedup_entry_t *e;
+   if (!dedup_table)
+      return NULL;
+   for (e = dedup_table[hash % dedup_table_size]; e; e = e->next) {
+      if (e->hash == hash && e->size == size)
+         return e;
+   }
+   return NULL;
+}
+
+/**
+ * Returns the path recorded for contents with this hash and size, or NULL
+ **/
+char *dedup_lookup(uint64_t hash, size_t size)
+{
+   dedup_entry_t *e = dedup_find(hash, size);
+   return e ? e->pathname : NULL;
+}
+
+/**
+ * Records pathname as the copy of contents with this hash and size,
+ * replacing any earlier path, which the caller found is gone.
+ **/
+void dedup_insert(uint64_t hash, size_t size, char *pathname)
+{
+   dedup_entry_t *e = dedup_find(hash, size);
+   if (e) {
+      free(e->pathname);
+      e->pathname = strdup(pathname);
+      return;
+   }
+   if (dedup_count >= dedup_table_size)
+      dedup_grow();
+   if (!dedup_table)
+      return;
+   e = (dedup_entry_t *) malloc(sizeof(dedup_entry_t));
+   e->hash = hash;
+   e->size = size;
+   e->pathname = strdup(pathname);
+   e->next = dedup_table[hash % dedup_table_size];
+   dedup_table[hash % dedup_table_size] = e;
+   dedup_count++;
+}
@@ -0,0 +1,35 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_DEDUP_H_)
+#define LDCS_AUDIT_SERVER_DEDUP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Install trees often ship byte-identical copies of the same file under
+ * different paths.  A server that reads a file hashes its contents, and
+ * these routines remember which path was first seen with each hash and
+ * size, so a later copy can be stored and sent as a link to the first.
+ * A hash match only nominates a candidate.  The caller compares the
+ * contents before treating two files as the same.
+ **/
+uint64_t dedup_hash(const void *buffer, size_t size);
+char *dedup_lookup(uint64_t hash, size_t size);
+void dedup_insert(uint64_t hash, size_t size, char *pathname);
+
+#endif
@@ -32,6 +32,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "ldcs_api.h"
 #include "ldcs_cache.h"
+#include "ldcs_hash.h"
 #include "ldcs_api_listen.h"
 #include "ldcs_audit_server_process.h"
 #include "ldcs_audit_server_filemngt.h"
@@ -173,13 +174,25 @@ int filemngt_read_file(char *filename, void *buffer, size_t *size, int strip, in
 
 int filemngt_encode_packet(char *filename, void *filecontents, size_t filesize, 
                            char **buffer, size_t *buffer_size)
+{
+   int is_elf = filemngt_is_elf_file(filecontents, filesize);
+   return filemngt_encode_packet_prefix(filename, is_elf, filesize, buffer, buffer_size);
+}
+
+/**
+ * Builds everything in a file packet but the file contents.  *buffer_size is set
+ * to the length of the whole packet.  In order to keep file contents zero-copy we
+ * don't add them to the packet, but instead send them with a second write.
+ **/
+int filemngt_encode_packet_prefix(char *filename, int is_elf, size_t filesize,
+                                  char **buffer, size_t *buffer_size)
 {
    int cur_pos = 0;
    int filename_len = strlen(filename) + 1;
-   int is_elf = filemngt_is_elf_file(filecontents, *buffer_size);
-   //TODO: Remove filesize from allocation if we're doing a non-contig send. Wastes memory.
-   *buffer_size = sizeof(is_elf) + filename_len + sizeof(filename_len) + sizeof(filesize) + filesize;
-   *buffer = (char *) malloc(*buffer_size);
+   size_t prefix_size = sizeof(is_elf) + filename_len + sizeof(filename_len) + sizeof(filesize);
+
+   *buffer_size = prefix_size + filesize;
+   *buffer = (char *) malloc(prefix_size);
    if (!*buffer) {
       err_printf("Failed to allocate memory for file contents packet for %s\n", filename);
       return -1;
@@ -197,14 +210,7 @@ int filemngt_encode_packet(char *filename, void *filecontents, size_t filesize,
    memcpy(*buffer + cur_pos, filename, filename_len);
    cur_pos += filename_len;
 
-   /* Explicitely removing the memcpy that puts the file contents into the
-      packet.  In order to keep file contents zero-copy we won't add them
-      to the packet, but will instead send them with a second write command.
-      memcpy(*buffer + cur_pos, filecontents, filesize);
-   */
-   cur_pos += filesize;
-
-   assert(cur_pos == *buffer_size);
+   assert(cur_pos == prefix_size);
    return 0;
 }
 
@@ -308,17 +314,15 @@ int filemngt_clear_file_space(void *buffer, size_t size, int fd)
    return 0;
 }
 
-void *filemngt_sync_file_space(void *buffer, int fd, char *pathname, size_t size, size_t newsize)
+int filemngt_sync_file_space(void *buffer, int fd, char *pathname, size_t size, size_t newsize)
 {
-   /* Linux gets annoying here.  We can't just mprotect the buffer to read-only,
-      Linux considers the file still open for writing (and thus throws ETXTBUSY on exec's)
+   /* Linux considers the file still open for writing (and thus throws ETXTBUSY on exec's)
       as long as we still have the buffer mmaped from a fd that was opened with write.
-      That means we've got to close the file, unmap the buffer, then re-open the file 
-      read-only, then re-map the buffer to the same place.  Ugh.  
+      So unmap the buffer and close the file.  Anyone who needs the contents afterwards
+      maps the file read-only with filemngt_map_cached_file.
    */
 
    int result;
-   char *buffer2;
 
    if (size == 0) {
        newsize = size = getpagesize();
@@ -329,42 +333,365 @@ void *filemngt_sync_file_space(void *buffer, int fd, char *pathname, size_t size
    result = munmap(buffer, size);
    if (result == -1) {
       err_printf("Error unmapping buffer for %s\n", pathname);
-      return NULL;
+      return -1;
    }
 
    if (size != newsize) {
       assert(newsize < size);
       /* The file shrunk after we read it, probably because we stripped it
-         as we read.  Shrink the local file on disk and shrink the mapped region */
+         as we read.  Shrink the local file on disk */
       result = ftruncate(fd, newsize);
       if (result == -1) {
          err_printf("Could not shrink file in local disk\n");
-         return NULL;
+         return -1;
       }
    }
    
    close(fd);
-   
-   fd = open(pathname, O_RDONLY);
+   return 0;
+}
+
+/**
+ * The server doesn't keep its cached files mapped, since a job with many
+ * files would need a mapping per file and could run into vm.max_map_count.
+ * Code that needs a cached file's contents maps it with
+ * filemngt_map_cached_file and hands it back with filemngt_release_mapping.
+ * Released mappings are kept in a small LRU, so files that are sent over
+ * and over aren't re-mapped each time, and the oldest are unmapped once
+ * there are more than MAX_IDLE_MAPPINGS.  Mappings that are handed out
+ * stay until they're released.  Each mapping is also chained into two hash
+ * tables, one keyed on its localname and one on its buffer address, so
+ * finding or releasing one doesn't walk every mapping.  Only used from the
+ * event loop.
+ **/
+#define MAX_IDLE_MAPPINGS 64
+#define MAPPING_INITIAL_BITS 8
+
+typedef struct mapped_file_t {
+   char *localname;
+   ldcs_hash_key_t name_hash;
+   void *buffer;
+   size_t map_size;
+   int refs;
+   struct mapped_file_t *prev, *next;
+   struct mapped_file_t *name_next, *buffer_next;
+} mapped_file_t;
+
+static mapped_file_t *mapped_head = NULL, *mapped_tail = NULL;
+static int mapped_count = 0, mapped_idle = 0, mapped_peak = 0;
+static unsigned long mapped_created = 0;
+
+static mapped_file_t **name_buckets = NULL, **buffer_buckets = NULL;
+static int bucket_bits = 0;
+
+static unsigned long mapping_bucket(ldcs_hash_key_t key)
+{
+   return (unsigned long) ((key * 2654435761u) >> (32 - bucket_bits));
+}
+
+static ldcs_hash_key_t buffer_key(void *buffer)
+{
+   return (ldcs_hash_key_t) (((unsigned long) buffer) >> 12);
+}
+
+static void mapping_index_add(mapped_file_t *m)
+{
+   unsigned long b;
+   b = mapping_bucket(m->name_hash);
+   m->name_next = name_buckets[b];
+   name_buckets[b] = m;
+   b = mapping_bucket(buffer_key(m->buffer));
+   m->buffer_next = buffer_buckets[b];
+   buffer_buckets[b] = m;
+}
+
+static void mapping_index_remove(mapped_file_t *m)
+{
+   mapped_file_t **i;
+   for (i = name_buckets + mapping_bucket(m->name_hash); *i != m; i = &(*i)->name_next);
+   *i = m->name_next;
+   for (i = buffer_buckets + mapping_bucket(buffer_key(m->buffer)); *i != m; i = &(*i)->buffer_next);
+   *i = m->buffer_next;
+   m->name_next = m->buffer_next = NULL;
+}
+
+/**
+ * Makes room for one more mapping, doubling the tables once there is more
+ * than one mapping per bucket.
+ **/
+static int mapping_index_reserve()
+{
+   mapped_file_t **old_names = name_buckets, **old_buffers = buffer_buckets;
+   mapped_file_t *m;
+   int old_bits = bucket_bits;
+   int new_bits = bucket_bits ? bucket_bits + 1 : MAPPING_INITIAL_BITS;
+
+   if (bucket_bits && mapped_count < (1 << bucket_bits))
+      return 0;
+
+   name_buckets = (mapped_file_t **) calloc(1 << new_bits, sizeof(mapped_file_t *));
+   buffer_buckets = (mapped_file_t **) calloc(1 << new_bits, sizeof(mapped_file_t *));
+   if (!name_buckets || !buffer_buckets) {
+      err_printf("Could not allocate mapping tables with %d buckets\n", 1 << new_bits);
+      free(name_buckets);
+      free(buffer_buckets);
+      name_buckets = old_names;
+      buffer_buckets = old_buffers;
+      return old_bits ? 0 : -1;
+   }
+   bucket_bits = new_bits;
+   for (m = mapped_head; m; m = m->next)
+      mapping_index_add(m);
+   free(old_names);
+   free(old_buffers);
+   return 0;
+}
+
+static void mapping_unlink(mapped_file_t *m)
+{
+   if (m->prev)
+      m->prev->next = m->next;
+   else
+      mapped_head = m->next;
+   if (m->next)
+      m->next->prev = m->prev;
+   else
+      mapped_tail = m->prev;
+   m->prev = m->next = NULL;
+}
+
+static void mapping_push(mapped_file_t *m)
+{
+   m->prev = NULL;
+   m->next = mapped_head;
+   if (mapped_head)
+      mapped_head->prev = m;
+   else
+      mapped_tail = m;
+   mapped_head = m;
+}
+
+static void mapping_free(mapped_file_t *m)
+{
+   debug_printf3("Unmapping %s from %p\n", m->localname, m->buffer);
+   mapping_unlink(m);
+   mapping_index_remove(m);
+   if (munmap(m->buffer, m->map_size) == -1)
+      err_printf("Error unmapping buffer for %s: %s\n", m->localname, strerror(errno));
+   if (!m->refs)
+      mapped_idle--;
+   mapped_count--;
+   free(m->localname);
+   free(m);
+}
+
+static void mapping_trim()
+{
+   mapped_file_t *m, *prev;
+   for (m = mapped_tail; m && mapped_idle > MAX_IDLE_MAPPINGS; m = prev) {
+      prev = m->prev;
+      if (!m->refs)
+         mapping_free(m);
+   }
+}
+
+static mapped_file_t *mapping_find(char *localname)
+{
+   mapped_file_t *m;
+   ldcs_hash_key_t hash;
+
+   if (!bucket_bits)
+      return NULL;
+   hash = ldcs_hash_Val(localname);
+   for (m = name_buckets[mapping_bucket(hash)]; m; m = m->name_next) {
+      if (m->name_hash == hash && strcmp(m->localname, localname) == 0)
+         return m;
+   }
+   return NULL;
+}
+
+static mapped_file_t *mapping_find_buffer(void *buffer)
+{
+   mapped_file_t *m;
+
+   if (!bucket_bits)
+      return NULL;
+   for (m = buffer_buckets[mapping_bucket(buffer_key(buffer))]; m; m = m->buffer_next) {
+      if (m->buffer == buffer)
+         return m;
+   }
+   return NULL;
+}
+
+/**
+ * Returns a read-only mapping of a cached file's local copy, which stays
+ * valid until it's passed to filemngt_release_mapping.  Returns NULL if
+ * the file can't be mapped.
+ **/
+void *filemngt_map_cached_file(char *localname, size_t size)
+{
+   mapped_file_t *m;
+   void *buffer;
+   int fd;
+
+   m = mapping_find(localname);
+   if (m) {
+      if (!m->refs)
+         mapped_idle--;
+      m->refs++;
+      mapping_unlink(m);
+      mapping_push(m);
+      return m->buffer;
+   }
+   if (mapping_index_reserve() == -1)
+      return NULL;
+
+   fd = open(localname, O_RDONLY);
    if (fd == -1) {
-      err_printf("Failed to re-open file %s: %s\n", pathname, strerror(errno));
+      err_printf("Failed to open local file %s: %s\n", localname, strerror(errno));
       return NULL;
    }
-   
-   buffer2 = mmap(buffer, newsize, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0);
-   if (buffer2 == MAP_FAILED) {
-      debug_printf("Failure re-mapping file %s: %s. Retrying.\n", pathname, strerror(errno));
-      buffer2 = mmap(NULL, newsize, PROT_READ, MAP_SHARED, fd, 0);
-      if (buffer2 == MAP_FAILED) {
-         debug_printf("Could not re-mapping file %s: %s\n", pathname, strerror(errno));
-         return NULL;
-      }
+   if (size == 0)
+      size = getpagesize();
+   buffer = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (buffer == MAP_FAILED) {
+      err_printf("Could not map local file %s: %s\n", localname, strerror(errno));
+      return NULL;
+   }
+   debug_printf3("Mapped %s of size %lu at %p\n", localname, (unsigned long) size, buffer);
+
+   m = (mapped_file_t *) malloc(sizeof(mapped_file_t));
+   m->localname = strdup(localname);
+   m->name_hash = ldcs_hash_Val(localname);
+   m->buffer = buffer;
+   m->map_size = size;
+   m->refs = 1;
+   mapping_push(m);
+   mapping_index_add(m);
+   mapped_count++;
+   mapped_created++;
+   if (mapped_count > mapped_peak)
+      mapped_peak = mapped_count;
+   return buffer;
+}
+
+/**
+ * Takes another reference on a mapping from filemngt_map_cached_file, for
+ * a second holder that will release it separately.
+ **/
+void filemngt_ref_mapping(void *buffer)
+{
+   mapped_file_t *m;
+   m = mapping_find_buffer(buffer);
+   if (!m || !m->refs) {
+      err_printf("Referenced mapping %p, which wasn't handed out\n", buffer);
+      return;
+   }
+   m->refs++;
+}
+
+/**
+ * Hands back a mapping from filemngt_map_cached_file.  NULL is ignored.
+ **/
+void filemngt_release_mapping(void *buffer)
+{
+   mapped_file_t *m;
+   if (!buffer)
+      return;
+   m = mapping_find_buffer(buffer);
+   if (!m || !m->refs) {
+      err_printf("Released mapping %p, which wasn't handed out\n", buffer);
+      return;
+   }
+   m->refs--;
+   if (!m->refs) {
+      mapped_idle++;
+      mapping_trim();
+   }
+}
+
+void filemngt_mapping_stats(int *count, int *peak, unsigned long *created)
+{
+   if (created)
+      *created = mapped_created;
+   if (count)
+      *count = mapped_count;
+   if (peak)
+      *peak = mapped_peak;
+}
+
+/**
+ * Removes a cached file from the local disk, unless some process has it
+ * open or mapped.  The test is taking a write lease on the file, which the
+ * kernel refuses while anyone else holds it open.  An idle mapping of our
+ * own would count as a holder, so it's dropped first.  Returns 0 if the
+ * file was removed, 1 if it is in use, and -1 if leases can't be used here.
+ **/
+int filemngt_evict_file(char *localname)
+{
+   int fd, result, lease_errno;
+   mapped_file_t *m;
+
+   m = mapping_find(localname);
+   if (m && m->refs)
+      return 1;
+   if (m)
+      mapping_free(m);
+
+   fd = open(localname, O_RDONLY);
+   if (fd == -1) {
+      debug_printf("Local file %s was already gone: %s\n", localname, strerror(errno));
+      return 0;
    }
-   debug_printf3("Remapped buffer %p of size %lu as read-only at %p\n", buffer, size, buffer2);
 
+   result = fcntl(fd, F_SETLEASE, F_WRLCK);
+   if (result == 0) {
+      if (unlink(localname) == -1)
+         err_printf("Could not remove local file %s: %s\n", localname, strerror(errno));
+      fcntl(fd, F_SETLEASE, F_UNLCK);
+      close(fd);
+      return 0;
+   }
+   lease_errno = errno;
    close(fd);
 
-   return buffer2;
+   if (lease_errno == EAGAIN || lease_errno == EBUSY)
+      return 1;
+   debug_printf("Could not take a lease on %s to test if it is in use: %s\n", localname, strerror(lease_errno));
+   return -1;
+}
+
+/**
+ * Makes localname a hard link to existing_localname, whose contents are
+ * the same, replacing any file already at localname.  The replacement is
+ * a rename, so localname never goes missing.  Fails if our own mapping of
+ * the old localname is still handed out.
+ **/
+int filemngt_link_file(char *existing_localname, char *localname)
+{
+   char tmpname[MAX_PATH_LEN+1];
+   mapped_file_t *m;
+
+   m = mapping_find(localname);
+   if (m && m->refs) {
+      err_printf("Can't replace %s with a link while it is mapped\n", localname);
+      return -1;
+   }
+   if (m)
+      mapping_free(m);
+
+   snprintf(tmpname, sizeof(tmpname), "%s.link", localname);
+   if (link(existing_localname, tmpname) == -1) {
+      err_printf("Could not link %s to %s: %s\n", tmpname, existing_localname, strerror(errno));
+      return -1;
+   }
+   if (rename(tmpname, localname) == -1) {
+      err_printf("Could not rename %s to %s: %s\n", tmpname, localname, strerror(errno));
+      unlink(tmpname);
+      return -1;
+   }
+   return 0;
 }
 
 size_t filemngt_get_file_size(char *pathname, int *errcode)
@@ -28,6 +28,8 @@ int ldcs_audit_server_filemngt_init (char* location);
 int filemngt_read_file(char *filename, void *buffer, size_t *size, int strip, int *err);
 int filemngt_encode_packet(char *filename, void *filecontents, size_t filesize, 
                            char **buffer, size_t *buffer_size);
+int filemngt_encode_packet_prefix(char *filename, int is_elf, size_t filesize,
+                                  char **buffer, size_t *buffer_size);
 int filemngt_decode_packet(node_peer_t peer, ldcs_message_t *msg, char *filename, size_t *buffer_size, int *bytes_read, int *is_elf);
 
 typedef enum {
@@ -44,8 +46,14 @@ char *filemngt_calc_localname(char *global_name, calc_local_t reqtype);
 int ldcs_audit_server_filemngt_clean();
 
 int filemngt_create_file_space(char *filename, size_t size, void **buffer_out, int *fd_out);
-void *filemngt_sync_file_space(void *buffer, int fd, char *pathname, size_t size, size_t newsize);
+int filemngt_sync_file_space(void *buffer, int fd, char *pathname, size_t size, size_t newsize);
 int filemngt_clear_file_space(void *buffer, size_t size, int fd);
+void *filemngt_map_cached_file(char *localname, size_t size);
+void filemngt_ref_mapping(void *buffer);
+void filemngt_release_mapping(void *buffer);
+void filemngt_mapping_stats(int *count, int *peak, unsigned long *created);
+int filemngt_evict_file(char *localname);
+int filemngt_link_file(char *existing_localname, char *localname);
 size_t filemngt_get_file_size(char *pathname, int *errcode);
 
 char* ldcs_is_a_localfile(char* filename);
@@ -21,6 +21,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <sys/inotify.h>
 #include <errno.h>
 #include <assert.h>
+#include <fcntl.h>
 
 #include "ldcs_api.h"
 #include "ldcs_api_listen.h"
@@ -33,9 +34,15 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "global_name.h"
 #include "ldcs_audit_server_handlers.h"
 #include "ldcs_audit_server_requestors.h"
+#include "ldcs_audit_server_waitqueue.h"
 #include "spindle_launch.h"
 #include "pathfn.h"
 #include "msgbundle.h"
+#include "ldcs_audit_server_readpool.h"
+#include "ldcs_audit_server_manifest.h"
+#include "ldcs_audit_server_prefetch.h"
+#include "ldcs_audit_server_dedup.h"
+#include "ldcs_audit_server_pcache.h"
 #include "ccwarns.h"
 #include "parse_mounts.h"
 #include "exitnote.h"
@@ -62,6 +69,7 @@ typedef enum {
    READ_FILE,
    REQ_DIRECTORY,
    REQ_FILE,
+   READING_FILE,
    ALIAS_TO,
    ORIG_FILE
 } handle_file_result_t;
@@ -76,9 +84,14 @@ typedef enum {
 typedef enum {
    preload_broadcast,
    request_broadcast,
+   prefetch_broadcast,
    suppress_broadcast
 } broadcast_t;
 
+/* Flags at the start of a metadata packet */
+#define METADATA_PACKET_EXISTS  1
+#define METADATA_PACKET_PRELOAD 2
+
 typedef enum {
    exists,
    not_exists
@@ -91,6 +104,36 @@ typedef enum {
 } is_elf_t;
 #define SPINDLE_ENODIR -68
 
+/* Files at least twice this size are forwarded down the tree as they arrive */
+#define FILE_CHUNK_SIZE (1024*1024)
+
+/* State for a file read that is running on the reader thread pool */
+typedef struct {
+   readpool_job_t job;
+   char *localname;
+   int fd;
+   int replicate;
+   broadcast_t bcast;
+} handle_read_t;
+
+/* A file in the preload list, and where it falls in the read order */
+typedef struct {
+   char *pathname;
+   int priority;
+   int index;
+} preload_file_t;
+
+/* Preload reads kept in flight for each reader thread */
+#define PRELOAD_READS_PER_THREAD 2
+
+/* Aliases and directory reads followed while resolving a prefetched dependency */
+#define PREFETCH_MAX_STEPS 16
+
+/* Files used more recently than this many seconds ago aren't evicted.  Clients
+   hold a file open from our answer until they've used it and ask again for one
+   that vanished, so this only saves refetching files that are in use. */
+#define EVICT_MIN_AGE 1.0
+
 static int handle_client_info_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
 static int handle_client_myrankinfo_msg(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
 static int handle_pythonprefix_query(ldcs_process_data_t *procdata, int nc);
@@ -101,15 +144,20 @@ static handle_file_result_t handle_howto_file(ldcs_process_data_t *procdata, cha
 static handle_metadata_result_t handle_howto_metadata(ldcs_process_data_t *procdata, char *pathname, metadata_t mdtype);
 static int handle_client_progress(ldcs_process_data_t *procdata, int nc);
 static int handle_progress(ldcs_process_data_t *procdata);
+static int handle_progress_key(ldcs_process_data_t *procdata, char *key);
 static int handle_client_get_alias(ldcs_process_data_t *procdata, int nc, char *alias_to);
 static int handle_read_directory(ldcs_process_data_t *procdata, char *dir);
-static int handle_broadcast_dir(ldcs_process_data_t *procdata, char *dir, broadcast_t bcast);
+static int handle_broadcast_dir(ldcs_process_data_t *procdata, char *dir, broadcast_t bcast, node_peer_t from);
 static int handle_read_and_broadcast_dir(ldcs_process_data_t *procdata, char *dir);
 
 static int handle_read_and_broadcast_file(ldcs_process_data_t *procdata, char *filename, 
                                           broadcast_t bcast);
+static int handle_finish_read(ldcs_process_data_t *procdata, char *pathname, char *localname, int *fd,
+                              char *buffer, size_t size, size_t newsize, int replicate, int errcode,
+                              uint64_t content_hash, broadcast_t bcast);
+static int handle_read_file_done(ldcs_process_data_t *procdata, readpool_job_t *job);
 static int handle_broadcast_file(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size,
-                                 broadcast_t bcast);
+                                 broadcast_t bcast, node_peer_t from);
 static void *handle_setup_file_buffer(ldcs_process_data_t *procdata, char *pathname, size_t size,
                                       int *fd, char **localpath, int *already_loaded, int *replicate,
                                       is_elf_t is_elf);
@@ -121,29 +169,36 @@ static int handle_finish_buffer_setup(ldcs_process_data_t *procdata,
 static int handle_client_originalfile_query(ldcs_process_data_t *procdata, int nc);
 static int handle_client_fulfilled_query(ldcs_process_data_t *procdata, int nc);
 static int handle_client_return_numa_replication(ldcs_process_data_t *procdata, int nc);
+static int handle_hold_for_numa_replica(ldcs_process_data_t *procdata, int nc);
 static int handle_client_rejected_query(ldcs_process_data_t *procdata, int nc, int errcode);
 
 static int handle_request(ldcs_process_data_t *procdata, node_peer_t from, ldcs_message_t *msg);
 static int handle_request_directory(ldcs_process_data_t *procdata, node_peer_t from, char *pathname);
-static int handle_request_file(ldcs_process_data_t *procdata, node_peer_t from, char *pathname);
+static int handle_request_file(ldcs_process_data_t *procdata, node_peer_t from, char *pathname, int refetch);
 
 static int handle_send_query(ldcs_process_data_t *procdata, char *path, int is_dir);
 static int handle_send_directory_query(ldcs_process_data_t *procdata, char *directory);
+static int handle_route_query(ldcs_process_data_t *procdata, ldcs_message_t *msg, char *key);
 static int handle_send_file_query(ldcs_process_data_t *procdata, char *fullpath);
 
 static int handle_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, 
                             broadcast_t bcast);
-static int handle_directory_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, broadcast_t bcast);
-static int handle_alias_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, broadcast_t bcast);
+static int handle_directory_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, broadcast_t bcast);
+static int handle_alias_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, broadcast_t bcast);
 
 static int handle_exit_broadcast(ldcs_process_data_t *procdata);
 static int handle_send_msg_to_keys(ldcs_process_data_t *procdata, ldcs_message_t *msg, char *key,
-                                   void *secondary_data, size_t secondary_size, int force_broadcast,
-                                   metadata_t mdtype);
+                                   void *secondary_data, size_t secondary_size, int secondary_fd,
+                                   int force_broadcast, metadata_t mdtype, node_peer_t from);
+static int handle_msg_targets(ldcs_process_data_t *procdata, char *key, int force_broadcast,
+                              metadata_t mdtype, node_peer_t from,
+                              node_peer_t **targets, int *num_targets, int *all_children);
 static int handle_preload_filelist(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static int handle_preload_next(ldcs_process_data_t *procdata);
 static int handle_preload_done(ldcs_process_data_t *procdata);
+static int handle_hold_for_preload(ldcs_process_data_t *procdata, int nc, char *key);
 static int handle_create_selfload_file(ldcs_process_data_t *procdata, char *filename);
-static int handle_recv_selfload_file(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+static int handle_recv_selfload_file(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer);
 static int handle_report_fileexist_result(ldcs_process_data_t *procdata, int nc, exist_t res);
 
 static int handle_fileexist_test(ldcs_process_data_t *procdata, int nc);
@@ -153,9 +208,11 @@ static int handle_stat_file(ldcs_process_data_t *procdata, char *pathname, metad
 static int handle_metadata_and_broadcast_file(ldcs_process_data_t *procdata, char *pathname, metadata_t mdtype, broadcast_t bcast);
 static int handle_cache_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists, metadata_t mdtype,
                                  struct stat *buf, char **localname);
-static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists, unsigned char *buf, size_t buf_size, metadata_t mdtype);
-static int handle_broadcast_errorcode(ldcs_process_data_t *procdata, char *pathname, int errcode);
-static int handle_broadcast_alias(ldcs_process_data_t *procdata, char *alias_from, char *alias_to);
+static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists, unsigned char *buf, size_t buf_size, metadata_t mdtype,
+                                     broadcast_t bcast, node_peer_t from);
+static int handle_broadcast_errorcode(ldcs_process_data_t *procdata, char *pathname, int errcode, node_peer_t from);
+static int handle_broadcast_alias(ldcs_process_data_t *procdata, char *alias_from, char *alias_to, broadcast_t bcast,
+                                  node_peer_t from);
 static int handle_metadata_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, metadata_t mdtype, node_peer_t peer);
 static int handle_client_metadata(ldcs_process_data_t *procdata, int nc);
 static int handle_client_metadata_result(ldcs_process_data_t *procdata, int nc, metadata_t mdtype);
@@ -172,6 +229,27 @@ static int handle_cache_ldso(ldcs_process_data_t *procdata, char *pathname, int
 static int handle_msgbundle(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_message_t *msg);
 static int handle_setup_alias(ldcs_process_data_t *procdata, char *pathname, char *alias_to);
 static int handle_close_client_query(ldcs_process_data_t *procdata, int nc);
+static int handle_client_answer(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_client_multi_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg);
+static int handle_multi_query_next(ldcs_process_data_t *procdata, int nc);
+static int handle_multi_query_finish(ldcs_process_data_t *procdata, int nc);
+static int handle_prefetch_deps(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size);
+static int handle_prefetch_file(ldcs_process_data_t *procdata, char *pathname);
+static void handle_prefetch_arrived(ldcs_process_data_t *procdata, char *pathname, size_t size);
+static void handle_prefetch_hit(ldcs_process_data_t *procdata, char *pathname);
+static void handle_cache_touch(ldcs_process_data_t *procdata, char *pathname);
+static int handle_cache_insert(ldcs_process_data_t *procdata, char *pathname);
+static int handle_evict_files(ldcs_process_data_t *procdata);
+static int handle_send_refetches(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size,
+                                 node_peer_t from);
+static char *handle_dedup_file(ldcs_process_data_t *procdata, char *pathname, char **buffer, size_t size,
+                               uint64_t content_hash);
+static int handle_broadcast_content_alias(ldcs_process_data_t *procdata, char *pathname, char *source, size_t size,
+                                          broadcast_t bcast, node_peer_t from);
+static int handle_content_alias_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer,
+                                     broadcast_t bcast);
+static int handle_pcache_restore(ldcs_process_data_t *procdata, char *pathname, char *file, char *dir,
+                                 char **localpath);
 
 /**
  * Query from client to server.  Returns info about client's rank in server data structures. 
@@ -260,6 +338,21 @@ static int handle_client_myrankinfo_msg(ldcs_process_data_t *procdata, int nc, l
    return 0;
 }
 
+/**
+ * Turns a client's relative directory into an absolute one.  Clients report
+ * their cwd at connect time and after each chdir, so we only fall back to
+ * reading /proc/<pid>/cwd for clients that never sent one.
+ **/
+static void add_client_cwd(ldcs_client_t *client, char *dir)
+{
+   if (dir[0] == '/')
+      return;
+   if (client->remote_cwd[0] != '\0')
+      addCWDStrToDir(client->remote_cwd, dir, MAX_PATH_LEN);
+   else
+      addCWDToDir(client->remote_pid, dir, MAX_PATH_LEN);
+}
+
 /**
  * Client is query'ing server for a specific file.  Could be executable, server, or open results.
  * Initializes client data structures to point to requested file.
@@ -290,7 +383,7 @@ static int handle_client_file_request(ldcs_process_data_t *procdata, int nc, ldc
    /* do initial check of query, parse the filename and store info */
    assert(nc != -1);
    ldcs_client_t *client = procdata->client_table + nc;
-   addCWDToDir(client->remote_pid, dir, MAX_PATH_LEN);
+   add_client_cwd(client, dir);
    reducePath(dir);
 
    GCC7_DISABLE_WARNING("-Wformat-truncation");
@@ -303,6 +396,10 @@ static int handle_client_file_request(ldcs_process_data_t *procdata, int nc, ldc
    GCC7_ENABLE_WARNING;
    
    client->query_localpath = NULL;
+
+   manifest_record_query(procdata,
+                         is_lstat ? manifest_lstat : is_stat ? manifest_stat : is_loader ? manifest_ldso : manifest_file,
+                         client->query_globalpath);
    
    client->query_open = 1;
    client->is_stat = is_stat;
@@ -366,6 +463,12 @@ static handle_file_result_t handle_howto_file(ldcs_process_data_t *procdata, cha
       *errcode = 0;
       return FOUND_ERRCODE;
    }
+
+   if (been_requested(procdata->pending_reads, pathname)) {
+      /* A reader thread is filling in this file's buffer */
+      debug_printf2("File %s is still being read\n", pathname);
+      return READING_FILE;
+   }
    
    /* check directory + file */
    cache_filedir_result = ldcs_cache_findFileDirInCache(file, dir, localpath, errcode);
@@ -394,8 +497,13 @@ static handle_file_result_t handle_howto_file(ldcs_process_data_t *procdata, cha
             to load the original file */
          return ORIG_FILE;
       }
-      /* File exists, but isn't present.  Read or request. */
-      responsible = ldcs_audit_server_md_is_responsible(procdata, pathname);
+      if (handle_pcache_restore(procdata, pathname, file, dir, localpath) == 0) {
+         /* An earlier job on this node kept the file, and it hasn't changed */
+         return FOUND_FILE;
+      }
+      /* File exists, but isn't present.  Read or request.  Files are read by the
+         server responsible for their directory, which already has the listing. */
+      responsible = ldcs_audit_server_md_is_responsible(procdata, dir);
       if (responsible)
          return READ_FILE;
       else
@@ -426,11 +534,6 @@ static int handle_client_progress(ldcs_process_data_t *procdata, int nc)
    char *alias_to;
 
    ldcs_client_t *client = procdata->client_table + nc;
-   if ((procdata->opts & OPT_PRELOAD) && !procdata->preload_done) {
-      /* Postpone client requests until preload is complete */
-      debug_printf3("Postpone client requests until preload is complete\n");
-      return 0;
-   }
    if (!client->query_open)
       return 0;
    if (client->existance_query)
@@ -445,6 +548,8 @@ static int handle_client_progress(ldcs_process_data_t *procdata, int nc)
    switch (result) {
       case FOUND_FILE:
          handle_client_return_numa_replication(procdata, nc);
+         if (handle_hold_for_numa_replica(procdata, nc))
+            return 0;
          return handle_client_fulfilled_query(procdata, nc);
       case NO_DIR:
          return handle_client_rejected_query(procdata, nc, SPINDLE_ENODIR);
@@ -453,26 +558,39 @@ static int handle_client_progress(ldcs_process_data_t *procdata, int nc)
       case FOUND_ERRCODE:
          return handle_client_rejected_query(procdata, nc, errcode);
       case READ_DIRECTORY:
+         if (handle_hold_for_preload(procdata, nc, client->query_dirname))
+            return 0;
          read_result = handle_read_directory(procdata, client->query_dirname);
          if (read_result == -1)
             return -1; 
-         broadcast_result = handle_broadcast_dir(procdata, client->query_dirname, request_broadcast);
+         broadcast_result = handle_broadcast_dir(procdata, client->query_dirname, request_broadcast, NODE_PEER_NULL);
          client_result = handle_client_progress(procdata, nc);
          return (client_result == -1 || broadcast_result == -1) ? -1 : 0;
       case READ_FILE:
+         if (handle_hold_for_preload(procdata, nc, client->query_globalpath))
+            return 0;
          read_result = handle_read_and_broadcast_file(procdata, client->query_globalpath, request_broadcast);
          if (read_result == -1)
             return -1;
          client_result = handle_client_progress(procdata, nc);
          return (client_result == -1 || read_result == -1) ? -1 : 0;
       case REQ_DIRECTORY:
+         if (handle_hold_for_preload(procdata, nc, client->query_dirname))
+            return 0;
          client_result = handle_send_query(procdata, client->query_dirname, 1);
          add_requestor(procdata->pending_requests, client->query_dirname, NODE_PEER_CLIENT);
+         waitqueue_add(procdata->client_waitqueue, client->query_dirname, nc);
          return client_result;
       case REQ_FILE:
+         if (handle_hold_for_preload(procdata, nc, client->query_globalpath))
+            return 0;
          client_result = handle_send_query(procdata, client->query_globalpath, 0);
          add_requestor(procdata->pending_requests, client->query_globalpath, NODE_PEER_CLIENT);
+         waitqueue_add(procdata->client_waitqueue, client->query_globalpath, nc);
          return client_result;
+      case READING_FILE:
+         waitqueue_add(procdata->client_waitqueue, client->query_globalpath, nc);
+         return 0;
       case ORIG_FILE:
          return handle_client_originalfile_query(procdata, nc);
       case ALIAS_TO:
@@ -484,7 +602,23 @@ static int handle_client_progress(ldcs_process_data_t *procdata, int nc)
 }
 
 /**
- * Handle client file requests for all clients.
+ * While a preload is running, a client request that would read from disk
+ * or go to the network waits on key instead, since the preload may be about
+ * to deliver it.  Requests that can be answered from what has already
+ * arrived go ahead.  Returns 1 if the client was held.
+ **/
+static int handle_hold_for_preload(ldcs_process_data_t *procdata, int nc, char *key)
+{
+   if (!(procdata->opts & OPT_PRELOAD) || procdata->preload_done)
+      return 0;
+   debug_printf3("Holding client request on %s until preload delivers it or completes\n", key);
+   waitqueue_add(procdata->client_waitqueue, key, nc);
+   return 1;
+}
+
+/**
+ * Handle client file requests for all clients.  Only needed when clients
+ * may have been held back, e.g. on something a preload did not deliver.
  **/
 static int handle_progress(ldcs_process_data_t *procdata)
 {
@@ -500,6 +634,32 @@ static int handle_progress(ldcs_process_data_t *procdata)
    return global_result;
 }
 
+/**
+ * Something arrived for key.  Handle client requests for the clients
+ * that were waiting on it.  Clients that are still blocked will re-queue
+ * themselves on whatever they now wait for.
+ **/
+static int handle_progress_key(ldcs_process_data_t *procdata, char *key)
+{
+   int global_result = 0, i, num_waiting;
+   int *waiting;
+
+   if (waitqueue_take(procdata->client_waitqueue, key, &waiting, &num_waiting) == -1)
+      return 0;
+
+   debug_printf3("Waking %d clients waiting on %s\n", num_waiting, key);
+   for (i = 0; i < num_waiting; i++) {
+      ldcs_client_t *client = procdata->client_table + waiting[i];
+      if (client->state == LDCS_CLIENT_STATUS_FREE || client->state == LDCS_CLIENT_STATUS_ACTIVE_PSEUDO)
+         continue;
+      int result = handle_client_progress(procdata, waiting[i]);
+      if (result == -1)
+         global_result = -1;
+   }
+   free(waiting);
+   return global_result;
+}
+
 /**
  * A client requested a file that turned out to be an alias. Move the query to 
  * ask for the target of that alias.
@@ -541,6 +701,7 @@ static int handle_read_directory(ldcs_process_data_t *procdata, char *dir)
 	
    if (cache_dir_result == LDCS_CACHE_DIR_PARSED_AND_EXISTS ||
        cache_dir_result == LDCS_CACHE_DIR_PARSED_AND_NOT_EXISTS) {
+      manifest_record_metadata(procdata, manifest_dir, dir, NULL);
       return 0;
    }
    else {
@@ -553,7 +714,7 @@ static int handle_read_directory(ldcs_process_data_t *procdata, char *dir)
  * Broadcast a directory contents to the specified client (if any),
  * and on the network.
  **/
-static int handle_broadcast_dir(ldcs_process_data_t *procdata, char *dir, broadcast_t bcast)
+static int handle_broadcast_dir(ldcs_process_data_t *procdata, char *dir, broadcast_t bcast, node_peer_t from)
 {
    ldcs_message_t msg;
    char *data;
@@ -580,7 +741,7 @@ static int handle_broadcast_dir(ldcs_process_data_t *procdata, char *dir, broadc
    msg.data = data;
    msg.header.len = data_len;
    
-   result = handle_send_msg_to_keys(procdata, &msg, dir, NULL, 0, force_broadcast, metadata_none);
+   result = handle_send_msg_to_keys(procdata, &msg, dir, NULL, 0, -1, force_broadcast, metadata_none, from);
 
    free(data);
    return result;
@@ -595,7 +756,7 @@ static int handle_read_and_broadcast_dir(ldcs_process_data_t *procdata, char *di
    int result = handle_read_directory(procdata, dir);
    if (result == -1)
       return -1;
-   return handle_broadcast_dir(procdata, dir, request_broadcast);
+   return handle_broadcast_dir(procdata, dir, request_broadcast, NODE_PEER_NULL);
 }
 
 /**
@@ -687,14 +848,17 @@ static void *handle_setup_file_buffer(ldcs_process_data_t *procdata, char *pathn
 }
 
 /**
- * Finalize a buffer that a file has just been written into.
+ * Finalize a buffer that a file has just been written into.  The server
+ * doesn't keep cached files mapped, so on success *orig_buffer is a
+ * read-only mapping of the local copy that the caller hands back with
+ * filemngt_release_mapping once it's done with the contents.
  **/
 static int handle_finish_buffer_setup(ldcs_process_data_t *procdata, char *localname, 
                                       char *pathname, int *fd, 
                                       char **orig_buffer, size_t size, size_t newsize, int *replicatep, int errcode)
 {
    double starttime;
-   void *newbuffer = NULL, *numabuffer = NULL, *final_numabuffer;
+   void *newbuffer = NULL, *numabuffer = NULL;
    int i, num_nodes, result, turned_off_replication = 0;
    char numaname[MAX_PATH_LEN+1];
    char *buffer = *orig_buffer;
@@ -720,7 +884,11 @@ static int handle_finish_buffer_setup(ldcs_process_data_t *procdata, char *local
    else if (!replicate) {
       debug_printf2("Cleaning buffer space at %p, which is size = %lu, newsize = %lu\n", buffer,
                     (unsigned long) size, (unsigned long) newsize);
-      newbuffer = filemngt_sync_file_space(buffer, *fd, localname, size, newsize);
+      result = filemngt_sync_file_space(buffer, *fd, localname, size, newsize);
+      if (result == -1)
+         return -1;
+      *fd = -1;
+      newbuffer = filemngt_map_cached_file(localname, newsize);
       if (newbuffer == NULL)
          return -1;
    }
@@ -734,22 +902,26 @@ static int handle_finish_buffer_setup(ldcs_process_data_t *procdata, char *local
          return -1;
       }
       memcpy(newbuffer, buffer, newsize);
-      newbuffer = filemngt_sync_file_space(newbuffer, newfd, localname, newsize, newsize);
-      if (newbuffer == NULL) {
+      result = filemngt_sync_file_space(newbuffer, newfd, localname, newsize, newsize);
+      if (result == -1) {
          if (newfd != -1) close(newfd);
          return -1;
       }
+      newbuffer = filemngt_map_cached_file(localname, newsize);
+      if (newbuffer == NULL)
+         return -1;
       procdata->server_stat.libstore.bytes += newsize;
-      if (newfd != -1) close(newfd);
       replicate = 0;
       *replicatep = 0;
       turned_off_replication = 1;
       numa_free_temporary_memory(buffer, size);      
    }
    else { //replicate && !errcode
-      num_nodes = numa_num_nodes();
+      /* Lazy replication only makes the node 0 copy now.  The other nodes' copies 
+         are made when a client on that node asks for the file. */
+      num_nodes = procdata->numa_replicate == numa_replicate_lazy ? 1 : numa_num_nodes();
       debug_printf2("Replicating %s onto buffers for %d different numa domains\n", pathname, num_nodes);
-      for (i = 0; i < numa_num_nodes(); i++) {
+      for (i = 0; i < num_nodes; i++) {
          int numafd;
          strncpy(numaname, localname, MAX_PATH_LEN);
          numa_update_local_filename(numaname, i);
@@ -769,36 +941,41 @@ static int handle_finish_buffer_setup(ldcs_process_data_t *procdata, char *local
          }
 
          memcpy(numabuffer, buffer, newsize);
-         final_numabuffer = filemngt_sync_file_space(numabuffer, numafd, numaname, newsize, newsize);
-         if (final_numabuffer == NULL) {
+         result = filemngt_sync_file_space(numabuffer, numafd, numaname, newsize, newsize);
+         if (result == -1) {
             if (numafd != -1) close(numafd);
             return -1;
          }
          procdata->server_stat.libstore.bytes += newsize;
-         
-         if (i == 0) {
-            //Use the 0 node replicated copy of the file for future broadcasts
-            newbuffer = final_numabuffer;
-         }
-         if (numafd != -1)
-            close(numafd);         
       }
+
+      /* The 0 node replicated copy is the source for future broadcasts and
+         lazy replicas.  The caller gets this mapping, and the replica list
+         takes its own reference, which it holds for good */
+      strncpy(numaname, localname, MAX_PATH_LEN);
+      numa_update_local_filename(numaname, 0);
+      newbuffer = filemngt_map_cached_file(numaname, newsize);
+      if (newbuffer == NULL)
+         return -1;
+      procdata->server_stat.numarepl.cnt += num_nodes;
+      procdata->server_stat.numarepl.bytes += newsize * num_nodes;
+      filemngt_ref_mapping(newbuffer);
+      numa_replica_add(localname, newbuffer, newsize, num_nodes);
       numa_free_temporary_memory(buffer, size);
    }
    procdata->server_stat.libstore.time += (ldcs_get_time() - starttime);      
 
    char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
    parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
-   if (size != newsize || buffer != newbuffer || errcode) {
-      /* The buffer either shrunk or moved.  Update file cache with the new information */
-      ldcs_cache_updateBuffer(filename, dirname, localname, newbuffer, newsize, errcode);
-      *orig_buffer = (char *) newbuffer;
-   }
-   if (replicate || turned_off_replication) {
+   /* The cache doesn't hold on to the mapping.  Contents are mapped again as needed */
+   ldcs_cache_updateBuffer(filename, dirname, localname, NULL, newsize, errcode);
+   *orig_buffer = (char *) newbuffer;
+   if (replicate || turned_off_replication)
       ldcs_cache_updateReplication(filename, dirname, replicate);
-      *orig_buffer = (char *) newbuffer;
-   }
    *fd = -1;
+
+   if (!errcode && !replicate)
+      return handle_cache_insert(procdata, pathname);
    return 0;
 }
 
@@ -826,7 +1003,8 @@ static int handle_setup_alias(ldcs_process_data_t *procdata, char *pathname, cha
 
 /**
  * Reads a file contents off disk and put into the file cache.  Distribute file
- * on network if necessary.
+ * on network if necessary.  Files read for a request are handed to the reader
+ * thread pool when it is enabled, and are broadcast once the read completes.
  **/
 static int handle_read_and_broadcast_file(ldcs_process_data_t *procdata, char *pathname,
                                           broadcast_t bcast)
@@ -839,7 +1017,15 @@ static int handle_read_and_broadcast_file(ldcs_process_data_t *procdata, char *p
    int errcode = 0, already_loaded;
    char alias_to_buffer[MAX_PATH_LEN+1], *alias_to = NULL;
    int replicate = 0;
-   
+   uint64_t content_hash = 0;
+   handle_read_t *rd;
+
+   if (been_requested(procdata->pending_reads, pathname)) {
+      debug_printf2("File %s is already being read.  Not re-reading\n", pathname);
+      return 0;
+   }
+
+   manifest_record_metadata(procdata, manifest_file, pathname, NULL);
 
    starttime = ldcs_get_time();
    debug_printf3("Checking if %s is an alias\n", pathname);
@@ -852,14 +1038,16 @@ static int handle_read_and_broadcast_file(ldcs_process_data_t *procdata, char *p
       debug_printf2("%s is an alias for %s. Setting up\n", pathname, alias_to);
 
       result = handle_setup_alias(procdata, pathname, alias_to);
-      if (result == -1) {
-         global_result = -1;
-         goto done;
-      }
-      goto do_broadcast;
+      if (result == -1)
+         return -1;
+      if (bcast == suppress_broadcast)
+         return 0;
+      return handle_broadcast_alias(procdata, pathname, alias_to, bcast, NODE_PEER_NULL);
    }
 
-      
+
+   pcache_record_read(procdata, pathname);
+
    /* Read file size from disk */
    starttime = ldcs_get_time();
    size = filemngt_get_file_size(pathname, &errcode);
@@ -881,6 +1069,30 @@ static int handle_read_and_broadcast_file(ldcs_process_data_t *procdata, char *p
       goto done;
    }
 
+   if (bcast != suppress_broadcast && readpool_enabled()) {
+      /* Read on the thread pool and finish in handle_read_file_done */
+      rd = (handle_read_t *) malloc(sizeof(handle_read_t));
+      rd->job.pathname = strdup(pathname);
+      rd->job.buffer = buffer;
+      rd->job.size = size;
+      rd->job.strip = (procdata->opts & OPT_STRIP);
+      rd->job.hash = (procdata->opts & OPT_DEDUP) ? 1 : 0;
+      rd->job.done_cb = handle_read_file_done;
+      rd->job.work_cb = NULL;
+      rd->job.data = rd;
+      rd->localname = localname;
+      rd->fd = fd;
+      rd->replicate = replicate;
+      rd->bcast = bcast;
+      if (readpool_submit(&rd->job) == 0) {
+         add_requestor(procdata->pending_reads, pathname, NODE_PEER_NULL);
+         return 0;
+      }
+      debug_printf("Could not queue read of %s.  Reading synchronously\n", pathname);
+      free(rd->job.pathname);
+      free(rd);
+   }
+
    /* Actually read the file into the buffer */
    starttime = ldcs_get_time();
 
@@ -889,6 +1101,8 @@ static int handle_read_and_broadcast_file(ldcs_process_data_t *procdata, char *p
       global_result = -1;
       goto done;
    }
+   if ((procdata->opts & OPT_DEDUP) && !errcode)
+      content_hash = dedup_hash(buffer, newsize);
 
    procdata->server_stat.libread.cnt++;
    procdata->server_stat.libread.bytes += !errcode ? newsize : 0;
@@ -899,46 +1113,420 @@ static int handle_read_and_broadcast_file(ldcs_process_data_t *procdata, char *p
    procdata->server_stat.libstore.time += (ldcs_get_time() - starttime);
 
   readdone:   
-   result = handle_finish_buffer_setup(procdata, localname, pathname, &fd, &buffer, size,
-                                       newsize, &replicate, errcode);
-   if (result == -1) {
+   result = handle_finish_read(procdata, pathname, localname, &fd, buffer, size, newsize,
+                               replicate, errcode, content_hash, bcast);
+   if (result == -1)
       global_result = -1;
-      goto done;
+
+  done:
+   if (fd != -1)
+      close(fd);
+   return global_result;
+}
+
+/**
+ * Finish a file whose contents have been read into its buffer, then
+ * distribute the contents or the read's error code.  With OPT_DEDUP,
+ * content_hash is the hash of the contents, and a file with the same
+ * contents as one already here is sent as a link to that one.
+ **/
+static int handle_finish_read(ldcs_process_data_t *procdata, char *pathname, char *localname, int *fd,
+                              char *buffer, size_t size, size_t newsize, int replicate, int errcode,
+                              uint64_t content_hash, broadcast_t bcast)
+{
+   int result;
+   char *source = NULL;
+
+   result = handle_finish_buffer_setup(procdata, localname, pathname, fd, &buffer, size,
+                                       newsize, &replicate, errcode);
+   if (result == -1)
+      return -1;
+
+   if ((procdata->opts & OPT_DEDUP) && !errcode && !replicate)
+      source = handle_dedup_file(procdata, pathname, &buffer, newsize, content_hash);
+
+   if (bcast == suppress_broadcast) {
+      filemngt_release_mapping(buffer);
+      return 0;
    }
 
-  do_broadcast:
-   if (bcast == suppress_broadcast)
-      goto done;
+   if (errcode)
+      return handle_broadcast_errorcode(procdata, pathname, errcode, NODE_PEER_NULL);
 
-   if (alias_to) {
-      result = handle_broadcast_alias(procdata, pathname, alias_to);
+   if (bcast == prefetch_broadcast)
+      handle_prefetch_arrived(procdata, pathname, newsize);
+   if (source && bcast != preload_broadcast) {
+      result = handle_broadcast_content_alias(procdata, pathname, source, newsize, bcast, NODE_PEER_NULL);
+      if (result != -1)
+         result = handle_send_refetches(procdata, pathname, buffer, newsize, NODE_PEER_NULL);
    }
-   else if (!errcode) {
-      result = handle_broadcast_file(procdata, pathname, buffer, newsize, bcast);
+   else
+      result = handle_broadcast_file(procdata, pathname, buffer, newsize, bcast, NODE_PEER_NULL);
+   if (result != -1) {
+      /* Start on the libraries this object will load while its users are still receiving it */
+      result = handle_prefetch_deps(procdata, pathname, buffer, newsize);
    }
-   else {
-      result = handle_broadcast_errorcode(procdata, pathname, errcode);
+   filemngt_release_mapping(buffer);
+   return result;
+}
+
+/**
+ * A reader thread finished reading a file.  Called from the event loop.
+ * Finish and broadcast the file, then wake the clients waiting on it.
+ **/
+static int handle_read_file_done(ldcs_process_data_t *procdata, readpool_job_t *job)
+{
+   handle_read_t *rd = (handle_read_t *) job->data;
+   int result, global_result = 0;
+   int errcode = job->errcode;
+
+   if (job->result == -1) {
+      /* Release the buffer and report the failure, so requestors don't wait forever */
+      err_printf("Reader thread failed to read %s\n", job->pathname);
+      global_result = -1;
+      if (!errcode)
+         errcode = EIO;
    }
+
+   procdata->server_stat.libread.cnt++;
+   procdata->server_stat.libread.bytes += !errcode ? job->newsize : 0;
+   procdata->server_stat.libread.time += job->read_time;
+
+   procdata->server_stat.libstore.cnt++;
+   procdata->server_stat.libstore.bytes += !errcode && !rd->replicate ? job->newsize : 0;
+   procdata->server_stat.libstore.time += job->read_time;
+
+   clear_requestor(procdata->pending_reads, job->pathname);
+
+   result = handle_finish_read(procdata, job->pathname, rd->localname, &rd->fd, (char *) job->buffer,
+                               job->size, job->newsize, rd->replicate, errcode, job->content_hash, rd->bcast);
    if (result == -1)
       global_result = -1;
+   if (rd->fd != -1)
+      close(rd->fd);
 
-  done:
-   if (fd != -1)
-      close(fd);
+   result = handle_progress_key(procdata, job->pathname);
+   if (result == -1)
+      global_result = -1;
+
+   if (been_requested(procdata->preload_reads, job->pathname)) {
+      clear_requestor(procdata->preload_reads, job->pathname);
+      procdata->preload_reads_active--;
+      result = handle_preload_next(procdata);
+      if (result == -1)
+         global_result = -1;
+   }
+
+   free(job->pathname);
+   free(rd);
    return global_result;
 }
 
 /**
- * Send a file's contents across the network
+ * A server that reads an ELF object off disk reads the libraries it
+ * depends on straight away and pushes them to every server, rather than
+ * waiting for each client's ld.so to ask for them one at a time.  Each
+ * dependency is the first of ld.so's candidate paths that exists.  The
+ * directory cache answers that, and directories this server is
+ * responsible for are read as needed.  A dependency whose candidates lead
+ * to another reader's directories is left for clients to request.
+ * Prefetched libraries are themselves ELF objects, so this walks the whole
+ * DT_NEEDED closure.
  **/
-static int handle_broadcast_file(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size, broadcast_t bcast)
+static int handle_prefetch_deps(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size)
 {
-   char *packet_buffer = NULL;
+   prefetch_dep_t *deps;
+   int num_deps, i, j, result, global_result = 0;
+   double starttime;
+
+   if (!procdata->prefetch || !(procdata->opts & OPT_RELOCSO) || (procdata->opts & OPT_STOPRELOC))
+      return 0;
+   if (!filemngt_is_elf_file(buffer, size))
+      return 0;
+
+   starttime = ldcs_get_time();
+   result = prefetch_find_deps(pathname, buffer, size, &deps, &num_deps);
+   procdata->server_stat.prefetch.time += ldcs_get_time() - starttime;
+   if (result == -1) {
+      debug_printf3("%s has no dynamic section to prefetch from\n", pathname);
+      return 0;
+   }
+
+   for (i = 0; i < num_deps; i++) {
+      for (j = 0; j < deps[i].num_paths; j++) {
+         result = handle_prefetch_file(procdata, deps[i].paths[j]);
+         if (result == 1)
+            continue;
+         if (result == -1) {
+            err_printf("Error prefetching %s for %s\n", deps[i].paths[j], pathname);
+            global_result = -1;
+         }
+         break;
+      }
+      if (j == deps[i].num_paths)
+         debug_printf2("Could not find %s, needed by %s, to prefetch\n", deps[i].needed, pathname);
+   }
+
+   prefetch_free_deps(deps, num_deps);
+   return global_result;
+}
+
+/**
+ * Prefetch one candidate path of a dependency.  Returns 1 if it doesn't
+ * exist, and ld.so would move on to the next candidate, or 0 once the file
+ * is loaded, being read, or can only be found by another server.
+ **/
+static int handle_prefetch_file(ldcs_process_data_t *procdata, char *pathname)
+{
+   char path[MAX_PATH_LEN+1], filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+   char *localpath, *alias_to;
+   int errcode = 0, step, result;
+   handle_file_result_t fresult;
+
+   path[MAX_PATH_LEN] = filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = '\0';
+   strncpy(path, pathname, MAX_PATH_LEN);
+
+   for (step = 0; step < PREFETCH_MAX_STEPS; step++) {
+      parseFilenameNoAlloc(path, filename, dirname, MAX_PATH_LEN);
+      fresult = handle_howto_file(procdata, path, filename, dirname, &localpath, &alias_to, &errcode);
+      switch (fresult) {
+         case NO_FILE:
+         case NO_DIR:
+            return 1;
+         case FOUND_ERRCODE:
+            /* Local files have no errcode, and are loaded from where they are */
+            return errcode ? 1 : 0;
+         case FOUND_FILE:
+         case READING_FILE:
+         case ORIG_FILE:
+         case REQ_DIRECTORY:
+         case REQ_FILE:
+            return 0;
+         case READ_DIRECTORY:
+            result = handle_read_and_broadcast_dir(procdata, dirname);
+            if (result == -1)
+               return -1;
+            break;
+         case ALIAS_TO:
+            strncpy(path, alias_to, MAX_PATH_LEN);
+            break;
+         case READ_FILE:
+            debug_printf2("Prefetching %s\n", path);
+            result = handle_read_and_broadcast_file(procdata, path, prefetch_broadcast);
+            if (result == -1)
+               return -1;
+            break;
+      }
+   }
+   return 0;
+}
+
+/**
+ * A prefetched file is in this server's cache.  It counts as a hit if a
+ * client here loads it, and as wasted otherwise.
+ **/
+static void handle_prefetch_arrived(ldcs_process_data_t *procdata, char *pathname, size_t size)
+{
+   if (been_requested(procdata->prefetched_files, pathname))
+      return;
+   add_requestor(procdata->prefetched_files, pathname, NODE_PEER_NULL);
+   procdata->server_stat.prefetch.cnt++;
+   procdata->server_stat.prefetch.bytes += size;
+}
+
+static void handle_prefetch_hit(ldcs_process_data_t *procdata, char *pathname)
+{
+   char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+   char *alias_to;
+   void *buffer;
+   size_t size = 0;
+
+   if (!been_requested(procdata->prefetched_files, pathname))
+      return;
+   clear_requestor(procdata->prefetched_files, pathname);
+
+   filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = '\0';
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   if (ldcs_cache_get_buffer(dirname, filename, &buffer, &size, &alias_to) == -1)
+      size = 0;
+   debug_printf3("Client loaded prefetched file %s\n", pathname);
+   procdata->server_stat.prefetch_hit.cnt++;
+   procdata->server_stat.prefetch_hit.bytes += size;
+}
+
+/**
+ * A file in the local cache was just used, which moves it to the back of
+ * the eviction order
+ **/
+static void handle_cache_touch(ldcs_process_data_t *procdata, char *pathname)
+{
+   char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+
+   if (!procdata->cache_budget)
+      return;
+   filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = '\0';
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   ldcs_cache_lruTouch(filename, dirname);
+}
+
+/**
+ * A file's contents were just stored in the local cache.  Make room for it
+ * if that took the cache over budget.
+ **/
+static int handle_cache_insert(ldcs_process_data_t *procdata, char *pathname)
+{
+   char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+
+   filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = '\0';
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   ldcs_cache_lruInsert(filename, dirname);
+   clear_requestor(procdata->refetch_files, pathname);
+   return handle_evict_files(procdata);
+}
+
+/**
+ * Bring the local cache back under its budget by removing the least
+ * recently used files that no process on this node has open or mapped.
+ * Evicting a file that is in use wouldn't free its memory, so those are
+ * moved to the back of the order and passed over.  Evicted files stay in
+ * the cache as existing but not present, and are read or re-requested
+ * (see handle_send_file_query) the next time a client asks for them.
+ **/
+static int handle_evict_files(ldcs_process_data_t *procdata)
+{
+   char pathname[MAX_PATH_LEN+1];
+   char *filename, *dirname, *localname;
+   size_t size, used, prev_used;
+   double starttime, now, last_use;
+   int i, count, result;
+
+   if (!procdata->cache_budget)
+      return 0;
+   ldcs_cache_lruStats(&used, NULL, &count);
+   if (used <= procdata->cache_budget)
+      return 0;
+
+   starttime = now = ldcs_get_time();
+   for (i = 0; i < count && used > procdata->cache_budget; i++) {
+      if (ldcs_cache_lruOldest(&filename, &dirname, &localname, &size, &last_use) == -1)
+         break;
+      if (now - last_use < EVICT_MIN_AGE)
+         break;
+      snprintf(pathname, sizeof(pathname), "%s/%s", dirname, filename);
+
+      prev_used = used;
+      result = filemngt_evict_file(localname);
+      if (result == 0) {
+         debug_printf2("Evicted %s (%s, %lu bytes) from the local cache\n", pathname, localname,
+                       (unsigned long) size);
+         ldcs_cache_evict(filename, dirname);
+         add_requestor(procdata->refetch_files, pathname, NODE_PEER_NULL);
+         clear_requestor(procdata->prefetched_files, pathname);
+         /* Only the last name of a dedup'd copy frees its bytes */
+         ldcs_cache_lruStats(&used, NULL, NULL);
+         procdata->server_stat.evict.cnt++;
+         procdata->server_stat.evict.bytes += prev_used - used;
+      }
+      else {
+         ldcs_cache_lruTouch(filename, dirname);
+         if (result == -1) {
+            err_printf("Cannot tell which cached files are in use.  Disabling the cache budget\n");
+            procdata->cache_budget = 0;
+            break;
+         }
+         debug_printf3("Not evicting %s, which is in use\n", pathname);
+         procdata->server_stat.evict_busy.cnt++;
+         procdata->server_stat.evict_busy.bytes += size;
+      }
+   }
+   procdata->server_stat.evict.time += ldcs_get_time() - starttime;
+
+   if (procdata->cache_budget && used > procdata->cache_budget)
+      debug_printf2("Local cache holds %lu bytes, over its %lu byte budget, after evicting what it could\n",
+                    (unsigned long) used, (unsigned long) procdata->cache_budget);
+   return 0;
+}
+
+/**
+ * Find the local copy of a cached file that its contents are sent from.
+ * Replicated files send from the numa domain 0 copy.  Returns -1 if there
+ * is no local file.
+ **/
+static int handle_cached_localfile(char *pathname, char *localfile)
+{
+   char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+   char *localname = NULL;
+   int errcode = 0, replicate = 0;
+   ldcs_cache_result_t cresult;
+
+   filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = localfile[MAX_PATH_LEN] = '\0';
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   cresult = ldcs_cache_findFileDirInCache(filename, dirname, &localname, &errcode);
+   if (cresult != LDCS_CACHE_FILE_FOUND || !localname || errcode)
+      return -1;
+
+   strncpy(localfile, localname, MAX_PATH_LEN);
+   ldcs_cache_isReplicated(filename, dirname, &replicate);
+   if (replicate)
+      numa_update_local_filename(localfile, 0);
+   return 0;
+}
+
+/**
+ * Open the local copy of a cached file so its contents can be sent straight
+ * from the page cache.  Returns -1 if there is no local file.
+ **/
+static int handle_open_cached_file(char *pathname)
+{
+   char localfile[MAX_PATH_LEN+1];
+   int fd;
+
+   if (handle_cached_localfile(pathname, localfile) == -1)
+      return -1;
+
+   fd = open(localfile, O_RDONLY);
+   if (fd == -1) {
+      debug_printf2("Could not open %s for sending %s from page cache: %s\n", localfile, pathname, strerror(errno));
+      return -1;
+   }
+   return fd;
+}
+
+/**
+ * Map the local copy of a cached file for sending it.  Hand the mapping
+ * back with filemngt_release_mapping.
+ **/
+static char *handle_map_cached_file(char *pathname, size_t size)
+{
+   char localfile[MAX_PATH_LEN+1];
+
+   if (handle_cached_localfile(pathname, localfile) == -1) {
+      err_printf("No local copy of %s to send\n", pathname);
+      return NULL;
+   }
+   return (char *) filemngt_map_cached_file(localfile, size);
+}
+
+/**
+ * Send a file's contents across the network.  If buffer is NULL the
+ * contents are mapped from the local copy for the duration of the send.
+ **/
+static int handle_broadcast_file(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size, broadcast_t bcast,
+                                 node_peer_t from)
+{
+   char *packet_buffer = NULL, *mapped = NULL;
    size_t packet_size;
    double starttime;
    int result, global_result = 0;
    ldcs_message_t msg;
    int force_broadcast;
+   int file_fd = -1;
+
+   if (!buffer && size) {
+      buffer = mapped = handle_map_cached_file(pathname, size);
+      if (!buffer)
+         return -1;
+   }
 
    result = filemngt_encode_packet(pathname, buffer, size, &packet_buffer, &packet_size);
    if (result == -1) {
@@ -950,6 +1538,10 @@ static int handle_broadcast_file(ldcs_process_data_t *procdata, char *pathname,
       msg.header.type = LDCS_MSG_PRELOAD_FILE;
       force_broadcast = 1;
    }
+   else if (bcast == prefetch_broadcast) {
+      msg.header.type = LDCS_MSG_PREFETCH_FILE;
+      force_broadcast = 1;
+   }
    else {
       msg.header.type = LDCS_MSG_FILE_DATA;
       force_broadcast = 0;
@@ -958,8 +1550,11 @@ static int handle_broadcast_file(ldcs_process_data_t *procdata, char *pathname,
    msg.data = packet_buffer;
    
    starttime = ldcs_get_time();
+
+   if (size)
+      file_fd = handle_open_cached_file(pathname);
    
-   result = handle_send_msg_to_keys(procdata, &msg, pathname, buffer, size, force_broadcast, metadata_none);
+   result = handle_send_msg_to_keys(procdata, &msg, pathname, buffer, size, file_fd, force_broadcast, metadata_none, from);
    if (result == -1) {
       global_result = -1;
       goto done;
@@ -972,14 +1567,192 @@ static int handle_broadcast_file(ldcs_process_data_t *procdata, char *pathname,
   done:
    if (packet_buffer)
       free(packet_buffer);
+   if (file_fd != -1)
+      close(file_fd);
+
+   if (global_result == 0)
+      global_result = handle_send_refetches(procdata, pathname, buffer, size, from);
+   filemngt_release_mapping(mapped);
+   return global_result;
+}
+
+/**
+ * Send a file to the children that evicted it, or couldn't resolve it as a
+ * content alias, and asked for it again.  The broadcast skips them, because
+ * they were already sent the file once.  If buffer is NULL the contents are
+ * mapped from the local copy.
+ **/
+static int handle_send_refetches(ldcs_process_data_t *procdata, char *pathname, char *buffer, size_t size,
+                                 node_peer_t from)
+{
+   node_peer_t *nodes, *targets = NULL;
+   char *packet_buffer = NULL, *mapped = NULL;
+   size_t packet_size;
+   int i, num_nodes, num_targets = 0, result, global_result = 0;
+   int file_fd = -1;
+   ldcs_message_t msg;
+
+   if (!been_requested(procdata->refetch_requests, pathname))
+      return 0;
+   if (get_requestors(procdata->refetch_requests, pathname, &nodes, &num_nodes) == -1)
+      return 0;
+   targets = (node_peer_t *) malloc(sizeof(node_peer_t) * (num_nodes ? num_nodes : 1));
+   for (i = 0; i < num_nodes; i++) {
+      if (nodes[i] != NODE_PEER_NULL && nodes[i] != NODE_PEER_CLIENT && nodes[i] != from)
+         targets[num_targets++] = nodes[i];
+   }
+   clear_requestor(procdata->refetch_requests, pathname);
+   if (!num_targets)
+      goto done;
+
+   if (!buffer && size) {
+      buffer = mapped = handle_map_cached_file(pathname, size);
+      if (!buffer) {
+         global_result = -1;
+         goto done;
+      }
+   }
+
+   result = filemngt_encode_packet(pathname, buffer, size, &packet_buffer, &packet_size);
+   if (result == -1) {
+      global_result = -1;
+      goto done;
+   }
+   msg.header.type = LDCS_MSG_FILE_DATA;
+   msg.header.len = packet_size;
+   msg.data = packet_buffer;
+   if (size)
+      file_fd = handle_open_cached_file(pathname);
+
+   debug_printf2("Re-sending %s to %d servers that evicted it\n", pathname, num_targets);
+   for (i = 0; i < num_targets; i++) {
+      result = spindle_send_file(procdata, &msg, targets[i], buffer, size, file_fd);
+      if (result == -1)
+         global_result = -1;
+   }
+   procdata->server_stat.libdist.cnt++;
+   procdata->server_stat.libdist.bytes += packet_size * num_targets;
 
+  done:
+   if (packet_buffer)
+      free(packet_buffer);
+   if (file_fd != -1)
+      close(file_fd);
+   filemngt_release_mapping(mapped);
+   free(targets);
    return global_result;
 }
 
+/**
+ * With OPT_DEDUP, look for a file in the local cache with the same contents
+ * as pathname, which was just read into *buffer.  If there is one,
+ * pathname's local copy becomes a hard link to that file, whose path is
+ * returned, and *buffer is swapped for a mapping of that file.  Otherwise
+ * pathname is recorded as the copy of its contents and NULL is returned.
+ **/
+static char *handle_dedup_file(ldcs_process_data_t *procdata, char *pathname, char **buffer, size_t size,
+                               uint64_t content_hash)
+{
+   char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+   char source_local[MAX_PATH_LEN+1];
+   char *source, *localname;
+   void *source_buffer;
+   int errcode, replicate = 0, result;
+   double starttime;
+
+   filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = '\0';
+   source = dedup_lookup(content_hash, size);
+   if (source && strcmp(source, pathname) != 0) {
+      parseFilenameNoAlloc(source, filename, dirname, MAX_PATH_LEN);
+      ldcs_cache_isReplicated(filename, dirname, &replicate);
+      if (replicate || handle_cached_localfile(source, source_local) == -1)
+         source = NULL;
+   }
+   else {
+      source = NULL;
+   }
+   if (!source) {
+      /* Nothing else here has these contents, or the file that did was evicted */
+      dedup_insert(content_hash, size, pathname);
+      return NULL;
+   }
+
+   starttime = ldcs_get_time();
+   source_buffer = filemngt_map_cached_file(source_local, size);
+   if (!source_buffer)
+      return NULL;
+   if (memcmp(source_buffer, *buffer, size) != 0) {
+      debug_printf("%s and %s have the same content hash, but different contents\n", pathname, source);
+      filemngt_release_mapping(source_buffer);
+      return NULL;
+   }
+
+   /* Same contents, so the caller can carry on with either mapping */
+   filemngt_release_mapping(*buffer);
+   *buffer = (char *) source_buffer;
+
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   ldcs_cache_findFileDirInCache(filename, dirname, &localname, &errcode);
+   if (!localname)
+      return NULL;
+   result = filemngt_link_file(source_local, localname);
+   if (result == -1)
+      return NULL;
+   /* Its bytes are now counted once, with the source's */
+   ldcs_cache_lruInsert(filename, dirname);
+
+   debug_printf2("Stored %s as a link to %s, which has the same contents\n", pathname, source);
+   procdata->server_stat.dedup.cnt++;
+   procdata->server_stat.dedup.bytes += size;
+   procdata->server_stat.dedup.time += ldcs_get_time() - starttime;
+   return source;
+}
+
+/**
+ * Send pathname as a link to source, a file with the same contents, in
+ * place of its contents
+ **/
+static int handle_broadcast_content_alias(ldcs_process_data_t *procdata, char *pathname, char *source, size_t size,
+                                          broadcast_t bcast, node_peer_t from)
+{
+   char *packet_buffer;
+   size_t packet_size, pos = 0, path_len, source_len;
+   ldcs_message_t msg;
+   int result;
+   double starttime;
+
+   debug_printf2("Broadcasting %s as a link to %s\n", pathname, source);
+   path_len = strlen(pathname) + 1;
+   source_len = strlen(source) + 1;
+
+   packet_size = sizeof(size) + path_len + source_len;
+   packet_buffer = (char *) malloc(packet_size);
+   memcpy(packet_buffer + pos, &size, sizeof(size));
+   pos += sizeof(size);
+   memcpy(packet_buffer + pos, pathname, path_len);
+   pos += path_len;
+   memcpy(packet_buffer + pos, source, source_len);
+   pos += source_len;
+   assert(pos == packet_size);
+
+   msg.header.type = (bcast == prefetch_broadcast) ? LDCS_MSG_PREFETCH_CONTENT_ALIAS : LDCS_MSG_CONTENT_ALIAS;
+   msg.header.len = packet_size;
+   msg.data = packet_buffer;
+
+   starttime = ldcs_get_time();
+   result = handle_send_msg_to_keys(procdata, &msg, pathname, NULL, 0, -1, bcast == prefetch_broadcast,
+                                    metadata_none, from);
+   procdata->server_stat.libdist.cnt++;
+   procdata->server_stat.libdist.bytes += packet_size;
+   procdata->server_stat.libdist.time += (ldcs_get_time() - starttime);
+   free(packet_buffer);
+   return result;
+}
+
 /**
  * Broadcast an error result from reading a file rather than file contents
  **/
-static int handle_broadcast_errorcode(ldcs_process_data_t *procdata, char *pathname, int errcode)
+static int handle_broadcast_errorcode(ldcs_process_data_t *procdata, char *pathname, int errcode, node_peer_t from)
 {
    char *packet_buffer = NULL;
    size_t packet_size = 0;
@@ -1007,7 +1780,7 @@ static int handle_broadcast_errorcode(ldcs_process_data_t *procdata, char *pathn
    msg.data = packet_buffer;
 
    starttime = ldcs_get_time();
-   result = handle_send_msg_to_keys(procdata, &msg, pathname, NULL, 0, 0, metadata_none);
+   result = handle_send_msg_to_keys(procdata, &msg, pathname, NULL, 0, -1, 0, metadata_none, from);
    procdata->server_stat.libdist.cnt++;
    procdata->server_stat.libdist.bytes += packet_size;
    procdata->server_stat.libdist.time += (ldcs_get_time() - starttime);      
@@ -1017,9 +1790,11 @@ static int handle_broadcast_errorcode(ldcs_process_data_t *procdata, char *pathn
 }
 
 /**
- * Broadcast an alias (soft symlink) that's the result from accessing a file
+ * Broadcast an alias (soft symlink) that's the result from accessing a file.
+ * Prefetched aliases go to every server, like the files they lead to.
  **/
-static int handle_broadcast_alias(ldcs_process_data_t *procdata, char *alias_from, char *alias_to)
+static int handle_broadcast_alias(ldcs_process_data_t *procdata, char *alias_from, char *alias_to, broadcast_t bcast,
+                                  node_peer_t from)
 {
    char *packet_buffer = 0;
    size_t packet_size = 0, pos = 0, from_len, to_len;
@@ -1041,12 +1816,13 @@ static int handle_broadcast_alias(ldcs_process_data_t *procdata, char *alias_fro
    pos += to_len;
    assert(pos == packet_size);
 
-   msg.header.type = LDCS_MSG_ALIAS;
+   msg.header.type = (bcast == prefetch_broadcast) ? LDCS_MSG_PREFETCH_ALIAS : LDCS_MSG_ALIAS;
    msg.header.len = packet_size;
    msg.data = packet_buffer;
 
    starttime = ldcs_get_time();
-   result = handle_send_msg_to_keys(procdata, &msg, alias_from, NULL, 0, 0, metadata_none);
+   result = handle_send_msg_to_keys(procdata, &msg, alias_from, NULL, 0, -1, bcast == prefetch_broadcast,
+                                    metadata_none, from);
    procdata->server_stat.libdist.cnt++;
    procdata->server_stat.libdist.bytes += packet_size;
    procdata->server_stat.libdist.time += (ldcs_get_time() - starttime);      
@@ -1073,7 +1849,7 @@ static int handle_client_return_numa_replication(ldcs_process_data_t *procdata,
    ldcs_client_t *client = procdata->client_table + nc;   
    int replication;
 
-   if (!(procdata->opts | OPT_NUMA)) {
+   if (!(procdata->opts & OPT_NUMA)) {
       client->query_is_numa_replicated = 0;
       return 0;
    }
@@ -1085,13 +1861,55 @@ static int handle_client_return_numa_replication(ldcs_process_data_t *procdata,
    return 0;
 }
 
+/**
+ * With lazy replication, hold a client whose numa node doesn't have a copy
+ * of its file yet, and start making that copy if no one else has.  Returns 1
+ * if the client was held.
+ **/
+static int handle_hold_for_numa_replica(ldcs_process_data_t *procdata, int nc)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   char replica_name[MAX_PATH_LEN+1];
+
+   if (!client->query_is_numa_replicated || procdata->numa_replicate != numa_replicate_lazy)
+      return 0;
+
+   switch (numa_replica_state(client->query_localpath, client->numa_node)) {
+      case numa_replica_ready:
+      case numa_replica_failed:
+         return 0;
+      case numa_replica_missing:
+         if (numa_replica_submit(client->query_localpath, client->numa_node) == -1)
+            return 0;
+         break;
+      case numa_replica_pending:
+         break;
+   }
+
+   strncpy(replica_name, client->query_localpath, MAX_PATH_LEN);
+   replica_name[MAX_PATH_LEN] = '\0';
+   numa_update_local_filename(replica_name, client->numa_node);
+   debug_printf3("Holding client until replica %s is created\n", replica_name);
+   waitqueue_add(procdata->client_waitqueue, replica_name, nc);
+   return 1;
+}
+
+/**
+ * A replica thread finished creating replica_name.  Wake the clients that were 
+ * waiting on it.  If it failed they're handed the node 0 copy.
+ **/
+int handle_numa_replica_done(ldcs_process_data_t *procdata, char *replica_name, int node, int result)
+{
+   return handle_progress_key(procdata, replica_name);
+}
+
 /**
  * Sends a message to a client with the local path for a sucessfully read file.
  **/
 static int handle_client_fulfilled_query(ldcs_process_data_t *procdata, int nc)
 {
    ldcs_message_t out_msg;
-   int connid, zero = 0;
+   int connid, node, zero = 0;
    char buffer_out[MAX_PATH_LEN+1+sizeof(int)];
    char *outfile;
    ldcs_client_t *client = procdata->client_table + nc;
@@ -1102,6 +1920,9 @@ static int handle_client_fulfilled_query(ldcs_process_data_t *procdata, int nc)
    if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
       return 0;
 
+   handle_prefetch_hit(procdata, client->query_globalpath);
+   handle_cache_touch(procdata, client->query_globalpath);
+
    out_msg.header.type = LDCS_MSG_FILE_QUERY_ANSWER;
    out_msg.data = (void *) buffer_out;
    memcpy(out_msg.data, &zero, sizeof(int));
@@ -1110,13 +1931,16 @@ static int handle_client_fulfilled_query(ldcs_process_data_t *procdata, int nc)
    strncpy(outfile, client->query_localpath, MAX_PATH_LEN);
    buffer_out[sizeof(buffer_out)-1] = '\0';
    if (client->query_is_numa_replicated) {
-      debug_printf3("Updating local file %s with numa domain %d before sending to client\n", outfile, client->numa_node);
-      numa_update_local_filename(outfile, client->numa_node);
+      node = client->numa_node;
+      if (numa_replica_state(client->query_localpath, node) != numa_replica_ready)
+         node = 0;
+      debug_printf3("Updating local file %s with numa domain %d before sending to client\n", outfile, node);
+      numa_update_local_filename(outfile, node);
    }
    
    out_msg.header.len = strlen(client->query_localpath) + 1 + sizeof(int);
 
-   ldcs_send_msg(connid, &out_msg);
+   handle_client_answer(procdata, nc, &out_msg);
 
    debug_printf2("Server answering query (fulfilled): %s\n", out_msg.data);
    
@@ -1149,7 +1973,7 @@ static int handle_client_rejected_query(ldcs_process_data_t *procdata, int nc, i
 
    out_msg.header.len = sizeof(buffer_out);
       
-   ldcs_send_msg(connid, &out_msg);
+   handle_client_answer(procdata, nc, &out_msg);
 
    debug_printf2("Server answering query (rejected with errcode %d)\n", errcode);
       
@@ -1168,6 +1992,10 @@ static int handle_exit_broadcast(ldcs_process_data_t *procdata)
    ldcs_message_t out_msg;
    debug_printf("Setting up Exiting after receiving exit bcast message\n");
 
+   /* If the FE is shutting us down before we were exit ready, hand it what we have */
+   if (procdata->md_rank == 0)
+      manifest_send(procdata);
+
    out_msg.header.type = LDCS_MSG_EXIT;
    out_msg.header.len = 0;
    out_msg.data = NULL;
@@ -1190,7 +2018,7 @@ static int handle_request(ldcs_process_data_t *procdata, node_peer_t from, ldcs_
    char *pathname = msg->data+1;
 
    debug_printf2("Got request for %s from network\n", pathname);
-   if (msg_type != 'D' && msg_type != 'F') {
+   if (msg_type != 'D' && msg_type != 'F' && msg_type != 'R') {
       err_printf("Badly formed request message with starting char '%c'\n", msg_type);
       return -1;
    }
@@ -1198,7 +2026,7 @@ static int handle_request(ldcs_process_data_t *procdata, node_peer_t from, ldcs_
    if (is_dir)
       return handle_request_directory(procdata, from, pathname);
    else
-      return handle_request_file(procdata, from, pathname);
+      return handle_request_file(procdata, from, pathname, msg_type == 'R');
 
    return result;
 }
@@ -1225,7 +2053,7 @@ static int handle_request_directory(ldcs_process_data_t *procdata, node_peer_t f
       case NO_FILE:
       case FOUND_FILE:
          add_requestor(procdata->pending_requests, pathname, from);
-         return handle_broadcast_dir(procdata, pathname, request_broadcast);
+         return handle_broadcast_dir(procdata, pathname, request_broadcast, NODE_PEER_NULL);
       default:
          err_printf("Unexpected return from handle_how_directory: %d\n", (int) result);
          assert(0);
@@ -1274,8 +2102,12 @@ static int handle_client_metadata(ldcs_process_data_t *procdata, int nc)
       assert(0);
       
    stat_result = handle_howto_metadata(procdata, pathname, mdtype);
+   if ((stat_result == REQUEST_METADATA || stat_result == METADATA_FILE) &&
+       handle_hold_for_preload(procdata, nc, pathname))
+      return 0;
    switch (stat_result) {
       case REQUEST_METADATA:
+         waitqueue_add(procdata->client_waitqueue, pathname, nc);
          return handle_metadata_request(procdata, pathname, mdtype, NODE_PEER_CLIENT);
       case METADATA_FILE:
          add_requestor(metadata_pending_requests(procdata, mdtype), pathname, NODE_PEER_CLIENT);
@@ -1288,6 +2120,7 @@ static int handle_client_metadata(ldcs_process_data_t *procdata, int nc)
          return handle_client_metadata_result(procdata, nc, mdtype);
       case METADATA_IN_PROGRESS:
          add_requestor(metadata_pending_requests(procdata, mdtype), pathname, NODE_PEER_CLIENT);
+         waitqueue_add(procdata->client_waitqueue, pathname, nc);
          return 0;
    }
    err_printf("Unexpected result from handle_howto_metadata: %d\n", (int) stat_result);
@@ -1299,7 +2132,7 @@ static int handle_client_metadata(ldcs_process_data_t *procdata, int nc)
  * We've received a request for a file from the network.  
  * Satisify or forward it.
  **/
-static int handle_request_file(ldcs_process_data_t *procdata, node_peer_t from, char *pathname)
+static int handle_request_file(ldcs_process_data_t *procdata, node_peer_t from, char *pathname, int refetch)
 {
    char *localname;
    void *buffer;
@@ -1312,20 +2145,28 @@ static int handle_request_file(ldcs_process_data_t *procdata, node_peer_t from,
    parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
    fresult = handle_howto_file(procdata, pathname, filename, dirname, &localname, &alias_to, &errcode);
 
-   debug_printf2("Received request for file %s from network\n", pathname);
+   debug_printf2("Received %srequest for file %s from network\n", refetch ? "re-fetch " : "", pathname);
+   if (refetch && (fresult == FOUND_FILE || fresult == READ_FILE || fresult == READING_FILE ||
+                   fresult == REQ_FILE || fresult == REQ_DIRECTORY)) {
+      /* The requestor evicted its copy.  It gets the file whether or not it was sent before */
+      add_requestor(procdata->refetch_requests, pathname, from);
+   }
    switch (fresult) {
       case FOUND_FILE:
+         /* The cache doesn't keep the contents mapped, so buffer is NULL and
+            handle_broadcast_file maps them */
          result = ldcs_cache_get_buffer(dirname, filename, &buffer, &size, &alias_to);
          if (result == -1) {
             err_printf("Failed to lookup %s / %s in cache\n", dirname, filename);
             return -1;
          }
+         handle_cache_touch(procdata, pathname);
          add_requestor(procdata->pending_requests, pathname, from);
-         result = handle_broadcast_file(procdata, pathname, buffer, size, request_broadcast);
+         result = handle_broadcast_file(procdata, pathname, buffer, size, request_broadcast, NODE_PEER_NULL);
          return result;
       case FOUND_ERRCODE:
          add_requestor(procdata->pending_requests, pathname, from);         
-         return handle_broadcast_errorcode(procdata, pathname, errcode);
+         return handle_broadcast_errorcode(procdata, pathname, errcode, NODE_PEER_NULL);
       case NO_FILE:
       case NO_DIR:
       case ORIG_FILE:
@@ -1334,10 +2175,14 @@ static int handle_request_file(ldcs_process_data_t *procdata, node_peer_t from,
          result = handle_read_and_broadcast_dir(procdata, dirname);
          if (result == -1)
             return -1;
-         return handle_request_file(procdata, from, pathname);
+         return handle_request_file(procdata, from, pathname, refetch);
       case READ_FILE:
          add_requestor(procdata->pending_requests, pathname, from);
          return handle_read_and_broadcast_file(procdata, pathname, request_broadcast);
+      case READING_FILE:
+         /* Sent to the requestor when the read finishes */
+         add_requestor(procdata->pending_requests, pathname, from);
+         return 0;
       case REQ_DIRECTORY:
          dir_result = handle_send_query(procdata, dirname, 1);
          add_requestor(procdata->pending_requests, dirname, from);
@@ -1348,7 +2193,7 @@ static int handle_request_file(ldcs_process_data_t *procdata, node_peer_t from,
          return (result == -1 || dir_result == -1) ? -1 : 0;
       case ALIAS_TO:
          add_requestor(procdata->pending_requests, pathname, from);
-         return handle_broadcast_alias(procdata, pathname, alias_to);         
+         return handle_broadcast_alias(procdata, pathname, alias_to, request_broadcast, NODE_PEER_NULL);
    }
    assert(0);
    return -1;
@@ -1373,7 +2218,19 @@ static int handle_send_query(ldcs_process_data_t *procdata, char *path, int is_d
 }
 
 /**
- * We've received request for a directory's contents. Request it from up the network.
+ * Send a query towards the server responsible for key.  That's down into a child's
+ * subtree if the responsible server lives there, otherwise up to our parent.
+ **/
+static int handle_route_query(ldcs_process_data_t *procdata, ldcs_message_t *msg, char *key)
+{
+   node_peer_t route = ldcs_audit_server_md_query_route(procdata, key);
+   if (route == NODE_PEER_NULL || route == ldcs_audit_server_md_get_parent(procdata))
+      return spindle_forward_query(procdata, msg);
+   return spindle_send(procdata, msg, route);
+}
+
+/**
+ * We've received request for a directory's contents. Request it from the responsible server.
  **/
 static int handle_send_directory_query(ldcs_process_data_t *procdata, char *directory)
 {
@@ -1381,19 +2238,18 @@ static int handle_send_directory_query(ldcs_process_data_t *procdata, char *dire
    char buffer_out[MAX_PATH_LEN+1];
    int bytes_written;
 
-   debug_printf2("Sending directory request for %s up network\n", directory);
+   debug_printf2("Sending directory request for %s across network\n", directory);
    out_msg.header.type = LDCS_MSG_FILE_REQUEST;
    out_msg.data = buffer_out;
 
    bytes_written = snprintf(out_msg.data, MAX_PATH_LEN+1, "D%s", directory);
    out_msg.header.len = bytes_written+1;
 
-   spindle_forward_query(procdata, &out_msg);
-   return 0;
+   return handle_route_query(procdata, &out_msg, directory);
 }
 
 /**
- * We've received request for a files's contents. Request it from up the network.
+ * We've received request for a files's contents. Request it from the responsible server.
  **/
 static int handle_send_file_query(ldcs_process_data_t *procdata, char *fullpath)
 {
@@ -1401,15 +2257,19 @@ static int handle_send_file_query(ldcs_process_data_t *procdata, char *fullpath)
    char buffer_out[MAX_PATH_LEN+1];
    int bytes_written;
 
-   debug_printf2("Sending file request for %s up network\n", fullpath);
+   char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
+
+   debug_printf2("Sending file request for %s across network\n", fullpath);
    out_msg.header.type = LDCS_MSG_FILE_REQUEST;
    out_msg.data = buffer_out;
 
-   bytes_written = snprintf(out_msg.data, MAX_PATH_LEN+1, "F%s", fullpath);
+   /* A file we were sent before but don't have, so ask for it to be sent again */
+   bytes_written = snprintf(out_msg.data, MAX_PATH_LEN+1, "%c%s",
+                            been_requested(procdata->refetch_files, fullpath) ? 'R' : 'F', fullpath);
    out_msg.header.len = bytes_written+1;
 
-   spindle_forward_query(procdata, &out_msg);
-   return 0;
+   parseFilenameNoAlloc(fullpath, filename, dirname, MAX_PATH_LEN);
+   return handle_route_query(procdata, &out_msg, dirname);
 }
 
 /**
@@ -1435,11 +2295,116 @@ static int handle_file_errcode(ldcs_process_data_t *procdata, ldcs_message_t *ms
    parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
    ldcs_cache_updateEntry(filename, dirname, NULL, NULL, 0, NULL, 0, errcode);
 
-   result = handle_broadcast_errorcode(procdata, pathname, errcode);
+   result = handle_broadcast_errorcode(procdata, pathname, errcode, peer);
    if (result == -1)
       return -1;
 
-   return handle_progress(procdata);
+   return handle_progress_key(procdata, pathname);
+}
+
+/**
+ * A file forwarded to target was cut off part way, so the rest of target's
+ * stream would be misframed.  Close the connection and forget that the file
+ * was sent there, so it isn't counted as delivered and can be sent again.
+ **/
+static void handle_drop_file_target(ldcs_process_data_t *procdata, char *pathname, node_peer_t target)
+{
+   ldcs_audit_server_md_fail_peer(procdata, target);
+   remove_requestor(procdata->completed_requests, pathname, NODE_PEER_ALL);
+   remove_requestor(procdata->completed_requests, pathname, target);
+}
+
+/**
+ * Read a file's contents off the network into its buffer.  Large files are
+ * forwarded on to the servers that should get them a chunk at a time, as the
+ * chunks arrive, so every level of the tree is sending at once rather than
+ * each waiting for the whole file.  The wire format is unchanged.  Sets
+ * *forwarded if the file has been sent on.  A server we fail to send to is
+ * dropped without stopping the read.  If the read itself fails then every
+ * server we were forwarding to is dropped and -1 is returned.
+ **/
+static int handle_recv_file_body(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer,
+                                 char *pathname, char *buffer, size_t size, int is_elf, broadcast_t bcast,
+                                 int *forwarded)
+{
+   node_peer_t *targets = NULL;
+   int i, num_targets = 0, all_children, result, global_result = 0;
+   char *packet_buffer = NULL;
+   size_t packet_size, pos, chunk;
+   ldcs_message_t out_msg;
+   double starttime;
+
+   *forwarded = 0;
+   if (size < FILE_CHUNK_SIZE * 2)
+      return ldcs_audit_server_md_complete_msg_read(peer, msg, buffer, size);
+
+   result = handle_msg_targets(procdata, pathname, bcast == preload_broadcast || bcast == prefetch_broadcast,
+                               metadata_none, peer, &targets, &num_targets, &all_children);
+   if (result == -1)
+      return -1;
+   *forwarded = 1;
+   if (!num_targets) {
+      if (targets)
+         free(targets);
+      return ldcs_audit_server_md_complete_msg_read(peer, msg, buffer, size);
+   }
+
+   debug_printf2("Forwarding %s to %d servers in %lu byte chunks as it arrives\n", pathname,
+                 num_targets, (unsigned long) FILE_CHUNK_SIZE);
+   starttime = ldcs_get_time();
+   result = filemngt_encode_packet_prefix(pathname, is_elf, size, &packet_buffer, &packet_size);
+   if (result == -1) {
+      free(targets);
+      return -1;
+   }
+   out_msg.header.type = msg->header.type;
+   out_msg.header.len = packet_size;
+   out_msg.data = packet_buffer;
+
+   /* Anything bundled for these servers must go out ahead of this file */
+   msgbundle_force_flush(procdata);
+   for (i = 0; i < num_targets; i++) {
+      result = ldcs_audit_server_md_send_begin(procdata, &out_msg, targets[i], packet_size - size);
+      if (result == -1) {
+         err_printf("Could not forward %s to server, dropping the server\n", pathname);
+         handle_drop_file_target(procdata, pathname, targets[i]);
+         targets[i] = NODE_PEER_NULL;
+      }
+   }
+
+   for (pos = 0; pos < size; pos += chunk) {
+      chunk = (size - pos < FILE_CHUNK_SIZE) ? size - pos : FILE_CHUNK_SIZE;
+      result = ldcs_audit_server_md_complete_msg_read(peer, msg, buffer + pos, chunk);
+      if (result == -1) {
+         err_printf("Lost the connection while reading %s, dropping the %d servers it was "
+                    "being forwarded to\n", pathname, num_targets);
+         ldcs_audit_server_md_fail_peer(procdata, peer);
+         for (i = 0; i < num_targets; i++) {
+            if (targets[i] != NODE_PEER_NULL)
+               handle_drop_file_target(procdata, pathname, targets[i]);
+         }
+         global_result = -1;
+         break;
+      }
+      for (i = 0; i < num_targets; i++) {
+         if (targets[i] == NODE_PEER_NULL)
+            continue;
+         result = ldcs_audit_server_md_send_continue(procdata, targets[i], buffer + pos, chunk);
+         if (result == -1) {
+            err_printf("Could not forward %s to server, dropping the server\n", pathname);
+            handle_drop_file_target(procdata, pathname, targets[i]);
+            targets[i] = NODE_PEER_NULL;
+         }
+      }
+   }
+
+   procdata->server_stat.libdist.cnt++;
+   procdata->server_stat.libdist.bytes += packet_size;
+   procdata->server_stat.libdist.time += (ldcs_get_time() - starttime);
+
+   free(packet_buffer);
+   free(targets);
+   return global_result;
 }
 
 /**
@@ -1448,10 +2413,10 @@ static int handle_file_errcode(ldcs_process_data_t *procdata, ldcs_message_t *ms
 static int handle_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, broadcast_t bcast)
 {
    char pathname[MAX_PATH_LEN+1], *localname;
-   char *buffer = NULL;
+   char *buffer = NULL, *mapped = NULL;
    size_t size = 0;
    int result, global_error = 0, already_loaded, fd = -1, bytes_read = 0;
-   int replicate, is_elf;
+   int replicate, is_elf, forwarded = 0;
    
    pathname[MAX_PATH_LEN] = '\0';
 
@@ -1471,7 +2436,7 @@ static int handle_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg,
    }
 
    debug_printf("Receiving file contents for file %s from %s\n", pathname, 
-                bcast == preload_broadcast ? "preload" : "request");
+                bcast == preload_broadcast ? "preload" : bcast == prefetch_broadcast ? "prefetch" : "request");
 
    /* Setup up a memory buffer for us to read into, which is mapped to the
       local file.  Also fills in the hash table.  Does not actually read
@@ -1491,7 +2456,7 @@ static int handle_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg,
 
    /* Now we'll go ahead and read the file data */
    if (!msg->data) {
-      result = ldcs_audit_server_md_complete_msg_read(peer, msg, buffer, size);
+      result = handle_recv_file_body(procdata, msg, peer, pathname, buffer, size, is_elf, bcast, &forwarded);
       if (result == -1) {
          global_error = -1;
          goto done;
@@ -1507,18 +2472,25 @@ static int handle_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg,
       global_error = -1;
       goto done;
    }
+   mapped = buffer;
+   if (bcast == prefetch_broadcast)
+      handle_prefetch_arrived(procdata, pathname, size);
 
    /* Notify other servers and clients of file read */
-   result = handle_broadcast_file(procdata, pathname, buffer, size, bcast);
+   if (!forwarded)
+      result = handle_broadcast_file(procdata, pathname, buffer, size, bcast, peer);
+   else
+      result = handle_send_refetches(procdata, pathname, buffer, size, peer);
    if (result == -1) {
       global_error = -1;
    }
-   result = handle_progress(procdata);
+   result = handle_progress_key(procdata, pathname);
    if (result == -1) {
       global_error = -1;
    }
 
   done:
+   filemngt_release_mapping(mapped);
    if (fd != -1)
       close(fd);
    return global_error;
@@ -1527,7 +2499,7 @@ static int handle_file_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg,
 /**
  * We've received a packet with directory info.  Process it.
  **/
-static int handle_directory_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, broadcast_t bcast)
+static int handle_directory_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, broadcast_t bcast)
 {
    dirbuffer_iterator_t pos;
    char *filename, *dirname, *dir = NULL;;
@@ -1547,19 +2519,21 @@ static int handle_directory_recv(ldcs_process_data_t *procdata, ldcs_message_t *
       ldcs_cache_addFileDir(dirname, filename);
    }
 
-   handle_broadcast_dir(procdata, dir, bcast);
+   handle_broadcast_dir(procdata, dir, bcast, peer);
    
    procdata->server_stat.distdir.cnt++;
    procdata->server_stat.distdir.bytes += msg->header.len;
    procdata->server_stat.distdir.time += ldcs_get_time() - starttime;
 
-   return handle_progress(procdata);
+   if (!dir)
+      return 0;
+   return handle_progress_key(procdata, dir);
 }
 
 /**
  * We've received a packet with alias info. Handle it.
  **/
-static int handle_alias_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, broadcast_t bcast)
+static int handle_alias_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer, broadcast_t bcast)
 {
    char *alias_from, *alias_to;
    char *data;
@@ -1574,55 +2548,215 @@ static int handle_alias_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg,
    debug_printf2("Received alias from network %s -> %s\n", alias_from, alias_to);
    char filename[MAX_PATH_LEN], dirname[MAX_PATH_LEN];
    parseFilenameNoAlloc(alias_from, filename, dirname, MAX_PATH_LEN);
+   if (bcast == prefetch_broadcast) {
+      /* Prefetched aliases can arrive ahead of their directory's listing */
+      char *localname;
+      int errcode;
+      if (ldcs_cache_findFileDirInCache(filename, dirname, &localname, &errcode) == LDCS_CACHE_FILE_NOT_FOUND)
+         ldcs_cache_addFileDir(dirname, filename);
+   }
    ldcs_cache_updateAlias(filename, dirname, alias_to);
 
-   result = handle_broadcast_alias(procdata, alias_from, alias_to);
+   result = handle_broadcast_alias(procdata, alias_from, alias_to, bcast, peer);
    if (result == -1)
       return -1;
 
-   return handle_progress(procdata);
+   return handle_progress_key(procdata, alias_from);
 }
 
 /**
- * Send a message to child servers.  If in push mode we send to every child always.
- * If in pull mode only send to children who requested the file.
+ * The server that read pathname found it has the same contents as source,
+ * and sent it as a link to source.  Store it as a hard link to our copy of
+ * source.  If we don't have source, ask for pathname's contents instead.
  **/
-int handle_send_msg_to_keys(ldcs_process_data_t *procdata, ldcs_message_t *msg, char *key,
-                            void *secondary_data, size_t secondary_size, int force_broadcast,
-                            metadata_t mdtype)
+static int handle_content_alias_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer,
+                                     broadcast_t bcast)
+{
+   char *data = (char *) msg->data;
+   char *pathname, *source, *localname;
+   char filename[MAX_PATH_LEN+1], dirname[MAX_PATH_LEN+1];
+   char source_filename[MAX_PATH_LEN+1], source_dirname[MAX_PATH_LEN+1];
+   char source_local[MAX_PATH_LEN+1];
+   size_t size;
+   int errcode, result, global_result = 0, replicate = 0, requested;
+   ldcs_cache_result_t cresult;
+   double starttime;
+
+   memcpy(&size, data, sizeof(size));
+   pathname = data + sizeof(size);
+   source = pathname + strlen(pathname) + 1;
+   debug_printf2("Received %s from network as a link to %s\n", pathname, source);
+
+   filename[MAX_PATH_LEN] = dirname[MAX_PATH_LEN] = '\0';
+   source_filename[MAX_PATH_LEN] = source_dirname[MAX_PATH_LEN] = '\0';
+   parseFilenameNoAlloc(pathname, filename, dirname, MAX_PATH_LEN);
+   cresult = ldcs_cache_findFileDirInCache(filename, dirname, &localname, &errcode);
+   if (cresult == LDCS_CACHE_FILE_FOUND && localname) {
+      debug_printf("File %s was already loaded\n", pathname);
+      return 0;
+   }
+
+   parseFilenameNoAlloc(source, source_filename, source_dirname, MAX_PATH_LEN);
+   ldcs_cache_isReplicated(source_filename, source_dirname, &replicate);
+   if (replicate || handle_cached_localfile(source, source_local) == -1)
+      goto refetch;
+
+   starttime = ldcs_get_time();
+   localname = filemngt_calc_localname(pathname, clt_file);
+   assert(localname);
+   if (filemngt_link_file(source_local, localname) == -1) {
+      free(localname);
+      goto refetch;
+   }
+   if (cresult == LDCS_CACHE_FILE_NOT_FOUND)
+      ldcs_cache_addFileDir(dirname, filename);
+   add_global_name(pathname, localname);
+   ldcs_cache_updateBuffer(filename, dirname, localname, NULL, size, 0);
+   handle_cache_insert(procdata, pathname);
+   procdata->server_stat.dedup.cnt++;
+   procdata->server_stat.dedup.bytes += size;
+   procdata->server_stat.dedup.time += ldcs_get_time() - starttime;
+
+   if (bcast == prefetch_broadcast)
+      handle_prefetch_arrived(procdata, pathname, size);
+   result = handle_broadcast_content_alias(procdata, pathname, source, size, bcast, peer);
+   if (result != -1)
+      result = handle_send_refetches(procdata, pathname, NULL, size, peer);
+   if (result == -1)
+      global_result = -1;
+   result = handle_progress_key(procdata, pathname);
+   if (result == -1)
+      global_result = -1;
+   return global_result;
+
+  refetch:
+   /* Our parent counts pathname as sent, so whoever asks for it next here
+      has to ask for it to be sent again */
+   requested = been_requested(procdata->pending_requests, pathname);
+   add_requestor(procdata->refetch_files, pathname, NODE_PEER_NULL);
+
+   /* Servers below us may still have source */
+   result = handle_broadcast_content_alias(procdata, pathname, source, size, bcast, peer);
+   if (result == -1)
+      global_result = -1;
+
+   if (!requested) {
+      debug_printf2("Not fetching %s, a link to %s, which isn't here.  Nobody here asked for it\n",
+                    pathname, source);
+      return global_result;
+   }
+   debug_printf2("Asking for the contents of %s, since %s isn't here\n", pathname, source);
+   result = handle_send_file_query(procdata, pathname);
+   if (result == -1)
+      global_result = -1;
+   /* Don't send a second request while this one is outstanding */
+   add_requestor(procdata->pending_requests, pathname, NODE_PEER_NULL);
+   return global_result;
+}
+
+/**
+ * Serve pathname from the persistent cache, if an earlier job on this node
+ * kept its contents and the root found it unchanged.  Returns -1 if it
+ * can't be, and the file is read or requested as usual.
+ **/
+static int handle_pcache_restore(ldcs_process_data_t *procdata, char *pathname, char *file, char *dir,
+                                 char **localpath)
+{
+   char *localname;
+   uint64_t hash;
+   size_t size;
+   double starttime;
+
+   if (pcache_lookup(procdata, pathname, &hash, &size) == -1)
+      return -1;
+   if ((procdata->opts & OPT_NUMA) && numa_should_replicate(procdata, pathname))
+      return -1;
+
+   starttime = ldcs_get_time();
+   localname = filemngt_calc_localname(pathname, clt_file);
+   assert(localname);
+   if (pcache_restore(procdata, pathname, localname) == -1) {
+      free(localname);
+      return -1;
+   }
+   add_global_name(pathname, localname);
+   ldcs_cache_updateBuffer(file, dir, localname, NULL, size, 0);
+   if (procdata->opts & OPT_DEDUP)
+      dedup_insert(hash, size, pathname);
+   procdata->server_stat.pcache.cnt++;
+   procdata->server_stat.pcache.bytes += size;
+   procdata->server_stat.pcache.time += ldcs_get_time() - starttime;
+
+   handle_cache_insert(procdata, pathname);
+   *localpath = localname;
+   return 0;
+}
+
+/**
+ * Choose the neighboring servers a message about key should go to, and record it
+ * as sent.  If in push mode we send to every server always.  If in pull mode only
+ * send to servers who requested the file.  from is the server the message arrived
+ * from, or NODE_PEER_NULL if it originated here.
+ *
+ * With a single reader everything flows down from the root, so a push goes to
+ * every child and *all_children is set.  With multiple readers a message may
+ * originate anywhere in the tree, so we push to every neighbor other than from.
+ * The caller frees *targets.
+ **/
+static int handle_msg_targets(ldcs_process_data_t *procdata, char *key, int force_broadcast,
+                              metadata_t mdtype, node_peer_t from,
+                              node_peer_t **targets, int *num_targets, int *all_children)
 {
-   int result, global_result = 0;
    static int have_done_broadcast = 0;
+   node_peer_t parent, child, *nodes = NULL;
+   int i, result, nodes_size, num_children, max_targets;
 
    requestor_list_t pending_reqs = (mdtype == metadata_none) ? procdata->pending_requests : metadata_pending_requests(procdata, mdtype);
    requestor_list_t completed_reqs = (mdtype == metadata_none) ? procdata->completed_requests : metadata_completed_requests(procdata, mdtype);
 
+   *targets = NULL;
+   *num_targets = 0;
+   *all_children = 0;
+
    if (have_done_broadcast) {
       /* Test whether this file has already been broadcast to all */
       if (peer_requested(completed_reqs, key, NODE_PEER_ALL)) {
          debug_printf2("Not sending message for %s, because it's already been broadcast\n", key);
+         clear_requestor(pending_reqs, key);
          return 0;
       }
    }
 
    if (procdata->dist_model == LDCS_PUSH || force_broadcast) {
       debug_printf3("Pushing message to all children\n");
-      result = spindle_broadcast_noncontig(procdata, msg, secondary_data, secondary_size);
-      if (result == -1)
-         global_result = -1;
+      num_children = ldcs_audit_server_md_get_num_children(procdata);
+      *targets = (node_peer_t *) malloc(sizeof(node_peer_t) * (num_children + 1));
+      for (i = 0; i < num_children; i++) {
+         child = ldcs_audit_server_md_get_child(procdata, i);
+         if (child != from)
+            (*targets)[(*num_targets)++] = child;
+      }
+      if (procdata->md_num_readers <= 1) {
+         *all_children = 1;
+      }
+      else {
+         parent = ldcs_audit_server_md_get_parent(procdata);
+         if (parent != NODE_PEER_NULL && parent != from) {
+            debug_printf3("Pushing message up to parent\n");
+            (*targets)[(*num_targets)++] = parent;
+         }
+      }
       have_done_broadcast = 1;
       add_requestor(completed_reqs, key, NODE_PEER_ALL);
    }
    else if (procdata->dist_model == LDCS_PULL) {
-      node_peer_t *nodes = NULL;
-      int nodes_size, i;
-
       debug_printf3("Sending messages to select children via pull model\n");
       result = get_requestors(pending_reqs, key, &nodes, &nodes_size);
       if (result == -1) {
          return 0;
       }
-      debug_printf3("Sending message %s to %d nodes who requested it\n", key, nodes_size);
+      max_targets = nodes_size;
+      *targets = (node_peer_t *) malloc(sizeof(node_peer_t) * (max_targets ? max_targets : 1));
       for (i = 0; i < nodes_size; i++) {
          if (nodes[i] == NODE_PEER_CLIENT || nodes[i] == NODE_PEER_NULL)
             continue;
@@ -1630,12 +2764,10 @@ int handle_send_msg_to_keys(ldcs_process_data_t *procdata, ldcs_message_t *msg,
             debug_printf2("Not sending message for %s to child, because it's already been sent\n", key);
             continue;
          }
-         result = spindle_send_noncontig(procdata, msg, nodes[i], secondary_data, secondary_size);
-         if (result == -1)
-            global_result = -1;
-         else
-            add_requestor(completed_reqs, key, nodes[i]);
+         (*targets)[(*num_targets)++] = nodes[i];
+         add_requestor(completed_reqs, key, nodes[i]);
       }
+      debug_printf3("Sending message %s to %d nodes who requested it\n", key, *num_targets);
    }
    else {
       assert(0);
@@ -1643,6 +2775,40 @@ int handle_send_msg_to_keys(ldcs_process_data_t *procdata, ldcs_message_t *msg,
 
    clear_requestor(pending_reqs, key);
 
+   return 0;
+}
+
+/**
+ * Send a message to neighboring servers, as chosen by handle_msg_targets.  The
+ * secondary data, if any, is sent from secondary_fd when that is not -1.
+ * Per-peer sends keep messages to each neighbor in order when bundling.
+ **/
+int handle_send_msg_to_keys(ldcs_process_data_t *procdata, ldcs_message_t *msg, char *key,
+                            void *secondary_data, size_t secondary_size, int secondary_fd,
+                            int force_broadcast, metadata_t mdtype, node_peer_t from)
+{
+   node_peer_t *targets;
+   int i, num_targets, all_children, result, global_result = 0;
+
+   result = handle_msg_targets(procdata, key, force_broadcast, mdtype, from, &targets, &num_targets, &all_children);
+   if (result == -1)
+      return -1;
+
+   if (all_children) {
+      result = spindle_broadcast_file(procdata, msg, secondary_data, secondary_size, secondary_fd);
+      if (result == -1)
+         global_result = -1;
+   }
+   else {
+      for (i = 0; i < num_targets; i++) {
+         result = spindle_send_file(procdata, msg, targets[i], secondary_data, secondary_size, secondary_fd);
+         if (result == -1)
+            global_result = -1;
+      }
+   }
+
+   if (targets)
+      free(targets);
    return global_result;
 }
 
@@ -1671,6 +2837,8 @@ int handle_client_message(ldcs_process_data_t *procdata, int nc, ldcs_message_t
          return handle_client_fileexist_msg(procdata, nc, msg);
       case LDCS_MSG_ORIGPATH_QUERY:
          return handle_client_origpath_msg(procdata, nc, msg);
+      case LDCS_MSG_MULTI_QUERY:
+         return handle_client_multi_query(procdata, nc, msg);
       case LDCS_MSG_END:
          return handle_client_end(procdata, nc);
       default:
@@ -1716,7 +2884,7 @@ int handle_server_message(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_
 {
    switch (msg->header.type) {
       case LDCS_MSG_CACHE_ENTRIES:
-         return handle_directory_recv(procdata, msg, request_broadcast);
+         return handle_directory_recv(procdata, msg, peer, request_broadcast);
       case LDCS_MSG_FILE_DATA:
          return handle_file_recv(procdata, msg, peer, request_broadcast);         
       case LDCS_MSG_FILE_ERRCODE:
@@ -1728,13 +2896,17 @@ int handle_server_message(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_
       case LDCS_MSG_PRELOAD_FILELIST:
          return handle_preload_filelist(procdata, msg);
       case LDCS_MSG_PRELOAD_DIR:
-         return handle_directory_recv(procdata, msg, preload_broadcast);
+         return handle_directory_recv(procdata, msg, peer, preload_broadcast);
       case LDCS_MSG_PRELOAD_FILE:
          return handle_file_recv(procdata, msg, peer, preload_broadcast);
+      case LDCS_MSG_PREFETCH_FILE:
+         return handle_file_recv(procdata, msg, peer, prefetch_broadcast);
+      case LDCS_MSG_PREFETCH_ALIAS:
+         return handle_alias_recv(procdata, msg, peer, prefetch_broadcast);
       case LDCS_MSG_PRELOAD_DONE:
          return handle_preload_done(procdata);
       case LDCS_MSG_SELFLOAD_FILE:
-         return handle_recv_selfload_file(procdata, msg);
+         return handle_recv_selfload_file(procdata, msg, peer);
       case LDCS_MSG_STAT_NET_RESULT:
          return handle_metadata_recv(procdata, msg, metadata_stat, peer);
       case LDCS_MSG_LSTAT_NET_RESULT:
@@ -1754,7 +2926,15 @@ int handle_server_message(ldcs_process_data_t *procdata, node_peer_t peer, ldcs_
       case LDCS_MSG_BUNDLE:
          return handle_msgbundle(procdata, peer, msg);
       case LDCS_MSG_ALIAS:
-         return handle_alias_recv(procdata, msg, request_broadcast);
+         return handle_alias_recv(procdata, msg, peer, request_broadcast);
+      case LDCS_MSG_CONTENT_ALIAS:
+         return handle_content_alias_recv(procdata, msg, peer, request_broadcast);
+      case LDCS_MSG_PREFETCH_CONTENT_ALIAS:
+         return handle_content_alias_recv(procdata, msg, peer, prefetch_broadcast);
+      case LDCS_MSG_MANIFEST:
+         return manifest_merge_msg(procdata, msg);
+      case LDCS_MSG_PCACHE_VALID:
+         return pcache_recv_msg(procdata, msg);
       default:
          err_printf("Received unexpected message from node: %d\n", (int) msg->header.type);
          assert(0);
@@ -1785,6 +2965,14 @@ int handle_client_end(ldcs_process_data_t *procdata, int nc)
 
    if (client->state != LDCS_CLIENT_STATUS_ACTIVE || connid < 0)
       return 0;
+
+   if (client->multi_query) {
+      free(client->multi_query->answer);
+      free(client->multi_query->paths);
+      free(client->multi_query);
+      client->multi_query = NULL;
+   }
+   waitqueue_remove_client(procdata->client_waitqueue, nc);
    
    ldcs_listen_unregister_fd(ldcs_get_fd(connid)); 
    ldcs_close_server_connection(connid);
@@ -1796,12 +2984,43 @@ int handle_client_end(ldcs_process_data_t *procdata, int nc)
    return handle_send_exit_ready_if_done(procdata);
 }
 
+/**
+ * Preloaded files are read in order of how early a process needs them:
+ * the dynamic loader, then libc, then other libraries, then everything
+ * else.  Files keep the preload list's order within each class, so a
+ * manifest's first-use order carries through.
+ **/
+static int preload_priority(const char *pathname)
+{
+   const char *base = strrchr(pathname, '/');
+   base = base ? base+1 : pathname;
+
+   if (strncmp(base, "ld-linux", 8) == 0 || strncmp(base, "ld64.so", 7) == 0 || strncmp(base, "ld.so", 5) == 0)
+      return 0;
+   if (strncmp(base, "libc.so", 7) == 0 || strncmp(base, "libc-", 5) == 0)
+      return 1;
+   if (strstr(base, ".so"))
+      return 2;
+   return 3;
+}
+
+static int preload_file_cmp(const void *a, const void *b)
+{
+   const preload_file_t *fa = (const preload_file_t *) a;
+   const preload_file_t *fb = (const preload_file_t *) b;
+   if (fa->priority != fb->priority)
+      return fa->priority - fb->priority;
+   return fa->index - fb->index;
+}
+
 static int handle_preload_filelist(ldcs_process_data_t *procdata, ldcs_message_t *msg)
 {
    int cur = 0, global_result = 0, result;
-   int num_dirs, num_files, i;
+   int num_dirs, num_files, num_metadata = 0, kind, i;
+   metadata_t mdtype;
    char *data = (char *) msg->data;
    char *pathname;
+   preload_file_t *files;
    
    debug_printf2("At top of handle_preload_filelist\n");
 
@@ -1816,7 +3035,9 @@ static int handle_preload_filelist(ldcs_process_data_t *procdata, ldcs_message_t
       pathname = data + cur;
       cur += strlen(pathname)+1;
 
-      if (!ldcs_audit_server_md_is_responsible(procdata, pathname)) {
+      /* The preload list only arrives at the root, so it reads every entry
+         regardless of which server is responsible for it at runtime. */
+      if (procdata->md_rank != 0) {
          debug_printf3("I am not responsible for preloading directory %s\n", pathname);
          continue;
       }
@@ -1829,7 +3050,7 @@ static int handle_preload_filelist(ldcs_process_data_t *procdata, ldcs_message_t
          continue;
       }
       
-      result = handle_broadcast_dir(procdata, pathname, preload_broadcast);
+      result = handle_broadcast_dir(procdata, pathname, preload_broadcast, NODE_PEER_NULL);
       if (result == -1) {
          err_printf("Error broadcasting directory during preload\n");
          global_result = -1;
@@ -1837,15 +3058,94 @@ static int handle_preload_filelist(ldcs_process_data_t *procdata, ldcs_message_t
       }
    }
 
+   /* Files are read after the metadata, a window at a time, by handle_preload_next */
+   files = (preload_file_t *) malloc(sizeof(preload_file_t) * (num_files ? num_files : 1));
    for (i = 0; i<num_files; i++) {
       assert(cur < msg->header.len);
       pathname = data + cur;
       cur += strlen(pathname)+1;
 
-      if (!ldcs_audit_server_md_is_responsible(procdata, pathname)) {
-         debug_printf3("I am not responsible for preloading file %s\n", pathname);
+      files[i].pathname = pathname;
+      files[i].priority = preload_priority(pathname);
+      files[i].index = i;
+   }
+
+   /* Lists built from a manifest end with the stat and ld.so queries of the recorded run */
+   if (cur < msg->header.len) {
+      memcpy(&num_metadata, data + cur, sizeof(int));
+      cur += sizeof(int);
+   }
+
+   for (i = 0; i<num_metadata; i++) {
+      assert(cur < msg->header.len);
+      memcpy(&kind, data + cur, sizeof(int));
+      cur += sizeof(int);
+      pathname = data + cur;
+      cur += strlen(pathname)+1;
+
+      if (procdata->md_rank != 0)
+         continue;
+
+      switch (kind) {
+         case manifest_stat: mdtype = metadata_stat; break;
+         case manifest_lstat: mdtype = metadata_lstat; break;
+         case manifest_ldso: mdtype = metadata_loader; break;
+         default:
+            err_printf("Unexpected kind %d of preloaded metadata for %s\n", kind, pathname);
+            continue;
+      }
+
+      debug_printf2("Preload of metadata for %s\n", pathname);
+      result = handle_metadata_and_broadcast_file(procdata, pathname, mdtype, preload_broadcast);
+      if (result == -1) {
+         err_printf("Error broadcasting metadata during preload\n");
+         global_result = -1;
          continue;
       }
+   }
+
+   if (procdata->md_rank != 0) {
+      debug_printf3("I am not responsible for preloading files\n");
+      free(files);
+      result = handle_preload_done(procdata);
+      if (result == -1) {
+         err_printf("Error from handle_preload_done");
+         global_result = -1;
+      }
+      return global_result;
+   }
+
+   qsort(files, num_files, sizeof(preload_file_t), preload_file_cmp);
+   procdata->preload_files = (char **) malloc(sizeof(char *) * (num_files ? num_files : 1));
+   for (i = 0; i < num_files; i++)
+      procdata->preload_files[i] = strdup(files[i].pathname);
+   procdata->preload_num_files = num_files;
+   procdata->preload_next_file = 0;
+   procdata->preload_reads_active = 0;
+   free(files);
+
+   result = handle_preload_next(procdata);
+   if (result == -1)
+      global_result = -1;
+
+   return global_result;
+}
+
+/**
+ * Starts preload reads until the window is full, and finishes the preload
+ * once every file has been read and broadcast.  With a read pool, reads run
+ * concurrently and each file is broadcast as soon as it is read, while
+ * other files are still being read.
+ **/
+static int handle_preload_next(ldcs_process_data_t *procdata)
+{
+   int result, global_result = 0, window, i;
+   char *pathname;
+
+   window = readpool_enabled() ? procdata->read_threads * PRELOAD_READS_PER_THREAD : 1;
+   while (procdata->preload_next_file < procdata->preload_num_files &&
+          procdata->preload_reads_active < window) {
+      pathname = procdata->preload_files[procdata->preload_next_file++];
 
       debug_printf2("Preload read of file %s\n", pathname);
       result = handle_read_and_broadcast_file(procdata, pathname, preload_broadcast);
@@ -1854,14 +3154,30 @@ static int handle_preload_filelist(ldcs_process_data_t *procdata, ldcs_message_t
          global_result = -1;
          continue;
       }
+      if (been_requested(procdata->pending_reads, pathname)) {
+         /* Finishes in handle_read_file_done */
+         add_requestor(procdata->preload_reads, pathname, NODE_PEER_NULL);
+         procdata->preload_reads_active++;
+      }
    }
 
+   if (procdata->preload_next_file < procdata->preload_num_files || procdata->preload_reads_active)
+      return global_result;
+   if (procdata->preload_done || !procdata->preload_files)
+      return global_result;
+
+   debug_printf("Finished preloading %d files\n", procdata->preload_num_files);
+   for (i = 0; i < procdata->preload_num_files; i++)
+      free(procdata->preload_files[i]);
+   free(procdata->preload_files);
+   procdata->preload_files = NULL;
+   procdata->preload_num_files = procdata->preload_next_file = 0;
+
    result = handle_preload_done(procdata);
    if (result == -1) {
       err_printf("Error from handle_preload_done");
       global_result = -1;
    }
-
    return global_result;
 }
 
@@ -1895,16 +3211,16 @@ static int handle_create_selfload_file(ldcs_process_data_t *procdata, char *file
    msg.header.len = strlen(filename) + 1;
    msg.data = filename;
 
-   return handle_send_msg_to_keys(procdata, &msg, filename, NULL, 0, request_broadcast, metadata_none);
+   return handle_send_msg_to_keys(procdata, &msg, filename, NULL, 0, -1, request_broadcast, metadata_none, NODE_PEER_NULL);
 }
 
-static int handle_recv_selfload_file(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+static int handle_recv_selfload_file(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t peer)
 {
    char *filename = (char *) msg->data;
    int result, nc, global_result = 0, found_client = 0;
 
    debug_printf("Recieved notice to selfload file %s\n", filename);
-   result = handle_send_msg_to_keys(procdata, msg, filename, NULL, 0, request_broadcast, metadata_none);
+   result = handle_send_msg_to_keys(procdata, msg, filename, NULL, 0, -1, request_broadcast, metadata_none, peer);
    if (result == -1) {
       err_printf("Could not send selfload file message\n");
       global_result = -1;
@@ -1929,7 +3245,12 @@ static int handle_recv_selfload_file(ldcs_process_data_t *procdata, ldcs_message
    }
 
    if (found_client) {
-      result = handle_progress(procdata);
+      /* Requesting clients may be waiting on either the file or its directory */
+      char dirname[MAX_PATH_LEN], basename[MAX_PATH_LEN];
+      parseFilenameNoAlloc(filename, basename, dirname, MAX_PATH_LEN);
+      result = handle_progress_key(procdata, filename);
+      if (handle_progress_key(procdata, dirname) == -1)
+         result = -1;
       if (result == -1) {
          err_printf("Error from handle_progress\n");
          global_result = -1;
@@ -1956,7 +3277,7 @@ static int handle_report_fileexist_result(ldcs_process_data_t *procdata, int nc,
    out_msg.header.len = sizeof(query_result);
    out_msg.data = (void *) &query_result;
 
-   result = ldcs_send_msg(connid, &out_msg);
+   result = handle_client_answer(procdata, nc, &out_msg);
    
    procdata->server_stat.clientmsg.cnt++;
    procdata->server_stat.clientmsg.time += ldcs_get_time() - client->query_arrival_time;
@@ -1983,6 +3304,7 @@ static int handle_fileexist_test(ldcs_process_data_t *procdata, int nc)
    switch (howto_result) {
       case READ_FILE:
       case REQ_FILE:
+      case READING_FILE:
       case FOUND_FILE:
       case FOUND_ERRCODE:
          return handle_report_fileexist_result(procdata, nc, exists);
@@ -1991,6 +3313,8 @@ static int handle_fileexist_test(ldcs_process_data_t *procdata, int nc)
          return handle_report_fileexist_result(procdata, nc, not_exists);
       case READ_DIRECTORY:
          /* We should read the directory.  After that is done, restart this operation */
+         if (handle_hold_for_preload(procdata, nc, client->query_dirname))
+            return 0;
          result = handle_read_and_broadcast_dir(procdata, client->query_dirname);
          if (result == -1) {
             err_printf("Error reading and broadcasting directory %s\n", client->query_dirname);
@@ -1999,11 +3323,14 @@ static int handle_fileexist_test(ldcs_process_data_t *procdata, int nc)
          return handle_fileexist_test(procdata, nc);
       case REQ_DIRECTORY:
          /* We should request the directory from another node */
+         if (handle_hold_for_preload(procdata, nc, client->query_dirname))
+            return 0;
          result = handle_send_query(procdata, client->query_dirname, 1);
          if (result == -1) {
             err_printf("Failure sending query for directory %s\n", client->query_dirname);
             return -1;
          }
+         waitqueue_add(procdata->client_waitqueue, client->query_dirname, nc);
          return 0;
       case ALIAS_TO:
          /* Test for existance of alias */
@@ -2029,7 +3356,7 @@ static int handle_client_fileexist_msg(ldcs_process_data_t *procdata, int nc, ld
 
    assert(nc != -1);
    client = procdata->client_table + nc;
-   addCWDToDir(client->remote_pid, dir, MAX_PATH_LEN);
+   add_client_cwd(client, dir);
    reducePath(dir);
 
    GCC7_DISABLE_WARNING("-Wformat-truncation");
@@ -2132,7 +3459,7 @@ static int handle_metadata_and_broadcast_file(ldcs_process_data_t *procdata, cha
       return 0;
    }
 
-   result = handle_broadcast_metadata(procdata, pathname, localname != NULL, buffer, buffer_size, mdtype);
+   result = handle_broadcast_metadata(procdata, pathname, localname != NULL, buffer, buffer_size, mdtype, bcast, NODE_PEER_NULL);
    if (result == -1) {
       err_printf("Error broadcasting stat data for %s\n", pathname);
       return -1;
@@ -2154,6 +3481,7 @@ static int handle_read_ldso_metadata(ldcs_process_data_t *procdata, char *pathna
 
    read_path = pathname[0] == '$' ? pathname+1 : pathname;
    result = filemngt_get_ldso_metadata(read_path, ldsoinfo);
+   manifest_record_metadata(procdata, manifest_ldso, pathname, NULL);
    if (result == -1) {
       err_printf("Error getting ldso metadata for %s\n", read_path);
       handle_cache_ldso(procdata, pathname, 0, NULL, result_file);
@@ -2187,6 +3515,8 @@ static int handle_stat_file(ldcs_process_data_t *procdata, char *pathname, metad
    starttime = ldcs_get_time();
    result = filemngt_stat(pathname, buf, (mdtype == metadata_lstat) ? 1 : 0);
    file_exists = (result != -1);
+   manifest_record_metadata(procdata, (mdtype == metadata_lstat) ? manifest_lstat : manifest_stat,
+                            pathname, file_exists ? buf : NULL);
    procdata->server_stat.libread.cnt++;
    procdata->server_stat.libread.bytes += file_exists ? sizeof(struct stat) : 0;
    procdata->server_stat.libread.time += (ldcs_get_time() - starttime);
@@ -2267,7 +3597,8 @@ static int handle_cache_ldso(ldcs_process_data_t *procdata, char *pathname, int
 /**
  * Distributes stat contents onto the network
  **/
-static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists, unsigned char *buf, size_t buf_size, metadata_t mdtype)
+static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathname, int file_exists, unsigned char *buf, size_t buf_size, metadata_t mdtype,
+                                     broadcast_t bcast, node_peer_t from)
 {
    char *packet_buffer = NULL;
    size_t packet_size;
@@ -2275,7 +3606,7 @@ static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathna
    int result;
    ldcs_message_t msg;
    int pathname_len = strlen(pathname) + 1;
-   int pos = 0;
+   int pos = 0, flags;
    struct stat *sbuf = (struct stat *) buf;
    const char *mount;
    int mount_len;
@@ -2308,7 +3639,8 @@ static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathna
       return -1;
    }
 
-   memcpy(packet_buffer + pos, &file_exists, sizeof(int));
+   flags = (file_exists ? METADATA_PACKET_EXISTS : 0) | (bcast == preload_broadcast ? METADATA_PACKET_PRELOAD : 0);
+   memcpy(packet_buffer + pos, &flags, sizeof(int));
    pos += sizeof(int);
 
    memcpy(packet_buffer + pos, &pathname_len, sizeof(int));
@@ -2340,7 +3672,7 @@ static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathna
 
    /* Send packet on network */
    starttime = ldcs_get_time();
-   result = handle_send_msg_to_keys(procdata, &msg, pathname, NULL, 0, 0, mdtype);
+   result = handle_send_msg_to_keys(procdata, &msg, pathname, NULL, 0, -1, bcast == preload_broadcast, mdtype, from);
    procdata->server_stat.libdist.cnt++;
    procdata->server_stat.libdist.bytes += packet_size;
    procdata->server_stat.libdist.time += (ldcs_get_time() - starttime);      
@@ -2354,7 +3686,8 @@ static int handle_broadcast_metadata(ldcs_process_data_t *procdata, char *pathna
  **/
 static int handle_metadata_recv(ldcs_process_data_t *procdata, ldcs_message_t *msg, metadata_t mdtype, node_peer_t peer)
 {
-   int file_exists;
+   int file_exists, flags;
+   broadcast_t bcast;
    char pathname[MAX_PATH_LEN+1], *localpath;
    struct stat buf;
    ldso_info_t ldsoinfo;
@@ -2365,8 +3698,10 @@ static int handle_metadata_recv(ldcs_process_data_t *procdata, ldcs_message_t *m
    mount[0] = '\0';
 
    /* Decode packet from network */
-   memcpy(&file_exists, buffer + pos, sizeof(int));
+   memcpy(&flags, buffer + pos, sizeof(int));
    pos += sizeof(int);
+   file_exists = (flags & METADATA_PACKET_EXISTS) ? 1 : 0;
+   bcast = (flags & METADATA_PACKET_PRELOAD) ? preload_broadcast : request_broadcast;
 
    memcpy(&pathlen, buffer + pos, sizeof(int));
    pos += sizeof(int);
@@ -2421,13 +3756,13 @@ static int handle_metadata_recv(ldcs_process_data_t *procdata, ldcs_message_t *m
       return -1;
    }
  
-   result = handle_broadcast_metadata(procdata, pathname, file_exists, payload, payload_size, mdtype);
+   result = handle_broadcast_metadata(procdata, pathname, file_exists, payload, payload_size, mdtype, bcast, peer);
    if (result == -1) {
       err_printf("Error broadcast stat results for %s\n", pathname);
       return -1;
    }
 
-   return handle_progress(procdata);
+   return handle_progress_key(procdata, pathname);
 }
 
 /**
@@ -2459,7 +3794,7 @@ static int handle_client_metadata_result(ldcs_process_data_t *procdata, int nc,
    msg.header.len = localpath ? strlen(localpath)+1 : 0;
    msg.data = localpath;
    
-   result = ldcs_send_msg(connid, &msg);
+   result = handle_client_answer(procdata, nc, &msg);
 
    procdata->server_stat.clientmsg.cnt++;
    procdata->server_stat.clientmsg.time+=(ldcs_get_time()-
@@ -2481,7 +3816,7 @@ static int handle_metadata_request(ldcs_process_data_t *procdata, char *pathname
       debug_printf2("Metadata %s has already been requested.  Not resending request\n", pathname);
       return 0;
    }
-   debug_printf2("Request metadata of %s from up the network\n", pathname);
+   debug_printf2("Request metadata of %s from across the network\n", pathname);
 
    add_requestor(metadata_pending_requests(procdata, mdtype), pathname, from);
    
@@ -2499,7 +3834,7 @@ static int handle_metadata_request(ldcs_process_data_t *procdata, char *pathname
    msg.header.len = pathlen;
    msg.data = pathname;
 
-   return spindle_forward_query(procdata, &msg);
+   return handle_route_query(procdata, &msg, pathname);
 }
 
 /**
@@ -2571,7 +3906,7 @@ static int handle_load_and_broadcast_metadata(ldcs_process_data_t *procdata, cha
       }
    }
    
-   result = handle_broadcast_metadata(procdata, pathname, localpath != NULL, buffer, buffer_size, mdtype);
+   result = handle_broadcast_metadata(procdata, pathname, localpath != NULL, buffer, buffer_size, mdtype, request_broadcast, NODE_PEER_NULL);
    if (result == -1) {
       err_printf("Failure broadcast stat results for %s\n", pathname);
       return -1;
@@ -2620,13 +3955,18 @@ static int handle_send_exit_ready_if_done(ldcs_process_data_t *procdata)
       debug_printf2("Not all child servers are ready to exit.\n");
       return 0;
    }
+
+   /* Our children's manifest records arrived before their exit readys */
+   result = manifest_send(procdata);
+   if (result == -1)
+      err_printf("Could not send manifest records.  Manifest will be incomplete\n");
    
    msg.header.type = LDCS_MSG_EXIT_READY;
    msg.header.len = 0;
    msg.data = NULL;
    procdata->sent_exit_ready = 1;
 
-   if (ldcs_audit_server_md_is_responsible(procdata, "")) {
+   if (procdata->md_rank == 0) {
       debug_printf2("Messaging FE that we're ready to exit\n");
       ldcs_audit_server_md_to_frontend(procdata, &msg);
       debug_printf("Exit globally ready.  Sending exit broadcast.\n");
@@ -2681,7 +4021,7 @@ static int handle_send_exit_cancel(ldcs_process_data_t *procdata)
    ldcs_message_t msg;
 
    assert(procdata->sent_exit_ready);
-   if (ldcs_audit_server_md_is_responsible(procdata, "")) {
+   if (procdata->md_rank == 0) {
       err_printf("Top of tree got exit cancel, but we've already started shutdown\n");
       return 0;
    }
@@ -2702,9 +4042,198 @@ static int handle_close_client_query(ldcs_process_data_t *procdata, int nc)
    client->query_is_numa_replicated = 0;
    client->is_stat = 0;
    client->query_globalpath[0] = client->query_filename[0] = client->query_dirname[0] = client->query_aliasfrom[0] = '\0';   
+   waitqueue_remove_client(procdata->client_waitqueue, nc);
+   if (client->multi_query)
+      return handle_multi_query_next(procdata, nc);
    return 0;   
 }
 
+/**
+ * Sends the answer to a client's query, or adds it to the answer for the
+ * client's multi-query if one is running.
+ **/
+static int handle_client_answer(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   multi_query_t *mq = client->multi_query;
+   multi_answer_header_t header;
+   size_t needed;
+
+   if (!mq)
+      return ldcs_send_msg(client->connid, msg);
+
+   needed = mq->answer_len + sizeof(header) + msg->header.len;
+   if (needed > mq->answer_size) {
+      while (mq->answer_size < needed)
+         mq->answer_size *= 2;
+      mq->answer = (unsigned char *) realloc(mq->answer, mq->answer_size);
+   }
+   header.type = msg->header.type;
+   header.len = msg->header.len;
+   memcpy(mq->answer + mq->answer_len, &header, sizeof(header));
+   if (msg->header.len)
+      memcpy(mq->answer + mq->answer_len + sizeof(header), msg->data, msg->header.len);
+   mq->answer_len = needed;
+   mq->num_answers++;
+
+   switch (msg->header.type) {
+      case LDCS_MSG_FILE_QUERY_ANSWER:
+         mq->hit = (msg->header.len > sizeof(int));
+         break;
+      case LDCS_MSG_STAT_ANSWER:
+         mq->hit = (msg->header.len > 0);
+         break;
+      case LDCS_MSG_EXISTS_ANSWER:
+         mq->hit = (*((uint32_t *) msg->data) != 0);
+         break;
+      default:
+         mq->hit = 0;
+         break;
+   }
+   return 0;
+}
+
+/**
+ * A client sent several paths to query in one round trip.  Each path goes
+ * through the same steps as a single query, in order, and the answers are
+ * collected into one LDCS_MSG_MULTI_QUERY_ANSWER.
+ **/
+static int handle_client_multi_query(ldcs_process_data_t *procdata, int nc, ldcs_message_t *msg)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   multi_query_header_t header;
+   multi_query_t *mq;
+   char *paths, *pos, *end;
+   int i;
+
+   assert(!client->multi_query);
+   if (msg->header.len < sizeof(header)) {
+      err_printf("Multi-query from client %d is too short (%d bytes)\n", nc, (int) msg->header.len);
+      return -1;
+   }
+   memcpy(&header, msg->data, sizeof(header));
+
+   switch (header.query_type) {
+      case LDCS_MSG_FILE_QUERY:
+      case LDCS_MSG_FILE_QUERY_EXACT_PATH:
+      case LDCS_MSG_STAT_QUERY:
+      case LDCS_MSG_LSTAT_QUERY:
+      case LDCS_MSG_EXISTS_QUERY:
+         break;
+      default:
+         err_printf("Unexpected query type %d in multi-query from client %d\n", (int) header.query_type, nc);
+         return -1;
+   }
+
+   paths = msg->data + sizeof(header);
+   end = msg->data + msg->header.len;
+   for (i = 0, pos = paths; i < header.num_paths; i++) {
+      char *path_end = pos < end ? memchr(pos, '\0', end - pos) : NULL;
+      if (!path_end) {
+         err_printf("Multi-query from client %d is missing paths (%d of %d)\n", nc, i, (int) header.num_paths);
+         return -1;
+      }
+      pos = path_end + 1;
+   }
+
+   mq = (multi_query_t *) malloc(sizeof(multi_query_t));
+   memset(mq, 0, sizeof(*mq));
+   mq->query_type = (ldcs_message_ids_t) header.query_type;
+   mq->first_hit = (header.flags & MULTI_QUERY_FIRST_HIT) ? 1 : 0;
+   mq->num_paths = header.num_paths;
+   mq->paths = (char *) malloc((pos - paths) + 1);
+   memcpy(mq->paths, paths, pos - paths);
+   mq->next_pos = mq->paths;
+   mq->answer_size = MAX_PATH_LEN;
+   mq->answer = (unsigned char *) malloc(mq->answer_size);
+   mq->answer_len = sizeof(int32_t);
+   client->multi_query = mq;
+
+   debug_printf2("Server recvd multi-query of type %s for %d paths%s\n", _message_type_to_str(mq->query_type),
+                 mq->num_paths, mq->first_hit ? " up to the first hit" : "");
+   return handle_multi_query_next(procdata, nc);
+}
+
+/**
+ * Start the query for the next path of a client's multi-query, or send the
+ * answers once they're all in.  A query that is answered right away comes
+ * back here through handle_close_client_query, so that case is run by the
+ * loop below rather than by recursing.
+ **/
+static int handle_multi_query_next(ldcs_process_data_t *procdata, int nc)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   multi_query_t *mq = client->multi_query;
+   ldcs_message_t msg;
+   int32_t errcode;
+   int result, answered, global_result = 0;
+
+   if (mq->running) {
+      mq->advance = 1;
+      return 0;
+   }
+
+   mq->running = 1;
+   do {
+      mq->advance = 0;
+      if (mq->next_path == mq->num_paths || (mq->first_hit && mq->hit)) {
+         result = handle_multi_query_finish(procdata, nc);
+         return (result == -1) ? -1 : global_result;
+      }
+
+      msg.header.type = mq->query_type;
+      msg.header.len = strlen(mq->next_pos) + 1;
+      msg.data = mq->next_pos;
+      mq->next_pos += msg.header.len;
+      mq->next_path++;
+
+      answered = mq->num_answers;
+      if (mq->query_type == LDCS_MSG_EXISTS_QUERY)
+         result = handle_client_fileexist_msg(procdata, nc, &msg);
+      else
+         result = handle_client_file_request(procdata, nc, &msg);
+      if (result == -1 && mq->num_answers == answered) {
+         /* The path failed before it was answered.  Answer it with an error,
+            which the client will retry as a single query, and move on. */
+         err_printf("Failed to look up %s in multi-query from client %d\n", msg.data, nc);
+         errcode = EIO;
+         msg.header.type = LDCS_MSG_MULTI_QUERY_ERROR;
+         msg.header.len = sizeof(errcode);
+         msg.data = (char *) &errcode;
+         handle_client_answer(procdata, nc, &msg);
+         if (!mq->advance)
+            handle_close_client_query(procdata, nc);
+      }
+      else if (result == -1)
+         global_result = -1;
+   } while (mq->advance);
+   mq->running = 0;
+
+   return global_result;
+}
+
+static int handle_multi_query_finish(ldcs_process_data_t *procdata, int nc)
+{
+   ldcs_client_t *client = procdata->client_table + nc;
+   multi_query_t *mq = client->multi_query;
+   ldcs_message_t out_msg;
+   int result;
+
+   memcpy(mq->answer, &mq->num_answers, sizeof(int32_t));
+   out_msg.header.type = LDCS_MSG_MULTI_QUERY_ANSWER;
+   out_msg.header.len = mq->answer_len;
+   out_msg.data = (char *) mq->answer;
+
+   debug_printf2("Server answering multi-query with %d of %d paths\n", (int) mq->num_answers, mq->num_paths);
+   client->multi_query = NULL;
+   result = ldcs_send_msg(client->connid, &out_msg);
+
+   free(mq->answer);
+   free(mq->paths);
+   free(mq);
+   return result;
+}
+
 /**
  * We got pinged via the spindleExitBE launch API call.
  **/
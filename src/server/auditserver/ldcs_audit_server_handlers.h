@@ -25,6 +25,7 @@ int handle_client_message(ldcs_process_data_t *procdata, int nc, ldcs_message_t
 int handle_client_start(ldcs_process_data_t *procdata, int nc);
 int handle_client_end(ldcs_process_data_t *procdata, int nc);
 int exit_note_cb(int infd, int serverid, void *data);
+int handle_numa_replica_done(ldcs_process_data_t *procdata, char *replica_name, int node, int result);
 
 
 #endif
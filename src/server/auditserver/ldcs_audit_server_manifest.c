@@ -0,0 +1,232 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ldcs_audit_server_manifest.h"
+#include "ldcs_audit_server_md.h"
+#include "msgbundle.h"
+#include "spindle_launch.h"
+#include "spindle_debug.h"
+
+typedef struct manifest_entry_t {
+   manifest_record_t rec;
+   char *path;
+   unsigned int hash_val;
+   struct manifest_entry_t *next_hash;
+   struct manifest_entry_t *next;
+} manifest_entry_t;
+
+#define MANIFEST_TABLE_SIZE 4096
+
+static manifest_entry_t **table;
+static manifest_entry_t *head, *tail;
+static int num_entries;
+
+static unsigned int hashval(manifest_kind_t kind, const char *str)
+{
+   unsigned int hash = 5381 + (unsigned int) kind;
+   unsigned int c;
+   while ((c = *str++))
+      hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+   return hash % MANIFEST_TABLE_SIZE;
+}
+
+/**
+ * Finds the record of pathname, adding one if needed.  Keeps the
+ * earliest first-use time seen for the path.
+ **/
+static manifest_entry_t *get_entry(manifest_kind_t kind, const char *pathname, double first_use)
+{
+   unsigned int val;
+   manifest_entry_t *cur;
+
+   if (!table)
+      table = (manifest_entry_t **) calloc(MANIFEST_TABLE_SIZE, sizeof(manifest_entry_t *));
+
+   val = hashval(kind, pathname);
+   for (cur = table[val]; cur != NULL; cur = cur->next_hash) {
+      if (cur->rec.kind != kind || strcmp(cur->path, pathname) != 0)
+         continue;
+      if (first_use < cur->rec.first_use)
+         cur->rec.first_use = first_use;
+      return cur;
+   }
+
+   cur = (manifest_entry_t *) calloc(1, sizeof(manifest_entry_t));
+   cur->path = strdup(pathname);
+   cur->hash_val = val;
+   cur->rec.kind = kind;
+   cur->rec.first_use = first_use;
+   cur->rec.path_len = strlen(pathname) + 1;
+   cur->next_hash = table[val];
+   table[val] = cur;
+
+   if (tail)
+      tail->next = cur;
+   else
+      head = cur;
+   tail = cur;
+   num_entries++;
+   return cur;
+}
+
+static void clear_entries()
+{
+   manifest_entry_t *cur, *next;
+   for (cur = head; cur != NULL; cur = next) {
+      next = cur->next;
+      free(cur->path);
+      free(cur);
+   }
+   if (table)
+      memset(table, 0, MANIFEST_TABLE_SIZE * sizeof(manifest_entry_t *));
+   head = tail = NULL;
+   num_entries = 0;
+}
+
+/**
+ * Notes that a client asked for pathname.
+ **/
+void manifest_record_query(ldcs_process_data_t *procdata, manifest_kind_t kind, const char *pathname)
+{
+   if (!(procdata->opts & OPT_RECORD))
+      return;
+   get_entry(kind, pathname, ldcs_get_time());
+}
+
+/**
+ * Notes the metadata of a path this server read off the file system.  If buf
+ * is NULL the path is stat'd here, and recorded as missing if that fails.
+ **/
+void manifest_record_metadata(ldcs_process_data_t *procdata, manifest_kind_t kind, const char *pathname,
+                              const struct stat *buf)
+{
+   manifest_entry_t *entry;
+   struct stat sbuf;
+   const char *stat_path;
+   int result;
+
+   if (!(procdata->opts & OPT_RECORD))
+      return;
+
+   entry = get_entry(kind, pathname, ldcs_get_time());
+   if (entry->rec.flags & MANIFEST_HAS_METADATA)
+      return;
+
+   if (!buf) {
+      stat_path = (pathname[0] == '$') ? pathname+1 : pathname;
+      result = (kind == manifest_lstat) ? lstat(stat_path, &sbuf) : stat(stat_path, &sbuf);
+      buf = (result == -1) ? NULL : &sbuf;
+   }
+
+   entry->rec.flags |= MANIFEST_HAS_METADATA;
+   if (!buf) {
+      entry->rec.flags |= MANIFEST_MISSING;
+      return;
+   }
+   entry->rec.size = (uint64_t) buf->st_size;
+   entry->rec.mtime_sec = (int64_t) buf->st_mtim.tv_sec;
+   entry->rec.mtime_nsec = (int64_t) buf->st_mtim.tv_nsec;
+   entry->rec.ino = (uint64_t) buf->st_ino;
+}
+
+/**
+ * Merges the records a child server sent up the tree into ours.
+ **/
+int manifest_merge_msg(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   manifest_record_t rec;
+   manifest_entry_t *entry;
+   char *data = (char *) msg->data;
+   int pos = 0, count = 0;
+
+   while (pos < msg->header.len) {
+      assert(pos + sizeof(rec) <= (size_t) msg->header.len);
+      memcpy(&rec, data + pos, sizeof(rec));
+      pos += sizeof(rec);
+      assert(rec.path_len > 0 && pos + rec.path_len <= msg->header.len);
+
+      entry = get_entry((manifest_kind_t) rec.kind, data + pos, rec.first_use);
+      pos += rec.path_len;
+      count++;
+
+      if ((rec.flags & MANIFEST_HAS_METADATA) && !(entry->rec.flags & MANIFEST_HAS_METADATA)) {
+         entry->rec.flags = rec.flags;
+         entry->rec.size = rec.size;
+         entry->rec.mtime_sec = rec.mtime_sec;
+         entry->rec.mtime_nsec = rec.mtime_nsec;
+         entry->rec.ino = rec.ino;
+      }
+   }
+
+   debug_printf2("Merged %d manifest records from a child server, now have %d\n", count, num_entries);
+   return 0;
+}
+
+/**
+ * Sends our records, including everything merged from our children, to
+ * our parent, or to the FE if we are the root.
+ **/
+int manifest_send(ldcs_process_data_t *procdata)
+{
+   manifest_entry_t *cur;
+   ldcs_message_t msg;
+   size_t size = 0, pos = 0;
+   char *buffer;
+   int result;
+
+   if (!(procdata->opts & OPT_RECORD) || !num_entries)
+      return 0;
+
+   for (cur = head; cur != NULL; cur = cur->next)
+      size += sizeof(manifest_record_t) + cur->rec.path_len;
+
+   buffer = (char *) malloc(size);
+   if (!buffer) {
+      err_printf("Could not allocate %lu bytes for manifest records\n", (unsigned long) size);
+      return -1;
+   }
+   for (cur = head; cur != NULL; cur = cur->next) {
+      memcpy(buffer + pos, &cur->rec, sizeof(manifest_record_t));
+      pos += sizeof(manifest_record_t);
+      memcpy(buffer + pos, cur->path, cur->rec.path_len);
+      pos += cur->rec.path_len;
+   }
+   assert(pos == size);
+
+   msg.header.type = LDCS_MSG_MANIFEST;
+   msg.header.len = size;
+   msg.data = buffer;
+
+   if (procdata->md_rank == 0) {
+      debug_printf("Sending %d manifest records to the FE\n", num_entries);
+      result = ldcs_audit_server_md_to_frontend(procdata, &msg);
+   }
+   else {
+      debug_printf2("Sending %d manifest records to parent\n", num_entries);
+      result = spindle_forward_query(procdata, &msg);
+   }
+   free(buffer);
+
+   clear_entries();
+   return result;
+}
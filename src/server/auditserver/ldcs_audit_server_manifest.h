@@ -0,0 +1,39 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_MANIFEST_H_)
+#define LDCS_AUDIT_SERVER_MANIFEST_H_
+
+#include "ldcs_audit_server_process.h"
+#include "ldcs_api.h"
+
+#include <sys/stat.h>
+
+/**
+ * With OPT_RECORD, each server records the paths its clients queried and,
+ * for the paths it read off the shared file system, their size, mtime and
+ * inode.  The records are merged up the server tree before the exit-ready
+ * message, and the root hands them to the FE, which writes the manifest.
+ * All calls are no-ops when OPT_RECORD is not set.
+ **/
+void manifest_record_query(ldcs_process_data_t *procdata, manifest_kind_t kind, const char *pathname);
+void manifest_record_metadata(ldcs_process_data_t *procdata, manifest_kind_t kind, const char *pathname,
+                              const struct stat *buf);
+int manifest_merge_msg(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+int manifest_send(ldcs_process_data_t *procdata);
+
+#endif
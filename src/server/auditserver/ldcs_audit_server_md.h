@@ -48,6 +48,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 extern "C" {
 #endif
 
+#include <sys/uio.h>
 #include "ldcs_api.h"
 #include "ldcs_audit_server_process.h"
 
@@ -76,6 +77,15 @@ int ldcs_audit_server_md_destroy ( ldcs_process_data_t *data );
    read the file */
 int ldcs_audit_server_md_is_responsible ( ldcs_process_data_t *data, char *filename );
 
+/* Returns the peer a query for key should be sent to in order to reach the
+   server responsible for key.  That is the child whose subtree holds the
+   responsible server, or the parent otherwise.  Returns NODE_PEER_NULL if this
+   server is responsible or is the root. */
+node_peer_t ldcs_audit_server_md_query_route(ldcs_process_data_t *data, char *key);
+
+/* Returns the peer for the parent server, or NODE_PEER_NULL at the root */
+node_peer_t ldcs_audit_server_md_get_parent(ldcs_process_data_t *data);
+
 /* Read some number of bytes from the peer and throw them away. */
 int ldcs_audit_server_md_trash_bytes(node_peer_t peer, size_t size);
 
@@ -104,7 +114,36 @@ int ldcs_audit_server_md_send_noncontig(ldcs_process_data_t *ldcs_process_data,
 int ldcs_audit_server_md_broadcast_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
                                              void *secondary_data, size_t secondary_size);
 
+/* Like the noncontig operations, but secondary_data is also the contents of the file
+   open at secondary_fd.  Lets the implementation send file contents straight from the
+   page cache.  secondary_fd may be -1. */
+int ldcs_audit_server_md_send_file(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                   node_peer_t peer,
+                                   void *secondary_data, size_t secondary_size, int secondary_fd);
+int ldcs_audit_server_md_broadcast_file(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                        void *secondary_data, size_t secondary_size, int secondary_fd);
+
+/* Used for forwarding a message while its body is still arriving.  send_begin sends the
+   header and the first initial_size bytes of msg->data.  The rest of the message's
+   header.len bytes are then sent, in order, with send_continue. */
+int ldcs_audit_server_md_send_begin(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                    node_peer_t peer, size_t initial_size);
+int ldcs_audit_server_md_send_continue(ldcs_process_data_t *ldcs_process_data, node_peer_t peer,
+                                       void *data, size_t size);
+
+/* Gives up on the connection to peer after a message to or from it was broken off part
+   way, leaving its stream misframed.  The peer stops being listened to and sees the
+   connection close.  Later sends to it are discarded. */
+int ldcs_audit_server_md_fail_peer(ldcs_process_data_t *ldcs_process_data, node_peer_t peer);
+
+/* Writes raw, already framed bytes from an iovec list to a peer in as few system calls
+   as possible.  Used to send a bundle of queued messages, possibly followed by another
+   message, without first copying them into one buffer.  May modify iov. */
+int ldcs_audit_server_md_send_iov(ldcs_process_data_t *ldcs_process_data, node_peer_t peer,
+                                  struct iovec *iov, int iovcnt);
+
 int ldcs_audit_server_md_get_num_children(ldcs_process_data_t *procdata);
+node_peer_t ldcs_audit_server_md_get_child(ldcs_process_data_t *procdata, int num);
 
 #if defined(__cplusplus)
 }
@@ -21,6 +21,10 @@
 #include <sys/inotify.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <fcntl.h>
 
 #include "ldcs_api.h"
 #include "ldcs_api_listen.h"
@@ -33,6 +37,10 @@
 #include "cobo_comm.h"
 #include "config.h"
 
+#if !defined(IOV_MAX)
+#define IOV_MAX 1024
+#endif
+
 int ldcs_audit_server_md_cobo_CB ( int fd, int nc, void *data );
 int ldcs_audit_server_md_cobo_send_msg ( int fd, ldcs_message_t *msg );
 
@@ -51,7 +59,8 @@ int read_msg(int fd, node_peer_t *peer, ldcs_message_t *msg)
    if (result == -1)
       return -1;
 
-   if (msg->header.type == LDCS_MSG_FILE_DATA || msg->header.type == LDCS_MSG_PRELOAD_FILE) {
+   if (msg->header.type == LDCS_MSG_FILE_DATA || msg->header.type == LDCS_MSG_PRELOAD_FILE ||
+       msg->header.type == LDCS_MSG_PREFETCH_FILE) {
       /* Optimization.  Don't read file data into heap, as it could be
          very large.  For these packets we'll postpone the network read
          until we have the file's mmap ready, then read it straight
@@ -77,6 +86,150 @@ int read_msg(int fd, node_peer_t *peer, ldcs_message_t *msg)
    return 0;
 }
 
+/* With more than one reader, files travel up the tree as well as down it.
+   Cobo's sockets block, so two neighbors each writing a large file to the
+   other would both stall in write().  Writes to the parent therefore never
+   block: whatever the socket won't take now is copied onto upward_queue and
+   written from the listen loop as the socket drains.  Writes to children
+   still block, so every blocking write points down the tree and no two
+   servers can wait on each other. */
+typedef struct upward_buffer_struct {
+   struct upward_buffer_struct *next;
+   size_t size;
+   size_t pos;
+   unsigned char data[];
+} upward_buffer_t;
+
+static int upward_fd = -1;
+static upward_buffer_t *upward_queue = NULL, *upward_queue_tail = NULL;
+
+static int upward_flush_CB(int fd, int id, void *data)
+{
+   upward_buffer_t *buf;
+   ssize_t result;
+
+   while ((buf = upward_queue) != NULL) {
+      result = send(fd, buf->data + buf->pos, buf->size - buf->pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (result == -1) {
+         if (errno == EINTR)
+            continue;
+         if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+         err_printf("Error writing queued data to parent on fd %d: %s\n", fd, strerror(errno));
+         return -1;
+      }
+      buf->pos += result;
+      if (buf->pos < buf->size)
+         continue;
+      upward_queue = buf->next;
+      if (!upward_queue)
+         upward_queue_tail = NULL;
+      free(buf);
+   }
+
+   debug_printf3("Drained queued writes to parent\n");
+   ldcs_listen_set_write_cb(fd, NULL);
+   return 0;
+}
+
+static void upward_free_queue()
+{
+   upward_buffer_t *buf;
+   while ((buf = upward_queue) != NULL) {
+      upward_queue = buf->next;
+      free(buf);
+   }
+   upward_queue_tail = NULL;
+}
+
+/* Writes the iovecs to fd, retrying on partial writes.  May modify iov. */
+static int peer_writev(int fd, struct iovec *iov, int iovcnt)
+{
+   struct msghdr hdr;
+   ssize_t result;
+   size_t remaining = 0, pos = 0;
+   upward_buffer_t *buf;
+   int i;
+
+   if (fd != upward_fd)
+      return ll_writev(fd, iov, iovcnt);
+
+   /* If earlier data is still queued, this has to queue behind it */
+   while (!upward_queue && iovcnt) {
+      memset(&hdr, 0, sizeof(hdr));
+      hdr.msg_iov = iov;
+      hdr.msg_iovlen = iovcnt;
+      result = sendmsg(fd, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (result == -1) {
+         if (errno == EINTR)
+            continue;
+         if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+         err_printf("Error writing to parent on fd %d: %s\n", fd, strerror(errno));
+         return -1;
+      }
+      while (iovcnt && (size_t) result >= iov->iov_len) {
+         result -= iov->iov_len;
+         iov++;
+         iovcnt--;
+      }
+      if (iovcnt) {
+         iov->iov_base = ((unsigned char *) iov->iov_base) + result;
+         iov->iov_len -= result;
+      }
+   }
+
+   for (i = 0; i < iovcnt; i++)
+      remaining += iov[i].iov_len;
+   if (!remaining)
+      return 0;
+
+   buf = (upward_buffer_t *) malloc(sizeof(upward_buffer_t) + remaining);
+   if (!buf) {
+      err_printf("Could not allocate %lu bytes to queue a write to the parent\n", (unsigned long) remaining);
+      return -1;
+   }
+   for (i = 0; i < iovcnt; i++) {
+      memcpy(buf->data + pos, iov[i].iov_base, iov[i].iov_len);
+      pos += iov[i].iov_len;
+   }
+   buf->size = remaining;
+   buf->pos = 0;
+   buf->next = NULL;
+   debug_printf3("Parent socket is full.  Queueing %lu bytes\n", (unsigned long) remaining);
+   if (upward_queue_tail) {
+      upward_queue_tail->next = buf;
+      upward_queue_tail = buf;
+      return 0;
+   }
+   upward_queue = upward_queue_tail = buf;
+   return ldcs_listen_set_write_cb(fd, upward_flush_CB);
+}
+
+static int peer_write(int fd, void *data, size_t size)
+{
+   struct iovec iov;
+   iov.iov_base = data;
+   iov.iov_len = size;
+   return peer_writev(fd, &iov, 1);
+}
+
+static int peer_write_msg(int fd, ldcs_message_t *msg)
+{
+   struct iovec iov[2];
+   int iovcnt = 0;
+
+   iov[iovcnt].iov_base = msg;
+   iov[iovcnt].iov_len = sizeof(*msg);
+   iovcnt++;
+   if (msg->header.len && msg->data) {
+      iov[iovcnt].iov_base = msg->data;
+      iov[iovcnt].iov_len = msg->header.len;
+      iovcnt++;
+   }
+   return peer_writev(fd, iov, iovcnt);
+}
+
 int ldcs_audit_server_md_init(unsigned int port, unsigned int num_ports, 
                               unique_id_t unique_id, ldcs_process_data_t *data)
 {
@@ -136,6 +289,8 @@ int ldcs_audit_server_md_register_fd ( ldcs_process_data_t *ldcs_process_data )
    debug_printf3("Registering fd %d for cobo parent connection\n",parent_fd);
    ldcs_listen_register_fd(parent_fd, 0, &ldcs_audit_server_md_cobo_CB, (void *) ldcs_process_data);
    ldcs_process_data->md_listen_to_parent=1;
+   if (ldcs_process_data->md_rank != 0 && ldcs_process_data->md_num_readers > 1)
+      upward_fd = parent_fd;
    
    cobo_get_num_childs(&num_childs);
    for (i = 0; i<num_childs; i++) {
@@ -150,11 +305,19 @@ int ldcs_audit_server_md_unregister_fd ( ldcs_process_data_t *ldcs_process_data
    int rc=0, i;
    int parent_fd, child_fd;
    int num_childs;
+   upward_buffer_t *buf;
    if(ldcs_process_data->md_listen_to_parent) {
       if(cobo_get_parent_socket(&parent_fd)!=COBO_SUCCESS) {
          _error("cobo internal error (parent socket)");
       }
       ldcs_process_data->md_listen_to_parent=0;
+      if (parent_fd == upward_fd) {
+         /* Nothing will drain the queue once we stop listening */
+         upward_fd = -1;
+         for (buf = upward_queue; buf; buf = buf->next)
+            ll_write(parent_fd, buf->data + buf->pos, buf->size - buf->pos);
+         upward_free_queue();
+      }
       ldcs_listen_unregister_fd(parent_fd);
 
       cobo_get_num_childs(&num_childs);
@@ -176,9 +339,28 @@ int ldcs_audit_server_md_destroy ( ldcs_process_data_t *ldcs_process_data )
    return 0;
 }
 
+static unsigned long key_hash(char *key)
+{
+   unsigned long hash = 5381;
+   int c;
+   while ((c = *key++))
+      hash = ((hash << 5) + hash) + c;
+   return hash;
+}
+
+/* Readers are spread evenly across the rank space, so their subtrees
+   (and the query traffic they attract) stay balanced. */
+static int responsible_rank(ldcs_process_data_t *ldcs_process_data, char *key)
+{
+   int reader;
+   if (ldcs_process_data->md_num_readers <= 1)
+      return 0;
+   reader = (int) (key_hash(key) % ldcs_process_data->md_num_readers);
+   return (int) (((long) reader * ldcs_process_data->md_size) / ldcs_process_data->md_num_readers);
+}
+
 int ldcs_audit_server_md_is_responsible ( ldcs_process_data_t *ldcs_process_data, char *filename ) {
-   /* current implementation: only MD rank does file operations  */
-   if(ldcs_process_data->md_rank == 0) { 
+   if (responsible_rank(ldcs_process_data, filename) == ldcs_process_data->md_rank) {
       debug_printf3("Decided I am responsible for file %s\n", filename);
       return 1;
    } else {
@@ -187,6 +369,32 @@ int ldcs_audit_server_md_is_responsible ( ldcs_process_data_t *ldcs_process_data
    }
 }
 
+node_peer_t ldcs_audit_server_md_get_parent(ldcs_process_data_t *ldcs_process_data)
+{
+   int parent_fd;
+   if (ldcs_process_data->md_rank == 0)
+      return NODE_PEER_NULL;
+   if (cobo_get_parent_socket(&parent_fd) != COBO_SUCCESS)
+      return NODE_PEER_NULL;
+   return (node_peer_t) (long) parent_fd;
+}
+
+node_peer_t ldcs_audit_server_md_query_route(ldcs_process_data_t *ldcs_process_data, char *key)
+{
+   int owner, child, child_fd;
+
+   owner = responsible_rank(ldcs_process_data, key);
+   if (owner == ldcs_process_data->md_rank)
+      return NODE_PEER_NULL;
+   if (cobo_get_child_for_rank(owner, &child) == COBO_SUCCESS) {
+      cobo_get_child_socket(child, &child_fd);
+      debug_printf3("Routing query for %s down to child %d towards rank %d\n", key, child, owner);
+      return (node_peer_t) (long) child_fd;
+   }
+   debug_printf3("Routing query for %s up towards rank %d\n", key, owner);
+   return ldcs_audit_server_md_get_parent(ldcs_process_data);
+}
+
 int ldcs_audit_server_md_to_frontend(ldcs_process_data_t *ldcs_process_data, ldcs_message_t  *msg) {
    int fe_fd = -1;
    int result;
@@ -220,7 +428,7 @@ int ldcs_audit_server_md_forward_query(ldcs_process_data_t *ldcs_process_data, l
    }
   
    cobo_get_parent_socket(&parent_fd);
-   result = write_msg(parent_fd, msg);
+   result = peer_write_msg(parent_fd, msg);
    if (result < 0) {
       err_printf("Problem writing message to parent, result is %d\n", result);
       return -1;
@@ -295,7 +503,7 @@ int ldcs_audit_server_md_cobo_CB(int fd, int nc, void *data)
 int ldcs_audit_server_md_send(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg, node_peer_t peer)
 {
    int fd = (int) (long) peer;
-   return write_msg(fd, msg);
+   return peer_write_msg(fd, msg);
 }
 
 int ldcs_audit_server_md_send_noncontig(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg, 
@@ -311,7 +519,7 @@ int ldcs_audit_server_md_send_noncontig(ldcs_process_data_t *ldcs_process_data,
    
    /* Send header */
    fd = (int) (long) peer;
-   int result = ll_write(fd, msg, sizeof(*msg));
+   int result = peer_write(fd, msg, sizeof(*msg));
    if (result == -1) {
       return -1;
    }
@@ -319,14 +527,14 @@ int ldcs_audit_server_md_send_noncontig(ldcs_process_data_t *ldcs_process_data,
    if (initial_size) {
       /* Send initial part of data */
       assert(msg->data);
-      result = ll_write(fd, msg->data, initial_size);
+      result = peer_write(fd, msg->data, initial_size);
       if (result == -1) {
          return -1;
       }
    }
 
    /* Send the secondary data */
-   result = ll_write(fd, secondary_data, secondary_size);
+   result = peer_write(fd, secondary_data, secondary_size);
    if (result == -1) {
       return -1;
    }
@@ -375,9 +583,139 @@ int ldcs_audit_server_md_broadcast_noncontig(ldcs_process_data_t *ldcs_process_d
    return global_result;   
 }
 
+/**
+ * Sends a message whose trailing data is the contents of an open file.  The
+ * header and packet prefix go out in one writev, then sendfile moves the file
+ * contents from the page cache to the socket without passing through our
+ * address space.  If sendfile isn't supported for this file or socket we
+ * finish the send from the mapped copy.
+ **/
+int ldcs_audit_server_md_send_file(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                   node_peer_t peer,
+                                   void *secondary_data, size_t secondary_size, int secondary_fd)
+{
+   int result, fd;
+   size_t sent = 0;
+
+   fd = (int) (long) peer;
+   if (secondary_fd == -1 || !secondary_size || fd == upward_fd)
+      return ldcs_audit_server_md_send_noncontig(ldcs_process_data, msg, peer, secondary_data, secondary_size);
+
+   assert(msg->header.len >= secondary_size);
+
+   result = ldcs_audit_server_md_send_begin(ldcs_process_data, msg, peer, msg->header.len - secondary_size);
+   if (result == -1)
+      return -1;
+
+   result = ll_sendfile(fd, secondary_fd, secondary_size, &sent);
+   if (result == -1) {
+      if (errno != EINVAL && errno != ENOSYS)
+         return -1;
+      debug_printf2("sendfile not supported after %lu bytes.  Sending remainder from memory\n",
+                    (unsigned long) sent);
+      result = ll_write(fd, ((unsigned char *) secondary_data) + sent, secondary_size - sent);
+      if (result == -1)
+         return -1;
+   }
+   return 0;
+}
+
+int ldcs_audit_server_md_broadcast_file(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                        void *secondary_data, size_t secondary_size, int secondary_fd)
+{
+   int fd, i;
+   int result, global_result = 0;
+   int num_childs = 0;
+
+   cobo_get_num_childs(&num_childs);
+   for (i = 0; i<num_childs; i++) {
+      cobo_get_child_socket(i, &fd);
+      result = ldcs_audit_server_md_send_file(ldcs_process_data, msg, (node_peer_t) (long) fd,
+                                              secondary_data, secondary_size, secondary_fd);
+      if (result == -1)
+         global_result = -1;
+   }
+   
+   return global_result;   
+}
+
+int ldcs_audit_server_md_send_begin(ldcs_process_data_t *ldcs_process_data, ldcs_message_t *msg,
+                                    node_peer_t peer, size_t initial_size)
+{
+   struct iovec iov[2];
+   int iovcnt = 0;
+
+   assert(msg->header.len >= initial_size);
+   iov[iovcnt].iov_base = msg;
+   iov[iovcnt].iov_len = sizeof(*msg);
+   iovcnt++;
+   if (initial_size) {
+      iov[iovcnt].iov_base = msg->data;
+      iov[iovcnt].iov_len = initial_size;
+      iovcnt++;
+   }
+   return peer_writev((int) (long) peer, iov, iovcnt);
+}
+
+int ldcs_audit_server_md_send_continue(ldcs_process_data_t *ldcs_process_data, node_peer_t peer,
+                                       void *data, size_t size)
+{
+   return peer_write((int) (long) peer, data, size);
+}
+
+int ldcs_audit_server_md_fail_peer(ldcs_process_data_t *ldcs_process_data, node_peer_t peer)
+{
+   int fd = (int) (long) peer;
+   int null_fd;
+
+   err_printf("Closing broken connection to peer on fd %d\n", fd);
+   if (fd == upward_fd) {
+      upward_fd = -1;
+      upward_free_queue();
+   }
+   ldcs_listen_unregister_fd(fd);
+   shutdown(fd, SHUT_RDWR);
+
+   /* cobo still holds this fd number.  Point it at /dev/null rather than closing it,
+      so it isn't reused and later writes to the peer neither fail nor raise SIGPIPE. */
+   null_fd = open("/dev/null", O_RDWR);
+   if (null_fd == -1) {
+      err_printf("Could not open /dev/null: %s\n", strerror(errno));
+      return -1;
+   }
+   if (dup2(null_fd, fd) == -1) {
+      err_printf("Could not replace fd %d: %s\n", fd, strerror(errno));
+      close(null_fd);
+      return -1;
+   }
+   close(null_fd);
+   return 0;
+}
+
+int ldcs_audit_server_md_send_iov(ldcs_process_data_t *ldcs_process_data, node_peer_t peer,
+                                  struct iovec *iov, int iovcnt)
+{
+   int result;
+   while (iovcnt > IOV_MAX) {
+      result = peer_writev((int) (long) peer, iov, IOV_MAX);
+      if (result == -1)
+         return -1;
+      iov += IOV_MAX;
+      iovcnt -= IOV_MAX;
+   }
+   return peer_writev((int) (long) peer, iov, iovcnt);
+}
+
 int ldcs_audit_server_md_get_num_children(ldcs_process_data_t *procdata)
 {
    int num_childs = 0;
    cobo_get_num_childs(&num_childs);
    return num_childs;
 }
+
+node_peer_t ldcs_audit_server_md_get_child(ldcs_process_data_t *procdata, int num)
+{
+   int fd;
+   cobo_get_child_socket(num, &fd);
+   return (node_peer_t) (long) fd;
+}
@@ -17,15 +17,22 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "config.h"
 #include <stdlib.h>
 #include "ldcs_audit_server_process.h"
+#include "ldcs_audit_server_numa.h"
 
 #if defined(LIBNUMA)
 
 #include <numa.h>
 #include <numaif.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <sys/mman.h>
 
-#include "ldcs_audit_server_numa.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "ldcs_api.h"
+#include "ldcs_api_listen.h"
 #include "spindle_debug.h"
 #include "spindle_launch.h"
 
@@ -221,6 +228,302 @@ void numa_update_local_filename(char *localfilename, int node)
    }
 }
 
+
+/* Replicas of each replicated file, indexed by its XXXXXX local name.  Only
+   touched from the event loop; the worker threads get a job that points at
+   an entry's name and source, which don't change once the entry exists. */
+typedef struct numa_replica_t {
+   char *localname;
+   void *source;
+   size_t size;
+   unsigned char *state;
+   struct numa_replica_t *next;
+} numa_replica_t;
+
+typedef struct replica_job_t {
+   numa_replica_t *replica;
+   char name[MAX_PATH_LEN+1];
+   int node;
+   int result;
+   double copy_time;
+   struct replica_job_t *next;
+} replica_job_t;
+
+typedef struct {
+   pthread_t thread;
+   int started;
+   pthread_cond_t cond;
+   replica_job_t *head, *tail;
+} replica_worker_t;
+
+#define REPLICA_TABLE_SIZE 1024
+static numa_replica_t *replica_table[REPLICA_TABLE_SIZE];
+
+static replica_worker_t *workers = NULL;
+static pthread_mutex_t replica_mut = PTHREAD_MUTEX_INITIALIZER;
+static replica_job_t *replica_done_head = NULL, *replica_done_tail = NULL;
+static int replica_pipe[2];
+static int replica_shutdown = 0;
+static numa_replica_done_cb_t replica_done_cb = NULL;
+
+static unsigned long replica_hash(char *str)
+{
+   unsigned long hash = 5381;
+   int c;
+   while ((c = *str++))
+      hash = ((hash << 5) + hash) + c;
+   return hash % REPLICA_TABLE_SIZE;
+}
+
+static numa_replica_t *replica_lookup(char *localfilename)
+{
+   numa_replica_t *r;
+   for (r = replica_table[replica_hash(localfilename)]; r; r = r->next) {
+      if (strcmp(r->localname, localfilename) == 0)
+         return r;
+   }
+   return NULL;
+}
+
+static void *replica_worker_main(void *arg)
+{
+   replica_worker_t *worker = (replica_worker_t *) arg;
+   int node = worker - workers;
+   replica_job_t *job;
+   void *buffer;
+   double starttime;
+   int fd, was_empty;
+   char c = 0;
+
+   if (numa_run_on_node(node) == -1)
+      debug_printf("Could not pin replica thread to numa node %d: %s\n", node, strerror(errno));
+
+   for (;;) {
+      pthread_mutex_lock(&replica_mut);
+      while (!worker->head && !replica_shutdown)
+         pthread_cond_wait(&worker->cond, &replica_mut);
+      if (replica_shutdown) {
+         pthread_mutex_unlock(&replica_mut);
+         return NULL;
+      }
+      job = worker->head;
+      worker->head = job->next;
+      if (!worker->head)
+         worker->tail = NULL;
+      pthread_mutex_unlock(&replica_mut);
+
+      starttime = ldcs_get_time();
+      job->result = -1;
+      debug_printf3("Creating replica %s for numa node %d\n", job->name, node);
+      if (filemngt_create_file_space(job->name, job->replica->size, &buffer, &fd) != -1) {
+         if (numa_assign_memory_to_node(buffer, job->replica->size, node) != -1) {
+            memcpy(buffer, job->replica->source, job->replica->size);
+            /* Clients map the replica themselves.  We don't need to keep it mapped. */
+            if (filemngt_sync_file_space(buffer, fd, job->name, job->replica->size, job->replica->size) == 0)
+               job->result = 0;
+            fd = -1;
+         }
+         if (fd != -1)
+            close(fd);
+      }
+      job->copy_time = ldcs_get_time() - starttime;
+      job->next = NULL;
+
+      pthread_mutex_lock(&replica_mut);
+      was_empty = (replica_done_head == NULL);
+      if (replica_done_tail)
+         replica_done_tail->next = job;
+      else
+         replica_done_head = job;
+      replica_done_tail = job;
+      if (was_empty)
+         (void)! write(replica_pipe[1], &c, sizeof(c));
+      pthread_mutex_unlock(&replica_mut);
+   }
+}
+
+/**
+ * Runs in the event loop when replica threads have finished jobs.
+ **/
+static int replica_done_pipe_cb(int fd, int serverid, void *data)
+{
+   ldcs_process_data_t *procdata = (ldcs_process_data_t *) data;
+   replica_job_t *job, *next;
+   char buf[64];
+   int result, global_result = 0;
+
+   while (read(fd, buf, sizeof(buf)) > 0);
+
+   pthread_mutex_lock(&replica_mut);
+   job = replica_done_head;
+   replica_done_head = replica_done_tail = NULL;
+   pthread_mutex_unlock(&replica_mut);
+
+   for (; job; job = next) {
+      next = job->next;
+      if (job->result == -1) {
+         err_printf("Failed to create replica %s for numa node %d. Clients on that node will use node 0's copy\n",
+                    job->name, job->node);
+         job->replica->state[job->node] = numa_replica_failed;
+      }
+      else {
+         debug_printf2("Created replica %s for numa node %d in %.3lfs\n", job->name, job->node, job->copy_time);
+         job->replica->state[job->node] = numa_replica_ready;
+         procdata->server_stat.numarepl.cnt++;
+         procdata->server_stat.numarepl.bytes += job->replica->size;
+         procdata->server_stat.numarepl.time += job->copy_time;
+         procdata->server_stat.libstore.bytes += job->replica->size;
+      }
+      result = replica_done_cb(procdata, job->name, job->node, job->result);
+      if (result == -1)
+         global_result = -1;
+      free(job);
+   }
+   return global_result;
+}
+
+/**
+ * Set up lazy replication.  Each node's worker thread is started on the
+ * first replica requested for that node.
+ **/
+int numa_replica_init(ldcs_process_data_t *procdata, numa_replica_done_cb_t cb)
+{
+   int i;
+
+   if (initialize_numa_lib() == -1)
+      return -1;
+   if (pipe(replica_pipe) == -1) {
+      err_printf("Could not create numa replica pipe: %s\n", strerror(errno));
+      return -1;
+   }
+   fcntl(replica_pipe[0], F_SETFL, fcntl(replica_pipe[0], F_GETFL) | O_NONBLOCK);
+   ldcs_listen_register_fd(replica_pipe[0], procdata->serverid, replica_done_pipe_cb, (void *) procdata);
+
+   workers = (replica_worker_t *) calloc(num_nodes, sizeof(replica_worker_t));
+   for (i = 0; i < num_nodes; i++)
+      pthread_cond_init(&workers[i].cond, NULL);
+   replica_done_cb = cb;
+   replica_shutdown = 0;
+   debug_printf("Using lazy numa replication across %d numa nodes\n", num_nodes);
+   return 0;
+}
+
+/**
+ * Record a replicated file whose copies for nodes [0, num_ready) exist.  source
+ * is a mapping of one of those copies, which later replicas are copied from.
+ **/
+void numa_replica_add(char *localfilename, void *source, size_t size, int num_ready)
+{
+   numa_replica_t *r;
+   unsigned long hash;
+   int i;
+
+   r = replica_lookup(localfilename);
+   if (!r) {
+      r = (numa_replica_t *) malloc(sizeof(numa_replica_t));
+      r->localname = strdup(localfilename);
+      r->state = (unsigned char *) malloc(num_nodes);
+      hash = replica_hash(localfilename);
+      r->next = replica_table[hash];
+      replica_table[hash] = r;
+   }
+   r->source = source;
+   r->size = size;
+   for (i = 0; i < num_nodes; i++)
+      r->state[i] = (i < num_ready) ? numa_replica_ready : numa_replica_missing;
+}
+
+numa_replica_state_t numa_replica_state(char *localfilename, int node)
+{
+   numa_replica_t *r;
+   if (node < 0 || node >= num_nodes)
+      return numa_replica_failed;
+   r = replica_lookup(localfilename);
+   if (!r)
+      return numa_replica_failed;
+   return (numa_replica_state_t) r->state[node];
+}
+
+/**
+ * Queue the creation of localfilename's replica on node.  Returns -1, and marks
+ * the replica as failed, if it can't be queued.
+ **/
+int numa_replica_submit(char *localfilename, int node)
+{
+   numa_replica_t *r;
+   replica_job_t *job;
+   replica_worker_t *worker;
+   int result;
+
+   r = replica_lookup(localfilename);
+   if (!r || node < 0 || node >= num_nodes)
+      return -1;
+   if (!workers) {
+      r->state[node] = numa_replica_failed;
+      return -1;
+   }
+   worker = workers + node;
+   if (!worker->started) {
+      result = pthread_create(&worker->thread, NULL, replica_worker_main, worker);
+      if (result != 0) {
+         err_printf("Could not create replica thread for numa node %d: %s\n", node, strerror(result));
+         r->state[node] = numa_replica_failed;
+         return -1;
+      }
+      worker->started = 1;
+   }
+
+   job = (replica_job_t *) malloc(sizeof(replica_job_t));
+   job->replica = r;
+   job->node = node;
+   job->next = NULL;
+   strncpy(job->name, localfilename, MAX_PATH_LEN);
+   job->name[MAX_PATH_LEN] = '\0';
+   numa_update_local_filename(job->name, node);
+   r->state[node] = numa_replica_pending;
+
+   debug_printf3("Queueing replica %s for numa node %d\n", job->name, node);
+   pthread_mutex_lock(&replica_mut);
+   if (worker->tail)
+      worker->tail->next = job;
+   else
+      worker->head = job;
+   worker->tail = job;
+   pthread_cond_signal(&worker->cond);
+   pthread_mutex_unlock(&replica_mut);
+   return 0;
+}
+
+/**
+ * Stop the replica threads.  Replicas that are still queued are dropped.
+ **/
+void numa_replica_done(ldcs_process_data_t *procdata)
+{
+   int i;
+   void *retval;
+
+   if (!workers)
+      return;
+
+   pthread_mutex_lock(&replica_mut);
+   replica_shutdown = 1;
+   for (i = 0; i < num_nodes; i++)
+      pthread_cond_broadcast(&workers[i].cond);
+   pthread_mutex_unlock(&replica_mut);
+
+   for (i = 0; i < num_nodes; i++) {
+      if (workers[i].started)
+         pthread_join(workers[i].thread, &retval);
+   }
+   free(workers);
+   workers = NULL;
+
+   ldcs_listen_unregister_fd(replica_pipe[0]);
+   close(replica_pipe[0]);
+   close(replica_pipe[1]);
+   replica_done_head = replica_done_tail = NULL;
+}
+
 #else
 
 int numa_should_replicate(ldcs_process_data_t *procdata, char *filename)
@@ -256,4 +559,27 @@ void numa_update_local_filename(char *localfilename, int node)
 {
 }
 
+int numa_replica_init(ldcs_process_data_t *procdata, numa_replica_done_cb_t cb)
+{
+   return -1;
+}
+
+void numa_replica_add(char *localfilename, void *source, size_t size, int num_ready)
+{
+}
+
+numa_replica_state_t numa_replica_state(char *localfilename, int node)
+{
+   return numa_replica_failed;
+}
+
+int numa_replica_submit(char *localfilename, int node)
+{
+   return -1;
+}
+
+void numa_replica_done(ldcs_process_data_t *procdata)
+{
+}
+
 #endif
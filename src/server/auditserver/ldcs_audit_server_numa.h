@@ -27,5 +27,27 @@ void *numa_alloc_temporary_memory(size_t size);
 void numa_free_temporary_memory(void *alloc, size_t size);
 void numa_update_local_filename(char *localfilename, int node);
 
+/**
+ * Lazily built per-node replicas.  A replicated file's node 0 copy is made
+ * when the file is read, and the other nodes' copies are made by worker
+ * threads pinned to their node the first time a client on that node asks
+ * for the file.  The done callback runs on the event loop with the name of
+ * the finished replica.
+ **/
+typedef enum {
+   numa_replica_missing,
+   numa_replica_pending,
+   numa_replica_ready,
+   numa_replica_failed
+} numa_replica_state_t;
+
+typedef int (*numa_replica_done_cb_t)(ldcs_process_data_t *procdata, char *replica_name, int node, int result);
+
+int numa_replica_init(ldcs_process_data_t *procdata, numa_replica_done_cb_t cb);
+void numa_replica_add(char *localfilename, void *source, size_t size, int num_ready);
+numa_replica_state_t numa_replica_state(char *localfilename, int node);
+int numa_replica_submit(char *localfilename, int node);
+void numa_replica_done(ldcs_process_data_t *procdata);
+
 #endif
 
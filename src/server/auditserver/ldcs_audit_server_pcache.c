@@ -0,0 +1,802 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ldcs_audit_server_pcache.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "ldcs_audit_server_dedup.h"
+#include "ldcs_audit_server_readpool.h"
+#include "ldcs_cache.h"
+#include "msgbundle.h"
+#include "spindle_launch.h"
+#include "spindle_debug.h"
+
+/**
+ * The index is a pcache_header_t followed by num_records pcache_record_t,
+ * each followed by path_len bytes of 0-terminated path.  The metadata is
+ * of the file on the shared file system.  hash and size are of the stored
+ * contents, which differ from the file's when it was stripped, so an index
+ * written with different strip settings isn't used.
+ **/
+#define PCACHE_MAGIC "SPNDLPC"
+#define PCACHE_VERSION 1
+
+typedef struct {
+   char magic[8];
+   int32_t version;
+   int32_t strip;
+   int32_t num_records;
+   int32_t unused;
+} pcache_header_t;
+
+typedef struct {
+   uint64_t hash;
+   uint64_t size;
+   uint64_t st_size;
+   int64_t mtime_sec;
+   int64_t mtime_nsec;
+   int64_t ctime_sec;
+   int64_t ctime_nsec;
+   uint64_t ino;
+   int32_t path_len;
+   int32_t unused;
+} pcache_record_t;
+
+/* A LDCS_MSG_PCACHE_VALID body is a sequence of these, each followed by
+   path_len bytes of 0-terminated path */
+typedef struct {
+   uint64_t hash;
+   uint64_t size;
+   int32_t path_len;
+   int32_t unused;
+} pcache_valid_t;
+
+#define PCACHE_INDEXED  1   /* rec's metadata came from the index */
+#define PCACHE_VALID    2   /* unchanged since it was indexed, with contents rec.hash and rec.size */
+#define PCACHE_READ     4   /* rec's metadata was taken when this server read the path */
+#define PCACHE_RESTORED 8   /* served from the object store in this job */
+#define PCACHE_SAVED    16  /* kept in the object store at exit */
+#define PCACHE_CHECKING 32  /* indexed, and not yet revalidated in this job */
+
+typedef struct pcache_entry_t {
+   char *pathname;
+   pcache_record_t rec;
+   int flags;
+   struct pcache_entry_t *next;
+} pcache_entry_t;
+
+#define PCACHE_TABLE_SIZE 4096
+static pcache_entry_t *pcache_table[PCACHE_TABLE_SIZE];
+
+/* Files whose ctime is this close to the start of the job may have changed
+   after we read them, so they aren't indexed from a stat at exit */
+#define PCACHE_SETTLE_SECS 60
+
+/* Objects no job has used in this long are removed */
+#define PCACHE_MAX_AGE_SECS (14 * 24 * 60 * 60)
+
+/* The index is revalidated on the read pool in jobs of this many entries,
+   so the stat round trips to the shared file system overlap and the event
+   loop keeps serving requests meanwhile */
+#define PCACHE_CHECK_CHUNK 256
+
+/* Unchanged entries are broadcast in messages of at most this many bytes,
+   which are small enough to be bundled */
+#define PCACHE_MSG_MAX (32*1024)
+
+static time_t pcache_start;
+
+static unsigned int hashval(const char *str)
+{
+   unsigned int hash = 5381;
+   unsigned int c;
+   while ((c = *str++))
+      hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+   return hash % PCACHE_TABLE_SIZE;
+}
+
+static pcache_entry_t *find_entry(const char *pathname)
+{
+   pcache_entry_t *e;
+   for (e = pcache_table[hashval(pathname)]; e; e = e->next) {
+      if (strcmp(e->pathname, pathname) == 0)
+         return e;
+   }
+   return NULL;
+}
+
+static pcache_entry_t *get_entry(const char *pathname)
+{
+   unsigned int val;
+   pcache_entry_t *e = find_entry(pathname);
+   if (e)
+      return e;
+
+   val = hashval(pathname);
+   e = (pcache_entry_t *) calloc(1, sizeof(pcache_entry_t));
+   e->pathname = strdup(pathname);
+   e->rec.path_len = strlen(pathname) + 1;
+   e->next = pcache_table[val];
+   pcache_table[val] = e;
+   return e;
+}
+
+static void object_name(ldcs_process_data_t *procdata, uint64_t hash, size_t size, char *name, size_t name_size)
+{
+   snprintf(name, name_size, "%s/objects/%016llx-%lu", procdata->pcache_dir,
+            (unsigned long long) hash, (unsigned long) size);
+}
+
+static void set_metadata(pcache_record_t *rec, const struct stat *buf)
+{
+   rec->st_size = (uint64_t) buf->st_size;
+   rec->mtime_sec = (int64_t) buf->st_mtim.tv_sec;
+   rec->mtime_nsec = (int64_t) buf->st_mtim.tv_nsec;
+   rec->ctime_sec = (int64_t) buf->st_ctim.tv_sec;
+   rec->ctime_nsec = (int64_t) buf->st_ctim.tv_nsec;
+   rec->ino = (uint64_t) buf->st_ino;
+}
+
+static int same_metadata(const pcache_record_t *rec, const struct stat *buf)
+{
+   return rec->st_size == (uint64_t) buf->st_size &&
+      rec->mtime_sec == (int64_t) buf->st_mtim.tv_sec &&
+      rec->mtime_nsec == (int64_t) buf->st_mtim.tv_nsec &&
+      rec->ctime_sec == (int64_t) buf->st_ctim.tv_sec &&
+      rec->ctime_nsec == (int64_t) buf->st_ctim.tv_nsec &&
+      rec->ino == (uint64_t) buf->st_ino;
+}
+
+static int make_dir(const char *path)
+{
+   if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+      err_printf("Could not create persistent cache directory %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * Contents in the persistent cache are handed to applications as is, so
+ * only trust path if it's ours, of the expected type, not a symlink, and
+ * not writable by anybody else.  Returns 1 if path doesn't exist.
+ **/
+static int check_private(const char *path, mode_t type)
+{
+   struct stat buf;
+
+   if (lstat(path, &buf) == -1) {
+      if (errno == ENOENT)
+         return 1;
+      err_printf("Could not stat persistent cache path %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+   if ((buf.st_mode & S_IFMT) != type) {
+      err_printf("Persistent cache path %s is a symlink or not a %s\n", path,
+                 type == S_IFDIR ? "directory" : "regular file");
+      return -1;
+   }
+   if (buf.st_uid != geteuid()) {
+      err_printf("Persistent cache path %s is owned by uid %d, not by us\n", path, (int) buf.st_uid);
+      return -1;
+   }
+   if (buf.st_mode & (S_IWGRP | S_IWOTH)) {
+      err_printf("Persistent cache path %s is writable by group or others (mode %o)\n", path,
+                 (unsigned int) (buf.st_mode & 07777));
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * Copies a file when the object store and the local cache are on different
+ * file systems and can't share it through a hard link
+ **/
+static int copy_file(const char *from, const char *to)
+{
+   char buffer[65536];
+   int in, out, result = 0;
+   ssize_t nread, nwritten, pos;
+
+   in = open(from, O_RDONLY);
+   if (in == -1) {
+      err_printf("Could not open %s to copy it: %s\n", from, strerror(errno));
+      return -1;
+   }
+   out = open(to, O_CREAT | O_EXCL | O_WRONLY, 0700);
+   if (out == -1) {
+      err_printf("Could not create %s: %s\n", to, strerror(errno));
+      close(in);
+      return -1;
+   }
+   for (;;) {
+      nread = read(in, buffer, sizeof(buffer));
+      if (nread == -1 && errno == EINTR)
+         continue;
+      if (nread <= 0) {
+         if (nread == -1) {
+            err_printf("Could not read %s: %s\n", from, strerror(errno));
+            result = -1;
+         }
+         break;
+      }
+      for (pos = 0; pos < nread; pos += nwritten) {
+         nwritten = write(out, buffer + pos, nread - pos);
+         if (nwritten == -1 && errno == EINTR) {
+            nwritten = 0;
+            continue;
+         }
+         if (nwritten == -1) {
+            err_printf("Could not write %s: %s\n", to, strerror(errno));
+            result = -1;
+            break;
+         }
+      }
+      if (result == -1)
+         break;
+   }
+   close(in);
+   if (close(out) == -1)
+      result = -1;
+   if (result == -1)
+      unlink(to);
+   return result;
+}
+
+/**
+ * Gives the file at from a second name, by a hard link if both are on the
+ * same file system and by a copy if not
+ **/
+static int link_or_copy(const char *from, const char *to)
+{
+   if (link(from, to) == 0)
+      return 0;
+   if (errno != EXDEV && errno != EPERM) {
+      debug_printf2("Could not link %s to %s: %s\n", to, from, strerror(errno));
+      return -1;
+   }
+   return copy_file(from, to);
+}
+
+/**
+ * A chunk of index entries being revalidated.  The reader thread only
+ * touches pathnames, which don't change, and the copies of the records, so
+ * the event loop can go on updating the entries.
+ **/
+typedef struct {
+   readpool_job_t job;
+   int count;
+   pcache_entry_t *entries[PCACHE_CHECK_CHUNK];
+   pcache_record_t recs[PCACHE_CHECK_CHUNK];
+   char unchanged[PCACHE_CHECK_CHUNK];
+} pcache_check_t;
+
+static int checks_pending = 0, check_total = 0, check_valid = 0;
+static double check_start;
+
+static void check_chunk_work(readpool_job_t *job)
+{
+   pcache_check_t *check = (pcache_check_t *) job->data;
+   struct stat buf;
+   int i;
+
+   for (i = 0; i < check->count; i++) {
+      check->unchanged[i] = (stat(check->entries[i]->pathname, &buf) == 0 &&
+                             same_metadata(check->recs + i, &buf));
+   }
+}
+
+/**
+ * Reads the index into the table.  A missing index, or one written by a
+ * different version or with different strip settings, is skipped.
+ **/
+static int load_index(ldcs_process_data_t *procdata)
+{
+   char indexname[MAX_PATH_LEN+1];
+   pcache_header_t header;
+   pcache_record_t rec;
+   pcache_entry_t *e;
+   char *path = NULL;
+   FILE *f;
+   int i, strip, count = 0;
+
+   snprintf(indexname, sizeof(indexname), "%s/index", procdata->pcache_dir);
+   f = fopen(indexname, "r");
+   if (!f) {
+      debug_printf("No persistent cache index at %s\n", indexname);
+      return 0;
+   }
+
+   strip = (procdata->opts & OPT_STRIP) ? 1 : 0;
+   if (fread(&header, sizeof(header), 1, f) != 1 ||
+       strncmp(header.magic, PCACHE_MAGIC, sizeof(header.magic)) != 0 ||
+       header.version != PCACHE_VERSION) {
+      err_printf("Persistent cache index %s is not a valid index.  Ignoring it\n", indexname);
+      fclose(f);
+      return 0;
+   }
+   if (header.strip != strip) {
+      debug_printf("Persistent cache index %s was written with different strip settings.  Ignoring it\n",
+                   indexname);
+      fclose(f);
+      return 0;
+   }
+
+   path = (char *) malloc(MAX_PATH_LEN+1);
+   for (i = 0; i < header.num_records; i++) {
+      if (fread(&rec, sizeof(rec), 1, f) != 1 || rec.path_len <= 1 || rec.path_len > MAX_PATH_LEN+1 ||
+          fread(path, rec.path_len, 1, f) != 1 || path[rec.path_len-1] != '\0') {
+         err_printf("Persistent cache index %s is truncated after %d of %d records\n", indexname, i,
+                    header.num_records);
+         break;
+      }
+      e = get_entry(path);
+      e->rec = rec;
+      e->flags = PCACHE_INDEXED;
+      count++;
+   }
+   free(path);
+   fclose(f);
+   debug_printf("Read %d records from persistent cache index %s\n", count, indexname);
+   return count;
+}
+
+/**
+ * Writes the index of every path the object store has contents for.  The
+ * index is written to a temporary file and renamed, so a job starting on
+ * the node at the same time sees the old index or the new one.
+ **/
+static int save_index(ldcs_process_data_t *procdata)
+{
+   char indexname[MAX_PATH_LEN+1], tmpname[MAX_PATH_LEN+1], objname[MAX_PATH_LEN+1];
+   pcache_header_t header;
+   pcache_entry_t *e;
+   FILE *f;
+   int i, result = 0;
+
+   snprintf(indexname, sizeof(indexname), "%s/index", procdata->pcache_dir);
+   snprintf(tmpname, sizeof(tmpname), "%s/index.%d", procdata->pcache_dir, (int) getpid());
+   f = fopen(tmpname, "w");
+   if (!f) {
+      err_printf("Could not create persistent cache index %s: %s\n", tmpname, strerror(errno));
+      return -1;
+   }
+
+   memset(&header, 0, sizeof(header));
+   strncpy(header.magic, PCACHE_MAGIC, sizeof(header.magic));
+   header.version = PCACHE_VERSION;
+   header.strip = (procdata->opts & OPT_STRIP) ? 1 : 0;
+   for (i = 0; i < PCACHE_TABLE_SIZE; i++) {
+      for (e = pcache_table[i]; e; e = e->next) {
+         /* Entries this job didn't use, or didn't get to revalidate, stay
+            while their object does */
+         if ((e->flags & (PCACHE_VALID | PCACHE_CHECKING)) && !(e->flags & PCACHE_SAVED)) {
+            object_name(procdata, e->rec.hash, e->rec.size, objname, sizeof(objname));
+            if (access(objname, R_OK) == -1)
+               e->flags &= ~(PCACHE_VALID | PCACHE_CHECKING);
+         }
+         if (e->flags & (PCACHE_SAVED | PCACHE_VALID | PCACHE_CHECKING))
+            header.num_records++;
+      }
+   }
+   if (fwrite(&header, sizeof(header), 1, f) != 1)
+      result = -1;
+
+   for (i = 0; i < PCACHE_TABLE_SIZE && result != -1; i++) {
+      for (e = pcache_table[i]; e; e = e->next) {
+         if (!(e->flags & (PCACHE_SAVED | PCACHE_VALID | PCACHE_CHECKING)))
+            continue;
+         if (fwrite(&e->rec, sizeof(e->rec), 1, f) != 1 ||
+             fwrite(e->pathname, e->rec.path_len, 1, f) != 1) {
+            result = -1;
+            break;
+         }
+      }
+   }
+   if (fclose(f) != 0)
+      result = -1;
+   if (result == -1) {
+      err_printf("Could not write persistent cache index %s\n", tmpname);
+      unlink(tmpname);
+      return -1;
+   }
+   if (rename(tmpname, indexname) == -1) {
+      err_printf("Could not rename %s to %s: %s\n", tmpname, indexname, strerror(errno));
+      unlink(tmpname);
+      return -1;
+   }
+   debug_printf("Wrote %d records to persistent cache index %s\n", header.num_records, indexname);
+   return 0;
+}
+
+/**
+ * Sends the hash and size of a chunk's unchanged entries to the other
+ * servers, in as many messages as it takes to stay under PCACHE_MSG_MAX
+ **/
+static int broadcast_valid(ldcs_process_data_t *procdata, pcache_check_t *check)
+{
+   ldcs_message_t msg;
+   pcache_valid_t valid;
+   char buffer[PCACHE_MSG_MAX];
+   size_t pos = 0;
+   int i, num_msg = 0, result = 0;
+
+   msg.header.type = LDCS_MSG_PCACHE_VALID;
+   msg.data = buffer;
+   memset(&valid, 0, sizeof(valid));
+   for (i = 0; i <= check->count; i++) {
+      if (i < check->count && !check->unchanged[i])
+         continue;
+      if (pos && (i == check->count || pos + sizeof(valid) + check->recs[i].path_len > sizeof(buffer))) {
+         msg.header.len = pos;
+         debug_printf2("Broadcasting %d unchanged persistent cache entries\n", num_msg);
+         if (spindle_broadcast(procdata, &msg) == -1)
+            result = -1;
+         pos = 0;
+         num_msg = 0;
+      }
+      if (i == check->count)
+         break;
+      valid.hash = check->recs[i].hash;
+      valid.size = check->recs[i].size;
+      valid.path_len = check->recs[i].path_len;
+      memcpy(buffer + pos, &valid, sizeof(valid));
+      pos += sizeof(valid);
+      memcpy(buffer + pos, check->entries[i]->pathname, valid.path_len);
+      pos += valid.path_len;
+      num_msg++;
+   }
+   return result;
+}
+
+/**
+ * Marks a revalidated chunk's unchanged entries valid and passes them on.
+ * Entries this server has read in the meantime are left to the read.
+ **/
+static int check_chunk_done(ldcs_process_data_t *procdata, readpool_job_t *job)
+{
+   pcache_check_t *check = (pcache_check_t *) job->data;
+   pcache_entry_t *e;
+   int i, num_valid = 0, result = 0;
+
+   for (i = 0; i < check->count; i++) {
+      e = check->entries[i];
+      e->flags &= ~PCACHE_CHECKING;
+      if (e->flags & PCACHE_READ)
+         check->unchanged[i] = 0;
+      if (!check->unchanged[i])
+         continue;
+      e->flags |= PCACHE_VALID;
+      num_valid++;
+   }
+   check_valid += num_valid;
+   if (num_valid)
+      result = broadcast_valid(procdata, check);
+   free(check);
+
+   if (--checks_pending == 0) {
+      procdata->server_stat.pcache_check.time += ldcs_get_time() - check_start;
+      debug_printf("%d of %d persistent cache entries are unchanged.  Revalidating took %.3lfs\n",
+                   check_valid, check_total, ldcs_get_time() - check_start);
+   }
+   return result;
+}
+
+/**
+ * Revalidates a chunk of entries on the read pool, or here if there is no
+ * read pool
+ **/
+static int check_chunk(ldcs_process_data_t *procdata, pcache_check_t *check)
+{
+   check->job.pathname = check->entries[0]->pathname;
+   check->job.buffer = NULL;
+   check->job.size = 0;
+   check->job.done_cb = check_chunk_done;
+   check->job.work_cb = check_chunk_work;
+   check->job.data = check;
+   checks_pending++;
+   if (readpool_enabled() && readpool_submit(&check->job) == 0)
+      return 0;
+
+   check_chunk_work(&check->job);
+   return check_chunk_done(procdata, &check->job);
+}
+
+/**
+ * Sets up the persistent cache.  The root starts revalidating its index,
+ * and tells the other servers which entries can be used as each chunk of
+ * it is done.  Until then, paths are read or requested as usual.
+ **/
+int pcache_init(ldcs_process_data_t *procdata)
+{
+   char objdir[MAX_PATH_LEN+1], indexname[MAX_PATH_LEN+1];
+   pcache_check_t *check;
+   pcache_entry_t *e;
+   int count, i, result = 0;
+
+   if (!procdata->pcache_dir)
+      return 0;
+
+   pcache_start = time(NULL);
+   snprintf(objdir, sizeof(objdir), "%s/objects", procdata->pcache_dir);
+   snprintf(indexname, sizeof(indexname), "%s/index", procdata->pcache_dir);
+   if (make_dir(procdata->pcache_dir) == -1 || check_private(procdata->pcache_dir, S_IFDIR) != 0 ||
+       make_dir(objdir) == -1 || check_private(objdir, S_IFDIR) != 0 ||
+       check_private(indexname, S_IFREG) == -1) {
+      err_printf("Not using the persistent cache\n");
+      procdata->pcache_dir = NULL;
+      return 0;
+   }
+
+   if (procdata->md_rank != 0)
+      return 0;
+
+   count = load_index(procdata);
+   if (!count)
+      return 0;
+
+   check_start = ldcs_get_time();
+   check_total = count;
+   procdata->server_stat.pcache_check.cnt += count;
+   check = NULL;
+   for (i = 0; i < PCACHE_TABLE_SIZE; i++) {
+      for (e = pcache_table[i]; e; e = e->next) {
+         if (!check)
+            check = (pcache_check_t *) calloc(1, sizeof(pcache_check_t));
+         e->flags |= PCACHE_CHECKING;
+         check->entries[check->count] = e;
+         check->recs[check->count] = e->rec;
+         if (++check->count < PCACHE_CHECK_CHUNK)
+            continue;
+         if (check_chunk(procdata, check) == -1)
+            result = -1;
+         check = NULL;
+      }
+   }
+   if (check && check_chunk(procdata, check) == -1)
+      result = -1;
+   return result;
+}
+
+/**
+ * Marks the entries the root found unchanged as valid here, and passes
+ * them on down the tree
+ **/
+int pcache_recv_msg(ldcs_process_data_t *procdata, ldcs_message_t *msg)
+{
+   pcache_valid_t valid;
+   pcache_entry_t *e;
+   char *data = (char *) msg->data;
+   int pos = 0, count = 0;
+
+   while (procdata->pcache_dir && pos < msg->header.len) {
+      assert(pos + sizeof(valid) <= (size_t) msg->header.len);
+      memcpy(&valid, data + pos, sizeof(valid));
+      pos += sizeof(valid);
+      assert(valid.path_len > 0 && pos + valid.path_len <= msg->header.len);
+
+      e = get_entry(data + pos);
+      pos += valid.path_len;
+      e->rec.hash = valid.hash;
+      e->rec.size = valid.size;
+      e->flags |= PCACHE_VALID;
+      count++;
+   }
+   debug_printf2("Received %d unchanged persistent cache entries\n", count);
+
+   return spindle_broadcast(procdata, msg);
+}
+
+/**
+ * Notes the metadata of a path the root is about to read off the shared
+ * file system, which is what the index records for it.  A stat taken
+ * before the read can only be older than the contents, so a change during
+ * the read makes the entry fail revalidation rather than serve stale data.
+ **/
+void pcache_record_read(ldcs_process_data_t *procdata, const char *pathname)
+{
+   struct stat buf;
+   pcache_entry_t *e;
+
+   if (!procdata->pcache_dir || procdata->md_rank != 0)
+      return;
+   if (stat(pathname, &buf) == -1)
+      return;
+   e = get_entry(pathname);
+   set_metadata(&e->rec, &buf);
+   e->flags |= PCACHE_READ;
+}
+
+/**
+ * Returns 0 and the hash and size of pathname's contents if it is unchanged
+ * since an earlier job kept it.
+ **/
+int pcache_lookup(ldcs_process_data_t *procdata, const char *pathname, uint64_t *hash, size_t *size)
+{
+   pcache_entry_t *e;
+
+   if (!procdata->pcache_dir)
+      return -1;
+   e = find_entry(pathname);
+   if (!e || !(e->flags & PCACHE_VALID))
+      return -1;
+   *hash = e->rec.hash;
+   *size = (size_t) e->rec.size;
+   return 0;
+}
+
+/**
+ * Puts the stored contents of pathname at localname.  If this node's
+ * object store doesn't have them, the entry is dropped and -1 returned, so
+ * the caller reads or requests the file as usual.
+ **/
+int pcache_restore(ldcs_process_data_t *procdata, const char *pathname, char *localname)
+{
+   char objname[MAX_PATH_LEN+1];
+   pcache_entry_t *e;
+
+   e = find_entry(pathname);
+   if (!e || !(e->flags & PCACHE_VALID))
+      return -1;
+
+   object_name(procdata, e->rec.hash, e->rec.size, objname, sizeof(objname));
+   if (link_or_copy(objname, localname) == -1) {
+      debug_printf2("Contents of %s aren't in the persistent cache on this node\n", pathname);
+      e->flags &= ~PCACHE_VALID;
+      return -1;
+   }
+   utimensat(AT_FDCWD, objname, NULL, 0);
+   e->flags |= PCACHE_RESTORED;
+   debug_printf2("Restored %s from persistent cache object %s\n", pathname, objname);
+   return 0;
+}
+
+/**
+ * Adds a cached file's contents to the object store, or marks the copy
+ * already there as used
+ **/
+static int store_object(ldcs_process_data_t *procdata, char *localname, uint64_t hash, size_t size)
+{
+   static unsigned int tmp_num = 0;
+   char objname[MAX_PATH_LEN+1], tmpname[MAX_PATH_LEN+1];
+
+   object_name(procdata, hash, size, objname, sizeof(objname));
+   if (utimensat(AT_FDCWD, objname, NULL, 0) == 0)
+      return 0;
+
+   snprintf(tmpname, sizeof(tmpname), "%s/objects/tmp.%d.%u", procdata->pcache_dir, (int) getpid(), tmp_num++);
+   if (link_or_copy(localname, tmpname) == -1)
+      return -1;
+   if (rename(tmpname, objname) == -1) {
+      err_printf("Could not rename %s to %s: %s\n", tmpname, objname, strerror(errno));
+      unlink(tmpname);
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * Removes objects that no job has used in PCACHE_MAX_AGE_SECS, and
+ * temporary files left by jobs that died while saving
+ **/
+static void prune_objects(ldcs_process_data_t *procdata)
+{
+   char objdir[MAX_PATH_LEN+1], objname[MAX_PATH_LEN+1];
+   struct dirent *dent;
+   struct stat buf;
+   time_t now = time(NULL);
+   DIR *d;
+   int count = 0;
+
+   snprintf(objdir, sizeof(objdir), "%s/objects", procdata->pcache_dir);
+   d = opendir(objdir);
+   if (!d)
+      return;
+   while ((dent = readdir(d))) {
+      if (dent->d_name[0] == '.')
+         continue;
+      snprintf(objname, sizeof(objname), "%s/%s", objdir, dent->d_name);
+      if (lstat(objname, &buf) == -1 || !S_ISREG(buf.st_mode))
+         continue;
+      if (now - buf.st_mtime < PCACHE_MAX_AGE_SECS)
+         continue;
+      if (unlink(objname) == 0)
+         count++;
+   }
+   closedir(d);
+   if (count)
+      debug_printf("Removed %d unused objects from the persistent cache\n", count);
+}
+
+/**
+ * Keeps every file in the local cache in the object store.  The root also
+ * indexes them, with the metadata taken when it read them.  Files it was
+ * sent are stat'd now, and only indexed if they are older than the job,
+ * since another server read them at some point after it started.
+ **/
+int pcache_save(ldcs_process_data_t *procdata)
+{
+   char pathname[MAX_PATH_LEN+1];
+   char *filename, *dirname, *localname;
+   void *pos = NULL, *buffer;
+   struct stat buf;
+   pcache_entry_t *e;
+   uint64_t hash;
+   size_t size;
+   double starttime;
+
+   if (!procdata->pcache_dir)
+      return 0;
+
+   starttime = ldcs_get_time();
+   while (ldcs_cache_lruNext(&pos, &filename, &dirname, &localname, &size) != -1) {
+      snprintf(pathname, sizeof(pathname), "%s/%s", dirname, filename);
+      e = find_entry(pathname);
+      if (e && (e->flags & PCACHE_RESTORED)) {
+         /* A link to the object it came from */
+         hash = e->rec.hash;
+      }
+      else if (size == 0) {
+         hash = dedup_hash(NULL, 0);
+      }
+      else {
+         buffer = filemngt_map_cached_file(localname, size);
+         if (!buffer)
+            continue;
+         hash = dedup_hash(buffer, size);
+         filemngt_release_mapping(buffer);
+      }
+      if (store_object(procdata, localname, hash, size) == -1)
+         continue;
+      procdata->server_stat.pcache_save.cnt++;
+      procdata->server_stat.pcache_save.bytes += size;
+
+      if (procdata->md_rank != 0)
+         continue;
+      e = get_entry(pathname);
+      if (!(e->flags & (PCACHE_RESTORED | PCACHE_READ))) {
+         if (stat(pathname, &buf) == -1 ||
+             buf.st_ctime >= pcache_start - PCACHE_SETTLE_SECS ||
+             buf.st_mtime >= pcache_start - PCACHE_SETTLE_SECS) {
+            debug_printf3("Not indexing %s, which may have changed during the job\n", pathname);
+            continue;
+         }
+         set_metadata(&e->rec, &buf);
+      }
+      e->rec.hash = hash;
+      e->rec.size = size;
+      e->flags |= PCACHE_SAVED;
+   }
+
+   prune_objects(procdata);
+   if (procdata->md_rank == 0)
+      save_index(procdata);
+   procdata->server_stat.pcache_save.time += ldcs_get_time() - starttime;
+   return 0;
+}
@@ -0,0 +1,46 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_PCACHE_H_)
+#define LDCS_AUDIT_SERVER_PCACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ldcs_audit_server_process.h"
+#include "ldcs_api.h"
+
+/**
+ * With a persistent cache directory, each server keeps the files in its
+ * local cache when the job ends, in an object store on the node named by
+ * the hash and size of their contents.  The root server also writes an
+ * index of the paths it cached, with the size, mtime, ctime and inode each
+ * had when it was read.  When the next job starts, the root stats the
+ * indexed paths in the background and broadcasts the hash and size of
+ * those that are unchanged in LDCS_MSG_PCACHE_VALID messages.  Servers then
+ * answer requests for those paths from their own object store, if they
+ * have the contents there, rather than reading or requesting them.
+ * All calls are no-ops without a persistent cache directory.
+ **/
+int pcache_init(ldcs_process_data_t *procdata);
+void pcache_record_read(ldcs_process_data_t *procdata, const char *pathname);
+int pcache_lookup(ldcs_process_data_t *procdata, const char *pathname, uint64_t *hash, size_t *size);
+int pcache_restore(ldcs_process_data_t *procdata, const char *pathname, char *localname);
+int pcache_recv_msg(ldcs_process_data_t *procdata, ldcs_message_t *msg);
+int pcache_save(ldcs_process_data_t *procdata);
+
+#endif
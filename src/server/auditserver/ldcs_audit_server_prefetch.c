@@ -0,0 +1,511 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ldcs_audit_server_prefetch.h"
+#include "ldcs_api.h"
+#include "pathfn.h"
+#include "spindle_debug.h"
+#include "config.h"
+
+/**
+ * The parts of glibc's ld.so.cache format that are needed to look up a
+ * library.  Newer caches contain only the new format.  Older ones have an
+ * old-format table first, followed by the new format.
+ **/
+#define LDSO_CACHE_FILE "/etc/ld.so.cache"
+#define LDSO_CACHE_MAGIC_OLD "ld.so-1.7.0"
+#define LDSO_CACHE_MAGIC_NEW "glibc-ld.so.cache1.1"
+#define LDSO_CACHE_FLAG_ELF_LIBC6 0x0003
+#define LDSO_CACHE_TYPE_MASK 0x00ff
+#define LDSO_CACHE_ARCH_MASK 0xff00
+
+typedef struct {
+   char magic[sizeof(LDSO_CACHE_MAGIC_OLD)-1];
+   uint32_t nlibs;
+} ldso_cache_old_header_t;
+
+typedef struct {
+   int32_t flags;
+   uint32_t key, value;
+} ldso_cache_old_entry_t;
+
+typedef struct {
+   char magic[sizeof(LDSO_CACHE_MAGIC_NEW)-1];
+   uint32_t nlibs;
+   uint32_t len_strings;
+   uint8_t flags;
+   uint8_t padding[3];
+   uint32_t extension_offset;
+   uint32_t unused[3];
+} ldso_cache_header_t;
+
+typedef struct {
+   int32_t flags;
+   uint32_t key, value;
+   uint32_t osversion;
+   uint64_t hwcap;
+} ldso_cache_entry_t;
+
+/* The cache's arch flags for 64-bit libraries, and the multiarch directory
+   name that Debian-style systems add to the default search path */
+#if defined(arch_x86_64)
+#define LDSO_CACHE_ARCH64 0x0300
+#define MULTIARCH_TRIPLET "x86_64-linux-gnu"
+#elif defined(arch_aarch64)
+#define LDSO_CACHE_ARCH64 0x0a00
+#define MULTIARCH_TRIPLET "aarch64-linux-gnu"
+#elif defined(arch_ppc64le)
+#define LDSO_CACHE_ARCH64 0x0500
+#define MULTIARCH_TRIPLET "powerpc64le-linux-gnu"
+#elif defined(arch_ppc64)
+#define LDSO_CACHE_ARCH64 0x0500
+#define MULTIARCH_TRIPLET "powerpc64-linux-gnu"
+#else
+#define LDSO_CACHE_ARCH64 -1
+#endif
+
+static const char *default_dirs64[] = {
+#if defined(MULTIARCH_TRIPLET)
+   "/lib/" MULTIARCH_TRIPLET,
+   "/usr/lib/" MULTIARCH_TRIPLET,
+#endif
+   "/lib64",
+   "/usr/lib64",
+   NULL
+};
+
+static const char *default_dirs32[] = {
+   "/lib",
+   "/usr/lib",
+   NULL
+};
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NATIVE_ELFDATA ELFDATA2LSB
+#else
+#define NATIVE_ELFDATA ELFDATA2MSB
+#endif
+
+/* What an object's dynamic section says about its dependencies.  The
+   strings point into the object's buffer. */
+typedef struct {
+   int elfclass;
+   int nodeflib;
+   const char *rpath;
+   const char *runpath;
+   const char **needed;
+   int num_needed;
+} elf_dynamic_t;
+
+static char *ldso_cache = NULL;
+static size_t ldso_cache_size = 0;
+static size_t ldso_cache_new_offset = 0;
+static int ldso_cache_loaded = 0;
+
+/**
+ * Returns the string at offset in a string table, or NULL if it runs off
+ * the end of the table
+ **/
+static const char *table_string(const char *table, size_t table_size, size_t offset)
+{
+   if (offset >= table_size)
+      return NULL;
+   if (!memchr(table + offset, '\0', table_size - offset))
+      return NULL;
+   return table + offset;
+}
+
+#define prefetch_dynamic_elfx(prefetch_dynamic_elfX, ElfX_Ehdr, ElfX_Phdr, ElfX_Dyn) \
+static int prefetch_dynamic_elfX(const unsigned char *base, size_t size, elf_dynamic_t *dyn) \
+{                                                                       \
+   const ElfX_Ehdr *ehdr = (const ElfX_Ehdr *) base;                    \
+   const ElfX_Phdr *phdrs, *phdr;                                       \
+   const ElfX_Dyn *dyns = NULL, *d;                                     \
+   const char *strtab, *str;                                            \
+   size_t num_dyns = 0, strtab_off = 0, strsz = 0, i;                   \
+   unsigned long strtab_addr = 0, rpath = 0, runpath = 0;               \
+   int have_strtab = 0, have_rpath = 0, have_runpath = 0, n = 0;        \
+                                                                        \
+   if (size < sizeof(*ehdr) || ehdr->e_phentsize != sizeof(*phdrs) ||   \
+       ehdr->e_phoff > size || ehdr->e_phnum > (size - ehdr->e_phoff) / sizeof(*phdrs)) \
+      return -1;                                                        \
+   phdrs = (const ElfX_Phdr *) (base + ehdr->e_phoff);                  \
+                                                                        \
+   for (i = 0; i < ehdr->e_phnum; i++) {                                \
+      phdr = phdrs + i;                                                 \
+      if (phdr->p_type != PT_DYNAMIC)                                   \
+         continue;                                                      \
+      if (phdr->p_offset > size || phdr->p_filesz > size - phdr->p_offset) \
+         return -1;                                                     \
+      dyns = (const ElfX_Dyn *) (base + phdr->p_offset);                \
+      num_dyns = phdr->p_filesz / sizeof(*dyns);                        \
+      break;                                                            \
+   }                                                                    \
+   if (!dyns)                                                           \
+      return -1;                                                        \
+                                                                        \
+   for (i = 0; i < num_dyns && dyns[i].d_tag != DT_NULL; i++) {         \
+      d = dyns + i;                                                     \
+      switch (d->d_tag) {                                               \
+         case DT_NEEDED: dyn->num_needed++; break;                      \
+         case DT_STRTAB: strtab_addr = d->d_un.d_ptr; have_strtab = 1; break; \
+         case DT_STRSZ: strsz = d->d_un.d_val; break;                   \
+         case DT_RPATH: rpath = d->d_un.d_val; have_rpath = 1; break;   \
+         case DT_RUNPATH: runpath = d->d_un.d_val; have_runpath = 1; break; \
+         case DT_FLAGS_1:                                               \
+            if (d->d_un.d_val & DF_1_NODEFLIB)                          \
+               dyn->nodeflib = 1;                                       \
+            break;                                                      \
+      }                                                                 \
+   }                                                                    \
+   if (!have_strtab || !strsz)                                          \
+      return -1;                                                        \
+                                                                        \
+   /* DT_STRTAB is an address.  Find it in the file through the segment that maps it */ \
+   for (i = 0; i < ehdr->e_phnum; i++) {                                \
+      phdr = phdrs + i;                                                 \
+      if (phdr->p_type != PT_LOAD)                                      \
+         continue;                                                      \
+      if (strtab_addr >= phdr->p_vaddr && strtab_addr < phdr->p_vaddr + phdr->p_filesz) { \
+         strtab_off = (strtab_addr - phdr->p_vaddr) + phdr->p_offset;   \
+         break;                                                         \
+      }                                                                 \
+   }                                                                    \
+   if (i == ehdr->e_phnum || strtab_off > size || strsz > size - strtab_off) \
+      return -1;                                                        \
+   strtab = (const char *) base + strtab_off;                           \
+                                                                        \
+   dyn->rpath = have_rpath ? table_string(strtab, strsz, rpath) : NULL; \
+   dyn->runpath = have_runpath ? table_string(strtab, strsz, runpath) : NULL; \
+   dyn->needed = (const char **) malloc(sizeof(char *) * (dyn->num_needed ? dyn->num_needed : 1)); \
+   for (i = 0; i < num_dyns && dyns[i].d_tag != DT_NULL; i++) {         \
+      if (dyns[i].d_tag != DT_NEEDED)                                   \
+         continue;                                                      \
+      str = table_string(strtab, strsz, dyns[i].d_un.d_val);            \
+      if (str && *str)                                                  \
+         dyn->needed[n++] = str;                                        \
+   }                                                                    \
+   dyn->num_needed = n;                                                 \
+   return 0;                                                            \
+}
+
+prefetch_dynamic_elfx(prefetch_dynamic_elf32, Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn)
+prefetch_dynamic_elfx(prefetch_dynamic_elf64, Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn)
+
+/**
+ * Read the dynamic section of an executable or shared library.  Returns -1
+ * if buffer isn't a dynamically linked object this host can load.
+ **/
+static int read_dynamic(const char *buffer, size_t size, elf_dynamic_t *dyn)
+{
+   const unsigned char *ident = (const unsigned char *) buffer;
+   uint16_t type;
+
+   memset(dyn, 0, sizeof(*dyn));
+   if (size < EI_NIDENT + sizeof(type) || memcmp(ident, ELFMAG, SELFMAG) != 0)
+      return -1;
+   if (ident[EI_DATA] != NATIVE_ELFDATA)
+      return -1;
+   memcpy(&type, buffer + EI_NIDENT, sizeof(type));
+   if (type != ET_EXEC && type != ET_DYN)
+      return -1;
+
+   dyn->elfclass = ident[EI_CLASS];
+   if (dyn->elfclass == ELFCLASS64)
+      return prefetch_dynamic_elf64(ident, size, dyn);
+   else if (dyn->elfclass == ELFCLASS32)
+      return prefetch_dynamic_elf32(ident, size, dyn);
+   return -1;
+}
+
+/**
+ * Read /etc/ld.so.cache the first time it's needed.  It is a local file,
+ * so is read directly.
+ **/
+static void load_ldso_cache()
+{
+   int fd = -1;
+   struct stat buf;
+   ssize_t result;
+   size_t pos = 0, offset;
+   ldso_cache_old_header_t old_header;
+
+   ldso_cache_loaded = 1;
+   fd = open(LDSO_CACHE_FILE, O_RDONLY);
+   if (fd == -1) {
+      debug_printf2("Could not open %s for dependency prefetching: %s\n", LDSO_CACHE_FILE, strerror(errno));
+      return;
+   }
+   if (fstat(fd, &buf) == -1 || buf.st_size < (off_t) sizeof(ldso_cache_header_t))
+      goto error;
+
+   ldso_cache_size = buf.st_size;
+   ldso_cache = (char *) malloc(ldso_cache_size);
+   while (pos < ldso_cache_size) {
+      result = read(fd, ldso_cache + pos, ldso_cache_size - pos);
+      if (result == -1 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         goto error;
+      pos += result;
+   }
+   close(fd);
+   fd = -1;
+
+   if (memcmp(ldso_cache, LDSO_CACHE_MAGIC_OLD, sizeof(old_header.magic)) == 0) {
+      memcpy(&old_header, ldso_cache, sizeof(old_header));
+      offset = sizeof(old_header) + old_header.nlibs * sizeof(ldso_cache_old_entry_t);
+      offset = (offset + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+   }
+   else
+      offset = 0;
+
+   if (offset > ldso_cache_size - sizeof(ldso_cache_header_t) ||
+       memcmp(ldso_cache + offset, LDSO_CACHE_MAGIC_NEW, sizeof(LDSO_CACHE_MAGIC_NEW)-1) != 0) {
+      debug_printf2("%s is not in a format that can be used for dependency prefetching\n", LDSO_CACHE_FILE);
+      goto error;
+   }
+   ldso_cache_new_offset = offset;
+   return;
+
+  error:
+   if (fd != -1)
+      close(fd);
+   if (ldso_cache)
+      free(ldso_cache);
+   ldso_cache = NULL;
+   ldso_cache_size = 0;
+}
+
+/**
+ * Returns the path ld.so.cache gives for a library name, or NULL.  Entries
+ * for hardware-capability subdirectories are passed over for the plain one.
+ **/
+static const char *ldso_cache_lookup(const char *name, int elfclass)
+{
+   ldso_cache_header_t header;
+   ldso_cache_entry_t entry;
+   const char *base, *key, *value;
+   size_t table_size, i;
+   int arch;
+
+   if (!ldso_cache_loaded)
+      load_ldso_cache();
+   if (!ldso_cache)
+      return NULL;
+
+   arch = (elfclass == ELFCLASS64) ? LDSO_CACHE_ARCH64 : 0;
+   if (arch == -1)
+      return NULL;
+
+   base = ldso_cache + ldso_cache_new_offset;
+   table_size = ldso_cache_size - ldso_cache_new_offset;
+   memcpy(&header, base, sizeof(header));
+   if (header.nlibs > (table_size - sizeof(header)) / sizeof(entry))
+      return NULL;
+
+   for (i = 0; i < header.nlibs; i++) {
+      memcpy(&entry, base + sizeof(header) + i * sizeof(entry), sizeof(entry));
+      if ((entry.flags & LDSO_CACHE_TYPE_MASK) != LDSO_CACHE_FLAG_ELF_LIBC6)
+         continue;
+      if ((entry.flags & LDSO_CACHE_ARCH_MASK) != arch || entry.hwcap)
+         continue;
+      key = table_string(base, table_size, entry.key);
+      if (!key || strcmp(key, name) != 0)
+         continue;
+      value = table_string(base, table_size, entry.value);
+      if (value && value[0] == '/')
+         return value;
+   }
+   return NULL;
+}
+
+/**
+ * The dynamic loader appears in libc's DT_NEEDED list, but the kernel maps
+ * it from the executable's PT_INTERP, so ld.so never searches for it.
+ **/
+static int is_loader_name(const char *name)
+{
+   return (strncmp(name, "ld-linux", 8) == 0 || strncmp(name, "ld64.so", 7) == 0 ||
+           strncmp(name, "ld.so", 5) == 0);
+}
+
+static void add_path(prefetch_dep_t *dep, const char *path)
+{
+   char fullpath[MAX_PATH_LEN+1];
+   int i;
+
+   if (path[0] != '/' || strlen(path) > MAX_PATH_LEN)
+      return;
+   strncpy(fullpath, path, MAX_PATH_LEN);
+   fullpath[MAX_PATH_LEN] = '\0';
+   if (reducePath(fullpath) == -1)
+      return;
+
+   for (i = 0; i < dep->num_paths; i++) {
+      if (strcmp(dep->paths[i], fullpath) == 0)
+         return;
+   }
+   dep->paths = (char **) realloc(dep->paths, sizeof(char *) * (dep->num_paths + 1));
+   dep->paths[dep->num_paths++] = strdup(fullpath);
+}
+
+static void add_dir_path(prefetch_dep_t *dep, const char *dir, const char *name)
+{
+   char path[MAX_PATH_LEN+1];
+   int len;
+
+   len = snprintf(path, sizeof(path), "%s/%s", dir, name);
+   if (len < 0 || len > MAX_PATH_LEN)
+      return;
+   add_path(dep, path);
+}
+
+/**
+ * Add the directories of a DT_RPATH or DT_RUNPATH string, expanding $ORIGIN
+ * and $LIB.  Directories using other tokens, and relative directories, which
+ * ld.so resolves against the application's cwd, are skipped.
+ **/
+static void add_search_list(prefetch_dep_t *dep, const char *list, const char *origin,
+                            int elfclass, const char *name)
+{
+   char dir[MAX_PATH_LEN+1];
+   const char *pos, *end, *token, *value;
+   size_t len, token_len, dir_len;
+   int skip;
+
+   for (pos = list; *pos; pos = *end ? end + 1 : end) {
+      end = pos + strcspn(pos, ":;");
+      dir_len = 0;
+      skip = 0;
+      while (pos < end && !skip) {
+         if (*pos != '$') {
+            if (dir_len < MAX_PATH_LEN)
+               dir[dir_len++] = *pos;
+            pos++;
+            continue;
+         }
+         token = pos + 1;
+         if (*token == '{') {
+            token++;
+            token_len = strcspn(token, "}");
+            pos = token + token_len + 1;
+         }
+         else {
+            token_len = 0;
+            while (token + token_len < end && (token[token_len] == '_' || (token[token_len] >= 'A' && token[token_len] <= 'Z')))
+               token_len++;
+            pos = token + token_len;
+         }
+         if (token_len == 6 && strncmp(token, "ORIGIN", 6) == 0)
+            value = origin;
+         else if (token_len == 3 && strncmp(token, "LIB", 3) == 0)
+            value = (elfclass == ELFCLASS64) ? "lib64" : "lib";
+         else
+            value = NULL;
+         if (!value || pos > end) {
+            skip = 1;
+            break;
+         }
+         len = strlen(value);
+         if (dir_len + len > MAX_PATH_LEN) {
+            skip = 1;
+            break;
+         }
+         memcpy(dir + dir_len, value, len);
+         dir_len += len;
+      }
+      dir[dir_len] = '\0';
+      if (skip || dir_len == 0 || dir[0] != '/')
+         continue;
+      add_dir_path(dep, dir, name);
+   }
+}
+
+int prefetch_find_deps(const char *pathname, const char *buffer, size_t size,
+                       prefetch_dep_t **deps, int *num_deps)
+{
+   elf_dynamic_t dyn;
+   char origin[MAX_PATH_LEN+1], file[MAX_PATH_LEN+1];
+   const char **dirs, *cached;
+   prefetch_dep_t *dep;
+   int i, j, n = 0;
+
+   *deps = NULL;
+   *num_deps = 0;
+   if (read_dynamic(buffer, size, &dyn) == -1)
+      return -1;
+
+   /* ld.so takes $ORIGIN from the name it opened the object by.  The server
+      reads objects by their real path, which is used instead. */
+   origin[MAX_PATH_LEN] = file[MAX_PATH_LEN] = '\0';
+   parseFilenameNoAlloc(pathname, file, origin, MAX_PATH_LEN);
+   dirs = (dyn.elfclass == ELFCLASS64) ? default_dirs64 : default_dirs32;
+
+   *deps = (prefetch_dep_t *) calloc(dyn.num_needed ? dyn.num_needed : 1, sizeof(prefetch_dep_t));
+   for (i = 0; i < dyn.num_needed; i++) {
+      if (is_loader_name(dyn.needed[i]))
+         continue;
+      dep = (*deps) + n++;
+      dep->needed = strdup(dyn.needed[i]);
+
+      if (strchr(dep->needed, '/')) {
+         add_path(dep, dep->needed);
+         continue;
+      }
+      if (dyn.rpath && !dyn.runpath)
+         add_search_list(dep, dyn.rpath, origin, dyn.elfclass, dep->needed);
+      if (dyn.runpath)
+         add_search_list(dep, dyn.runpath, origin, dyn.elfclass, dep->needed);
+      if (dyn.nodeflib)
+         continue;
+      cached = ldso_cache_lookup(dep->needed, dyn.elfclass);
+      if (cached)
+         add_path(dep, cached);
+      for (j = 0; dirs[j]; j++)
+         add_dir_path(dep, dirs[j], dep->needed);
+   }
+   *num_deps = n;
+   free(dyn.needed);
+
+   debug_printf3("Found %d DT_NEEDED entries in %s\n", *num_deps, pathname);
+   return 0;
+}
+
+void prefetch_free_deps(prefetch_dep_t *deps, int num_deps)
+{
+   int i, j;
+
+   if (!deps)
+      return;
+   for (i = 0; i < num_deps; i++) {
+      for (j = 0; j < deps[i].num_paths; j++)
+         free(deps[i].paths[j]);
+      free(deps[i].paths);
+      free(deps[i].needed);
+   }
+   free(deps);
+}
@@ -0,0 +1,42 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms
+and conditions of the GNU Lesser General Public License for more details.  You should
+have received a copy of the GNU Lesser General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_PREFETCH_H_)
+#define LDCS_AUDIT_SERVER_PREFETCH_H_
+
+#include <stddef.h>
+
+/**
+ * When a server reads an ELF object it can tell which libraries ld.so is
+ * about to ask for next.  These routines parse an object's dynamic section
+ * and turn each DT_NEEDED entry into the list of paths ld.so would try, in
+ * its search order: DT_RPATH (when there is no DT_RUNPATH), DT_RUNPATH,
+ * /etc/ld.so.cache, then the default system directories.  $ORIGIN and $LIB
+ * are expanded.  LD_LIBRARY_PATH is the application's, not the server's, so
+ * it is not searched.  Checking which of the paths exists is left to the
+ * caller, which can answer that from the file cache.
+ **/
+typedef struct {
+   char *needed;      /* The DT_NEEDED string */
+   char **paths;      /* Where ld.so would look for it, most preferred first */
+   int num_paths;
+} prefetch_dep_t;
+
+int prefetch_find_deps(const char *pathname, const char *buffer, size_t size,
+                       prefetch_dep_t **deps, int *num_deps);
+void prefetch_free_deps(prefetch_dep_t *deps, int num_deps);
+
+#endif
@@ -34,7 +34,11 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ldcs_cache.h"
 #include "spindle_launch.h"
 #include "ldcs_audit_server_requestors.h"
+#include "ldcs_audit_server_waitqueue.h"
 #include "msgbundle.h"
+#include "ldcs_audit_server_readpool.h"
+#include "ldcs_audit_server_numa.h"
+#include "ldcs_audit_server_pcache.h"
 #include "exitnote.h"
 #include "cleanup_proc.h"
 
@@ -145,10 +149,16 @@ int ldcs_audit_server_process(spindle_args_t *args)
    ldcs_process_data.pythonprefix = args->pythonprefix;
    ldcs_process_data.numa_substrs = args->numa_files;
    ldcs_process_data.numa_excludes = args->numa_excludes;
+   ldcs_process_data.numa_replicate = (int) args->numa_replicate;
    ldcs_process_data.md_port = args->port;
    ldcs_process_data.opts = args->opts;
    ldcs_process_data.msgbundle_cache_size_kb = args->bundle_cachesize_kb;
    ldcs_process_data.msgbundle_timeout_ms = args->bundle_timeout_ms;
+   ldcs_process_data.md_num_readers = args->num_readers ? (int) args->num_readers : 1;
+   if (ldcs_process_data.md_num_readers > ldcs_process_data.md_size)
+      ldcs_process_data.md_num_readers = ldcs_process_data.md_size;
+   debug_printf("Using %d of %d servers to read from the shared file system\n",
+                ldcs_process_data.md_num_readers, ldcs_process_data.md_size);
    ldcs_process_data.pending_requests = new_requestor_list();
    ldcs_process_data.completed_requests = new_requestor_list();
    ldcs_process_data.pending_stat_requests = new_requestor_list();
@@ -157,6 +167,16 @@ int ldcs_audit_server_process(spindle_args_t *args)
    ldcs_process_data.completed_lstat_requests = new_requestor_list();
    ldcs_process_data.pending_ldso_requests = new_requestor_list();
    ldcs_process_data.completed_ldso_requests = new_requestor_list();
+   ldcs_process_data.pending_reads = new_requestor_list();
+   ldcs_process_data.preload_reads = new_requestor_list();
+   ldcs_process_data.prefetched_files = new_requestor_list();
+   ldcs_process_data.prefetch = (int) args->prefetch;
+   ldcs_process_data.cache_budget = ((size_t) args->cache_budget_mb) * 1024 * 1024;
+   ldcs_process_data.pcache_dir = (args->pcache_dir && args->pcache_dir[0]) ? args->pcache_dir : NULL;
+   ldcs_process_data.refetch_files = new_requestor_list();
+   ldcs_process_data.refetch_requests = new_requestor_list();
+   ldcs_process_data.read_threads = (int) args->read_threads;
+   ldcs_process_data.client_waitqueue = new_waitqueue();
    ldcs_process_data.handling_bundle = 0;
    ldcs_process_data.exit_note_done = 0;
    
@@ -216,6 +236,19 @@ int ldcs_audit_server_process(spindle_args_t *args)
 
    msgbundle_init(&ldcs_process_data);
 
+   if (readpool_init(&ldcs_process_data, ldcs_process_data.read_threads) == -1)
+      debug_printf("Could not set up reader threads.  Files will be read synchronously\n");
+
+   if ((ldcs_process_data.opts & OPT_NUMA) && ldcs_process_data.numa_replicate == numa_replicate_lazy) {
+      if (numa_replica_init(&ldcs_process_data, handle_numa_replica_done) == -1) {
+         debug_printf("Could not set up lazy numa replication.  Replicating eagerly\n");
+         ldcs_process_data.numa_replicate = numa_replicate_eager;
+      }
+   }
+
+   if (pcache_init(&ldcs_process_data) == -1)
+      err_printf("Could not share persistent cache entries.  Files will be read or requested\n");
+
    return 0;
 }  
 
@@ -232,8 +265,12 @@ int ldcs_audit_server_run()
       - ldcs_process_data.server_stat.server_cb.time
       - ldcs_process_data.server_stat.md_cb.time;
 
+   /* Keep the cached files for later jobs before the cache is cleaned up */
+   pcache_save(&ldcs_process_data);
 
    _ldcs_server_stat_print(&ldcs_process_data.server_stat);
+   ldcs_cache_print_stats();
+   msgbundle_print_stats(&ldcs_process_data);
   
    debug_printf("destroy server (%s,%d)\n", ldcs_process_data.location, ldcs_process_data.number);
    ldcs_destroy_server(ldcs_process_data.serverid);
@@ -242,6 +279,8 @@ int ldcs_audit_server_run()
    ldcs_audit_server_md_destroy(&ldcs_process_data);
 
    msgbundle_done(&ldcs_process_data);
+   readpool_done(&ldcs_process_data);
+   numa_replica_done(&ldcs_process_data);
    
    /* destroy file cache */
    if (!(ldcs_process_data.opts & OPT_NOCLEAN)) {
@@ -285,6 +324,15 @@ int ldcs_audit_server_run()
    _ldcs_server_stat_init_entry(&server_stat->clientmsg);
    _ldcs_server_stat_init_entry(&server_stat->bcast);
    _ldcs_server_stat_init_entry(&server_stat->preload);
+   _ldcs_server_stat_init_entry(&server_stat->numarepl);
+   _ldcs_server_stat_init_entry(&server_stat->prefetch);
+   _ldcs_server_stat_init_entry(&server_stat->prefetch_hit);
+   _ldcs_server_stat_init_entry(&server_stat->evict);
+   _ldcs_server_stat_init_entry(&server_stat->evict_busy);
+   _ldcs_server_stat_init_entry(&server_stat->dedup);
+   _ldcs_server_stat_init_entry(&server_stat->pcache);
+   _ldcs_server_stat_init_entry(&server_stat->pcache_check);
+   _ldcs_server_stat_init_entry(&server_stat->pcache_save);
 
    return(rc);
  }
@@ -292,6 +340,9 @@ int ldcs_audit_server_run()
  /* Statistic functions */
  int _ldcs_server_stat_print ( ldcs_server_stat_t *server_stat ) {
    int rc=0;
+   size_t cache_bytes, cache_peak;
+   int cache_files, mapped_files, mapped_peak;
+   unsigned long mapped_created;
    debug_printf("SERVER[%02d] STAT: #conn=%2d md_size=%2d md_fan_out=%2d listen_time=%8.4f select_time=%8.4f ts_first_connect=%16.6f hostname=%s\n",
 	   server_stat->md_rank, 
 	   server_stat->num_connections,	
@@ -376,6 +427,79 @@ int ldcs_audit_server_run()
 	  server_stat->preload.bytes/1024.0/1024.0,
 	  server_stat->preload.time );
 
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"numarepl",
+	  server_stat->numarepl.cnt,
+	  server_stat->numarepl.bytes/1024.0/1024.0,
+	  server_stat->numarepl.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"prefetch",
+	  server_stat->prefetch.cnt,
+	  server_stat->prefetch.bytes/1024.0/1024.0,
+	  server_stat->prefetch.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"pf_hit",
+	  server_stat->prefetch_hit.cnt,
+	  server_stat->prefetch_hit.bytes/1024.0/1024.0,
+	  server_stat->prefetch_hit.time );
+
+  debug_printf("SERVER[%02d] STAT:  prefetch hit rate=%5.1f%%, wasted=%8.2f MB\n",
+	  server_stat->md_rank,
+	  server_stat->prefetch.cnt ? 100.0 * server_stat->prefetch_hit.cnt / server_stat->prefetch.cnt : 0.0,
+	  (server_stat->prefetch.bytes - server_stat->prefetch_hit.bytes)/1024.0/1024.0 );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"evict",
+	  server_stat->evict.cnt,
+	  server_stat->evict.bytes/1024.0/1024.0,
+	  server_stat->evict.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"evict_busy",
+	  server_stat->evict_busy.cnt,
+	  server_stat->evict_busy.bytes/1024.0/1024.0,
+	  server_stat->evict_busy.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"dedup",
+	  server_stat->dedup.cnt,
+	  server_stat->dedup.bytes/1024.0/1024.0,
+	  server_stat->dedup.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"pcache",
+	  server_stat->pcache.cnt,
+	  server_stat->pcache.bytes/1024.0/1024.0,
+	  server_stat->pcache.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"pc_check",
+	  server_stat->pcache_check.cnt,
+	  server_stat->pcache_check.bytes/1024.0/1024.0,
+	  server_stat->pcache_check.time );
+
+  debug_printf(MYFORMAT,
+	  server_stat->md_rank,"pc_save",
+	  server_stat->pcache_save.cnt,
+	  server_stat->pcache_save.bytes/1024.0/1024.0,
+	  server_stat->pcache_save.time );
+
+  ldcs_cache_lruStats(&cache_bytes, &cache_peak, &cache_files);
+  debug_printf("SERVER[%02d] STAT:  local cache=%8.2f MB in %d files, peak=%8.2f MB\n",
+	  server_stat->md_rank,
+	  cache_bytes/1024.0/1024.0,
+	  cache_files,
+	  cache_peak/1024.0/1024.0 );
+
+  filemngt_mapping_stats(&mapped_files, &mapped_peak, &mapped_created);
+  debug_printf("SERVER[%02d] STAT:  mapped files=%d, peak=%d, #maps=%lu\n",
+	  server_stat->md_rank,
+	  mapped_files,
+	  mapped_peak,
+	  mapped_created );
+
   return(rc);
 }
 
@@ -26,6 +26,7 @@ extern "C" {
 #include "stat_cache.h"   
 
 typedef void* requestor_list_t;
+typedef void* waitqueue_t;
 
 /* client description structure */
 typedef enum {
@@ -71,12 +72,38 @@ struct ldcs_server_stat_struct
   ldcs_server_stat_entry_t clientmsg;
   ldcs_server_stat_entry_t bcast;
   ldcs_server_stat_entry_t preload;
+  ldcs_server_stat_entry_t numarepl;	/* lazily created numa replicas */
+  ldcs_server_stat_entry_t prefetch;	/* dependencies prefetched to this server */
+  ldcs_server_stat_entry_t prefetch_hit;	/* prefetched files a client here then loaded */
+  ldcs_server_stat_entry_t evict;	/* files removed to keep the local cache in budget */
+  ldcs_server_stat_entry_t evict_busy;	/* eviction candidates passed over because they were in use */
+  ldcs_server_stat_entry_t dedup;	/* files stored as links to identical contents under another path */
+  ldcs_server_stat_entry_t pcache;	/* files served from the persistent cache */
+  ldcs_server_stat_entry_t pcache_check;	/* persistent cache index entries revalidated */
+  ldcs_server_stat_entry_t pcache_save;	/* files kept in the persistent cache at exit */
 
   char *hostname;
 
 };
 typedef struct ldcs_server_stat_struct ldcs_server_stat_t;
 
+/* A LDCS_MSG_MULTI_QUERY being answered one path at a time */
+typedef struct multi_query_t {
+  ldcs_message_ids_t   query_type;
+  int                  first_hit;
+  int                  num_paths;
+  int                  next_path;      /* index of the next path to query */
+  char                 *paths;         /* 0-separated paths, copied from the message */
+  char                 *next_pos;
+  int                  hit;            /* the last answered path exists */
+  int                  running;        /* handle_multi_query_next is on the stack */
+  int                  advance;        /* a path was answered while running */
+  unsigned char        *answer;        /* LDCS_MSG_MULTI_QUERY_ANSWER body being built */
+  size_t               answer_len;
+  size_t               answer_size;
+  int32_t              num_answers;
+} multi_query_t;
+
 struct ldcs_client_struct
 {
   int                  connid;
@@ -99,14 +126,23 @@ struct ldcs_client_struct
   char                 query_aliasfrom[MAX_PATH_LEN+2];
   int                  query_is_numa_replicated;
   double               query_arrival_time;
+  multi_query_t        *multi_query;
 };
 typedef struct ldcs_client_struct ldcs_client_t;
 
 typedef struct msgbundle_entry_t {
-   unsigned char *cache;
-   int position;
+   unsigned char *cache;      /* headers and bodies of the queued messages */
+   size_t position;           /* bytes queued in cache */
+   size_t limit;              /* adaptive flush threshold */
+   int num_msgs;              /* messages queued in cache */
    void* node;
-   struct msgbundle_entry_t *next;
+   double deadline;           /* time by which the queued messages must be sent */
+   double last_arrival;       /* time the last message to this node was sent */
+   double avg_gap;            /* moving average of the time between messages */
+   double avg_size;           /* moving average of the message size */
+   unsigned long seen;        /* messages sent to this node */
+   struct msgbundle_entry_t *next_pending;
+   struct msgbundle_entry_t *prev_pending;
    char name[16];
 } msgbundle_entry_t;
    
@@ -128,7 +164,12 @@ struct ldcs_process_data_struct
   char *pythonprefix;
   char *numa_substrs;
   char *numa_excludes;   
-  msgbundle_entry_t *msgbundle_entries;
+  int numa_replicate;			/* numa_replicate_eager or numa_replicate_lazy */
+  msgbundle_entry_t **msgbundle_table;     /* bundles hashed by destination */
+  int msgbundle_table_size;
+  int msgbundle_table_used;
+  msgbundle_entry_t *msgbundle_pending;    /* non-empty bundles, in deadline order */
+  msgbundle_entry_t *msgbundle_pending_tail;
   int msgbundle_cache_size_kb;
   int msgbundle_timeout_ms;
   int handling_bundle;
@@ -144,11 +185,26 @@ struct ldcs_process_data_struct
   requestor_list_t completed_lstat_requests;
   requestor_list_t pending_ldso_requests;
   requestor_list_t completed_ldso_requests;
+  requestor_list_t pending_reads;	/* files being read by the reader threads */
+  requestor_list_t preload_reads;	/* files the preload is waiting on the reader threads for */
+  char **preload_files;			/* files the root has yet to preload, most needed first */
+  int preload_num_files;
+  int preload_next_file;
+  int preload_reads_active;
+  int prefetch;				/* read the DT_NEEDED closure of ELF objects as they're read */
+  requestor_list_t prefetched_files;	/* prefetched files no client here has loaded yet */
+  size_t cache_budget;			/* bytes of file contents the local cache is held to, 0 for no limit */
+  char *pcache_dir;			/* node-local directory files are kept in across jobs, NULL for none */
+  requestor_list_t refetch_files;	/* files we were sent but don't have (evicted, or an unresolved content alias), which are asked for again */
+  requestor_list_t refetch_requests;	/* children waiting on a file they evicted */
+  waitqueue_t client_waitqueue;
 
   /* multi daemon support */
   int md_rank;
   int md_size;
   int md_fan_out; 		/* number of childs */
+  int md_num_readers;		/* number of servers reading from the shared fs */
+  int read_threads;		/* size of the reader thread pool */
   int md_listen_to_parent;
   unsigned int md_port;
   
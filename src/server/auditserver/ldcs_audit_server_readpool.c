@@ -0,0 +1,234 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ldcs_audit_server_readpool.h"
+#include "ldcs_audit_server_filemngt.h"
+#include "ldcs_audit_server_dedup.h"
+#include "ldcs_api.h"
+#include "ldcs_api_listen.h"
+#include "spindle_debug.h"
+
+static pthread_t *threads;
+static int num_threads = 0, max_threads = 0;
+static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static readpool_job_t *queue_head = NULL, *queue_tail = NULL;
+static readpool_job_t *done_head = NULL, *done_tail = NULL;
+static int done = 0;
+static int done_pipe[2];
+static int initialized = 0;
+
+static void *reader_main(void *arg);
+static int readpool_done_cb(int fd, int serverid, void *data);
+
+/**
+ * Set up a pool of nthreads reader threads.  The threads are started on the
+ * first submitted read, so servers that never read from the shared file
+ * system don't run them.  With zero threads the pool stays disabled and
+ * callers should read files synchronously.
+ **/
+int readpool_init(ldcs_process_data_t *procdata, int nthreads)
+{
+   if (nthreads <= 0) {
+      debug_printf("Reader thread pool disabled.  Files will be read synchronously\n");
+      return 0;
+   }
+
+   if (pipe(done_pipe) == -1) {
+      err_printf("Could not create reader pool pipe: %s\n", strerror(errno));
+      return -1;
+   }
+   fcntl(done_pipe[0], F_SETFL, fcntl(done_pipe[0], F_GETFL) | O_NONBLOCK);
+   ldcs_listen_register_fd(done_pipe[0], procdata->serverid, readpool_done_cb, (void *) procdata);
+
+   max_threads = nthreads;
+   num_threads = 0;
+   done = 0;
+   initialized = 1;
+   debug_printf("Using up to %d reader threads\n", max_threads);
+   return 0;
+}
+
+static int start_threads()
+{
+   int i, result;
+
+   threads = (pthread_t *) malloc(sizeof(pthread_t) * max_threads);
+   for (i = 0; i < max_threads; i++) {
+      result = pthread_create(threads + i, NULL, reader_main, NULL);
+      if (result != 0) {
+         err_printf("Could not create reader thread %d: %s\n", i, strerror(result));
+         break;
+      }
+   }
+   num_threads = i;
+   if (!num_threads) {
+      free(threads);
+      threads = NULL;
+      return -1;
+   }
+   debug_printf2("Started %d reader threads\n", num_threads);
+   return 0;
+}
+
+int readpool_enabled()
+{
+   return initialized;
+}
+
+/**
+ * Queue a file read.  The job must stay valid until its done_cb
+ * is called from the event loop.
+ **/
+int readpool_submit(readpool_job_t *job)
+{
+   assert(initialized);
+   assert(job->done_cb);
+
+   if (!num_threads && start_threads() == -1)
+      return -1;
+
+   debug_printf3("Queueing read of %s into %p\n", job->pathname, job->buffer);
+   job->next = NULL;
+   job->result = 0;
+   job->errcode = 0;
+   job->content_hash = 0;
+   job->newsize = job->size;
+
+   pthread_mutex_lock(&mut);
+   if (queue_tail)
+      queue_tail->next = job;
+   else
+      queue_head = job;
+   queue_tail = job;
+   pthread_cond_signal(&queue_cond);
+   pthread_mutex_unlock(&mut);
+   return 0;
+}
+
+/**
+ * Stop the reader threads.  Reads that are still queued are dropped.
+ **/
+void readpool_done(ldcs_process_data_t *procdata)
+{
+   int i;
+   void *retval;
+
+   if (!initialized)
+      return;
+
+   pthread_mutex_lock(&mut);
+   done = 1;
+   pthread_cond_broadcast(&queue_cond);
+   pthread_mutex_unlock(&mut);
+
+   for (i = 0; i < num_threads; i++)
+      pthread_join(threads[i], &retval);
+   free(threads);
+   threads = NULL;
+   num_threads = 0;
+
+   ldcs_listen_unregister_fd(done_pipe[0]);
+   close(done_pipe[0]);
+   close(done_pipe[1]);
+   queue_head = queue_tail = NULL;
+   done_head = done_tail = NULL;
+   initialized = 0;
+}
+
+static void *reader_main(void *arg)
+{
+   readpool_job_t *job;
+   double starttime;
+   int was_empty;
+   char c = 0;
+
+   for (;;) {
+      pthread_mutex_lock(&mut);
+      while (!queue_head && !done)
+         pthread_cond_wait(&queue_cond, &mut);
+      if (done) {
+         pthread_mutex_unlock(&mut);
+         return NULL;
+      }
+      job = queue_head;
+      queue_head = job->next;
+      if (!queue_head)
+         queue_tail = NULL;
+      pthread_mutex_unlock(&mut);
+
+      starttime = ldcs_get_time();
+      if (job->work_cb) {
+         job->work_cb(job);
+      }
+      else {
+         job->result = filemngt_read_file(job->pathname, job->buffer, &job->newsize, job->strip, &job->errcode);
+         if (job->hash && job->result == 0 && !job->errcode)
+            job->content_hash = dedup_hash(job->buffer, job->newsize);
+      }
+      job->read_time = ldcs_get_time() - starttime;
+      job->next = NULL;
+
+      /* Only wake the event loop when the done list goes from empty to
+         non-empty.  It takes the whole list each time it runs. */
+      pthread_mutex_lock(&mut);
+      was_empty = (done_head == NULL);
+      if (done_tail)
+         done_tail->next = job;
+      else
+         done_head = job;
+      done_tail = job;
+      if (was_empty)
+         (void)! write(done_pipe[1], &c, sizeof(c));
+      pthread_mutex_unlock(&mut);
+   }
+}
+
+/**
+ * Runs in the event loop when reader threads have finished jobs.
+ **/
+static int readpool_done_cb(int fd, int serverid, void *data)
+{
+   ldcs_process_data_t *procdata = (ldcs_process_data_t *) data;
+   readpool_job_t *job, *next;
+   char buf[64];
+   int result, global_result = 0;
+
+   while (read(fd, buf, sizeof(buf)) > 0);
+
+   pthread_mutex_lock(&mut);
+   job = done_head;
+   done_head = done_tail = NULL;
+   pthread_mutex_unlock(&mut);
+
+   for (; job; job = next) {
+      next = job->next;
+      debug_printf3("Reader thread finished %s in %.3lfs\n", job->pathname, job->read_time);
+      result = job->done_cb(procdata, job);
+      if (result == -1)
+         global_result = -1;
+   }
+   return global_result;
+}
@@ -0,0 +1,63 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(LDCS_AUDIT_SERVER_READPOOL_H_)
+#define LDCS_AUDIT_SERVER_READPOOL_H_
+
+#include "ldcs_audit_server_process.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The read pool reads files off the shared file system on a set of worker
+ * threads, so the server's event loop keeps running while reads are in
+ * progress.  A completed read is handed back to the event loop, which
+ * calls the job's done callback.  A job with a work_cb runs that on the
+ * thread instead of reading pathname, for other shared file system work.
+ **/
+typedef struct readpool_job_t readpool_job_t;
+typedef int (*readpool_done_cb_t)(ldcs_process_data_t *procdata, readpool_job_t *job);
+typedef void (*readpool_work_cb_t)(readpool_job_t *job);
+
+struct readpool_job_t {
+   /* Filled in by the submitter */
+   char *pathname;
+   void *buffer;
+   size_t size;
+   int strip;
+   int hash;
+   readpool_done_cb_t done_cb;
+   readpool_work_cb_t work_cb;
+   void *data;
+
+   /* Filled in by the reader thread */
+   size_t newsize;
+   int result;
+   int errcode;
+   uint64_t content_hash;
+   double read_time;
+
+   readpool_job_t *next;
+};
+
+int readpool_init(ldcs_process_data_t *procdata, int num_threads);
+int readpool_enabled();
+int readpool_submit(readpool_job_t *job);
+void readpool_done(ldcs_process_data_t *procdata);
+
+#endif
@@ -131,6 +131,23 @@ void clear_requestor(requestor_list_t list, char *file)
    free(cur);
 }
 
+void remove_requestor(requestor_list_t list, char *file, node_peer_t peer)
+{
+   requested_file_t *cur = get_requestor(list, file, 0);
+   int i;
+   if (!cur) return;
+
+   for (i = 0; i < cur->requestors_num; i++) {
+      if (cur->requestors[i] != peer)
+         continue;
+      cur->requestors[i] = cur->requestors[cur->requestors_num - 1];
+      cur->requestors_num--;
+      break;
+   }
+   if (!cur->requestors_num)
+      clear_requestor(list, file);
+}
+
 int peer_requested(requestor_list_t list, char *file, node_peer_t peer)
 {
    int i;
@@ -24,6 +24,7 @@ requestor_list_t new_requestor_list();
 int been_requested(requestor_list_t list, char *file);
 void add_requestor(requestor_list_t list, char *file, node_peer_t peer);
 void clear_requestor(requestor_list_t list, char *file);
+void remove_requestor(requestor_list_t list, char *file, node_peer_t peer);
 int get_requestors(requestor_list_t list, char *file, node_peer_t **requestor_list, int *requestor_list_size);
 int peer_requested(requestor_list_t list, char *file, node_peer_t peer);
 
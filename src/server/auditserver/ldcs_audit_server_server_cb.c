@@ -62,6 +62,8 @@ int _ldcs_server_CB ( int infd, int serverid, void *data ) {
       ldcs_process_data->client_table[nc].lrank        = ldcs_process_data->client_counter;
       ldcs_process_data->client_table[nc].query_localpath = NULL;
       ldcs_process_data->client_table[nc].query_is_numa_replicated = 0;
+      ldcs_process_data->client_table[nc].multi_query = NULL;
+      ldcs_process_data->client_table[nc].remote_cwd[0] = '\0';
       ldcs_process_data->client_table_used++;
       ldcs_process_data->client_counter++;
       ldcs_process_data->clients_live++;
@@ -0,0 +1,153 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ldcs_audit_server_waitqueue.h"
+
+struct waiting_key_struct
+{
+   char *key;
+   unsigned int hash_val;
+   int clients_num;
+   int clients_size;
+   int *clients;
+   struct waiting_key_struct *next;
+};
+typedef struct waiting_key_struct waiting_key_t;
+
+#define INITIAL_CLIENTS_SIZE 8
+#define WAITQUEUE_TABLE_SIZE 1024
+
+struct waitqueue_struct
+{
+   waiting_key_t *table[WAITQUEUE_TABLE_SIZE];
+   int num_keys;
+};
+typedef struct waitqueue_struct waitqueue_impl_t;
+
+waitqueue_t new_waitqueue()
+{
+   return (waitqueue_t) calloc(1, sizeof(waitqueue_impl_t));
+}
+
+static unsigned int hashval(char *str) 
+{
+   unsigned int hash = 5381;
+   unsigned int c;
+   while ((c = *str++))
+      hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+   return hash % WAITQUEUE_TABLE_SIZE;
+}
+
+/**
+ * Add client nc to the queue of clients waiting on key.
+ **/
+void waitqueue_add(waitqueue_t wq, char *key, int nc)
+{
+   waiting_key_t **table = ((waitqueue_impl_t *) wq)->table;
+   waiting_key_t *cur;
+   unsigned int val;
+   int i;
+
+   val = hashval(key);
+   for (cur = table[val]; cur != NULL; cur = cur->next) {
+      if (strcmp(cur->key, key) == 0)
+         break;
+   }
+
+   if (!cur) {
+      cur = (waiting_key_t *) malloc(sizeof(waiting_key_t));
+      cur->key = strdup(key);
+      cur->hash_val = val;
+      cur->clients_num = 0;
+      cur->clients_size = INITIAL_CLIENTS_SIZE;
+      cur->clients = (int *) malloc(sizeof(int) * INITIAL_CLIENTS_SIZE);
+      cur->next = table[val];
+      table[val] = cur;
+      ((waitqueue_impl_t *) wq)->num_keys++;
+   }
+
+   for (i = 0; i < cur->clients_num; i++) {
+      if (cur->clients[i] == nc)
+         return;
+   }
+
+   if (cur->clients_num == cur->clients_size) {
+      cur->clients_size *= 2;
+      cur->clients = realloc(cur->clients, sizeof(int) * cur->clients_size);
+   }
+   cur->clients[cur->clients_num++] = nc;
+}
+
+/**
+ * Remove the queue of clients waiting on key and return it.  The caller
+ * owns and must free the returned array.  Returns -1 if nobody is waiting.
+ **/
+int waitqueue_take(waitqueue_t wq, char *key, int **clients, int *clients_size)
+{
+   waiting_key_t **table = ((waitqueue_impl_t *) wq)->table;
+   waiting_key_t *cur, **prev;
+   unsigned int val;
+
+   val = hashval(key);
+   for (prev = table + val, cur = *prev; cur != NULL; prev = &cur->next, cur = cur->next) {
+      if (strcmp(cur->key, key) == 0)
+         break;
+   }
+   if (!cur)
+      return -1;
+
+   *prev = cur->next;
+   *clients = cur->clients;
+   *clients_size = cur->clients_num;
+   free(cur->key);
+   free(cur);
+   ((waitqueue_impl_t *) wq)->num_keys--;
+   return 0;
+}
+
+/**
+ * Remove client nc from every queue it is waiting in, so a client slot
+ * that is reused isn't woken for what its previous owner waited on.
+ **/
+void waitqueue_remove_client(waitqueue_t wq, int nc)
+{
+   waitqueue_impl_t *queue = (waitqueue_impl_t *) wq;
+   waiting_key_t *cur, **prev;
+   int i, j;
+
+   for (i = 0; i < WAITQUEUE_TABLE_SIZE && queue->num_keys; i++) {
+      prev = queue->table + i;
+      while ((cur = *prev) != NULL) {
+         for (j = 0; j < cur->clients_num; j++) {
+            if (cur->clients[j] == nc) {
+               cur->clients[j] = cur->clients[--cur->clients_num];
+               break;
+            }
+         }
+         if (cur->clients_num) {
+            prev = &cur->next;
+            continue;
+         }
+         *prev = cur->next;
+         free(cur->clients);
+         free(cur->key);
+         free(cur);
+         queue->num_keys--;
+      }
+   }
+}
@@ -0,0 +1,32 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#if !defined(LDCS_AUDIT_SERVER_WAITQUEUE_H_)
+#define LDCS_AUDIT_SERVER_WAITQUEUE_H_
+
+#include "ldcs_audit_server_process.h"
+
+/**
+ * Wait queues index blocked clients by the path or directory they are 
+ * waiting on, so an arriving file or directory only wakes the clients
+ * that need it.
+ **/
+waitqueue_t new_waitqueue();
+void waitqueue_add(waitqueue_t wq, char *key, int nc);
+int waitqueue_take(waitqueue_t wq, char *key, int **clients, int *clients_size);
+void waitqueue_remove_client(waitqueue_t wq, int nc);
+
+#endif
@@ -6,28 +6,47 @@
 #include "spindle_launch.h"
 
 #include <assert.h>
-#include <pthread.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
 
-static pthread_t thrd_handle;
-static pthread_mutex_t mut;
-static pthread_cond_t timeout_sync;
-static volatile int active_timeout, active_flush;
-static volatile int done = 0;
-static int flush_pipe[2];
 static int initialized = 0;
 
-static int flush_msgbuffer_cb(int fd, int serverid, void *data);
-static void *thrd_main(void *timeout);
 int spindle_send_worker(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t node,
-                        void *secondary_data, size_t secondary_size);
+                        void *secondary_data, size_t secondary_size, int secondary_fd);
+static int flush_timeout_cb(void *data);
 
 #define BROADCAST ((node_peer_t) (long) -2)
 #define PARENT ((node_peer_t) (long) -3)
 #define PASSTHROUGH -3
 
+/* Smallest flush threshold a bundle adapts down to */
+#define MSGBUNDLE_MIN_LIMIT (4*1024)
+/* Messages bigger than this are never copied into a bundle */
+#define MSGBUNDLE_MAX_COPY (32*1024)
+
+typedef enum {
+   flush_timeout,      /* the bundle's oldest message reached the timeout */
+   flush_full,         /* the next message would not fit under the bundle's limit */
+   flush_large,        /* a message too large to bundle went to the same node */
+   flush_sparse,       /* messages to the node arrive too rarely to bundle */
+   flush_forced,       /* msgbundle_force_flush */
+   flush_num_reasons
+} flush_reason_t;
+
+static const char *flush_reason_names[flush_num_reasons] = { "timeout", "full", "large", "sparse", "forced" };
+
+static struct {
+   unsigned long bundled_msgs;
+   unsigned long bundled_bytes;
+   unsigned long direct_msgs;
+   unsigned long bundles_sent;
+   unsigned long flushes[flush_num_reasons];
+} stats;
+
 void msgbundle_init(ldcs_process_data_t *procdata)
 {
    if (!(procdata->opts & OPT_MSGBUNDLE)) {
@@ -37,53 +56,98 @@ void msgbundle_init(ldcs_process_data_t *procdata)
 
    assert(procdata->msgbundle_cache_size_kb);
    assert(procdata->msgbundle_timeout_ms);
-   procdata->msgbundle_entries = NULL;
+   procdata->msgbundle_table_size = 16;
+   procdata->msgbundle_table_used = 0;
+   procdata->msgbundle_table = (msgbundle_entry_t **) calloc(procdata->msgbundle_table_size,
+                                                            sizeof(msgbundle_entry_t *));
+   procdata->msgbundle_pending = NULL;
+   procdata->msgbundle_pending_tail = NULL;
+   memset(&stats, 0, sizeof(stats));
    debug_printf("Initializing message bundling with buffer of size %u kb and "
                 "send timeout of %u ms\n", procdata->msgbundle_cache_size_kb,
                 procdata->msgbundle_timeout_ms);
 
-   debug_printf2("Spawning timeout monitoring thread for cache buffers\n");
-   (void)! pipe(flush_pipe);
-   ldcs_listen_register_fd(flush_pipe[0], procdata->serverid, &flush_msgbuffer_cb, (void *) procdata);
-   pthread_mutex_init(&mut, NULL);
-   pthread_cond_init(&timeout_sync, NULL);
-   pthread_create(&thrd_handle, NULL, thrd_main, (void *) (long) procdata->msgbundle_timeout_ms);
+   ldcs_listen_register_timeout_cb(flush_timeout_cb, (void *) procdata);
 
    initialized = 1;
 }
 
 void msgbundle_done(ldcs_process_data_t *procdata)
 {   
-   void *retval;
+   int i;
+   msgbundle_entry_t *mb;
+
    if (!initialized)
       return;
-   
-   pthread_mutex_lock(&mut);
-   done = 1;
-   pthread_cond_broadcast(&timeout_sync);
-   pthread_mutex_unlock(&mut);
-
-   ldcs_listen_unregister_fd(flush_pipe[0]);
-   close(flush_pipe[0]);
-   close(flush_pipe[1]);
+
+   ldcs_listen_set_timeout(-1);
+   ldcs_listen_register_timeout_cb(NULL, NULL);
+
+   for (i = 0; i < procdata->msgbundle_table_size; i++) {
+      mb = procdata->msgbundle_table[i];
+      if (!mb)
+         continue;
+      if (mb->position)
+         debug_printf("Dropping %d unsent bundled messages to node %s at shutdown\n", mb->num_msgs, mb->name);
+      free(mb->cache);
+      free(mb);
+   }
+   free(procdata->msgbundle_table);
+   procdata->msgbundle_table = NULL;
+   procdata->msgbundle_pending = NULL;
+   procdata->msgbundle_pending_tail = NULL;
    initialized = 0;
-   pthread_join(thrd_handle, &retval);
-   pthread_cond_destroy(&timeout_sync);
-   pthread_mutex_destroy(&mut);
+}
+
+void msgbundle_print_stats(ldcs_process_data_t *procdata)
+{
+   int i;
+   msgbundle_entry_t *mb;
+
+   if (!initialized)
+      return;
+
+   debug_printf("Message bundling sent %lu messages (%lu bytes) in %lu bundles, %.1f per bundle.  "
+                "%lu messages were sent unbundled\n",
+                stats.bundled_msgs, stats.bundled_bytes, stats.bundles_sent,
+                stats.bundles_sent ? (double) stats.bundled_msgs / stats.bundles_sent : 0.0,
+                stats.direct_msgs);
+   debug_printf("Message bundle flushes: %s=%lu %s=%lu %s=%lu %s=%lu %s=%lu\n",
+                flush_reason_names[flush_timeout], stats.flushes[flush_timeout],
+                flush_reason_names[flush_full], stats.flushes[flush_full],
+                flush_reason_names[flush_large], stats.flushes[flush_large],
+                flush_reason_names[flush_sparse], stats.flushes[flush_sparse],
+                flush_reason_names[flush_forced], stats.flushes[flush_forced]);
+   for (i = 0; i < procdata->msgbundle_table_size; i++) {
+      mb = procdata->msgbundle_table[i];
+      if (!mb)
+         continue;
+      debug_printf2("Message bundle to node %s: %lu messages, limit %lu bytes, avg gap %.3f ms, avg size %.0f bytes\n",
+                    mb->name, mb->seen, (unsigned long) mb->limit, mb->avg_gap * 1000.0, mb->avg_size);
+   }
 }
 
 int spindle_send_noncontig(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t node,
                            void *secondary_data, size_t secondary_size)
 {
-   int result = spindle_send_worker(procdata, msg, node, secondary_data, secondary_size);
+   int result = spindle_send_worker(procdata, msg, node, secondary_data, secondary_size, -1);
    if (result == PASSTHROUGH)
       return ldcs_audit_server_md_send_noncontig(procdata, msg, node, secondary_data, secondary_size);
    return result;
 }
 
+int spindle_send_file(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t node,
+                      void *secondary_data, size_t secondary_size, int secondary_fd)
+{
+   int result = spindle_send_worker(procdata, msg, node, secondary_data, secondary_size, secondary_fd);
+   if (result == PASSTHROUGH)
+      return ldcs_audit_server_md_send_file(procdata, msg, node, secondary_data, secondary_size, secondary_fd);
+   return result;
+}
+
 int spindle_send(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t node)
 {
-   int result = spindle_send_worker(procdata, msg, node, NULL, 0);
+   int result = spindle_send_worker(procdata, msg, node, NULL, 0, -1);
    if (result == PASSTHROUGH)
       return ldcs_audit_server_md_send(procdata, msg, node);
    return result;
@@ -92,15 +156,24 @@ int spindle_send(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t
 int spindle_broadcast_noncontig(ldcs_process_data_t *procdata, ldcs_message_t *msg,
                                 void *secondary_data, size_t secondary_size)
 {
-   int result = spindle_send_worker(procdata, msg, BROADCAST, secondary_data, secondary_size);
+   int result = spindle_send_worker(procdata, msg, BROADCAST, secondary_data, secondary_size, -1);
    if (result == PASSTHROUGH)
       return ldcs_audit_server_md_broadcast_noncontig(procdata, msg, secondary_data, secondary_size);
    return result;
 }
 
+int spindle_broadcast_file(ldcs_process_data_t *procdata, ldcs_message_t *msg,
+                           void *secondary_data, size_t secondary_size, int secondary_fd)
+{
+   int result = spindle_send_worker(procdata, msg, BROADCAST, secondary_data, secondary_size, secondary_fd);
+   if (result == PASSTHROUGH)
+      return ldcs_audit_server_md_broadcast_file(procdata, msg, secondary_data, secondary_size, secondary_fd);
+   return result;
+}
+
 int spindle_broadcast(ldcs_process_data_t *procdata, ldcs_message_t *msg)
 {
-   int result = spindle_send_worker(procdata, msg, BROADCAST, NULL, 0);
+   int result = spindle_send_worker(procdata, msg, BROADCAST, NULL, 0, -1);
    if (result == PASSTHROUGH)
       return ldcs_audit_server_md_broadcast(procdata, msg);
    return result;
@@ -108,115 +181,233 @@ int spindle_broadcast(ldcs_process_data_t *procdata, ldcs_message_t *msg)
 
 int spindle_forward_query(ldcs_process_data_t *procdata, ldcs_message_t *msg)
 {
-   int result = spindle_send_worker(procdata, msg, PARENT, NULL, 0);
+   int result = spindle_send_worker(procdata, msg, PARENT, NULL, 0, -1);
    if (result == PASSTHROUGH)
       return ldcs_audit_server_md_forward_query(procdata, msg);
    return result;
 }
 
 
-static void *thrd_main(void *timeout)
+
+static unsigned int hash_node(node_peer_t node, int table_size)
 {
-   int timeout_ms = (int) (long) timeout;
-   int result;
+   unsigned long h = (unsigned long) node;
+   h ^= h >> 16;
+   h *= 0x45d9f3bUL;
+   h ^= h >> 16;
+   return (unsigned int) (h & (table_size - 1));
+}
 
-   for (;;) {
-      pthread_mutex_lock(&mut);
-      while (!active_timeout && !done)
-         pthread_cond_wait(&timeout_sync, &mut);      
-      pthread_mutex_unlock(&mut);
-
-      if (done)
-         return NULL;
-
-      debug_printf2("Starting message buffer cache timeout of %d ms.\n", timeout_ms);      
-      usleep(timeout_ms * 1000);
-      do {
-         debug_printf2("Triggering message buffer cache flush due to timeout\n");
-         result = write(flush_pipe[1], "f", 1);
-      } while (result == EINTR);
-
-      pthread_mutex_lock(&mut);
-      active_timeout = 0;
-      active_flush = 1;
-      while (active_flush && !done)
-         pthread_cond_wait(&timeout_sync, &mut);      
-      pthread_mutex_unlock(&mut);
-
-      if (done)
-         return NULL;
-   }
+static void insert_bundle(ldcs_process_data_t *procdata, msgbundle_entry_t *mb)
+{
+   unsigned int i = hash_node(mb->node, procdata->msgbundle_table_size);
+   while (procdata->msgbundle_table[i])
+      i = (i + 1) & (procdata->msgbundle_table_size - 1);
+   procdata->msgbundle_table[i] = mb;
 }
 
-static int flush_msgbuffer(msgbundle_entry_t *mb, ldcs_process_data_t *procdata)
+static void grow_bundle_table(ldcs_process_data_t *procdata)
 {
-   ldcs_message_t msg;
-   int result;
+   msgbundle_entry_t **old_table = procdata->msgbundle_table;
+   int i, old_size = procdata->msgbundle_table_size;
+
+   procdata->msgbundle_table_size *= 2;
+   procdata->msgbundle_table = (msgbundle_entry_t **) calloc(procdata->msgbundle_table_size,
+                                                            sizeof(msgbundle_entry_t *));
+   for (i = 0; i < old_size; i++) {
+      if (old_table[i])
+         insert_bundle(procdata, old_table[i]);
+   }
+   free(old_table);
+}
 
-   if (!mb->position)
-      return 0;
+/* Returns the bundle for node, creating it on first use */
+static msgbundle_entry_t *get_bundle(ldcs_process_data_t *procdata, node_peer_t node)
+{
+   msgbundle_entry_t *mb;
+   unsigned int i = hash_node(node, procdata->msgbundle_table_size);
 
-   msg.header.type = LDCS_MSG_BUNDLE;
-   msg.header.len = mb->position;
-   msg.data = (char *) mb->cache;
+   for (; (mb = procdata->msgbundle_table[i]) != NULL; i = (i + 1) & (procdata->msgbundle_table_size - 1)) {
+      if (mb->node == node)
+         return mb;
+   }
 
-   debug_printf2("Flushing message buffer for node %s\n", mb->name);
+   debug_printf2("Creating new message bundle for node %p\n", node);
+   mb = (msgbundle_entry_t *) calloc(1, sizeof(msgbundle_entry_t));
+   mb->node = node;
+   mb->limit = procdata->msgbundle_cache_size_kb*1024;
    if (mb->node == BROADCAST)
-      result = ldcs_audit_server_md_broadcast(procdata, &msg);
+      snprintf(mb->name, sizeof(mb->name), "BROADCAST");
    else if (mb->node == PARENT)
-      result = ldcs_audit_server_md_forward_query(procdata, &msg);
+      snprintf(mb->name, sizeof(mb->name), "PARENT");
    else
-      result = ldcs_audit_server_md_send(procdata, &msg, mb->node);
-   mb->position = 0;
-   return result;
+      snprintf(mb->name, sizeof(mb->name), "%lu", (unsigned long) mb->node);
+   mb->name[sizeof(mb->name)-1] = '\0';
+
+   if ((procdata->msgbundle_table_used + 1) * 2 > procdata->msgbundle_table_size)
+      grow_bundle_table(procdata);
+   insert_bundle(procdata, mb);
+   procdata->msgbundle_table_used++;
+   return mb;
 }
 
-static int flush_msgbuffer_cb(int fd, int serverid, void *data)
+static void remove_pending(ldcs_process_data_t *procdata, msgbundle_entry_t *mb)
+{
+   if (mb->prev_pending)
+      mb->prev_pending->next_pending = mb->next_pending;
+   else
+      procdata->msgbundle_pending = mb->next_pending;
+   if (mb->next_pending)
+      mb->next_pending->prev_pending = mb->prev_pending;
+   else
+      procdata->msgbundle_pending_tail = mb->prev_pending;
+   mb->next_pending = mb->prev_pending = NULL;
+}
+
+/* Every bundle gets the same timeout when its first message is queued, so appending
+   keeps the pending list sorted by deadline */
+static void add_pending(ldcs_process_data_t *procdata, msgbundle_entry_t *mb)
+{
+   mb->prev_pending = procdata->msgbundle_pending_tail;
+   mb->next_pending = NULL;
+   if (procdata->msgbundle_pending_tail)
+      procdata->msgbundle_pending_tail->next_pending = mb;
+   else
+      procdata->msgbundle_pending = mb;
+   procdata->msgbundle_pending_tail = mb;
+}
+
+/**
+ * Sends the queued messages in mb as one LDCS_MSG_BUNDLE.  If msg is non-NULL it
+ * is sent as its own message straight after the bundle, in the same writev, so
+ * it is never copied.
+ **/
+static int send_bundle(ldcs_process_data_t *procdata, msgbundle_entry_t *mb, flush_reason_t reason,
+                       ldcs_message_t *msg, void *secondary_data, size_t secondary_size)
+{
+   ldcs_message_t bundle_msg;
+   struct iovec iov[5], child_iov[5];
+   int iovcnt = 0, i, num_children, result, global_result = 0;
+   node_peer_t peer;
+
+   if (mb->position) {
+      memset(&bundle_msg, 0, sizeof(bundle_msg));
+      bundle_msg.header.type = LDCS_MSG_BUNDLE;
+      bundle_msg.header.len = mb->position;
+      iov[iovcnt].iov_base = &bundle_msg;
+      iov[iovcnt++].iov_len = sizeof(bundle_msg);
+      iov[iovcnt].iov_base = mb->cache;
+      iov[iovcnt++].iov_len = mb->position;
+   }
+   if (msg) {
+      iov[iovcnt].iov_base = msg;
+      iov[iovcnt++].iov_len = sizeof(*msg);
+      if (msg->header.len - secondary_size) {
+         iov[iovcnt].iov_base = msg->data;
+         iov[iovcnt++].iov_len = msg->header.len - secondary_size;
+      }
+      if (secondary_size) {
+         iov[iovcnt].iov_base = secondary_data;
+         iov[iovcnt++].iov_len = secondary_size;
+      }
+   }
+   if (!iovcnt)
+      return 0;
+
+   debug_printf2("Flushing message buffer for node %s with %d messages (%lu bytes) due to %s%s\n",
+                 mb->name, mb->num_msgs, (unsigned long) mb->position, flush_reason_names[reason],
+                 msg ? ", followed by an unbundled message" : "");
+
+   if (mb->node == BROADCAST) {
+      num_children = ldcs_audit_server_md_get_num_children(procdata);
+      for (i = 0; i < num_children; i++) {
+         memcpy(child_iov, iov, sizeof(iov));
+         result = ldcs_audit_server_md_send_iov(procdata, ldcs_audit_server_md_get_child(procdata, i),
+                                                child_iov, iovcnt);
+         if (result == -1)
+            global_result = -1;
+      }
+   }
+   else {
+      peer = (mb->node == PARENT) ? ldcs_audit_server_md_get_parent(procdata) : mb->node;
+      if (peer != NODE_PEER_NULL)
+         global_result = ldcs_audit_server_md_send_iov(procdata, peer, iov, iovcnt);
+   }
+
+   if (mb->position) {
+      stats.bundles_sent++;
+      stats.flushes[reason]++;
+      remove_pending(procdata, mb);
+      mb->position = 0;
+      mb->num_msgs = 0;
+   }
+   return global_result;
+}
+
+static int flush_timeout_cb(void *data)
 {
-   msgbundle_entry_t *mb;
    ldcs_process_data_t *procdata = (ldcs_process_data_t *) data;
-   char throwaway_byte;
+   double now = ldcs_get_time();
+   msgbundle_entry_t *mb;
 
-   if (fd != -1)
-      (void)! read(fd, (void *) &throwaway_byte, 1);
-   
-   for (mb = procdata->msgbundle_entries; mb; mb = mb->next) {
-      debug_printf3("flushing for mb %s\n", mb->name);
-      flush_msgbuffer(mb, procdata);
+   /* Flush everything due within the next millisecond, rather than waking again for it */
+   while ((mb = procdata->msgbundle_pending) && mb->deadline <= now + 0.001) {
+      debug_printf2("Triggering message buffer flush for node %s due to timeout\n", mb->name);
+      send_bundle(procdata, mb, flush_timeout, NULL, NULL, 0);
    }
 
-   pthread_mutex_lock(&mut);
-   active_flush = 0;
-   pthread_cond_broadcast(&timeout_sync);
-   pthread_mutex_unlock(&mut);
+   if (procdata->msgbundle_pending)
+      ldcs_listen_set_timeout((int) ((procdata->msgbundle_pending->deadline - now) * 1000.0) + 1);
    return 0;
 }
 
 void msgbundle_force_flush(ldcs_process_data_t *procdata)
 {
-   if (!procdata || !(procdata->opts & OPT_MSGBUNDLE))
+   if (!procdata || !(procdata->opts & OPT_MSGBUNDLE) || !initialized)
       return;
-   flush_msgbuffer_cb(-1, 0, procdata);
+   while (procdata->msgbundle_pending)
+      send_bundle(procdata, procdata->msgbundle_pending, flush_forced, NULL, NULL, 0);
 }
 
-static void start_cache_timeout(int timeout_ms, ldcs_process_data_t *procdata)
+/**
+ * Tracks how often and how large messages to mb's node are, and sets the bundle's
+ * flush threshold to the bytes expected within one timeout.  Slow message streams
+ * get small bundles that go out sooner, busy streams grow up to the buffer size.
+ **/
+static void update_bundle_rate(ldcs_process_data_t *procdata, msgbundle_entry_t *mb, size_t size, double now)
 {
-   pthread_mutex_lock(&mut);
-
-   if (!active_timeout) {
-      active_timeout = 1;
-      pthread_cond_broadcast(&timeout_sync);
-   }
-   
-   pthread_mutex_unlock(&mut);
+   size_t max_limit = procdata->msgbundle_cache_size_kb*1024;
+   double timeout = procdata->msgbundle_timeout_ms / 1000.0;
+   double expected;
+
+   if (mb->seen == 1)
+      mb->avg_gap = now - mb->last_arrival;
+   else if (mb->seen > 1)
+      mb->avg_gap = 0.875 * mb->avg_gap + 0.125 * (now - mb->last_arrival);
+   mb->avg_size = mb->seen ? 0.875 * mb->avg_size + 0.125 * size : size;
+   mb->last_arrival = now;
+   mb->seen++;
+
+   if (mb->seen < 2)
+      return;
+   expected = (mb->avg_gap > 0.0) ? mb->avg_size * timeout / mb->avg_gap : (double) max_limit;
+   if (expected > (double) max_limit)
+      mb->limit = max_limit;
+   else if (expected < MSGBUNDLE_MIN_LIMIT)
+      mb->limit = MSGBUNDLE_MIN_LIMIT < max_limit ? MSGBUNDLE_MIN_LIMIT : max_limit;
+   else
+      mb->limit = (size_t) expected;
 }
 
 int spindle_send_worker(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t node,
-                        void *secondary_data, size_t secondary_size)
+                        void *secondary_data, size_t secondary_size, int secondary_fd)
 {
    msgbundle_entry_t *mb;
+   size_t size;
+   double now;
+   int result;
 
-   if (!procdata || !(procdata->opts & OPT_MSGBUNDLE))
+   if (!procdata || !(procdata->opts & OPT_MSGBUNDLE) || !initialized)
       return PASSTHROUGH;
 
    if (ldcs_audit_server_md_get_num_children(procdata) == 0 && node == BROADCAST) {
@@ -224,65 +415,40 @@ int spindle_send_worker(ldcs_process_data_t *procdata, ldcs_message_t *msg, node
       return 0;
    }
    
+   size = sizeof(ldcs_message_header_t) + msg->header.len;
    debug_printf2("Processing message of size header:%lu + body:%lu (secondary:%lu) = %lu for message bundling\n",
                  sizeof(ldcs_message_header_t), (unsigned long) msg->header.len, secondary_size,
-                 sizeof(ldcs_message_header_t) + msg->header.len);
+                 (unsigned long) size);
 
-   for (mb = procdata->msgbundle_entries; mb && mb->node != node; mb = mb->next);
+   mb = get_bundle(procdata, node);
+   now = ldcs_get_time();
+   update_bundle_rate(procdata, mb, size, now);
 
-   if (sizeof(msg->header)*2 + msg->header.len >=
-       procdata->msgbundle_cache_size_kb*1024)
+   if (size > mb->limit || size > MSGBUNDLE_MAX_COPY ||
+       (mb->seen > 2 && mb->avg_gap * 1000.0 > procdata->msgbundle_timeout_ms))
    {
-      debug_printf2("Not using message bundling because packet size (%ld) is greater than"
-                    "cache size %d.\n",
-                    sizeof(msg->header)*2 + msg->header.len,
-                    procdata->msgbundle_cache_size_kb*1024);
-      if (mb)
-         flush_msgbuffer(mb, procdata);
-      return PASSTHROUGH;
+      flush_reason_t reason = (size > mb->limit || size > MSGBUNDLE_MAX_COPY) ? flush_large : flush_sparse;
+      debug_printf2("Not bundling message of size %lu to node %s (limit %lu, avg gap %.3f ms)\n",
+                    (unsigned long) size, mb->name, (unsigned long) mb->limit, mb->avg_gap * 1000.0);
+      stats.direct_msgs++;
+      if (secondary_fd != -1) {
+         /* file contents go out with sendfile, so only the queued messages are written here */
+         result = send_bundle(procdata, mb, reason, NULL, NULL, 0);
+         return result == -1 ? -1 : PASSTHROUGH;
+      }
+      return send_bundle(procdata, mb, reason, msg, secondary_data, secondary_size);
    }
 
-   if (!mb) {
-      debug_printf2("Creating new message bundle cache for node %p\n", node);
-      mb = (msgbundle_entry_t *) malloc(sizeof(msgbundle_entry_t));
-      mb->cache = (unsigned char *) malloc(procdata->msgbundle_cache_size_kb*1024);
-      mb->position = 0;
-      mb->node = node;
-      mb->next = procdata->msgbundle_entries;
-      if (mb->node == BROADCAST)
-         snprintf(mb->name, sizeof(mb->name), "BROADCAST");
-      else if (mb->node == PARENT)
-         snprintf(mb->name, sizeof(mb->name), "PARENT");
-      else
-         snprintf(mb->name, sizeof(mb->name), "%lu", (unsigned long) mb->node);
-      mb->name[sizeof(mb->name)-1] = '\0';
-      procdata->msgbundle_entries = mb;
-   }
-   else {
-      debug_printf2("Selected existing message bundle for node %s with size %lu/%lu\n",
-                    mb->name, (unsigned long) mb->position,
-                    (unsigned long) procdata->msgbundle_cache_size_kb*1024);
-   }
-   
-
-   if (sizeof(msg->header) + msg->header.len + mb->position >=
-       procdata->msgbundle_cache_size_kb*1024)
-   {
-      debug_printf2("Flushing message buffer due to no space for adding new message."
-                    "Current size = %u, new message size = %lu, capacity = %u\n",
-                    mb->position,
-                    sizeof(msg->header) + msg->header.len,
-                    procdata->msgbundle_cache_size_kb*1024);
-      flush_msgbuffer(mb, procdata);
-   }
-
-   if (!mb->position) {
-      debug_printf2("Starting new message buffer\n");
-   }
-   else {
-      debug_printf2("Appending message at position %d\n", mb->position);
+   if (mb->position + size > mb->limit) {
+      debug_printf2("Flushing message buffer due to no space for adding new message.  "
+                    "Current size = %lu, new message size = %lu, limit = %lu\n",
+                    (unsigned long) mb->position, (unsigned long) size, (unsigned long) mb->limit);
+      send_bundle(procdata, mb, flush_full, NULL, NULL, 0);
    }
 
+   /* The message is copied, as callers reuse their buffers as soon as we return */
+   if (!mb->cache)
+      mb->cache = (unsigned char *) malloc(procdata->msgbundle_cache_size_kb*1024);
    memcpy(mb->cache + mb->position, &msg->header, sizeof(ldcs_message_header_t));
    mb->position += sizeof(ldcs_message_header_t);
    memcpy(mb->cache + mb->position, msg->data, (msg->header.len - secondary_size));
@@ -291,9 +457,16 @@ int spindle_send_worker(ldcs_process_data_t *procdata, ldcs_message_t *msg, node
       memcpy(mb->cache + mb->position, secondary_data, secondary_size);
       mb->position += secondary_size;
    }
-   debug_printf2("Cached data in message buffer to node %s, which is %u of %u bytes full.\n",
-                 mb->name, (int) mb->position, procdata->msgbundle_cache_size_kb*1024);
-
-   start_cache_timeout(procdata->msgbundle_timeout_ms, procdata);
+   mb->num_msgs++;
+   stats.bundled_msgs++;
+   stats.bundled_bytes += size;
+   debug_printf2("Cached data in message buffer to node %s, which is %lu of %lu bytes full.\n",
+                 mb->name, (unsigned long) mb->position, (unsigned long) mb->limit);
+
+   if (mb->num_msgs == 1) {
+      mb->deadline = now + procdata->msgbundle_timeout_ms / 1000.0;
+      add_pending(procdata, mb);
+      ldcs_listen_set_timeout(procdata->msgbundle_timeout_ms);
+   }
    return 0;
 }
@@ -8,11 +8,16 @@
 void msgbundle_init(ldcs_process_data_t *procdata);
 void msgbundle_done(ldcs_process_data_t *procdata);
 void msgbundle_force_flush(ldcs_process_data_t *procdata);
+void msgbundle_print_stats(ldcs_process_data_t *procdata);
    
 int spindle_send_noncontig(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t node,
                            void *secondary_data, size_t secondary_size);
 int spindle_broadcast_noncontig(ldcs_process_data_t *procdata, ldcs_message_t *msg,
                                 void *secondary_data, size_t secondary_size);
+int spindle_send_file(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t node,
+                      void *secondary_data, size_t secondary_size, int secondary_fd);
+int spindle_broadcast_file(ldcs_process_data_t *procdata, ldcs_message_t *msg,
+                           void *secondary_data, size_t secondary_size, int secondary_fd);
 
 int spindle_send(ldcs_process_data_t *procdata, ldcs_message_t *msg, node_peer_t node);
 int spindle_broadcast(ldcs_process_data_t *procdata, ldcs_message_t *msg);
@@ -20,15 +20,189 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <string.h>
 #include <assert.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "ldcs_api.h"
 #include "ldcs_cache.h"
 #include "ldcs_hash.h"
 #include "ccwarns.h"
 
+/**
+ * Files whose contents are stored on the local disk are kept on a list,
+ * most recently used first, along with the bytes they take up.  The server
+ * evicts from the tail of the list when the cache outgrows its budget.
+ **/
+static struct ldcs_hash_entry_t *lru_head = NULL;
+static struct ldcs_hash_entry_t *lru_tail = NULL;
+static size_t lru_bytes = 0;
+static size_t lru_peak = 0;
+static int lru_count = 0;
+
+/**
+ * Dedup stores files with the same contents as hard links to one local
+ * copy, so listed files are grouped by the inode of their local copy, and
+ * an inode's bytes count once while any of its names are listed.
+ **/
+struct ldcs_lru_inode_t {
+   dev_t dev;
+   ino_t ino;
+   size_t size;
+   int members;
+   struct ldcs_lru_inode_t *next;
+};
+
+#define LRU_INODE_INITIAL_SIZE 1024
+static struct ldcs_lru_inode_t **inode_table = NULL;
+static unsigned long inode_table_size = 0;
+static unsigned long inode_count = 0;
+
+static unsigned long inode_bucket(dev_t dev, ino_t ino, unsigned long size)
+{
+   return (unsigned long) ((((uint64_t) ino * 0x9E3779B97F4A7C15ULL) ^ (uint64_t) dev) % size);
+}
+
+static int inode_table_grow()
+{
+   struct ldcs_lru_inode_t **new_table, *g, *next;
+   unsigned long i, b, new_size;
+
+   new_size = inode_table_size ? inode_table_size * 2 : LRU_INODE_INITIAL_SIZE;
+   new_table = (struct ldcs_lru_inode_t **) calloc(new_size, sizeof(*new_table));
+   if (!new_table)
+      return -1;
+   for (i = 0; i < inode_table_size; i++) {
+      for (g = inode_table[i]; g; g = next) {
+         next = g->next;
+         b = inode_bucket(g->dev, g->ino, new_size);
+         g->next = new_table[b];
+         new_table[b] = g;
+      }
+   }
+   free(inode_table);
+   inode_table = new_table;
+   inode_table_size = new_size;
+   return 0;
+}
+
+static struct ldcs_lru_inode_t *inode_get(dev_t dev, ino_t ino)
+{
+   struct ldcs_lru_inode_t *g;
+   unsigned long b;
+
+   if (inode_table_size) {
+      for (g = inode_table[inode_bucket(dev, ino, inode_table_size)]; g; g = g->next) {
+         if (g->ino == ino && g->dev == dev)
+            return g;
+      }
+   }
+   if (inode_count >= inode_table_size && inode_table_grow() == -1 && !inode_table_size)
+      return NULL;
+   g = (struct ldcs_lru_inode_t *) calloc(1, sizeof(*g));
+   if (!g)
+      return NULL;
+   g->dev = dev;
+   g->ino = ino;
+   b = inode_bucket(dev, ino, inode_table_size);
+   g->next = inode_table[b];
+   inode_table[b] = g;
+   inode_count++;
+   return g;
+}
+
+static void inode_put(struct ldcs_lru_inode_t *g)
+{
+   struct ldcs_lru_inode_t **i;
+   for (i = inode_table + inode_bucket(g->dev, g->ino, inode_table_size); *i != g; i = &(*i)->next);
+   *i = g->next;
+   inode_count--;
+   free(g);
+}
+
+/**
+ * Counts a file's bytes as it's listed, unless another listed name
+ * already shares its local copy.  A file whose local copy can't be
+ * stat'd counts on its own.
+ **/
+static void lru_add_bytes(struct ldcs_hash_entry_t *e)
+{
+   struct stat buf;
+   struct ldcs_lru_inode_t *g = NULL;
+
+   if (stat(e->localpath, &buf) == 0)
+      g = inode_get(buf.st_dev, buf.st_ino);
+   e->lru_inode = g;
+   if (g && g->members++)
+      return;
+   if (g)
+      g->size = e->buffer_size;
+   lru_bytes += e->buffer_size;
+   if (lru_bytes > lru_peak)
+      lru_peak = lru_bytes;
+}
+
+static void lru_remove_bytes(struct ldcs_hash_entry_t *e)
+{
+   struct ldcs_lru_inode_t *g = e->lru_inode;
+
+   e->lru_inode = NULL;
+   if (!g) {
+      lru_bytes -= e->buffer_size;
+      return;
+   }
+   if (--g->members)
+      return;
+   lru_bytes -= g->size;
+   inode_put(g);
+}
+
+static int lru_member(struct ldcs_hash_entry_t *e)
+{
+   return e->lru_prev != NULL || lru_head == e;
+}
+
+static void lru_unlink(struct ldcs_hash_entry_t *e)
+{
+   if (e->lru_prev)
+      e->lru_prev->lru_next = e->lru_next;
+   else
+      lru_head = e->lru_next;
+   if (e->lru_next)
+      e->lru_next->lru_prev = e->lru_prev;
+   else
+      lru_tail = e->lru_prev;
+   e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push(struct ldcs_hash_entry_t *e)
+{
+   e->lru_prev = NULL;
+   e->lru_next = lru_head;
+   if (lru_head)
+      lru_head->lru_prev = e;
+   else
+      lru_tail = e;
+   lru_head = e;
+   e->last_use = ldcs_get_time();
+}
+
+static void lru_remove(struct ldcs_hash_entry_t *e)
+{
+   lru_unlink(e);
+   lru_remove_bytes(e);
+   lru_count--;
+}
+
+static void lru_add(struct ldcs_hash_entry_t *e)
+{
+   lru_push(e);
+   lru_add_bytes(e);
+   lru_count++;
+}
+
 ldcs_cache_result_t ldcs_cache_findDirInCache(char *dirname) {
    struct ldcs_hash_entry_t *e = ldcs_hash_Lookup(dirname);
    if(e) {
@@ -114,9 +288,13 @@ ldcs_cache_result_t ldcs_cache_updateBuffer(char *filename, char *dirname, char
    }
    debug_printf3("Updating cache of %s/%s with new file information\n", dirname, filename);
    e->ostate = LDCS_CACHE_OBJECT_STATUS_LOCAL_PATH;   
+   if (lru_member(e))
+      lru_remove_bytes(e);
    e->localpath = localname;
    e->buffer = buffer;
    e->buffer_size = buffer_size;
+   if (lru_member(e))
+      lru_add_bytes(e);
    e->errcode = errcode;
    return LDCS_CACHE_FILE_FOUND;
 }
@@ -136,7 +314,10 @@ ldcs_cache_result_t ldcs_cache_updateReplication(char *filename, char *dirname,
 ldcs_cache_result_t ldcs_cache_updateEntry(char *filename, char *dirname, 
                                            char *localname, void *buffer, size_t buffer_size, char *alias_to, int replicate, int errcode)
 {
-   struct ldcs_hash_entry_t *e = ldcs_hash_updateEntry(filename, dirname, localname, buffer, buffer_size, alias_to, replicate, errcode);
+   struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
+   if (e && lru_member(e))
+      lru_remove(e);
+   e = ldcs_hash_updateEntry(filename, dirname, localname, buffer, buffer_size, alias_to, replicate, errcode);
    if(e) { 
       e->ostate = LDCS_CACHE_OBJECT_STATUS_LOCAL_PATH;
       return(LDCS_CACHE_FILE_FOUND);
@@ -179,6 +360,106 @@ int ldcs_cache_get_buffer(char *dirname, char *filename, void **buffer, size_t *
    return 0;
 }
 
+/**
+ * Puts a file whose contents are now on the local disk at the front of the
+ * LRU list.  Files with errcodes or without local contents aren't listed.
+ * Called again when a listed file's local copy is replaced, such as by a
+ * link to another copy.
+ **/
+void ldcs_cache_lruInsert(char *filename, char *dirname)
+{
+   struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
+   if (!e || e->ostate != LDCS_CACHE_OBJECT_STATUS_LOCAL_PATH || !e->localpath || e->errcode)
+      return;
+   if (lru_member(e))
+      lru_remove(e);
+   lru_add(e);
+}
+
+/**
+ * Marks a listed file as just used
+ **/
+void ldcs_cache_lruTouch(char *filename, char *dirname)
+{
+   struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
+   if (!e || !lru_member(e))
+      return;
+   if (lru_head != e) {
+      lru_unlink(e);
+      lru_push(e);
+   }
+   else {
+      e->last_use = ldcs_get_time();
+   }
+}
+
+/**
+ * Returns the least recently used file on the list.  Returns -1 if the
+ * list is empty.
+ **/
+int ldcs_cache_lruOldest(char **filename, char **dirname, char **localpath, size_t *size, double *last_use)
+{
+   if (!lru_tail)
+      return -1;
+   *filename = lru_tail->filename;
+   *dirname = lru_tail->dirname;
+   *localpath = lru_tail->localpath;
+   *size = lru_tail->buffer_size;
+   *last_use = lru_tail->last_use;
+   return 0;
+}
+
+/**
+ * Walks the LRU list from the most recently used file.  *pos is NULL to
+ * start, and is kept by the caller between calls.  Returns -1 after the
+ * last file.  The list must not change during the walk.
+ **/
+int ldcs_cache_lruNext(void **pos, char **filename, char **dirname, char **localpath, size_t *size)
+{
+   struct ldcs_hash_entry_t *e = *pos ? ((struct ldcs_hash_entry_t *) *pos)->lru_next : lru_head;
+   if (!e)
+      return -1;
+   *pos = e;
+   *filename = e->filename;
+   *dirname = e->dirname;
+   *localpath = e->localpath;
+   *size = e->buffer_size;
+   return 0;
+}
+
+void ldcs_cache_lruStats(size_t *bytes, size_t *peak, int *count)
+{
+   if (bytes)
+      *bytes = lru_bytes;
+   if (peak)
+      *peak = lru_peak;
+   if (count)
+      *count = lru_count;
+}
+
+/**
+ * Forgets the local copy of a file, after the caller has removed it from
+ * the local disk.  The file stays in the cache as existing but not present,
+ * so the next request for it reads or requests it again.  The old local
+ * name isn't freed, since answers already sent to clients may point at it.
+ **/
+ldcs_cache_result_t ldcs_cache_evict(char *filename, char *dirname)
+{
+   struct ldcs_hash_entry_t *e = ldcs_hash_Lookup_FN_and_DIR(filename, dirname);
+   if (!e) {
+      err_printf("Asked to evict %s/%s, but wasn't found in cache\n", dirname, filename);
+      return LDCS_CACHE_FILE_NOT_FOUND;
+   }
+   debug_printf3("Evicting %s/%s with local file %s from cache\n", dirname, filename, e->localpath);
+   if (lru_member(e))
+      lru_remove(e);
+   e->ostate = LDCS_CACHE_OBJECT_STATUS_NOT_SET;
+   e->localpath = NULL;
+   e->buffer = NULL;
+   e->buffer_size = 0;
+   return LDCS_CACHE_FILE_FOUND;
+}
+
 #define INITIAL_BUFFER_SIZE 4096
 int ldcs_cache_getNewEntriesForDir(char *dir, char **data, int *len)
 {
@@ -342,6 +623,10 @@ int ldcs_cache_dump(char *filename) {
   return(rc);
 }
 
+void ldcs_cache_print_stats() {
+  ldcs_hash_print_stats();
+}
+
 int directoryParsed(char *dirname) {
    struct ldcs_hash_entry_t *e = ldcs_hash_Lookup(dirname);
    return e ? 1 : 0;
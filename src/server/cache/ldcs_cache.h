@@ -55,9 +55,18 @@ int ldcs_cache_getNewEntriesForDir(char *dir, char **data, int *len);
 
 int ldcs_cache_init();
 int ldcs_cache_dump(char *filename);
+void ldcs_cache_print_stats();
 
 int ldcs_cache_get_buffer(char *dirname, char *filename, void **buffer, size_t *size, char **alias_to);
 
+/* Files stored on the local disk, in least recently used order */
+void ldcs_cache_lruInsert(char *filename, char *dirname);
+void ldcs_cache_lruTouch(char *filename, char *dirname);
+int ldcs_cache_lruOldest(char **filename, char **dirname, char **localpath, size_t *size, double *last_use);
+int ldcs_cache_lruNext(void **pos, char **filename, char **dirname, char **localpath, size_t *size);
+void ldcs_cache_lruStats(size_t *bytes, size_t *peak, int *count);
+ldcs_cache_result_t ldcs_cache_evict(char *filename, char *dirname);
+
 char *ldcs_cache_result_to_str(ldcs_cache_result_t res);
 /* Parse directory content packets */
 typedef struct {
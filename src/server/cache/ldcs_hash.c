@@ -14,6 +14,7 @@ program; if not, write to the Free Software Foundation, Inc., 59 Temple
 Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -24,9 +25,56 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ldcs_hash.h"
 #include "global_name.h"
 
-struct ldcs_hash_entry_t  ldcs_hash_table[HASH_SIZE];
-int                       ldcs_hash_last_new_entry_index=-1;
-struct ldcs_hash_entry_t *ldcs_hash_last_new_entry_ptr=NULL;
+/**
+ * The file cache is an open-addressing table with linear probing, keyed
+ * on (dirname, filename).  Slots only hold the full hash and a pointer, so
+ * a probe sequence stays within a few cache lines and rarely touches an
+ * entry that doesn't match.  Entries themselves are allocated in blocks and
+ * never move, since callers and the per-directory lists hold pointers to
+ * them.  The table doubles when its load factor passes 0.7.
+ *
+ * Directory and file names are interned in a second table of the same
+ * shape.  Thousands of entries share each dirname (and every package has an
+ * __init__.py), so each string is stored once and keys compare by pointer.
+ **/
+
+#define INITIAL_TABLE_SIZE (16*1024)
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 10
+#define ENTRY_BLOCK_COUNT 1024
+#define STRING_BLOCK_SIZE (64*1024)
+
+typedef struct {
+   ldcs_hash_key_t hash;
+   void *ptr;
+} hash_slot_t;
+
+typedef int (*slot_match_t)(void *ptr, const void *arg);
+
+typedef struct {
+   hash_slot_t *slots;
+   unsigned long size;
+   unsigned long count;
+   unsigned long lookups;
+   unsigned long probes;
+   unsigned long max_probe;
+   unsigned long resizes;
+} hash_table_t;
+
+typedef struct {
+   const char *dirname;
+   const char *filename;
+} entry_key_t;
+
+static hash_table_t entry_table;
+static hash_table_t string_table;
+
+static struct ldcs_hash_entry_t *entry_block = NULL;
+static int entry_block_used = ENTRY_BLOCK_COUNT;
+
+static char *string_block = NULL;
+static size_t string_block_used = STRING_BLOCK_SIZE;
+static size_t string_bytes = 0;
 
 ldcs_hash_key_t ldcs_hash_Val(const char *str) {
    ldcs_hash_key_t hash = 5381;
@@ -36,22 +84,183 @@ ldcs_hash_key_t ldcs_hash_Val(const char *str) {
    return hash;
 }
 
+/* djb2 puts little entropy in its low bits, which we use as the index */
+static ldcs_hash_key_t mix_key(ldcs_hash_key_t h)
+{
+   h ^= h >> 16;
+   h *= 0x85ebca6b;
+   h ^= h >> 13;
+   h *= 0xc2b2ae35;
+   h ^= h >> 16;
+   return h;
+}
+
+static ldcs_hash_key_t entry_key(ldcs_hash_key_t dir_hash, ldcs_hash_key_t file_hash)
+{
+   return mix_key(dir_hash ^ (file_hash * 0x9e3779b1));
+}
+
+static int init_table(hash_table_t *table)
+{
+   memset(table, 0, sizeof(*table));
+   table->size = INITIAL_TABLE_SIZE;
+   table->slots = (hash_slot_t *) calloc(table->size, sizeof(hash_slot_t));
+   if (!table->slots) {
+      err_printf("Could not allocate file cache table\n");
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * Returns the slot holding a match for arg, or the empty slot where it
+ * would be inserted.
+ **/
+static hash_slot_t *find_slot(hash_table_t *table, ldcs_hash_key_t key, slot_match_t match, const void *arg)
+{
+   unsigned long mask = table->size - 1;
+   unsigned long i = key & mask;
+   unsigned long probes = 1;
+
+   while (table->slots[i].ptr) {
+      if (table->slots[i].hash == key && match(table->slots[i].ptr, arg))
+         break;
+      i = (i + 1) & mask;
+      probes++;
+   }
+
+   table->lookups++;
+   table->probes += probes;
+   if (probes > table->max_probe)
+      table->max_probe = probes;
+   return table->slots + i;
+}
+
+static int grow_table(hash_table_t *table)
+{
+   hash_slot_t *old_slots = table->slots;
+   unsigned long old_size = table->size, i, j, mask;
+
+   table->size = old_size * 2;
+   table->slots = (hash_slot_t *) calloc(table->size, sizeof(hash_slot_t));
+   if (!table->slots) {
+      err_printf("Could not grow file cache table to %lu slots\n", table->size);
+      table->slots = old_slots;
+      table->size = old_size;
+      return -1;
+   }
+   mask = table->size - 1;
+
+   for (i = 0; i < old_size; i++) {
+      if (!old_slots[i].ptr)
+         continue;
+      for (j = old_slots[i].hash & mask; table->slots[j].ptr; j = (j + 1) & mask);
+      table->slots[j] = old_slots[i];
+   }
+   free(old_slots);
+   table->resizes++;
+   debug_printf3("Grew file cache table to %lu slots with %lu used\n", table->size, table->count);
+   return 0;
+}
+
+/* Grows the table if needed before an insert.  Invalidates slot pointers */
+static void reserve_slot(hash_table_t *table)
+{
+   if ((table->count + 1) * MAX_LOAD_DEN > table->size * MAX_LOAD_NUM)
+      grow_table(table);
+}
+
+static int match_string(void *ptr, const void *arg)
+{
+   return strcmp((const char *) ptr, (const char *) arg) == 0;
+}
+
+static int match_entry(void *ptr, const void *arg)
+{
+   struct ldcs_hash_entry_t *entry = (struct ldcs_hash_entry_t *) ptr;
+   const entry_key_t *key = (const entry_key_t *) arg;
+   return entry->dirname == key->dirname && entry->filename == key->filename;
+}
+
+static char *find_string(const char *str)
+{
+   return (char *) find_slot(&string_table, mix_key(ldcs_hash_Val(str)), match_string, str)->ptr;
+}
+
+static char *intern_string(const char *str)
+{
+   ldcs_hash_key_t key = mix_key(ldcs_hash_Val(str));
+   hash_slot_t *slot;
+   size_t len;
+   char *newstr;
+
+   slot = find_slot(&string_table, key, match_string, str);
+   if (slot->ptr)
+      return (char *) slot->ptr;
+
+   len = strlen(str) + 1;
+   if (len > STRING_BLOCK_SIZE / 4) {
+      newstr = (char *) malloc(len);
+   }
+   else {
+      if (string_block_used + len > STRING_BLOCK_SIZE) {
+         string_block = (char *) malloc(STRING_BLOCK_SIZE);
+         string_block_used = 0;
+      }
+      newstr = string_block ? string_block + string_block_used : NULL;
+      string_block_used += len;
+   }
+   if (!newstr) {
+      err_printf("Could not allocate memory for file cache string %s\n", str);
+      return NULL;
+   }
+   memcpy(newstr, str, len);
+   string_bytes += len;
+
+   reserve_slot(&string_table);
+   slot = find_slot(&string_table, key, match_string, str);
+   slot->hash = key;
+   slot->ptr = newstr;
+   string_table.count++;
+   return newstr;
+}
+
+static struct ldcs_hash_entry_t *alloc_entry()
+{
+   if (entry_block_used == ENTRY_BLOCK_COUNT) {
+      entry_block = (struct ldcs_hash_entry_t *) calloc(ENTRY_BLOCK_COUNT, sizeof(struct ldcs_hash_entry_t));
+      if (!entry_block) {
+         err_printf("Could not allocate file cache entries\n");
+         return NULL;
+      }
+      entry_block_used = 0;
+   }
+   return entry_block + entry_block_used++;
+}
+
 struct ldcs_hash_entry_t *ldcs_hash_addEntry(char *dirname, char *filename) {
-   struct ldcs_hash_entry_t *newentry;
-   ldcs_hash_key_t key = ldcs_hash_Val(filename);
-   unsigned int index = (unsigned int) key % HASH_SIZE;
+   struct ldcs_hash_entry_t *newentry, *dent;
+   hash_slot_t *slot;
+   entry_key_t ekey;
+   ldcs_hash_key_t key;
    int is_dir = (dirname == filename || strcmp(dirname, filename) == 0);
 
-   /* debug_printf3("Adding dir='%s' fn='%s' to cache at index %u\n", dirname, filename, index); */
-   newentry = ldcs_hash_table + index;
-   if (newentry->dirname != NULL) {
-      while (newentry->next != NULL)
-         newentry = newentry->next;
-      newentry->next = (struct ldcs_hash_entry_t *) malloc(sizeof(struct ldcs_hash_entry_t));
-      newentry = newentry->next;
-   }
-   newentry->filename = (filename)?strdup(filename):NULL;
-   newentry->dirname = (dirname)?strdup(dirname):NULL;
+   ekey.dirname = intern_string(dirname);
+   ekey.filename = intern_string(filename);
+   if (!ekey.dirname || !ekey.filename)
+      return NULL;
+   key = entry_key(ldcs_hash_Val(dirname), ldcs_hash_Val(filename));
+
+   /* debug_printf3("Adding dir='%s' fn='%s' to cache\n", dirname, filename); */
+   slot = find_slot(&entry_table, key, match_entry, &ekey);
+   if (slot->ptr)
+      return (struct ldcs_hash_entry_t *) slot->ptr;
+
+   newentry = alloc_entry();
+   if (!newentry)
+      return NULL;
+   newentry->filename = (char *) ekey.filename;
+   newentry->dirname = (char *) ekey.dirname;
    newentry->hash_val = key;
    newentry->state = HASH_ENTRY_STATUS_NEW;
    newentry->ostate = 0;
@@ -60,16 +269,27 @@ struct ldcs_hash_entry_t *ldcs_hash_addEntry(char *dirname, char *filename) {
    newentry->replication = 0;
    newentry->buffer = NULL;
    newentry->buffer_size = 0;
-   newentry->next = NULL;
+   newentry->dir_next = NULL;
+   newentry->lru_prev = NULL;
+   newentry->lru_next = NULL;
+   newentry->lru_inode = NULL;
+   newentry->last_use = 0.0;
+
+   reserve_slot(&entry_table);
+   slot = find_slot(&entry_table, key, match_entry, &ekey);
+   slot->hash = key;
+   slot->ptr = newentry;
+   entry_table.count++;
 
    if (is_dir) {
-      newentry->dir_next = NULL;
       return newentry;
    }
 
-   struct ldcs_hash_entry_t *dent = ldcs_hash_Lookup(dirname);
+   dent = ldcs_hash_Lookup(dirname);
    if (!dent) {
       dent = ldcs_hash_addEntry(dirname, dirname);
+      if (!dent)
+         return newentry;
    }
    newentry->dir_next = dent->dir_next;
    dent->dir_next = newentry;
@@ -111,87 +331,82 @@ struct ldcs_hash_entry_t *ldcs_hash_updateEntryOState(char *filename, char *dirn
    return entry;
 }
 
+/**
+ * Looks up a directory by its full path.  Parsed directories are stored as
+ * (path, path) and directories that could not be read as ("-", path).
+ **/
 struct ldcs_hash_entry_t *ldcs_hash_Lookup(const char *filename) {
    struct ldcs_hash_entry_t *entry;
-   ldcs_hash_key_t key = ldcs_hash_Val(filename);
-   unsigned int index = (unsigned int) key % HASH_SIZE;
-   
-   if (ldcs_hash_table[index].dirname == NULL) {
-      debug_printf3("No key for %s at index %u\n", filename, index);
-      return NULL;
-   }
 
-   entry = ldcs_hash_table+index;
-   while (entry != NULL) {
-      if (entry->hash_val == key && strcmp(filename, entry->filename) == 0) {
-         /* debug_printf3("Found entry for %s\n", filename); */
-         return entry;
-      }
-      entry = entry->next;
-   } 
-   debug_printf3("No key for %s at index %u\n", filename, index);
-   return NULL;
+   entry = ldcs_hash_Lookup_FN_and_DIR(filename, filename);
+   if (!entry)
+      entry = ldcs_hash_Lookup_FN_and_DIR(filename, "-");
+   if (!entry)
+      debug_printf3("No key for %s\n", filename);
+   return entry;
 }
 
 struct ldcs_hash_entry_t *ldcs_hash_Lookup_FN_and_DIR(const char *filename, const char *dirname) {
-   struct ldcs_hash_entry_t *entry;
-   ldcs_hash_key_t key = ldcs_hash_Val(filename);
-   unsigned int index = (unsigned int) key % HASH_SIZE;
-   
-   if (ldcs_hash_table[index].dirname == NULL) {
-      debug_printf3("No key for %s at index %u\n", filename, index);
+   entry_key_t ekey;
+   ldcs_hash_key_t key;
+
+   ekey.dirname = find_string(dirname);
+   ekey.filename = find_string(filename);
+   if (!ekey.dirname || !ekey.filename)
       return NULL;
-   }
 
-   entry = ldcs_hash_table+index;
-   while (entry != NULL) {
-     if (entry->hash_val == key && strcmp(filename, entry->filename) == 0 &&
-	 strcmp(dirname, entry->dirname) == 0 ) {
-	    /* debug_printf3("Found entry for %s in dir %s\n", filename, dirname); */
-       return entry;
-     }
-     entry = entry->next;
-   } 
-     debug_printf3("No key for %s in dir %s at index %u\n", filename, dirname,index);
-   return NULL;
+   key = entry_key(ldcs_hash_Val(dirname), ldcs_hash_Val(filename));
+   return (struct ldcs_hash_entry_t *) find_slot(&entry_table, key, match_entry, &ekey)->ptr;
 }
 
 void ldcs_hash_dump(char *tofile) {
   FILE *dumpfile;
   struct ldcs_hash_entry_t *entry;
-  int index;
+  unsigned long index;
  
   dumpfile=fopen(tofile, "w");
+  if (!dumpfile)
+    return;
   
-  for(index=0;index<HASH_SIZE;index++) {
-    entry = ldcs_hash_table+index;
-    while (entry != NULL) {
-      if(entry->hash_val != 0) {
-	fprintf(dumpfile,"%4d: %16u %s %s %s\n",
-		index,entry->hash_val,entry->filename,entry->dirname,
-		(entry->state == HASH_ENTRY_STATUS_USED)        ? "HASH_ENTRY_STATUS_USED" :
-		(entry->state == HASH_ENTRY_STATUS_NEW)         ? "HASH_ENTRY_STATUS_NEW" :
-		(entry->state == HASH_ENTRY_STATUS_FREE)        ? "HASH_ENTRY_STATUS_FREE" :
-		(entry->state == HASH_ENTRY_STATUS_UNKNOWN)     ? "HASH_ENTRY_STATUS_UNKNOWN" : "???"
-		);
-      }
-      entry = entry->next;
-    } 
+  for(index=0;index<entry_table.size;index++) {
+    entry = (struct ldcs_hash_entry_t *) entry_table.slots[index].ptr;
+    if (!entry)
+      continue;
+    fprintf(dumpfile,"%4lu: %16u %s %s %s\n",
+            index,entry->hash_val,entry->filename,entry->dirname,
+            (entry->state == HASH_ENTRY_STATUS_USED)        ? "HASH_ENTRY_STATUS_USED" :
+            (entry->state == HASH_ENTRY_STATUS_NEW)         ? "HASH_ENTRY_STATUS_NEW" :
+            (entry->state == HASH_ENTRY_STATUS_FREE)        ? "HASH_ENTRY_STATUS_FREE" :
+            (entry->state == HASH_ENTRY_STATUS_UNKNOWN)     ? "HASH_ENTRY_STATUS_UNKNOWN" : "???"
+            );
   }
   fclose(dumpfile);
 }
 
+static void print_table_stats(const char *name, hash_table_t *table)
+{
+   debug_printf("File cache %s table: %lu used of %lu slots (load %.2f), %lu resizes, "
+                "%lu lookups averaging %.2f probes, longest probe %lu\n",
+                name, table->count, table->size,
+                table->size ? (double) table->count / (double) table->size : 0.0,
+                table->resizes, table->lookups,
+                table->lookups ? (double) table->probes / (double) table->lookups : 0.0,
+                table->max_probe);
+}
+
+void ldcs_hash_print_stats()
+{
+   print_table_stats("entry", &entry_table);
+   print_table_stats("string", &string_table);
+   debug_printf("File cache interned %lu strings in %lu bytes\n",
+                string_table.count, (unsigned long) string_bytes);
+}
+
 int ldcs_hash_init() {
   int rc=0;
-  int index;
-
-  for(index=0;index<HASH_SIZE;index++) {
-    ldcs_hash_table[index].hash_val = 0;
-    ldcs_hash_table[index].state    = HASH_ENTRY_STATUS_FREE;
-    ldcs_hash_table[index].next     = NULL;
-    ldcs_hash_table[index].filename = NULL;
-    ldcs_hash_table[index].dirname  = NULL;
-  }
+
+  if (init_table(&entry_table) == -1 || init_table(&string_table) == -1)
+    rc = -1;
   init_global_name_list();
   return(rc);
 }
@@ -17,7 +17,6 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef LDCS_HASH_H
 #define LDCS_HASH_H
 
-#define HASH_SIZE (10*1024)
 typedef unsigned ldcs_hash_key_t;
 
 typedef enum {
@@ -36,12 +35,15 @@ struct ldcs_hash_entry_t
   char *localpath;
   char *alias_to;
   int replication;
-  void *buffer;
+  void *buffer;                         /* Only set while the file is being written */
   size_t buffer_size;
   ldcs_hash_key_t hash_val;
   int errcode;
-  struct ldcs_hash_entry_t *next;
   struct ldcs_hash_entry_t *dir_next;
+  struct ldcs_hash_entry_t *lru_prev;   /* Neighbors on the local file LRU list */
+  struct ldcs_hash_entry_t *lru_next;
+  struct ldcs_lru_inode_t *lru_inode;   /* Inode of the local copy while listed, shared by dedup links */
+  double last_use;
 };
 
 int ldcs_hash_init();
@@ -56,6 +58,7 @@ struct ldcs_hash_entry_t *ldcs_hash_Lookup(const char *filename);
 struct ldcs_hash_entry_t *ldcs_hash_Lookup_FN_and_DIR(const char *filename, const char *dirname);
 
 void ldcs_hash_dump(char *tofile);
+void ldcs_hash_print_stats();
 
 struct ldcs_hash_entry_t *ldcs_hash_getFirstEntryForDir(char *dirname);
 struct ldcs_hash_entry_t *ldcs_hash_getNextEntryForDir(struct ldcs_hash_entry_t *prev_entry);
@@ -14,16 +14,132 @@ program; if not, write to the Free Software Foundation, Inc., 59 Temple
 Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
-#include <map>
-#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
 #include <cassert>
-#include <utility>
+#include <vector>
 #include "spindle_debug.h"
 #include "stat_cache.h"
 
-static std::map<std::string, char*> stat_table;
-static std::map<std::string, char*> lstat_table;
-static std::map<std::string, char*> ldso_table;
+/**
+ * The metadata tables are open-addressing hash tables keyed by path.  Keys
+ * are copied into an arena that is never freed, and lookups hash and compare
+ * the caller's const char* directly, so a query allocates nothing.
+ **/
+namespace {
+
+class metadata_table {
+   struct slot_t {
+      uint64_t hash;
+      const char *path;
+      char *data;
+   };
+
+   static const size_t initial_size = 1024;
+   static const size_t arena_block_size = 64*1024;
+
+   std::vector<slot_t> slots;
+   size_t count;
+   std::vector<char *> arena_blocks;
+   size_t arena_used;
+
+   static uint64_t hash_path(const char *path) {
+      uint64_t h = 14695981039346656037ULL;
+      for (const unsigned char *c = (const unsigned char *) path; *c; c++) {
+         h ^= *c;
+         h *= 1099511628211ULL;
+      }
+      return h;
+   }
+
+   size_t find_slot(const char *path, uint64_t hash) const {
+      size_t mask = slots.size() - 1;
+      size_t i = hash & mask;
+      while (slots[i].path) {
+         if (slots[i].hash == hash && strcmp(slots[i].path, path) == 0)
+            break;
+         i = (i + 1) & mask;
+      }
+      return i;
+   }
+
+   void grow() {
+      std::vector<slot_t> old_slots(slots.size() * 2);
+      old_slots.swap(slots);
+      size_t mask = slots.size() - 1;
+      for (std::vector<slot_t>::iterator s = old_slots.begin(); s != old_slots.end(); s++) {
+         if (!s->path)
+            continue;
+         size_t i = s->hash & mask;
+         while (slots[i].path)
+            i = (i + 1) & mask;
+         slots[i] = *s;
+      }
+   }
+
+   const char *copy_path(const char *path) {
+      size_t len = strlen(path) + 1;
+      char *newpath;
+      if (len > arena_block_size / 4) {
+         newpath = (char *) malloc(len);
+      }
+      else {
+         if (arena_blocks.empty() || arena_used + len > arena_block_size) {
+            arena_blocks.push_back((char *) malloc(arena_block_size));
+            arena_used = 0;
+         }
+         newpath = arena_blocks.back() ? arena_blocks.back() + arena_used : NULL;
+         arena_used += len;
+      }
+      if (!newpath)
+         return NULL;
+      memcpy(newpath, path, len);
+      return newpath;
+   }
+
+ public:
+   metadata_table() :
+      slots(initial_size),
+      count(0),
+      arena_used(0)
+   {
+   }
+
+   bool lookup(const char *path, char **data) const {
+      const slot_t &s = slots[find_slot(path, hash_path(path))];
+      if (!s.path)
+         return false;
+      *data = s.data;
+      return true;
+   }
+
+   void insert(const char *path, char *data) {
+      uint64_t hash = hash_path(path);
+      size_t i = find_slot(path, hash);
+      if (slots[i].path)
+         return;
+      if ((count + 1) * 10 > slots.size() * 7) {
+         grow();
+         i = find_slot(path, hash);
+      }
+      const char *key = copy_path(path);
+      if (!key) {
+         err_printf("Could not allocate memory for metadata cache entry %s\n", path);
+         return;
+      }
+      slots[i].hash = hash;
+      slots[i].path = key;
+      slots[i].data = data;
+      count++;
+   }
+};
+
+}
+
+static metadata_table stat_table;
+static metadata_table lstat_table;
+static metadata_table ldso_table;
 
 int init_stat_cache()
 {
@@ -39,8 +155,7 @@ void add_stat_cache(char *pathname, char *data, metadata_t stattype)
                     (stattype == metadata_lstat) ? "l" : "",
                     pathname, data ? data : "NULL");
 
-   std::string pathname_key = pathname;
-   std::map<std::string, char*> *table = nullptr;
+   metadata_table *table = nullptr;
    switch (stattype) {
       case metadata_none: assert(0); break;
       case metadata_stat: table = &stat_table; break;
@@ -48,14 +163,12 @@ void add_stat_cache(char *pathname, char *data, metadata_t stattype)
       case metadata_loader: table = &ldso_table; break;         
    }
 
-   table->insert(std::make_pair(pathname_key, data));
+   table->insert(pathname, data);
 }
 
 int lookup_stat_cache(char *pathname, char **data, metadata_t stattype)
 {
-   std::string pathname_key = pathname;
-
-   std::map<std::string, char*> *table = nullptr;
+   metadata_table *table = nullptr;
    switch (stattype) {
       case metadata_none: assert(0); break;      
       case metadata_stat: table = &stat_table; break;
@@ -63,13 +176,11 @@ int lookup_stat_cache(char *pathname, char **data, metadata_t stattype)
       case metadata_loader: table = &ldso_table; break;
    }
 
-   std::map<std::string, char*>::iterator i = table->find(pathname_key);
-   if (i == table->end()) {
+   if (!table->lookup(pathname, data)) {
       debug_printf3("Looked up metadata cache entry %s, not cached\n", pathname);
       *data = NULL;
       return -1;
    }
 
-   *data = i->second;
    return 0;
 }
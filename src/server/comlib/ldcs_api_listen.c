@@ -16,10 +16,12 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/inotify.h>
+#include <sys/epoll.h>
 #include <errno.h>
+#include <time.h>
 
 #include "ldcs_api.h"
 
@@ -36,8 +38,11 @@ struct ldcs_listen_data_item_struct
    int                            fd;
    int                            id;
    int                            (*cb_func) ( int fd, int id, void *data );
+   int                            (*write_cb_func) ( int fd, int id, void *data );
    void*                          data;
    ldcs_listen_data_item_status_t state;
+   uint32_t                       generation; /* bumped on each reuse, to detect stale events */
+   int                            next_free;
 };
 typedef struct ldcs_listen_data_item_struct ldcs_listen_data_item_t;
 
@@ -48,17 +53,32 @@ struct ldcs_listen_data_struct
    int item_table_used;
    ldcs_listen_data_item_t* item_table;
    int signal_end;
+   int epoll_fd;
+   int free_head;           /* head of free list threaded through item_table */
+   int *fd_table;           /* maps an fd to its item_table index, or -1 */
+   int fd_table_size;
 };
 
 typedef struct ldcs_listen_data_struct ldcs_listen_data_t;
 
-static ldcs_listen_data_t ldcs_listen_data = {0, 0, 0, NULL, 0};
+static ldcs_listen_data_t ldcs_listen_data = {0, 0, 0, NULL, 0, -1, -1, NULL, 0};
 
 static int (*loop_exit_cb) ( int num_fds, void *data ) = NULL;
 static void *loop_exit_cb_data = NULL;
 
+static int (*timeout_cb) ( void *data ) = NULL;
+static void *timeout_cb_data = NULL;
+static int timeout_armed = 0;
+static struct timespec timeout_deadline;
+
 static int do_exit = 0;
 
+#define MAX_EPOLL_EVENTS 64
+
+#define EVENT_DATA(c, gen) (((uint64_t) (gen) << 32) | (uint32_t) (c))
+#define EVENT_ITEM(d) ((int) ((d) & 0xffffffff))
+#define EVENT_GEN(d) ((uint32_t) ((d) >> 32))
+
 int ldcs_listen_register_exit_loop_cb( int cb_func ( int num_fds, void *data ), 
                                        void * data) {
    int rc=0;
@@ -67,27 +87,93 @@ int ldcs_listen_register_exit_loop_cb( int cb_func ( int num_fds, void *data ),
    return(rc);
 }
 
+int ldcs_listen_register_timeout_cb( int cb_func ( void *data ),
+                                     void * data) {
+   timeout_cb = cb_func;
+   timeout_cb_data = data;
+   return 0;
+}
+
+int ldcs_listen_set_timeout( int timeout_ms ) {
+   struct timespec deadline;
+
+   if (timeout_ms < 0) {
+      timeout_armed = 0;
+      return 0;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &deadline);
+   deadline.tv_sec += timeout_ms / 1000;
+   deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+   if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+   }
+
+   if (!timeout_armed || deadline.tv_sec < timeout_deadline.tv_sec ||
+       (deadline.tv_sec == timeout_deadline.tv_sec && deadline.tv_nsec < timeout_deadline.tv_nsec))
+      timeout_deadline = deadline;
+   timeout_armed = 1;
+   return 0;
+}
+
+/* Milliseconds until the armed timeout expires, rounded up.  -1 if not armed. */
+static int timeout_remaining()
+{
+   struct timespec now;
+   long ms;
+
+   if (!timeout_armed)
+      return -1;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   ms = (timeout_deadline.tv_sec - now.tv_sec) * 1000L +
+        (timeout_deadline.tv_nsec - now.tv_nsec + 999999L) / 1000000L;
+   return ms < 0 ? 0 : (int) ms;
+}
+
+static void grow_fd_table(int fd)
+{
+   int c, newsize;
+   newsize = ldcs_listen_data.fd_table_size ? ldcs_listen_data.fd_table_size : 64;
+   while (newsize <= fd)
+      newsize *= 2;
+   ldcs_listen_data.fd_table = realloc(ldcs_listen_data.fd_table, newsize * sizeof(int));
+   for (c = ldcs_listen_data.fd_table_size; c < newsize; c++)
+      ldcs_listen_data.fd_table[c] = -1;
+   ldcs_listen_data.fd_table_size = newsize;
+}
+
 int ldcs_listen_register_fd( int fd, 
                              int id, 
                              int cb_func ( int fd, int id, void *data ), 
                              void * data) {
    int rc=0;
    int c;
+   struct epoll_event event;
+
+   if (ldcs_listen_data.epoll_fd == -1) {
+      ldcs_listen_data.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      if (ldcs_listen_data.epoll_fd == -1) _error("could not create epoll fd");
+   }
 
    /* icrease size of list if needed */
-   if (ldcs_listen_data.item_table_used >= ldcs_listen_data.item_table_size) {
+   if (ldcs_listen_data.free_head == -1) {
       ldcs_listen_data.item_table = realloc(ldcs_listen_data.item_table, 
-                                            (ldcs_listen_data.item_table_used + 16) * sizeof(ldcs_listen_data_item_t)
+                                            (ldcs_listen_data.item_table_size + 16) * sizeof(ldcs_listen_data_item_t)
          );
-      ldcs_listen_data.item_table_size = ldcs_listen_data.item_table_used + 16;
-      for(c=ldcs_listen_data.item_table_used;(c<ldcs_listen_data.item_table_used + 16);c++) {
+      for(c=ldcs_listen_data.item_table_size + 15;c>=ldcs_listen_data.item_table_size;c--) {
          ldcs_listen_data.item_table[c].state=LDCS_LISTEN_STATUS_FREE;
+         ldcs_listen_data.item_table[c].generation=0;
+         ldcs_listen_data.item_table[c].next_free=ldcs_listen_data.free_head;
+         ldcs_listen_data.free_head=c;
       }
+      ldcs_listen_data.item_table_size += 16;
    }
-   for(c=0;(c<ldcs_listen_data.item_table_size);c++) {
-      if (ldcs_listen_data.item_table[c].state==LDCS_LISTEN_STATUS_FREE) break;
-   }
-   if(c==ldcs_listen_data.item_table_size) _error("internal error with item table (table full)");
+   c = ldcs_listen_data.free_head;
+   ldcs_listen_data.free_head = ldcs_listen_data.item_table[c].next_free;
+
+   if (fd >= ldcs_listen_data.fd_table_size)
+      grow_fd_table(fd);
 
    /* store information of new item */
    ldcs_listen_data.item_table_used++;
@@ -96,23 +182,68 @@ int ldcs_listen_register_fd( int fd,
    ldcs_listen_data.item_table[c].id    = id;
    ldcs_listen_data.item_table[c].data  = data;
    ldcs_listen_data.item_table[c].cb_func = cb_func;
+   ldcs_listen_data.item_table[c].write_cb_func = NULL;
+   ldcs_listen_data.item_table[c].generation++;
+   ldcs_listen_data.fd_table[fd] = c;
+
+   /* Level-triggered: callbacks consume one message per call, so an fd
+      with more buffered data must keep reporting ready. */
+   memset(&event, 0, sizeof(event));
+   event.events = EPOLLIN;
+   event.data.u64 = EVENT_DATA(c, ldcs_listen_data.item_table[c].generation);
+   if (epoll_ctl(ldcs_listen_data.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+      err_printf("Could not add fd %d to epoll set: %s\n", fd, strerror(errno));
+      rc = -1;
+   }
 
    debug_printf3("registered fd %d id=%d  c=%d\n",fd,id,c);
 
    return(rc);
 }
 
+int ldcs_listen_set_write_cb( int fd,
+                              int cb_func ( int fd, int id, void *data ) ) {
+   int c = -1;
+   struct epoll_event event;
+   ldcs_listen_data_item_t *item;
+
+   if (fd >= 0 && fd < ldcs_listen_data.fd_table_size)
+      c = ldcs_listen_data.fd_table[fd];
+   if (c == -1 || ldcs_listen_data.item_table[c].state != LDCS_LISTEN_STATUS_ACTIVE) {
+      err_printf("Could not watch unregistered fd %d for writing\n", fd);
+      return -1;
+   }
+   item = ldcs_listen_data.item_table + c;
+   if ((item->write_cb_func != NULL) == (cb_func != NULL)) {
+      item->write_cb_func = cb_func;
+      return 0;
+   }
+   item->write_cb_func = cb_func;
+
+   memset(&event, 0, sizeof(event));
+   event.events = EPOLLIN | (cb_func ? EPOLLOUT : 0);
+   event.data.u64 = EVENT_DATA(c, item->generation);
+   if (epoll_ctl(ldcs_listen_data.epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1) {
+      err_printf("Could not change epoll events for fd %d: %s\n", fd, strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
 int ldcs_listen_unregister_fd( int fd ) {
    int rc=0;
-   int c;
+   int c = -1;
    debug_printf3("unregister fd %d ..\n",fd);
-   for(c=0;(c<ldcs_listen_data.item_table_size);c++) {
-      if ( ( ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE ) &&
-           ( ldcs_listen_data.item_table[c].fd==fd) ) break;
-   }
-   if(c<ldcs_listen_data.item_table_size) {
+   if (fd >= 0 && fd < ldcs_listen_data.fd_table_size)
+      c = ldcs_listen_data.fd_table[fd];
+   if(c != -1 && ldcs_listen_data.item_table[c].state != LDCS_LISTEN_STATUS_FREE) {
       debug_printf3("unregister fd %d c=%d\n",fd,c);
+      if (ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE)
+         epoll_ctl(ldcs_listen_data.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
       ldcs_listen_data.item_table[c].state = LDCS_LISTEN_STATUS_FREE;
+      ldcs_listen_data.item_table[c].next_free = ldcs_listen_data.free_head;
+      ldcs_listen_data.free_head = c;
+      ldcs_listen_data.fd_table[fd] = -1;
       ldcs_listen_data.item_table_used--;
    } else {
       printf("ldcs_listen_unregister_fd: entry not found\n");
@@ -128,60 +259,57 @@ int ldcs_listen_signal_end_listen_loop( ) {
    return(rc);
 }
 
-#undef max
-#define max(x,y) ((x) > (y) ? (x) : (y))
-
 int ldcs_listen() {
    int rc=-1;
-   int r, nfds, fd, c;
-   fd_set rd, wr, er;
+   int r, i, c;
    int do_listen=0;
+   struct epoll_event events[MAX_EPOLL_EVENTS];
+   ldcs_listen_data_item_t *item;
 
    debug_printf2("Listening for data\n");
    do_listen=(ldcs_listen_data.item_table_used>0);
    while(do_listen && !do_exit) {
-      nfds = 0;
-      FD_ZERO(&rd);
-      FD_ZERO(&wr);
-      FD_ZERO(&er);
-    
-      /* collect all fds */
-      for(c=0;c<ldcs_listen_data.item_table_size;c++) {
-         if ( ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE ) {
-            fd = ldcs_listen_data.item_table[c].fd;
-            FD_SET(fd, &rd);
-            nfds = max(nfds, fd);  
-         }
+      debug_printf3("Blocking for new messages in epoll_wait\n");
+      r = epoll_wait(ldcs_listen_data.epoll_fd, events, MAX_EPOLL_EVENTS, timeout_remaining());
+
+      /* run the timeout callback once its deadline has passed */
+      if (timeout_armed && timeout_remaining() == 0) {
+         timeout_armed = 0;
+         if (timeout_cb)
+            timeout_cb(timeout_cb_data);
       }
-    
-      /* do select if sckets avail */
-      if(nfds>0) {
-         debug_printf3("Blocking for new messages in select\n");
-         r = select(nfds + 1, &rd, &wr, &er, NULL);
       
-         /* signal caught, do nothing */
-         if (r == -1 && errno == EINTR) {
-            continue;
-         }
+      /* signal caught, do nothing */
+      if (r == -1 && errno == EINTR) {
+         continue;
+      }
       
-         /* error happened */
-         if (r == -1)  _error("in listen");
+      /* error happened */
+      if (r == -1)  _error("in listen");
       
-         /* call callback function for all active fds */
-         for(c=0;c<ldcs_listen_data.item_table_size;c++) {
-            if ( ldcs_listen_data.item_table[c].state == LDCS_LISTEN_STATUS_ACTIVE ) {
-               fd     = ldcs_listen_data.item_table[c].fd;
-               if(FD_ISSET(fd, &rd)) {
-                  debug_printf3("Select returned data.  Calling callback for fd %d id=%d\n",fd, ldcs_listen_data.item_table[c].id);
-                  int result = ldcs_listen_data.item_table[c].cb_func(ldcs_listen_data.item_table[c].fd,
-                                                                      ldcs_listen_data.item_table[c].id,
-                                                                      ldcs_listen_data.item_table[c].data);
-                  if (result == -1) {
-                     debug_printf("Marking fd %d in error\n", ldcs_listen_data.item_table[c].fd);
-                     ldcs_listen_data.item_table[c].state = LDCS_LISTEN_STATUS_ERROR;
-                  }
-               }
-            }
+      /* call callback function for the ready fds */
+      for (i = 0; i < r; i++) {
+         c = EVENT_ITEM(events[i].data.u64);
+         item = ldcs_listen_data.item_table + c;
+         /* An earlier callback in this batch may have unregistered this item */
+         if (item->state != LDCS_LISTEN_STATUS_ACTIVE || item->generation != EVENT_GEN(events[i].data.u64))
+            continue;
+         int result = 0;
+         if ((events[i].events & EPOLLOUT) && item->write_cb_func) {
+            debug_printf3("Epoll reported fd %d writable.  Calling write callback\n", item->fd);
+            result = item->write_cb_func(item->fd, item->id, item->data);
+            item = ldcs_listen_data.item_table + c;
+         }
+         if (result != -1 && (events[i].events & ~EPOLLOUT) && item->state == LDCS_LISTEN_STATUS_ACTIVE) {
+            debug_printf3("Epoll returned data.  Calling callback for fd %d id=%d\n", item->fd, item->id);
+            result = item->cb_func(item->fd, item->id, item->data);
+         }
+         /* The callback may have registered new fds and moved the table */
+         item = ldcs_listen_data.item_table + c;
+         if (result == -1 && item->state == LDCS_LISTEN_STATUS_ACTIVE) {
+            debug_printf("Marking fd %d in error\n", item->fd);
+            item->state = LDCS_LISTEN_STATUS_ERROR;
+            epoll_ctl(ldcs_listen_data.epoll_fd, EPOLL_CTL_DEL, item->fd, NULL);
          }
       }
 
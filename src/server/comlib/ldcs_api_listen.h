@@ -27,6 +27,20 @@ int ldcs_listen_register_exit_loop_cb( int cb_func ( int num_fds, void *data ),
 
 int ldcs_listen_unregister_fd( int fd );
 
+/* Also call cb_func from the listen loop whenever the registered fd can be
+   written without blocking.  A NULL cb_func stops watching for writes. */
+int ldcs_listen_set_write_cb( int fd,
+                              int cb_func ( int fd, int id, void *data ) );
+
+/* A single timeout callback, run from the listen loop once the armed timeout
+   expires.  ldcs_listen_set_timeout arms it timeout_ms from now, unless it is
+   already armed to expire sooner.  A negative timeout_ms disarms it.  The
+   timeout is disarmed before the callback runs, so the callback may re-arm it. */
+int ldcs_listen_register_timeout_cb( int cb_func ( void *data ),
+                                     void * data);
+
+int ldcs_listen_set_timeout( int timeout_ms );
+
 int ldcs_listen_signal_end_listen_loop( );
 
 int ldcs_listen();
@@ -0,0 +1,354 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <assert.h>
+
+#include "ldcs_api.h"
+#include "ldcs_api_shmem.h"
+#include "ldcs_api_pipe_notify.h"
+#include "ldcs_audit_server_process.h"
+
+/* ************************************************************** */
+/* FD list                                                        */
+/* ************************************************************** */
+
+#define FDLIST_INITIAL_SIZE 32
+static struct shmem_fdlist_entry_t *fdlist_shmem = NULL;
+static int fdlist_shmem_cnt = 0;
+static int fdlist_shmem_size = 0;
+
+static int get_new_fd_shmem()
+{
+   int i;
+   if (fdlist_shmem_cnt == fdlist_shmem_size) {
+      fdlist_shmem_size = fdlist_shmem_size ? fdlist_shmem_size * 2 : FDLIST_INITIAL_SIZE;
+      fdlist_shmem = realloc(fdlist_shmem, fdlist_shmem_size * sizeof(struct shmem_fdlist_entry_t));
+      if (!fdlist_shmem) {
+         err_printf("Failed to allocate fdlist_shmem of size %d\n", fdlist_shmem_size);
+         assert(0);
+      }
+      for (i = fdlist_shmem_cnt; i < fdlist_shmem_size; i++) {
+         fdlist_shmem[i].inuse = 0;
+      }
+   }
+   for (i = 0; i < fdlist_shmem_size; i++) {
+      if (!fdlist_shmem[i].inuse) {
+         memset(fdlist_shmem + i, 0, sizeof(struct shmem_fdlist_entry_t));
+         fdlist_shmem[i].inuse = 1;
+         fdlist_shmem_cnt++;
+         return i;
+      }
+   }
+   err_printf("Should have found empty fd, but didn't.");
+   assert(0);
+   return -1;
+}
+
+static void free_fd_shmem(int fd)
+{
+   fdlist_shmem[fd].inuse = 0;
+   fdlist_shmem_cnt--;
+   if (fdlist_shmem[fd].shm_fn)
+      free(fdlist_shmem[fd].shm_fn);
+   if (fdlist_shmem[fd].bell_fn)
+      free(fdlist_shmem[fd].bell_fn);
+}
+
+int ldcs_get_fd_shmem(int fd)
+{
+   int realfd = -1;
+   if ((fd<0) || (fd>fdlist_shmem_size) )  _error("wrong fd");
+   if (fdlist_shmem[fd].inuse) {
+      if (fdlist_shmem[fd].type == LDCS_SHMEM_FD_TYPE_SERVER)
+         realfd = ldcs_notify_get_fd(fdlist_shmem[fd].notify_fd);
+      if (fdlist_shmem[fd].type == LDCS_SHMEM_FD_TYPE_CONN)
+         realfd = fdlist_shmem[fd].bell_fd;
+   }
+   return realfd;
+}
+/* end of fd list */
+
+extern int spindle_mkdir(char *orig_path);
+
+int ldcs_create_server_shmem(char* location, int number)
+{
+   int fd;
+
+   fd = get_new_fd_shmem();
+   if (fd < 0) return -1;
+
+   int len = strlen(location) + 32;
+   char *staging_dir = (char *) malloc(len);
+   snprintf(staging_dir, len, "%s/spindle_comm", location);
+
+   if (-1 == spindle_mkdir(staging_dir)) {
+      err_printf("mkdir: ERROR during mkdir %s\n", staging_dir);
+      _error("mkdir failed");
+   }
+
+   char readypath[MAX_PATH_LEN];
+   snprintf(readypath, MAX_PATH_LEN, "%s/ready", staging_dir);
+   int readyfd = creat(readypath, 0000);
+   close(readyfd);
+
+   /* Connection files are created by the client, watch for their doorbells */
+   fdlist_shmem[fd].type = LDCS_SHMEM_FD_TYPE_SERVER;
+   fdlist_shmem[fd].notify_fd = ldcs_notify_init(staging_dir);
+   fdlist_shmem[fd].path = staging_dir;
+
+   chmod(readypath, S_IRUSR | S_IWUSR);
+
+   return fd;
+}
+
+int ldcs_open_server_connection_shmem(int fd)
+{
+   return -1;
+}
+
+int ldcs_open_server_connections_shmem(int fd, int nc, int *more_avail)
+{
+   char fname[MAX_PATH_LEN];
+   char *new_file;
+   int pid, connfd, shmfd, bellfd;
+   shmem_conn_t *conn;
+  
+   if ((fd<0) || (fd>fdlist_shmem_size) )  _error("wrong fd");
+
+   /* wait until a bell-<pid> fifo is created.  The client creates it after
+      its shm-<pid> file is fully initialized. */
+   for (;;) {
+      new_file = ldcs_notify_get_next_file(fdlist_shmem[fd].notify_fd);
+      if (new_file) {
+         pid = 0;
+         sscanf(new_file, "bell-%d", &pid);
+         free(new_file);
+         if (pid > 0)
+            break;
+      }
+   }
+
+   snprintf(fname, MAX_PATH_LEN, "%s/shm-%d", fdlist_shmem[fd].path, pid);
+   shmfd = open(fname, O_RDWR);
+   if (shmfd == -1) {
+      err_printf("Could not open shared memory file %s: %s\n", fname, strerror(errno));
+      return -1;
+   }
+   conn = (shmem_conn_t *) mmap(NULL, sizeof(shmem_conn_t), PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
+   close(shmfd);
+   if (conn == MAP_FAILED) {
+      err_printf("Could not map shared memory file %s: %s\n", fname, strerror(errno));
+      return -1;
+   }
+   if (conn->magic != SHMEM_MAGIC) {
+      err_printf("Shared memory file %s was not initialized by client\n", fname);
+      munmap(conn, sizeof(shmem_conn_t));
+      return -1;
+   }
+   conn->server_pid = getpid();
+
+   connfd = get_new_fd_shmem();
+   if (connfd < 0) return -1;
+   fdlist_shmem[connfd].serverfd = fd;
+   fdlist_shmem[connfd].type = LDCS_SHMEM_FD_TYPE_CONN;
+   fdlist_shmem[connfd].conn = conn;
+   fdlist_shmem[connfd].shm_fn = strdup(fname);
+
+   snprintf(fname, MAX_PATH_LEN, "%s/bell-%d", fdlist_shmem[fd].path, pid);
+   fdlist_shmem[connfd].bell_fn = strdup(fname);
+
+   debug_printf3("before open doorbell '%s'\n", fname);
+   bellfd = open(fname, O_RDONLY|O_NONBLOCK);
+   if (bellfd == -1) _error("open doorbell failed");
+   debug_printf3("after open doorbell: -> fd=%d\n", bellfd);
+   fdlist_shmem[connfd].bell_fd = bellfd;
+
+   /* add info to server fd data structure */
+   fdlist_shmem[fd].conn_list_used++;
+   if (fdlist_shmem[fd].conn_list_used > fdlist_shmem[fd].conn_list_size) {
+      fdlist_shmem[fd].conn_list = realloc(fdlist_shmem[fd].conn_list, 
+                                           (fdlist_shmem[fd].conn_list_used + 15) * sizeof(int));
+      fdlist_shmem[fd].conn_list_size = fdlist_shmem[fd].conn_list_used + 15;
+   }
+   fdlist_shmem[fd].conn_list[fdlist_shmem[fd].conn_list_used-1] = connfd;
+
+   *more_avail = ldcs_notify_more_avail(fdlist_shmem[fd].notify_fd);
+
+   return connfd;
+}
+
+int ldcs_close_server_connection_shmem(int fd)
+{
+   int serverfd, c;
+
+   if ((fd<0) || (fd>fdlist_shmem_size) )  _error("wrong fd");
+  
+   debug_printf3("closing doorbell %d for conn %d, closing connection\n", fdlist_shmem[fd].bell_fd, fd);
+   close(fdlist_shmem[fd].bell_fd);
+   munmap(fdlist_shmem[fd].conn, sizeof(shmem_conn_t));
+
+   if (unlink(fdlist_shmem[fd].bell_fn) != 0)
+      debug_printf3("error while unlink doorbell %s errno=%d (%s)\n", fdlist_shmem[fd].bell_fn,
+                    errno, strerror(errno));
+   if (unlink(fdlist_shmem[fd].shm_fn) != 0)
+      debug_printf3("error while unlink shared memory %s errno=%d (%s)\n", fdlist_shmem[fd].shm_fn,
+                    errno, strerror(errno));
+
+   /* remove connection from server list */
+   serverfd = fdlist_shmem[fd].serverfd;
+   for (c = 0; c < fdlist_shmem[serverfd].conn_list_used; c++) {
+      if (fdlist_shmem[serverfd].conn_list[c] == fd)
+         fdlist_shmem[serverfd].conn_list[c] = -1;
+   }
+
+   free_fd_shmem(fd);
+   return 0;
+}
+
+int ldcs_destroy_server_shmem(int fd)
+{
+   char path[MAX_PATH_LEN];
+
+   if ((fd<0) || (fd>fdlist_shmem_size) )  _error("wrong fd");
+  
+   ldcs_notify_destroy(fdlist_shmem[fd].notify_fd);
+
+   snprintf(path, MAX_PATH_LEN, "%s/ready", fdlist_shmem[fd].path);
+   unlink(path);
+   rmdir(fdlist_shmem[fd].path);
+   free(fdlist_shmem[fd].path);
+   free_fd_shmem(fd);
+
+   return 0;
+}
+
+/* ************************************************************** */
+/* message transfer functions                                     */
+/* ************************************************************** */
+int ldcs_send_msg_shmem(int fd, ldcs_message_t * msg)
+{
+   shmem_conn_t *conn;
+
+   if ((fd<0) || (fd>fdlist_shmem_size) )  _error("wrong fd");
+   conn = fdlist_shmem[fd].conn;
+
+   debug_printf3("sending message of type: %s len=%d data=%s ...\n",
+                 _message_type_to_str(msg->header.type),
+                 msg->header.len, msg->data);
+
+   if (shmem_ring_write(&conn->response, &msg->header, sizeof(msg->header), &conn->client_pid) == -1) {
+      err_printf("Could not write message header to shared memory ring\n");
+      return -1;
+   }
+   if (msg->header.len > 0) {
+      if (shmem_ring_write(&conn->response, msg->data, msg->header.len, &conn->client_pid) == -1) {
+         err_printf("Could not write message data to shared memory ring\n");
+         return -1;
+      }
+   }
+   return 0;
+}
+
+int ldcs_recv_msg_static_shmem(int fd, ldcs_message_t *msg, ldcs_read_block_t block)
+{
+   shmem_conn_t *conn;
+   struct pollfd pfd;
+   char bell;
+   int n;
+
+   msg->header.type = LDCS_MSG_UNKNOWN;
+   msg->header.len = 0;
+   if ((fd<0) || (fd>fdlist_shmem_size) )  _error("wrong fd");
+   conn = fdlist_shmem[fd].conn;
+
+   for (;;) {
+      n = read(fdlist_shmem[fd].bell_fd, &bell, 1);
+      if (n != -1)
+         break;
+      if (errno == EINTR)
+         continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+         break;
+      if (block == LDCS_READ_NO_BLOCK)
+         return 0;
+      /* The doorbell is non-blocking for the event loop, so wait for it here */
+      pfd.fd = fdlist_shmem[fd].bell_fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+         err_printf("Error waiting on doorbell: %s\n", strerror(errno));
+         return -1;
+      }
+   }
+   if (n == 0) {
+      /* Disconnect.  Return an artificial client end message */
+      debug_printf2("Client disconnected.  Returning END message\n");
+      msg->header.type = LDCS_MSG_END;
+      msg->header.len = 0;
+      msg->data = NULL;
+      return 0;
+   }
+   if (n == -1) {
+      err_printf("Error reading doorbell: %s\n", strerror(errno));
+      return -1;
+   }
+
+   /* The client writes the whole message before ringing, so these do not wait */
+   if (shmem_ring_read(&conn->request, &msg->header, sizeof(msg->header), &conn->client_pid) == -1)
+      return -1;
+   if (msg->header.len > MAX_PATH_LEN) {
+      err_printf("Client message of %d bytes exceeds receive buffer\n", msg->header.len);
+      return -1;
+   }
+   if (msg->header.len > 0) {
+      if (shmem_ring_read(&conn->request, msg->data, msg->header.len, &conn->client_pid) == -1)
+         return -1;
+   }
+   else {
+      *msg->data = '\0';
+   }
+
+   debug_printf3("received message of type: %s len=%d data=%s ...\n",
+                 _message_type_to_str(msg->header.type),
+                 msg->header.len, msg->data);
+
+   return 0;
+}
+
+int ldcs_get_aux_fd_shmem()
+{
+   return -1;
+}
+
+int ldcs_socket_id_to_nc_shmem(int id, int fd, ldcs_process_data_t *process_data)
+{
+   return id;
+}
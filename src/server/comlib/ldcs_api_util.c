@@ -80,6 +80,15 @@ char* _message_type_to_str (ldcs_message_ids_t type) {
       STR_CASE(LDCS_MSG_EXIT_CANCEL);
       STR_CASE(LDCS_MSG_BUNDLE);
       STR_CASE(LDCS_MSG_ALIAS);
+      STR_CASE(LDCS_MSG_MANIFEST);
+      STR_CASE(LDCS_MSG_MULTI_QUERY);
+      STR_CASE(LDCS_MSG_MULTI_QUERY_ANSWER);
+      STR_CASE(LDCS_MSG_MULTI_QUERY_ERROR);
+      STR_CASE(LDCS_MSG_PREFETCH_FILE);
+      STR_CASE(LDCS_MSG_PREFETCH_ALIAS);
+      STR_CASE(LDCS_MSG_CONTENT_ALIAS);
+      STR_CASE(LDCS_MSG_PREFETCH_CONTENT_ALIAS);
+      STR_CASE(LDCS_MSG_PCACHE_VALID);
       STR_CASE(LDCS_MSG_UNKNOWN);
    }
    return "unknown";
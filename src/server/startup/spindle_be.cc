@@ -65,6 +65,12 @@ static int unpack_data(spindle_args_t *args, void *buffer, int buffer_size)
    unpack_param(args->bundle_cachesize_kb, buf, pos);
    unpack_param(args->numa_files, buf, pos);
    unpack_param(args->numa_excludes, buf, pos);
+   unpack_param(args->num_readers, buf, pos);
+   unpack_param(args->read_threads, buf, pos);
+   unpack_param(args->numa_replicate, buf, pos);
+   unpack_param(args->prefetch, buf, pos);
+   unpack_param(args->cache_budget_mb, buf, pos);
+   unpack_param(args->pcache_dir, buf, pos);
    assert(pos == buffer_size);
 
    return 0;    
@@ -149,6 +155,17 @@ int spindleRunBE(unsigned int port, unsigned int num_ports, unique_id_t unique_i
    free(args.location);
    args.location = new_location;
 
+   if (args.pcache_dir[0] != '\0') {
+      char *new_pcache_dir = parse_location(args.pcache_dir);
+      if (!new_pcache_dir) {
+         err_printf("Failed to convert persistent cache directory %s\n", args.pcache_dir);
+         return -1;
+      }
+      debug_printf("Translated persistent cache directory from %s to %s\n", args.pcache_dir, new_pcache_dir);
+      free(args.pcache_dir);
+      args.pcache_dir = new_pcache_dir;
+   }
+
    result = ldcs_audit_server_process(&args);
    if (result == -1) {
       err_printf("Error in ldcs_audit_server_process\n");
@@ -21,10 +21,11 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <errno.h>
 
 #include "ldcs_api.h"
+#include "pathfn.h"
 
 int addCWDToDir(pid_t pid, char *dir, int result_size)
 {
-   int cwd_len, dir_len, i, result;
+   int result;
    char cwd[MAX_PATH_LEN+1];
    char cwd_loc[64];
    
@@ -39,7 +40,17 @@ int addCWDToDir(pid_t pid, char *dir, int result_size)
       err_printf("Could not read CWD from %s: %s\n", cwd_loc, strerror(error));
    }
    cwd[MAX_PATH_LEN] = '\0';
-   
+
+   return addCWDStrToDir(cwd, dir, result_size);
+}
+
+int addCWDStrToDir(const char *cwd, char *dir, int result_size)
+{
+   int cwd_len, dir_len, i;
+
+   if (dir[0] == '/')
+      return 0;
+
    cwd_len = strlen(cwd);
    dir_len = strlen(dir);
    if (!cwd_len)
@@ -25,6 +25,7 @@ extern "C" {
 
 int parseFilenameNoAlloc(const char *name, char *file, char *dir, int result_size);
 int addCWDToDir(pid_t pid, char *dir, int result_size);
+int addCWDStrToDir(const char *cwd, char *dir, int result_size);
 int reducePath(char *dir);
 char *concatStrings(const char *str1, int str1_len, const char *str2, int str2_len);
 
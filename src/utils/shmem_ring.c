@@ -0,0 +1,187 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ldcs_api_shmem.h"
+
+/* Spin this many times on an empty/full ring before sleeping in the kernel.
+   A daemon answer from cache usually arrives well within this window.
+   Spinning only helps if the peer can run at the same time, so we go
+   straight to the futex on single-CPU nodes. */
+#define SHMEM_SPIN_COUNT 4096
+static int spin_count = -1;
+
+/* How long a futex sleep lasts before we check whether the peer still exists */
+#define SHMEM_WAIT_SECS 1
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __asm__ __volatile__("pause" ::: "memory")
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define cpu_relax() __sync_synchronize()
+#endif
+
+static int futex_wait(volatile uint32_t *word, uint32_t val)
+{
+   struct timespec timeout;
+   timeout.tv_sec = SHMEM_WAIT_SECS;
+   timeout.tv_nsec = 0;
+   return syscall(SYS_futex, word, FUTEX_WAIT, val, &timeout, NULL, 0);
+}
+
+static void futex_wake(volatile uint32_t *word)
+{
+   syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static int peer_gone(volatile int32_t *peer)
+{
+   pid_t pid = *peer;
+   if (pid <= 0)
+      return 0;
+   return (kill(pid, 0) == -1 && errno == ESRCH);
+}
+
+/* Wait until *word no longer holds val.  Returns -1 if the peer process
+   went away while we were waiting. */
+static int wait_for_change(volatile uint32_t *word, volatile uint32_t *waiting, uint32_t val,
+                           volatile int32_t *peer)
+{
+   int i, result;
+
+   if (spin_count == -1)
+      spin_count = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? SHMEM_SPIN_COUNT : 0;
+
+   for (i = 0; i < spin_count; i++) {
+      if (*word != val)
+         return 0;
+      cpu_relax();
+   }
+
+   for (;;) {
+      *waiting = 1;
+      __sync_synchronize();
+      if (*word != val) {
+         *waiting = 0;
+         return 0;
+      }
+      result = futex_wait(word, val);
+      *waiting = 0;
+      __sync_synchronize();
+      if (*word != val)
+         return 0;
+      if (result == -1 && errno == ETIMEDOUT && peer_gone(peer)) {
+         err_printf("Peer process %d of shared memory ring exited\n", (int) *peer);
+         return -1;
+      }
+   }
+}
+
+void shmem_ring_init(shmem_ring_t *ring)
+{
+   ring->head = 0;
+   ring->tail = 0;
+   ring->reader_waiting = 0;
+   ring->writer_waiting = 0;
+}
+
+int shmem_ring_write(shmem_ring_t *ring, const void *data, int bytes, volatile int32_t *peer)
+{
+   const unsigned char *src = (const unsigned char *) data;
+   uint32_t head, tail, space, n, offset, first;
+   int left = bytes;
+
+   while (left > 0) {
+      head = ring->head;
+      tail = ring->tail;
+      space = SHMEM_RING_SIZE - (head - tail);
+      if (space == 0) {
+         if (wait_for_change(&ring->tail, &ring->writer_waiting, tail, peer) == -1)
+            return -1;
+         continue;
+      }
+
+      n = ((uint32_t) left < space) ? (uint32_t) left : space;
+      offset = head & (SHMEM_RING_SIZE - 1);
+      first = SHMEM_RING_SIZE - offset;
+      if (first > n)
+         first = n;
+      memcpy(ring->data + offset, src, first);
+      if (n > first)
+         memcpy(ring->data, src + first, n - first);
+
+      __sync_synchronize();
+      ring->head = head + n;
+      __sync_synchronize();
+      if (ring->reader_waiting)
+         futex_wake(&ring->head);
+
+      src += n;
+      left -= n;
+   }
+   return bytes;
+}
+
+int shmem_ring_read(shmem_ring_t *ring, void *data, int bytes, volatile int32_t *peer)
+{
+   unsigned char *dest = (unsigned char *) data;
+   uint32_t head, tail, avail, n, offset, first;
+   int left = bytes;
+
+   while (left > 0) {
+      tail = ring->tail;
+      head = ring->head;
+      avail = head - tail;
+      if (avail == 0) {
+         if (wait_for_change(&ring->head, &ring->reader_waiting, head, peer) == -1)
+            return -1;
+         continue;
+      }
+      __sync_synchronize();
+
+      n = ((uint32_t) left < avail) ? (uint32_t) left : avail;
+      offset = tail & (SHMEM_RING_SIZE - 1);
+      first = SHMEM_RING_SIZE - offset;
+      if (first > n)
+         first = n;
+      memcpy(dest, ring->data + offset, first);
+      if (n > first)
+         memcpy(dest + first, ring->data, n - first);
+
+      __sync_synchronize();
+      ring->tail = tail + n;
+      __sync_synchronize();
+      if (ring->writer_waiting)
+         futex_wake(&ring->tail);
+
+      dest += n;
+      left -= n;
+   }
+   return bytes;
+}
@@ -0,0 +1,81 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+/* Measures the client/server round-trip latency of the configured
+   communication transport.  Run under spindle, e.g.:
+     spindle --no-mpi ./commbench [num_requests]
+   Each stat of a distinct missing library is intercepted and sent to the
+   server as one request, so build spindle with different transports
+   (--enable-pipes, --enable-shmem, ...) and compare the reported latencies. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define DEFAULT_REQUESTS 5000
+
+static double now_usec()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+   double da = *(const double *) a, db = *(const double *) b;
+   return (da > db) - (da < db);
+}
+
+int main(int argc, char *argv[])
+{
+   int i, num_requests = DEFAULT_REQUESTS;
+   double *times, start, total = 0.0;
+   char cwd[4096], path[4200];
+   struct stat buf;
+
+   if (argc > 1)
+      num_requests = atoi(argv[1]);
+   if (num_requests <= 0) {
+      fprintf(stderr, "Usage: %s [num_requests]\n", argv[0]);
+      return -1;
+   }
+   if (!getcwd(cwd, sizeof(cwd))) {
+      perror("getcwd");
+      return -1;
+   }
+
+   times = (double *) malloc(num_requests * sizeof(double));
+   for (i = 0; i < num_requests; i++) {
+      snprintf(path, sizeof(path), "%s/commbench_noexist_%d_%d.so", cwd, (int) getpid(), i);
+      start = now_usec();
+      stat(path, &buf);
+      times[i] = now_usec() - start;
+      total += times[i];
+   }
+
+   qsort(times, num_requests, sizeof(double), cmp_double);
+   printf("requests: %d\n", num_requests);
+   printf("mean:     %.2f usec\n", total / num_requests);
+   printf("median:   %.2f usec\n", times[num_requests / 2]);
+   printf("p99:      %.2f usec\n", times[(int) (num_requests * 0.99)]);
+   printf("min:      %.2f usec\n", times[0]);
+   free(times);
+   return 0;
+}
@@ -0,0 +1,113 @@
+/*
+This file is part of Spindle.  For copyright information see the COPYRIGHT 
+file in the top level directory, or at 
+https://github.com/hpc/Spindle/blob/master/COPYRIGHT
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free Software
+Foundation) version 2.1 dated February 1999.  This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even the IMPLIED
+WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the terms 
+and conditions of the GNU Lesser General Public License for more details.  You should 
+have received a copy of the GNU Lesser General Public License along with this 
+program; if not, write to the Free Software Foundation, Inc., 59 Temple
+Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+/* Compares the server's metadata cache (stat_cache.cc) against the
+   std::map<std::string, char*> table it replaced.  Runs standalone:
+     ./statcachebench [num_paths]
+   Paths are shaped like a python site-packages tree and are looked up in
+   shuffled order, once each, after all have been inserted. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include "stat_cache.h"
+
+#define DEFAULT_PATHS 100000
+
+/* stat_cache.cc logs through spindle_logc.h.  Keep it quiet. */
+extern "C" {
+int spindle_debug_prints = 0;
+char *spindle_debug_name = (char *) "statcachebench";
+FILE *spindle_debug_output_f = NULL;
+void spindle_dump_on_error() {}
+}
+
+static double now_usec()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static std::map<std::string, char*> map_table;
+
+static int lookup_map(char *pathname, char **data)
+{
+   std::string pathname_key = pathname;
+   std::map<std::string, char*>::iterator i = map_table.find(pathname_key);
+   if (i == map_table.end()) {
+      *data = NULL;
+      return -1;
+   }
+   *data = i->second;
+   return 0;
+}
+
+int main(int argc, char *argv[])
+{
+   int i, num_paths = DEFAULT_PATHS, misses = 0;
+   double start, map_time, table_time;
+   char path[512], *data;
+   std::vector<std::string> paths;
+   std::vector<int> order;
+
+   if (argc > 1)
+      num_paths = atoi(argv[1]);
+   if (num_paths <= 0) {
+      fprintf(stderr, "Usage: %s [num_paths]\n", argv[0]);
+      return -1;
+   }
+
+   for (i = 0; i < num_paths; i++) {
+      snprintf(path, sizeof(path), "/usr/lib/python3.11/site-packages/package%d/module%d/__init__%d.cpython-311-x86_64-linux-gnu.so",
+               i / 1000, (i / 10) % 100, i);
+      paths.push_back(path);
+      order.push_back(i);
+   }
+   std::mt19937 rng(1);
+   std::shuffle(order.begin(), order.end(), rng);
+
+   init_stat_cache();
+   for (i = 0; i < num_paths; i++) {
+      map_table.insert(std::make_pair(paths[i], (char *) paths[i].c_str()));
+      add_stat_cache((char *) paths[i].c_str(), (char *) paths[i].c_str(), metadata_stat);
+   }
+
+   start = now_usec();
+   for (i = 0; i < num_paths; i++)
+      misses += (lookup_map((char *) paths[order[i]].c_str(), &data) == -1);
+   map_time = now_usec() - start;
+
+   start = now_usec();
+   for (i = 0; i < num_paths; i++)
+      misses += (lookup_stat_cache((char *) paths[order[i]].c_str(), &data, metadata_stat) == -1);
+   table_time = now_usec() - start;
+
+   if (misses) {
+      fprintf(stderr, "%d lookups missed\n", misses);
+      return -1;
+   }
+   printf("paths:       %d\n", num_paths);
+   printf("std::map:    %.3f usec/lookup\n", map_time / num_paths);
+   printf("stat_cache:  %.3f usec/lookup\n", table_time / num_paths);
+   return 0;
+}